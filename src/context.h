@@ -67,11 +67,24 @@ struct ctx_op_data
   void *hook;
 
   /* The number of outstanding references.  */
-  int references;
+  unsigned int references;
 };
 typedef struct ctx_op_data *ctx_op_data_t;
 
 
+/* The parts of a key listed by a keylist operation as selected with
+   the context flag "keylist-fields".  The primary key record is
+   always listed.  */
+#define KEYLIST_FIELD_FPR     1   /* Fingerprints and chain IDs.  */
+#define KEYLIST_FIELD_SUBKEYS 2   /* Subkeys but the primary key.  */
+#define KEYLIST_FIELD_UIDS    4   /* User IDs.  */
+#define KEYLIST_FIELD_SIGS    8   /* Key signatures.  */
+#define KEYLIST_FIELD_TOFU    16  /* TOFU info of user IDs.  */
+#define KEYLIST_FIELD_KEYGRIP 32  /* Keygrips.  */
+#define KEYLIST_FIELD_ORIGIN  64  /* Key origin and last update.  */
+#define KEYLIST_FIELD_ALL     127
+
+
 /* The context defines an environment in which crypto operations can
    be performed (sequentially).  */
 struct gpgme_context
@@ -81,6 +94,30 @@ struct gpgme_context
   /* True if the context was canceled asynchronously.  */
   int canceled;
 
+  /* The time in milliseconds an operation may take or 0 for no
+     limit.  */
+  unsigned int timeout_ms;
+
+  /* The maximum number of keys queued by a keylist operation with a
+     user event loop or 0 to pass the keys with GPGME_EVENT_NEXT_KEY.  */
+  unsigned int keylist_queue_depth;
+
+  /* The number of engine processes a keylist operation is distributed
+     over; 0 or 1 to use just one.  */
+  unsigned int keylist_shards;
+
+  /* The number of keys gpgme_get_key found in and not found in the
+     key cache.  */
+  unsigned long key_cache_hits;
+  unsigned long key_cache_misses;
+
+  /* Buffer used by gpgme_get_ctx_flag for numeric flags.  */
+  char number_str[24];
+
+  /* The end of the current operation as returned by
+     _gpgme_get_monotonic_ms or 0 if there is no limit.  */
+  unsigned long long deadline;
+
   /* The engine info for this context.  */
   gpgme_engine_info_t engine_info;
 
@@ -128,9 +165,23 @@ struct gpgme_context
    * after the operation.  */
   unsigned int ignore_mdc_error : 1;
 
+  /* True if gpgme_get_key shall use the key cache.  */
+  unsigned int key_cache : 1;
+
+  /* True if a distributed keylist operation shall return the keys in
+     the order of the shards.  */
+  unsigned int keylist_shards_ordered : 1;
+
+  /* True if public keys shall be listed by reading the keybox of gpg
+     instead of running gpg.  */
+  unsigned int keylist_keybox : 1;
+
   /* Flags for keylist mode.  */
   gpgme_keylist_mode_t keylist_mode;
 
+  /* The KEYLIST_FIELD_* bits of the parts of the keys to list.  */
+  unsigned int keylist_fields;
+
   /* The current pinentry mode.  */
   gpgme_pinentry_mode_t pinentry_mode;
 
@@ -165,6 +216,9 @@ struct gpgme_context
   /* The optional trust-model override.  */
   char *trust_model;
 
+  /* The value of the context flag "keylist-fields" or NULL.  */
+  char *keylist_fields_str;
+
   /* The operation data hooked into the context.  */
   ctx_op_data_t op_data;
 
@@ -403,6 +403,27 @@ _gpgme_split_fields (char *string, char **array, int arraysize)
   return n;
 }
 
+/* Split a colon delimited record into fields.  A pointer to each field
+ * is stored in ARRAY.  Stop splitting at ARRAYSIZE fields.  The
+ * function modifies LINE.  The number of parsed fields is returned.
+ */
+int
+_gpgme_split_colon_fields (char *line, char **array, int arraysize)
+{
+  int n = 0;
+
+  while (line && n < arraysize)
+    {
+      array[n++] = line;
+      line = strchr (line, ':');
+      if (line)
+        *line++ = 0;
+    }
+
+  return n;
+}
+
+
 /* Convert the field STRING into an unsigned long value.  Check for
  * trailing garbage.  */
 gpgme_error_t
@@ -23,12 +23,21 @@
 #endif
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
 #endif
 #include <assert.h>
 #include <string.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) \
+    && !defined(HAVE_W32_SYSTEM)
+# include <fcntl.h>
+# include <stdint.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
 
 #include "data.h"
 #include "util.h"
@@ -155,16 +164,516 @@ mem_release (gpgme_data_t dh)
 }
 
 
+static gpgme_ssize_t
+mem_get_segments (gpgme_data_t dh, struct gpgme_data_segment *segs,
+                  size_t nsegs)
+{
+  size_t amt = dh->data.mem.length - dh->data.mem.offset;
+  const char *src;
+
+  if (!amt || !nsegs)
+    return 0;
+
+  src = dh->data.mem.buffer ? dh->data.mem.buffer : dh->data.mem.orig_buffer;
+  segs[0].buffer = src + dh->data.mem.offset;
+  segs[0].length = amt;
+  return 1;
+}
+
+
+static gpgme_error_t
+mem_reset (gpgme_data_t dh)
+{
+  /* A buffer of the caller is no longer used; our own is kept.  */
+  if (!dh->data.mem.buffer)
+    dh->data.mem.size = 0;
+  dh->data.mem.orig_buffer = NULL;
+  dh->data.mem.length = 0;
+  dh->data.mem.offset = 0;
+  return 0;
+}
+
+
 static struct _gpgme_data_cbs mem_cbs =
   {
     mem_read,
     mem_write,
     mem_seek,
     mem_release,
-    NULL
+    NULL,
+    mem_get_segments,
+    mem_reset
   };
 
 
+#ifdef USE_MMAP
+/* The pages of a mapped file are given back to the kernel in units of
+   this many bytes.  */
+#define MAP_DROP_SIZE (8 * 1024 * 1024)
+
+
+/* The file is usually read once from the start to the end.  Drop
+   the pages behind the position of DH so that the resident set does
+   not grow with the size of the file; they are read in again if the
+   data object is rewound.  This is done after reading and after
+   seeking, because the data handlers write the data to the engine
+   directly from the mapping and then move the position with a
+   seek.  */
+static void
+map_drop_behind (gpgme_data_t dh)
+{
+#ifdef MADV_DONTNEED
+  if (!dh->data.mem.buffer
+      && dh->data.mem.offset - dh->data.mem.map_dropped >= MAP_DROP_SIZE)
+    {
+      size_t end = dh->data.mem.offset - dh->data.mem.offset % MAP_DROP_SIZE;
+
+      madvise ((char *) dh->data.mem.map + dh->data.mem.map_dropped,
+               end - dh->data.mem.map_dropped, MADV_DONTNEED);
+      dh->data.mem.map_dropped = end;
+    }
+#else
+  (void)dh;
+#endif
+}
+
+
+static gpgme_ssize_t
+map_read (gpgme_data_t dh, void *buffer, size_t size)
+{
+  gpgme_ssize_t amt = mem_read (dh, buffer, size);
+
+  if (amt > 0)
+    map_drop_behind (dh);
+  return amt;
+}
+
+
+static gpgme_off_t
+map_seek (gpgme_data_t dh, gpgme_off_t offset, int whence)
+{
+  gpgme_off_t res = mem_seek (dh, offset, whence);
+
+  if (res >= 0 && res < dh->data.mem.map_dropped)
+    dh->data.mem.map_dropped = res - res % MAP_DROP_SIZE;
+  else if (res >= 0)
+    map_drop_behind (dh);
+  return res;
+}
+
+
+static void
+map_release (gpgme_data_t dh)
+{
+  mem_release (dh);
+  if (dh->data.mem.map)
+    munmap (dh->data.mem.map, dh->data.mem.map_len);
+}
+
+
+/* A memory based data object whose original buffer is a read-only
+   mapping of a file.  Writing copies the content to the heap as for
+   gpgme_data_new_from_mem without copy.  */
+static struct _gpgme_data_cbs map_cbs =
+  {
+    map_read,
+    mem_write,
+    map_seek,
+    map_release,
+    NULL,
+    mem_get_segments
+  };
+#endif /*USE_MMAP*/
+
+
+
+/* The chunked data object.  The data is stored in a list of chunks,
+   so that appending never moves the data written so far.  The size
+   of the chunks doubles from CHUNK_MIN_SIZE up to CHUNK_MAX_SIZE.  */
+#define CHUNK_MIN_SIZE 4096
+#define CHUNK_MAX_SIZE (1024 * 1024)
+
+struct _gpgme_data_chunk
+{
+  struct _gpgme_data_chunk *next;
+  size_t size;  /* Allocated size of DATA.  */
+  size_t len;   /* Used length of DATA.  */
+  char data[1];
+};
+
+
+/* Append a new empty chunk to DH and return it.  Returns NULL and
+   sets errno if out of core.  */
+static struct _gpgme_data_chunk *
+chunk_append (gpgme_data_t dh)
+{
+  struct _gpgme_data_chunk *c;
+  size_t size = CHUNK_MIN_SIZE;
+
+  if (dh->data.chunk.last)
+    {
+      size = 2 * dh->data.chunk.last->size;
+      if (size > CHUNK_MAX_SIZE)
+        size = CHUNK_MAX_SIZE;
+    }
+
+  c = malloc (offsetof (struct _gpgme_data_chunk, data) + size);
+  if (!c)
+    return NULL;
+  c->next = NULL;
+  c->size = size;
+  c->len = 0;
+
+  if (dh->data.chunk.last)
+    dh->data.chunk.last->next = c;
+  else
+    dh->data.chunk.first = dh->data.chunk.cur = c;
+  dh->data.chunk.last = c;
+  return c;
+}
+
+
+/* Return the chunk holding the current position of DH, moving past
+   chunks which end at the position, or NULL if there is no data at
+   the position.  */
+static struct _gpgme_data_chunk *
+chunk_at_offset (gpgme_data_t dh)
+{
+  struct _gpgme_data_chunk *c = dh->data.chunk.cur;
+
+  while (c && dh->data.chunk.offset - dh->data.chunk.cur_start == c->len)
+    {
+      if (!c->next || !c->next->len)
+        return NULL;
+      dh->data.chunk.cur_start += c->len;
+      c = dh->data.chunk.cur = c->next;
+    }
+  return c;
+}
+
+
+static gpgme_ssize_t
+chunk_read (gpgme_data_t dh, void *buffer, size_t size)
+{
+  struct _gpgme_data_chunk *c;
+  size_t pos, amt, total = 0;
+
+  while (total < size && (c = chunk_at_offset (dh)))
+    {
+      pos = dh->data.chunk.offset - dh->data.chunk.cur_start;
+      amt = c->len - pos;
+      if (amt > size - total)
+        amt = size - total;
+      memcpy ((char *) buffer + total, c->data + pos, amt);
+      dh->data.chunk.offset += amt;
+      total += amt;
+    }
+  return total;
+}
+
+
+static gpgme_ssize_t
+chunk_write (gpgme_data_t dh, const void *buffer, size_t size)
+{
+  struct _gpgme_data_chunk *c = dh->data.chunk.cur;
+  size_t pos, amt, total = 0;
+
+  while (total < size)
+    {
+      if (!c)
+        {
+          /* The first write to an empty object.  */
+          if (!chunk_append (dh))
+            return -1;
+          c = dh->data.chunk.cur;
+        }
+      pos = dh->data.chunk.offset - dh->data.chunk.cur_start;
+      if (pos == c->len && c->len == c->size)
+        {
+          /* Go to the next chunk, if needed a new one.  */
+          if (!c->next && !chunk_append (dh))
+            return total? total : -1;
+          dh->data.chunk.cur_start += c->len;
+          c = dh->data.chunk.cur = c->next;
+          continue;
+        }
+
+      /* Overwrite the data after the position and append to the last
+         chunk.  */
+      amt = (pos < c->len ? c->len : c->size) - pos;
+      if (amt > size - total)
+        amt = size - total;
+      memcpy (c->data + pos, (const char *) buffer + total, amt);
+      if (pos + amt > c->len)
+        {
+          dh->data.chunk.length += pos + amt - c->len;
+          c->len = pos + amt;
+        }
+      dh->data.chunk.offset += amt;
+      total += amt;
+    }
+  return total;
+}
+
+
+static gpgme_off_t
+chunk_seek (gpgme_data_t dh, gpgme_off_t offset, int whence)
+{
+  switch (whence)
+    {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += dh->data.chunk.offset;
+      break;
+    case SEEK_END:
+      offset += dh->data.chunk.length;
+      break;
+    default:
+      gpg_err_set_errno (EINVAL);
+      return -1;
+    }
+  if (offset < 0 || (size_t) offset > dh->data.chunk.length)
+    {
+      gpg_err_set_errno (EINVAL);
+      return -1;
+    }
+  dh->data.chunk.offset = offset;
+
+  /* Find the chunk for the new position.  */
+  if (dh->data.chunk.offset < dh->data.chunk.cur_start)
+    {
+      dh->data.chunk.cur = dh->data.chunk.first;
+      dh->data.chunk.cur_start = 0;
+    }
+  while (dh->data.chunk.cur
+         && (dh->data.chunk.offset
+             > dh->data.chunk.cur_start + dh->data.chunk.cur->len))
+    {
+      dh->data.chunk.cur_start += dh->data.chunk.cur->len;
+      dh->data.chunk.cur = dh->data.chunk.cur->next;
+    }
+  return offset;
+}
+
+
+static void
+chunk_release (gpgme_data_t dh)
+{
+  struct _gpgme_data_chunk *c, *c_next;
+
+  for (c = dh->data.chunk.first; c; c = c_next)
+    {
+      c_next = c->next;
+      free (c);
+    }
+}
+
+
+static gpgme_ssize_t
+chunk_get_segments (gpgme_data_t dh, struct gpgme_data_segment *segs,
+                    size_t nsegs)
+{
+  struct _gpgme_data_chunk *c = chunk_at_offset (dh);
+  size_t pos, n = 0;
+
+  if (!c)
+    return 0;
+
+  pos = dh->data.chunk.offset - dh->data.chunk.cur_start;
+  for (; c && c->len && n < nsegs; c = c->next, pos = 0)
+    {
+      segs[n].buffer = c->data + pos;
+      segs[n].length = c->len - pos;
+      n++;
+    }
+  return n;
+}
+
+
+static gpgme_error_t
+chunk_reset (gpgme_data_t dh)
+{
+  struct _gpgme_data_chunk *c;
+
+  /* Keep the chunks for the next writes.  */
+  for (c = dh->data.chunk.first; c; c = c->next)
+    c->len = 0;
+  dh->data.chunk.cur = dh->data.chunk.first;
+  dh->data.chunk.cur_start = 0;
+  dh->data.chunk.length = 0;
+  dh->data.chunk.offset = 0;
+  return 0;
+}
+
+
+static struct _gpgme_data_cbs chunk_cbs =
+  {
+    chunk_read,
+    chunk_write,
+    chunk_seek,
+    chunk_release,
+    NULL,
+    chunk_get_segments,
+    chunk_reset
+  };
+
+
+/* Return the content of the chunked data object DH in one buffer and
+   its length at R_LEN.  The chunks are released while they are
+   copied.  Returns NULL for an empty object; on error NULL is
+   returned and errno set.  */
+static char *
+chunk_flatten (gpgme_data_t dh, size_t *r_len)
+{
+  struct _gpgme_data_chunk *c, *c_next;
+  size_t len = dh->data.chunk.length;
+  size_t off = 0;
+  char *str;
+
+  *r_len = len;
+  if (!len)
+    return NULL;
+  str = malloc (len);
+  if (!str)
+    return NULL;
+
+  for (c = dh->data.chunk.first; c; c = c_next)
+    {
+      c_next = c->next;
+      memcpy (str + off, c->data, c->len);
+      off += c->len;
+      free (c);
+    }
+  dh->data.chunk.first = dh->data.chunk.last = dh->data.chunk.cur = NULL;
+  dh->data.chunk.length = dh->data.chunk.offset = 0;
+  dh->data.chunk.cur_start = 0;
+  return str;
+}
+
+
+
+/* The data object made of segments provided by the caller.  */
+
+/* Return the index of the segment holding the current position of DH,
+   moving past segments which end at the position, or NSEGS if there
+   is no data at the position.  */
+static size_t
+segs_at_offset (gpgme_data_t dh)
+{
+  size_t i = dh->data.segs.cur;
+
+  while (i < dh->data.segs.nsegs
+         && (dh->data.segs.offset - dh->data.segs.cur_start
+             == dh->data.segs.segs[i].length))
+    {
+      dh->data.segs.cur_start += dh->data.segs.segs[i].length;
+      i = ++dh->data.segs.cur;
+    }
+  return i;
+}
+
+
+static gpgme_ssize_t
+segs_read (gpgme_data_t dh, void *buffer, size_t size)
+{
+  const struct gpgme_data_segment *seg;
+  size_t i, pos, amt, total = 0;
+
+  while (total < size && (i = segs_at_offset (dh)) < dh->data.segs.nsegs)
+    {
+      seg = dh->data.segs.segs + i;
+      pos = dh->data.segs.offset - dh->data.segs.cur_start;
+      amt = seg->length - pos;
+      if (amt > size - total)
+        amt = size - total;
+      memcpy ((char *) buffer + total, (const char *) seg->buffer + pos, amt);
+      dh->data.segs.offset += amt;
+      total += amt;
+    }
+  return total;
+}
+
+
+static gpgme_off_t
+segs_seek (gpgme_data_t dh, gpgme_off_t offset, int whence)
+{
+  switch (whence)
+    {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += dh->data.segs.offset;
+      break;
+    case SEEK_END:
+      offset += dh->data.segs.length;
+      break;
+    default:
+      gpg_err_set_errno (EINVAL);
+      return -1;
+    }
+  if (offset < 0 || (size_t) offset > dh->data.segs.length)
+    {
+      gpg_err_set_errno (EINVAL);
+      return -1;
+    }
+  dh->data.segs.offset = offset;
+
+  /* Find the segment for the new position.  */
+  if (dh->data.segs.offset < dh->data.segs.cur_start)
+    {
+      dh->data.segs.cur = 0;
+      dh->data.segs.cur_start = 0;
+    }
+  while (dh->data.segs.cur < dh->data.segs.nsegs
+         && (dh->data.segs.offset > dh->data.segs.cur_start
+             + dh->data.segs.segs[dh->data.segs.cur].length))
+    {
+      dh->data.segs.cur_start += dh->data.segs.segs[dh->data.segs.cur].length;
+      dh->data.segs.cur++;
+    }
+  return offset;
+}
+
+
+static void
+segs_release (gpgme_data_t dh)
+{
+  free (dh->data.segs.segs);
+}
+
+
+static gpgme_ssize_t
+segs_get_segments (gpgme_data_t dh, struct gpgme_data_segment *segs,
+                   size_t nsegs)
+{
+  size_t i = segs_at_offset (dh);
+  size_t pos, n;
+
+  if (i == dh->data.segs.nsegs)
+    return 0;
+
+  pos = dh->data.segs.offset - dh->data.segs.cur_start;
+  for (n = 0; i < dh->data.segs.nsegs && n < nsegs; i++, n++, pos = 0)
+    {
+      segs[n].buffer = (const char *) dh->data.segs.segs[i].buffer + pos;
+      segs[n].length = dh->data.segs.segs[i].length - pos;
+    }
+  return n;
+}
+
+
+static struct _gpgme_data_cbs segs_cbs =
+  {
+    segs_read,
+    NULL,
+    segs_seek,
+    segs_release,
+    NULL,
+    segs_get_segments
+  };
+
+
 /* Create a new data buffer and return it in R_DH.  */
 gpgme_error_t
 gpgme_data_new (gpgme_data_t *r_dh)
@@ -182,6 +691,25 @@ gpgme_data_new (gpgme_data_t *r_dh)
 }
 
 
+/* Create a new data buffer which keeps its content in a list of
+   chunks and return it in R_DH.  Unlike with gpgme_data_new the data
+   is never moved when the object grows.  */
+gpgme_error_t
+gpgme_data_new_chunked (gpgme_data_t *r_dh)
+{
+  gpgme_error_t err;
+  TRACE_BEG  (DEBUG_DATA, "gpgme_data_new_chunked", r_dh, "");
+
+  err = _gpgme_data_new (r_dh, &chunk_cbs);
+
+  if (err)
+    return TRACE_ERR (err);
+
+  TRACE_SUC ("dh=%p", *r_dh);
+  return 0;
+}
+
+
 /* Create a new data buffer filled with SIZE bytes starting from
    BUFFER.  If COPY is zero, copying is delayed until necessary, and
    the data is taken from the original location when needed.  */
@@ -220,6 +748,139 @@ gpgme_data_new_from_mem (gpgme_data_t *r_dh, const char *buffer,
 }
 
 
+/* Create a new data buffer with the data of the NSEGS segments SEGS
+   in this order.  The data is not copied and must stay valid as long
+   as the data object exists.  */
+gpgme_error_t
+gpgme_data_new_from_segments (gpgme_data_t *r_dh,
+                              const struct gpgme_data_segment *segs,
+                              size_t nsegs)
+{
+  gpgme_error_t err;
+  struct gpgme_data_segment *copy;
+  size_t i, n, length;
+  TRACE_BEG  (DEBUG_DATA, "gpgme_data_new_from_segments", r_dh,
+	      "segs=%p, nsegs=%zu", segs, nsegs);
+
+  if (!r_dh || (nsegs && !segs))
+    return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
+
+  for (i = n = length = 0; i < nsegs; i++)
+    if (segs[i].length)
+      {
+        if (!segs[i].buffer || segs[i].length > SIZE_MAX - length)
+          return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
+        length += segs[i].length;
+        n++;
+      }
+
+  copy = malloc ((n? n : 1) * sizeof *copy);
+  if (!copy)
+    return TRACE_ERR (gpg_error_from_syserror ());
+  for (i = n = 0; i < nsegs; i++)
+    if (segs[i].length)
+      copy[n++] = segs[i];
+
+  err = _gpgme_data_new (r_dh, &segs_cbs);
+  if (err)
+    {
+      free (copy);
+      return TRACE_ERR (err);
+    }
+  (*r_dh)->data.segs.segs = copy;
+  (*r_dh)->data.segs.nsegs = n;
+  (*r_dh)->data.segs.length = length;
+  (*r_dh)->size_hint = length;
+
+  TRACE_SUC ("dh=%p", *r_dh);
+  return 0;
+}
+
+
+/* Create a new data buffer with the content of the file FNAME.  The
+   file is mapped into memory instead of being read, so that its pages
+   are only read in when the data is used.  The file must not be
+   truncated as long as the data object exists.  */
+gpgme_error_t
+gpgme_data_new_from_file_mapped (gpgme_data_t *r_dh, const char *fname)
+{
+  gpgme_error_t err;
+#ifdef USE_MMAP
+  struct stat statbuf;
+  void *map = NULL;
+  int fd;
+#endif
+
+  TRACE_BEG  (DEBUG_DATA, "gpgme_data_new_from_file_mapped", r_dh,
+	      "file_name=%s", fname);
+
+  if (!r_dh || !fname)
+    return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
+
+#ifdef USE_MMAP
+  fd = open (fname, O_RDONLY);
+  if (fd == -1)
+    return TRACE_ERR (gpg_error_from_syserror ());
+  if (fstat (fd, &statbuf))
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return TRACE_ERR (err);
+    }
+  if (!S_ISREG (statbuf.st_mode))
+    {
+      close (fd);
+      return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
+    }
+  if ((uintmax_t) statbuf.st_size > SIZE_MAX)
+    {
+      close (fd);
+      return TRACE_ERR (gpg_error (GPG_ERR_TOO_LARGE));
+    }
+
+  /* An empty file can't be mapped.  */
+  if (statbuf.st_size)
+    {
+      map = mmap (NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED)
+        {
+          err = gpg_error_from_syserror ();
+          close (fd);
+          return TRACE_ERR (err);
+        }
+#ifdef MADV_SEQUENTIAL
+      madvise (map, statbuf.st_size, MADV_SEQUENTIAL);
+#endif
+    }
+  close (fd);
+
+  err = _gpgme_data_new (r_dh, &map_cbs);
+  if (err)
+    {
+      if (map)
+        munmap (map, statbuf.st_size);
+      return TRACE_ERR (err);
+    }
+
+  (*r_dh)->data.mem.orig_buffer = map;
+  (*r_dh)->data.mem.size = statbuf.st_size;
+  (*r_dh)->data.mem.length = statbuf.st_size;
+  (*r_dh)->data.mem.map = map;
+  (*r_dh)->data.mem.map_len = statbuf.st_size;
+#else /*!USE_MMAP*/
+  err = gpgme_data_new_from_file (r_dh, fname, 1);
+  if (err)
+    return TRACE_ERR (err);
+#endif /*!USE_MMAP*/
+
+  /* Let the engine know the size of the input.  */
+  (*r_dh)->size_hint = (*r_dh)->data.mem.length;
+
+  TRACE_SUC ("dh=%p", *r_dh);
+  return 0;
+}
+
+
 /* Destroy the data buffer DH and return a pointer to its content.
    The memory has be to released with gpgme_free() by the user.  It's
    size is returned in R_LEN.  */
@@ -234,7 +895,11 @@ gpgme_data_release_and_get_mem (gpgme_data_t dh, size_t *r_len)
   TRACE_BEG  (DEBUG_DATA, "gpgme_data_release_and_get_mem", dh,
 	      "r_len=%p", r_len);
 
-  if (!dh || dh->cbs != &mem_cbs)
+  if (!dh || (dh->cbs != &mem_cbs && dh->cbs != &chunk_cbs
+#ifdef USE_MMAP
+              && dh->cbs != &map_cbs
+#endif
+              ))
     {
       gpgme_data_release (dh);
       TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
@@ -249,6 +914,24 @@ gpgme_data_release_and_get_mem (gpgme_data_t dh, size_t *r_len)
       return NULL;
     }
 
+  if (dh->cbs == &chunk_cbs)
+    {
+      str = chunk_flatten (dh, &len);
+      if (!str && len)
+	{
+	  int saved_err = gpg_error_from_syserror ();
+	  gpgme_data_release (dh);
+	  TRACE_ERR (saved_err);
+	  return NULL;
+	}
+      if (blankout && len)
+        {
+          len = 1;
+          *str = 0;
+        }
+      goto leave;
+    }
+
   str = dh->data.mem.buffer;
   len = dh->data.mem.length;
   if (blankout && len)
@@ -278,6 +961,7 @@ gpgme_data_release_and_get_mem (gpgme_data_t dh, size_t *r_len)
       dh->data.mem.buffer = NULL;
     }
 
+ leave:
   if (r_len)
     *r_len = len;
 
@@ -38,111 +38,261 @@
 #include "debug.h"
 
 
+/* The upper limit for the I/O chunk size if the application did not
+ * request an I/O buffer size.  This is the default capacity of a
+ * pipe on Linux.  */
+#define DEFAULT_IO_BUFFER_SIZE (64 * 1024)
+
+/* The largest I/O buffer size an application may request.  */
+#define MAX_IO_BUFFER_SIZE (16 * 1024 * 1024)
+
+
 /* The property table which has an entry for each active data object.
- * The data object itself uses an index into this table and the table
- * has a pointer back to the data object.  All access to that table is
- * controlled by the property_table_lock.
+ * The data object itself points to its entry and the entry has a
+ * pointer back to the data object.
  *
  * We use a separate table instead of linking all data objects
  * together for faster locating properties of the data object using
- * the data objects serial number.  We use 64 bit for the serial
- * number which is good enough to create a new data object every
- * nanosecond for more than 500 years.  Thus no wrap around will ever
- * happen.
+ * the data objects serial number.
+ *
+ * To let threads create data objects without waiting for each other
+ * the table is split into shards, each with its own lock.  A thread
+ * uses the same shard for all its objects if thread local storage is
+ * available.  The slots of a shard are stored in segments of growing
+ * size which are never moved or released; thus the entry of a data
+ * object can be accessed through the data object without a lock.
+ * Unused slots are kept in a list.
+ *
+ * The serial number encodes the shard, the index of the slot in the
+ * shard, and a generation number of the slot which is incremented
+ * each time the slot is used.  This allows to look up the entry for
+ * a serial number directly and to detect serial numbers of data
+ * objects which have been released.  With 36 bits for the generation
+ * a slot can be reused every nanosecond for more than a minute
+ * without a wrap around.  The serial number is never 0.
  */
-struct property_s
+#define PROPERTY_SHARD_BITS   4
+#define PROPERTY_INDEX_BITS   24
+#define PROPERTY_SHARDS       (1 << PROPERTY_SHARD_BITS)
+#define PROPERTY_SEGMENT_SIZE 32  /* Size of the first segment.  */
+#define PROPERTY_SEGMENTS     19  /* Enough for 2^24 slots.  */
+
+#define PROPERTY_FLAG_BLANKOUT 1  /* Void the held data.  */
+
+struct _gpgme_data_prop
 {
-  gpgme_data_t dh;   /* The data objcet or NULL if the slot is not used.  */
-  uint64_t dserial;  /* The serial number of the data object.  */
-  struct {
-    unsigned int blankout : 1;  /* Void the held data.  */
-  } flags;
+  gpgme_data_t dh;   /* The data object or NULL if the slot is not used.  */
+  uint64_t dserial;  /* The serial number of the data object or, if the
+                        slot is not used, of the last one.  */
+  unsigned int flags;      /* The PROPERTY_FLAG_ values.  */
+  unsigned int next_free;  /* For an unused slot the index of the
+                              next unused slot plus one or 0.  */
 };
-typedef struct property_s *property_t;
+typedef struct _gpgme_data_prop *property_t;
 
-static property_t property_table;
-static unsigned int property_table_size;
-DEFINE_STATIC_LOCK (property_table_lock);
-#define PROPERTY_TABLE_ALLOCATION_CHUNK 32
+struct property_shard_s
+{
+  gpgrt_lock_t lock;  /* Protects all fields of the shard.  */
 
+  /* Segment N has PROPERTY_SEGMENT_SIZE << N slots.  */
+  property_t segments[PROPERTY_SEGMENTS];
 
-
-/* Insert the newly created data object DH into the property table and
- * store the index of it at R_IDX.  An error code is returned on error
- * and the table is not changed.  */
+  /* The number of slots which have ever been used.  */
+  unsigned int nslots;
+
+  /* The index plus one of the first unused slot below NSLOTS or 0.  */
+  unsigned int free_list;
+};
+
+#define PROPERTY_SHARD_INITIALIZER { GPGRT_LOCK_INITIALIZER }
+static struct property_shard_s property_shards[PROPERTY_SHARDS] =
+  {
+    PROPERTY_SHARD_INITIALIZER, PROPERTY_SHARD_INITIALIZER,
+    PROPERTY_SHARD_INITIALIZER, PROPERTY_SHARD_INITIALIZER,
+    PROPERTY_SHARD_INITIALIZER, PROPERTY_SHARD_INITIALIZER,
+    PROPERTY_SHARD_INITIALIZER, PROPERTY_SHARD_INITIALIZER,
+    PROPERTY_SHARD_INITIALIZER, PROPERTY_SHARD_INITIALIZER,
+    PROPERTY_SHARD_INITIALIZER, PROPERTY_SHARD_INITIALIZER,
+    PROPERTY_SHARD_INITIALIZER, PROPERTY_SHARD_INITIALIZER,
+    PROPERTY_SHARD_INITIALIZER, PROPERTY_SHARD_INITIALIZER
+  };
+
+/* The flags are read and changed through the data object without
+ * taking the lock of the shard if the atomic builtins are
+ * available.  */
+#ifdef HAVE_ATOMIC_BUILTINS
+# define PROP_FLAGS_GET(p) __atomic_load_n (&(p)->flags, __ATOMIC_ACQUIRE)
+# define PROP_FLAGS_SET(p,f) \
+  ((void) __atomic_or_fetch (&(p)->flags, (f), __ATOMIC_ACQ_REL))
+# define PROP_FLAGS_CLEAR(p,f) \
+  ((void) __atomic_and_fetch (&(p)->flags, ~(f), __ATOMIC_ACQ_REL))
+#else
+# define PROP_FLAGS_GET(p) ((p)->flags)
+# define PROP_FLAGS_SET(p,f) ((void) ((p)->flags |= (f)))
+# define PROP_FLAGS_CLEAR(p,f) ((void) ((p)->flags &= ~(f)))
+#endif
+
+
+/* Return the shard of the serial number DSERIAL.  */
+static struct property_shard_s *
+dserial_shard (uint64_t dserial)
+{
+  return property_shards + (dserial & (PROPERTY_SHARDS - 1));
+}
+
+
+/* Return the slot index of the serial number DSERIAL.  */
+static unsigned int
+dserial_index (uint64_t dserial)
+{
+  return ((dserial >> PROPERTY_SHARD_BITS)
+          & ((1 << PROPERTY_INDEX_BITS) - 1));
+}
+
+
+/* Return the serial number for the next use of the slot IDX of shard
+ * SHARDNO whose last serial number was DSERIAL.  The generation is
+ * incremented and, if it wraps around, generation 0 is skipped so that
+ * the serial number is never 0.  */
+static uint64_t
+next_dserial (uint64_t dserial, unsigned int idx, unsigned int shardno)
+{
+  uint64_t gen;
+
+  gen = (dserial >> (PROPERTY_SHARD_BITS + PROPERTY_INDEX_BITS)) + 1;
+  gen &= ((uint64_t)1 << (64 - PROPERTY_SHARD_BITS - PROPERTY_INDEX_BITS)) - 1;
+  if (!gen)
+    gen = 1;
+  return ((gen << (PROPERTY_SHARD_BITS + PROPERTY_INDEX_BITS))
+          | ((uint64_t)idx << PROPERTY_SHARD_BITS) | shardno);
+}
+
+
+/* Return the shard to use for a new data object DH.  */
+static unsigned int
+select_shard (gpgme_data_t dh)
+{
+#ifdef HAVE_TLS
+  static unsigned int next_shard;
+  static __thread unsigned int my_shard;
+
+  (void)dh;
+
+  /* The shards are assigned to the threads in turn; a race on
+     NEXT_SHARD only makes two threads share a shard.  */
+  if (!my_shard)
+    my_shard = (next_shard++ % PROPERTY_SHARDS) + 1;
+  return my_shard - 1;
+#else
+  /* Spread the objects over the shards by their address.  */
+  return ((uintptr_t)dh / sizeof *dh) % PROPERTY_SHARDS;
+#endif
+}
+
+
+/* Return the slot IDX of SHARD.  If ALLOC is set the segment for the
+ * slot is allocated if needed.  Returns NULL if IDX is out of range
+ * or on allocation failure.  Must be called with the lock of SHARD
+ * held.  */
+static property_t
+shard_slot (struct property_shard_s *shard, unsigned int idx, int alloc)
+{
+  unsigned int seg;
+  unsigned int start = 0;
+  size_t size = PROPERTY_SEGMENT_SIZE;
+
+  for (seg = 0; seg < PROPERTY_SEGMENTS; seg++, start += size, size *= 2)
+    if (idx - start < size)
+      break;
+  if (!(seg < PROPERTY_SEGMENTS))
+    return NULL;
+
+  if (!shard->segments[seg])
+    {
+      if (!alloc)
+        return NULL;
+      shard->segments[seg] = calloc (size, sizeof *shard->segments[seg]);
+      if (!shard->segments[seg])
+        return NULL;
+    }
+  return shard->segments[seg] + (idx - start);
+}
+
+
+/* Insert the newly created data object DH into the property table.
+ * An error code is returned on error and the table is not
+ * changed.  */
 static gpg_error_t
-insert_into_property_table (gpgme_data_t dh, unsigned int *r_idx)
+insert_into_property_table (gpgme_data_t dh)
 {
-  static uint64_t last_dserial;
-  gpg_error_t err;
+  unsigned int shardno = select_shard (dh);
+  struct property_shard_s *shard = property_shards + shardno;
+  gpg_error_t err = 0;
   unsigned int idx;
+  property_t prop;
 
-  LOCK (property_table_lock);
-  if (!property_table)
+  LOCK (shard->lock);
+  if (shard->free_list)
     {
-      property_table_size = PROPERTY_TABLE_ALLOCATION_CHUNK;
-      property_table = calloc (property_table_size, sizeof *property_table);
-      if (!property_table)
-        {
-          err = gpg_error_from_syserror ();
-          goto leave;
-        }
+      idx = shard->free_list - 1;
+      prop = shard_slot (shard, idx, 0);
+      assert (prop && !prop->dh);
+      shard->free_list = prop->next_free;
     }
-
-  /* Find an empty slot.  */
-  for (idx = 0; idx < property_table_size; idx++)
-    if (!property_table[idx].dh)
-      break;
-  if (!(idx < property_table_size))
+  else
     {
-      /* No empty slot found.  Enlarge the table.  */
-      property_t newtbl;
-      unsigned int newsize;
-
-      newsize = property_table_size + PROPERTY_TABLE_ALLOCATION_CHUNK;;
-      if ((newsize * sizeof *property_table)
-          < (property_table_size * sizeof *property_table))
+      idx = shard->nslots;
+      prop = shard_slot (shard, idx, 1);
+      if (!prop)
         {
           err = gpg_error (GPG_ERR_ENOMEM);
           goto leave;
         }
-      newtbl = realloc (property_table, newsize * sizeof *property_table);
-      if (!newtbl)
-        {
-          err = gpg_error_from_syserror ();
-          goto leave;
-        }
-      property_table = newtbl;
-      for (idx = property_table_size; idx < newsize; idx++)
-        property_table[idx].dh = NULL;
-      idx = property_table_size;
-      property_table_size = newsize;
+      shard->nslots++;
     }
 
-  /* Slot found. */
-  property_table[idx].dh = dh;
-  property_table[idx].dserial = ++last_dserial;
-  memset (&property_table[idx].flags, 0, sizeof property_table[idx].flags);
-  *r_idx = idx;
-  err = 0;
+  prop->dh = dh;
+  prop->dserial = next_dserial (prop->dserial, idx, shardno);
+  prop->flags = 0;
+  prop->next_free = 0;
+  dh->prop = prop;
 
  leave:
-  UNLOCK (property_table_lock);
+  UNLOCK (shard->lock);
   return err;
 }
 
 
-/* Remove the data object at PROPIDX from the table.  DH is only used
- * for cross checking.  */
+/* Remove the data object DH from the table.  */
 static void
-remove_from_property_table (gpgme_data_t dh, unsigned int propidx)
+remove_from_property_table (gpgme_data_t dh)
 {
-  LOCK (property_table_lock);
-  assert (property_table);
-  assert (propidx < property_table_size);
-  assert (property_table[propidx].dh == dh);
-  property_table[propidx].dh = NULL;
-  UNLOCK (property_table_lock);
+  property_t prop = dh->prop;
+  struct property_shard_s *shard = dserial_shard (prop->dserial);
+
+  LOCK (shard->lock);
+  assert (prop->dh == dh);
+  prop->dh = NULL;
+  prop->next_free = shard->free_list;
+  shard->free_list = dserial_index (prop->dserial) + 1;
+  UNLOCK (shard->lock);
+}
+
+
+/* Give the data object DH a new serial number and clear its
+ * properties as if it had been newly inserted.  */
+static void
+renew_in_property_table (gpgme_data_t dh)
+{
+  property_t prop = dh->prop;
+  struct property_shard_s *shard = dserial_shard (prop->dserial);
+
+  LOCK (shard->lock);
+  assert (prop->dh == dh);
+  prop->dserial = next_dserial (prop->dserial, dserial_index (prop->dserial),
+                                prop->dserial & (PROPERTY_SHARDS - 1));
+  prop->flags = 0;
+  UNLOCK (shard->lock);
 }
 
 
@@ -151,21 +301,37 @@ remove_from_property_table (gpgme_data_t dh, unsigned int propidx)
 uint64_t
 _gpgme_data_get_dserial (gpgme_data_t dh)
 {
-  uint64_t dserial;
-  unsigned int idx;
-
   if (!dh)
     return 0;
 
-  idx = dh->propidx;
-  LOCK (property_table_lock);
-  assert (property_table);
-  assert (idx < property_table_size);
-  assert (property_table[idx].dh == dh);
-  dserial = property_table[idx].dserial;
-  UNLOCK (property_table_lock);
+  /* Only the owner of DH changes the serial number.  */
+  assert (dh->prop && dh->prop->dh == dh);
+  return dh->prop->dserial;
+}
 
-  return dserial;
+
+/* Find the entry for the data object with the serial number DSERIAL
+ * and return it.  The lock of the shard is held on success; it is
+ * returned at R_SHARD.  */
+static gpg_error_t
+lookup_dserial (uint64_t dserial, struct property_shard_s **r_shard,
+                property_t *r_prop)
+{
+  struct property_shard_s *shard = dserial_shard (dserial);
+  unsigned int idx = dserial_index (dserial);
+  property_t prop;
+
+  LOCK (shard->lock);
+  if (!(idx < shard->nslots)
+      || !(prop = shard_slot (shard, idx, 0))
+      || !prop->dh || prop->dserial != dserial)
+    {
+      UNLOCK (shard->lock);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+  *r_shard = shard;
+  *r_prop = prop;
+  return 0;
 }
 
 
@@ -177,40 +343,29 @@ _gpgme_data_set_prop (gpgme_data_t dh, uint64_t dserial,
                       data_prop_t name, int value)
 {
   gpg_error_t err = 0;
-  int idx;
+  struct property_shard_s *shard = NULL;
+  property_t prop;
   TRACE_BEG  (DEBUG_DATA, "gpgme_data_set_prop", dh,
 	      "dserial=%llu %lu=%d",
               (unsigned long long)dserial,
               (unsigned long)name, value);
 
-  LOCK (property_table_lock);
   if ((!dh && !dserial) || (dh && dserial))
-    {
-      err = gpg_error (GPG_ERR_INV_VALUE);
-      goto leave;
-    }
+    return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
   if (dh) /* Lookup via handle.  */
     {
-      idx = dh->propidx;
-      assert (property_table);
-      assert (idx < property_table_size);
-      assert (property_table[idx].dh == dh);
+      prop = dh->prop;
+      assert (prop && prop->dh == dh);
+#ifndef HAVE_ATOMIC_BUILTINS
+      shard = dserial_shard (prop->dserial);
+      LOCK (shard->lock);
+#endif
     }
   else /* Lookup via DSERIAL.  */
     {
-      if (!property_table)
-        {
-          err = gpg_error (GPG_ERR_NOT_FOUND);
-          goto leave;
-        }
-      for (idx = 0; idx < property_table_size; idx++)
-        if (property_table[idx].dh && property_table[idx].dserial == dserial)
-          break;
-      if (!(idx < property_table_size))
-        {
-          err = gpg_error (GPG_ERR_NOT_FOUND);
-          goto leave;
-        }
+      err = lookup_dserial (dserial, &shard, &prop);
+      if (err)
+        return TRACE_ERR (err);
     }
 
   switch (name)
@@ -218,7 +373,10 @@ _gpgme_data_set_prop (gpgme_data_t dh, uint64_t dserial,
     case DATA_PROP_NONE: /* Nothing to to do.  */
       break;
     case DATA_PROP_BLANKOUT:
-      property_table[idx].flags.blankout = !!value;
+      if (value)
+        PROP_FLAGS_SET (prop, PROPERTY_FLAG_BLANKOUT);
+      else
+        PROP_FLAGS_CLEAR (prop, PROPERTY_FLAG_BLANKOUT);
       break;
 
     default:
@@ -226,8 +384,8 @@ _gpgme_data_set_prop (gpgme_data_t dh, uint64_t dserial,
       break;
     }
 
- leave:
-  UNLOCK (property_table_lock);
+  if (shard)
+    UNLOCK (shard->lock);
   return TRACE_ERR (err);
 }
 
@@ -240,7 +398,9 @@ _gpgme_data_get_prop (gpgme_data_t dh, uint64_t dserial,
                       data_prop_t name, int *r_value)
 {
   gpg_error_t err = 0;
-  int idx;
+  struct property_shard_s *shard = NULL;
+  property_t prop;
+  unsigned int flags;
   TRACE_BEG  (DEBUG_DATA, "gpgme_data_get_prop", dh,
 	      "dserial=%llu %lu",
               (unsigned long long)dserial,
@@ -248,42 +408,33 @@ _gpgme_data_get_prop (gpgme_data_t dh, uint64_t dserial,
 
   *r_value = 0;
 
-  LOCK (property_table_lock);
   if ((!dh && !dserial) || (dh && dserial))
-    {
-      err = gpg_error (GPG_ERR_INV_VALUE);
-      goto leave;
-    }
+    return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
   if (dh) /* Lookup via handle.  */
     {
-      idx = dh->propidx;
-      assert (property_table);
-      assert (idx < property_table_size);
-      assert (property_table[idx].dh == dh);
+      prop = dh->prop;
+      assert (prop && prop->dh == dh);
+#ifndef HAVE_ATOMIC_BUILTINS
+      shard = dserial_shard (prop->dserial);
+      LOCK (shard->lock);
+#endif
     }
   else /* Lookup via DSERIAL.  */
     {
-      if (!property_table)
-        {
-          err = gpg_error (GPG_ERR_NOT_FOUND);
-          goto leave;
-        }
-      for (idx = 0; idx < property_table_size; idx++)
-        if (property_table[idx].dh && property_table[idx].dserial == dserial)
-          break;
-      if (!(idx < property_table_size))
-        {
-          err = gpg_error (GPG_ERR_NOT_FOUND);
-          goto leave;
-        }
+      err = lookup_dserial (dserial, &shard, &prop);
+      if (err)
+        return TRACE_ERR (err);
     }
+  flags = PROP_FLAGS_GET (prop);
+  if (shard)
+    UNLOCK (shard->lock);
 
   switch (name)
     {
     case DATA_PROP_NONE: /* Nothing to to do.  */
       break;
     case DATA_PROP_BLANKOUT:
-      *r_value = property_table[idx].flags.blankout;
+      *r_value = !!(flags & PROPERTY_FLAG_BLANKOUT);
       break;
 
     default:
@@ -291,13 +442,39 @@ _gpgme_data_get_prop (gpgme_data_t dh, uint64_t dserial,
       break;
     }
 
- leave:
-  UNLOCK (property_table_lock);
   return TRACE_ERR (err);
 }
 
 
 
+/* A pool of data objects created by gpgme_data_pool_new.  The pool
+ * and its objects are not locked; they must only be used by one
+ * thread at a time.  */
+struct gpgme_data_pool
+{
+  /* The number of objects taken from the pool and not yet released,
+   * plus one until gpgme_data_pool_release has been called.  */
+  unsigned int refs;
+
+  /* The maximum number of unused objects kept.  */
+  unsigned int size;
+
+  /* The list of unused objects and its length.  */
+  gpgme_data_t unused;
+  unsigned int nunused;
+};
+
+
+/* Drop a reference to POOL and release it if it was the last.  */
+static void
+pool_unref (gpgme_data_pool_t pool)
+{
+  if (!--pool->refs)
+    free (pool);
+}
+
+
+
 gpgme_error_t
 _gpgme_data_new (gpgme_data_t *r_dh, struct _gpgme_data_cbs *cbs)
 {
@@ -317,8 +494,9 @@ _gpgme_data_new (gpgme_data_t *r_dh, struct _gpgme_data_cbs *cbs)
     return gpg_error_from_syserror ();
 
   dh->cbs = cbs;
+  dh->io_chunk = BUFFER_SIZE;
 
-  err = insert_into_property_table (dh, &dh->propidx);
+  err = insert_into_property_table (dh);
   if (err)
     {
       free (dh);
@@ -336,9 +514,12 @@ _gpgme_data_release (gpgme_data_t dh)
   if (!dh)
     return;
 
-  remove_from_property_table (dh, dh->propidx);
+  remove_from_property_table (dh);
   if (dh->file_name)
     free (dh->file_name);
+  free (dh->pending);
+  if (dh->pool)
+    pool_unref (dh->pool);
   free (dh);
 }
 
@@ -441,6 +622,185 @@ gpgme_data_seek (gpgme_data_t dh, gpgme_off_t offset, int whence)
 }
 
 
+/* Store pointers to up to NSEGS contiguous parts of the data in DH,
+   starting at the current position, in SEGS without changing the
+   position.  Return the number of parts stored, 0 at the end of the
+   data, or -1 on error.  If an error occurs, errno is set.  */
+gpgme_ssize_t
+gpgme_data_get_segments (gpgme_data_t dh, struct gpgme_data_segment *segs,
+                         size_t nsegs)
+{
+  gpgme_ssize_t res;
+  int blankout;
+  TRACE_BEG  (DEBUG_DATA, "gpgme_data_get_segments", dh,
+	      "segs=%p, nsegs=%zu", segs, nsegs);
+
+  if (!dh || (nsegs && !segs))
+    {
+      gpg_err_set_errno (EINVAL);
+      return TRACE_SYSRES (-1);
+    }
+  if (!dh->cbs->get_segments)
+    {
+      gpg_err_set_errno (ENOSYS);
+      return TRACE_SYSRES (-1);
+    }
+
+  if (_gpgme_data_get_prop (dh, 0, DATA_PROP_BLANKOUT, &blankout)
+      || blankout)
+    res = 0;
+  else
+    res = (*dh->cbs->get_segments) (dh, segs, nsegs);
+
+  return TRACE_SYSRES ((int)res);
+}
+
+
+/* Make the data object DH empty as if it had just been created but
+   keep the memory allocated for its content.  This is only supported
+   for memory based objects which can be written to.  */
+gpgme_error_t
+gpgme_data_reset (gpgme_data_t dh)
+{
+  gpgme_error_t err;
+  TRACE_BEG  (DEBUG_DATA, "gpgme_data_reset", dh, "");
+
+  if (!dh)
+    return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
+  if (!dh->cbs->reset)
+    return TRACE_ERR (gpg_error (GPG_ERR_NOT_SUPPORTED));
+
+  err = (*dh->cbs->reset) (dh);
+  if (err)
+    return TRACE_ERR (err);
+
+  /* The buffer for pending data is kept as well.  */
+  dh->pending_len = 0;
+  dh->io_buffer_size = 0;
+  dh->io_chunk = BUFFER_SIZE;
+  dh->no_splice = 0;
+  dh->no_writev = 0;
+  dh->encoding = GPGME_DATA_ENCODING_NONE;
+  if (dh->file_name)
+    {
+      free (dh->file_name);
+      dh->file_name = NULL;
+    }
+  dh->size_hint = 0;
+
+  /* Operations which still refer to the old serial number must not
+     affect the object any longer.  */
+  renew_in_property_table (dh);
+
+  return TRACE_ERR (0);
+}
+
+
+/* Create a new pool for up to SIZE unused data objects and return it
+   at R_POOL.  */
+gpgme_error_t
+gpgme_data_pool_new (gpgme_data_pool_t *r_pool, unsigned int size)
+{
+  gpgme_data_pool_t pool;
+  TRACE_BEG  (DEBUG_DATA, "gpgme_data_pool_new", r_pool, "size=%u", size);
+
+  if (!r_pool || !size)
+    return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
+  *r_pool = NULL;
+
+  pool = calloc (1, sizeof *pool);
+  if (!pool)
+    return TRACE_ERR (gpg_error_from_syserror ());
+  pool->refs = 1;
+  pool->size = size;
+
+  *r_pool = pool;
+  TRACE_SUC ("pool=%p", pool);
+  return 0;
+}
+
+
+/* Release the pool POOL and the unused data objects in it.  The
+   objects still in use are destroyed when they are released.  */
+void
+gpgme_data_pool_release (gpgme_data_pool_t pool)
+{
+  gpgme_data_t dh;
+  TRACE (DEBUG_DATA, "gpgme_data_pool_release", pool, "");
+
+  if (!pool)
+    return;
+
+  /* The unused objects hold no reference.  */
+  while ((dh = pool->unused))
+    {
+      pool->unused = dh->pool_next;
+      dh->pool = NULL;
+      gpgme_data_release (dh);
+    }
+  pool->nunused = 0;
+  pool->size = 0;
+  pool_unref (pool);
+}
+
+
+/* Return a memory based data object in R_DH, taking an unused one
+   from POOL if there is one.  The object goes back to POOL when it is
+   released.  */
+gpgme_error_t
+gpgme_data_new_from_pool (gpgme_data_t *r_dh, gpgme_data_pool_t pool)
+{
+  gpgme_error_t err;
+  gpgme_data_t dh;
+  TRACE_BEG  (DEBUG_DATA, "gpgme_data_new_from_pool", r_dh,
+	      "pool=%p", pool);
+
+  if (!r_dh || !pool)
+    return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
+
+  if ((dh = pool->unused))
+    {
+      pool->unused = dh->pool_next;
+      pool->nunused--;
+      dh->pool_next = NULL;
+    }
+  else
+    {
+      err = gpgme_data_new (&dh);
+      if (err)
+        {
+          *r_dh = NULL;
+          return TRACE_ERR (err);
+        }
+      dh->pool = pool;
+    }
+  pool->refs++;
+
+  *r_dh = dh;
+  TRACE_SUC ("dh=%p", dh);
+  return 0;
+}
+
+
+/* Give the data object DH, which was taken from a pool, back to the
+   pool.  Returns true if this was done and false if the object shall
+   be destroyed.  */
+static int
+pool_put (gpgme_data_t dh)
+{
+  gpgme_data_pool_t pool = dh->pool;
+
+  if (pool->nunused >= pool->size || gpgme_data_reset (dh))
+    return 0;
+
+  dh->pool_next = pool->unused;
+  pool->unused = dh;
+  pool->nunused++;
+  pool->refs--;
+  return 1;
+}
+
+
 /* Convenience function to do a gpgme_data_seek (dh, 0, SEEK_SET).  */
 gpgme_error_t
 gpgme_data_rewind (gpgme_data_t dh)
@@ -464,6 +824,9 @@ gpgme_data_release (gpgme_data_t dh)
   if (!dh)
     return;
 
+  if (dh->pool && pool_put (dh))
+    return;
+
   if (dh->cbs->release)
     (*dh->cbs->release) (dh);
   _gpgme_data_release (dh);
@@ -555,6 +918,15 @@ gpgme_data_set_flag (gpgme_data_t dh, const char *name, const char *value)
     {
       dh->size_hint= value? _gpgme_string_to_off (value) : 0;
     }
+  else if (!strcmp (name, "io-buffer-size"))
+    {
+      size_t n = value? strtoul (value, NULL, 10) : 0;
+
+      if (n > MAX_IO_BUFFER_SIZE)
+        n = MAX_IO_BUFFER_SIZE;
+      dh->io_buffer_size = n;
+      dh->io_chunk = n && n < BUFFER_SIZE? n : BUFFER_SIZE;
+    }
   else
     return gpg_error (GPG_ERR_UNKNOWN_NAME);
 
@@ -565,18 +937,177 @@ gpgme_data_set_flag (gpgme_data_t dh, const char *name, const char *value)
 
 /* Functions to support the wait interface.  */
 
+/* Make sure that the buffer of DH can hold the current chunk size.
+   Must only be called if no data is pending.  Returns 0 on success or
+   -1 with ERRNO set.  */
+static int
+alloc_io_buffer (gpgme_data_t dh)
+{
+  char *buffer;
+
+  if (dh->pending_size >= dh->io_chunk)
+    return 0;
+
+  /* Nothing is pending, thus there is no need to keep the content.  */
+  buffer = malloc (dh->io_chunk);
+  if (!buffer)
+    return -1;
+  free (dh->pending);
+  dh->pending = buffer;
+  dh->pending_size = dh->io_chunk;
+  return 0;
+}
+
+
+/* The last system call of a data handler moved a complete chunk; use
+   a larger chunk next time.  */
+static void
+grow_io_chunk (gpgme_data_t dh)
+{
+  size_t max = dh->io_buffer_size? dh->io_buffer_size : DEFAULT_IO_BUFFER_SIZE;
+
+  if (dh->io_chunk < max)
+    {
+      dh->io_chunk *= 2;
+      if (dh->io_chunk > max)
+        dh->io_chunk = max;
+    }
+}
+
+
+/* Move data between the file descriptor backing DH and the engine
+   pipe FD with _gpgme_io_splice.  INBOUND gives the direction.
+   Returns the number of bytes moved, 0 on EOF, -1 on error with ERRNO
+   set, or -2 if splice can't be used; the caller shall then fall back
+   to reading and writing.  */
+static gpgme_ssize_t
+splice_data (gpgme_data_t dh, int fd, int inbound)
+{
+  int dfd;
+  int blankout;
+  gpgme_ssize_t n;
+
+  if (dh->no_splice || dh->pending_len)
+    return -2;
+  if (!inbound
+      && (_gpgme_data_get_prop (dh, 0, DATA_PROP_BLANKOUT, &blankout)
+          || blankout))
+    return -2;
+
+  dfd = _gpgme_data_get_fd (dh);
+  if (dfd == -1)
+    {
+      dh->no_splice = 1;
+      return -2;
+    }
+
+  if (inbound)
+    n = _gpgme_io_splice (fd, dfd, dh->io_chunk);
+  else
+    n = _gpgme_io_splice (dfd, fd, dh->io_chunk);
+  if (n == -1)
+    {
+      /* Unsupported types of fds are detected with the first call.
+         EAGAIN may be due to a non-blocking data fd, which we leave
+         to the regular code.  */
+      if (errno == EINVAL || errno == ENOSYS)
+        dh->no_splice = 1;
+      if (dh->no_splice || errno == EAGAIN)
+        return -2;
+    }
+  else if ((size_t)n == dh->io_chunk)
+    grow_io_chunk (dh);
+  return n;
+}
+
+
+/* Write the data of DH to the engine pipe FD directly from the
+   memory of DH with _gpgme_io_writev.  Returns the number of bytes
+   written, 0 at the end of the data, -1 on error with ERRNO set, or
+   -2 if this can't be used; the caller shall then fall back to
+   reading and writing.  */
+static gpgme_ssize_t
+writev_data (gpgme_data_t dh, int fd)
+{
+  struct gpgme_data_segment segs[16];
+  gpgme_ssize_t n, nwritten;
+  size_t total = 0;
+  int blankout;
+  int i;
+
+  if (dh->no_writev || dh->pending_len
+      || !dh->cbs->get_segments || !dh->cbs->seek)
+    return -2;
+  if (_gpgme_data_get_prop (dh, 0, DATA_PROP_BLANKOUT, &blankout)
+      || blankout)
+    return -2;
+
+  n = (*dh->cbs->get_segments) (dh, segs, DIM (segs));
+  if (n <= 0)
+    return n;
+
+  /* Write no more than a chunk like the regular code does.  */
+  for (i = 0; i < n && total < dh->io_chunk; i++)
+    {
+      if (segs[i].length > dh->io_chunk - total)
+        segs[i].length = dh->io_chunk - total;
+      total += segs[i].length;
+    }
+
+  nwritten = _gpgme_io_writev (fd, segs, i);
+  if (nwritten == -1 && errno == ENOSYS)
+    {
+      dh->no_writev = 1;
+      return -2;
+    }
+  if (nwritten > 0)
+    {
+      if ((*dh->cbs->seek) (dh, nwritten, SEEK_CUR) < 0)
+        return -1;
+      if ((size_t)nwritten == dh->io_chunk)
+        grow_io_chunk (dh);
+    }
+  return nwritten;
+}
+
+
 gpgme_error_t
 _gpgme_data_inbound_handler (void *opaque, int fd)
 {
   struct io_cb_data *data = (struct io_cb_data *) opaque;
   gpgme_data_t dh = (gpgme_data_t) data->handler_value;
-  char buffer[BUFFER_SIZE];
-  char *bufp = buffer;
+  char stackbuf[BUFFER_SIZE];
+  char *buffer;
+  size_t size;
+  char *bufp;
   gpgme_ssize_t buflen;
   TRACE_BEG  (DEBUG_CTX, "_gpgme_data_inbound_handler", dh,
 	      "fd=0x%x", fd);
 
-  buflen = _gpgme_io_read (fd, buffer, BUFFER_SIZE);
+  buflen = splice_data (dh, fd, 1);
+  if (buflen != -2)
+    {
+      if (buflen < 0)
+        return TRACE_ERR (gpg_error_from_syserror ());
+      if (buflen == 0)
+        _gpgme_io_close (fd);
+      return TRACE_ERR (0);
+    }
+
+  /* Use the buffer of the data object unless it is also used for
+     outbound data.  */
+  if (!dh->pending_len && !alloc_io_buffer (dh))
+    {
+      buffer = dh->pending;
+      size = dh->io_chunk;
+    }
+  else
+    {
+      buffer = stackbuf;
+      size = sizeof stackbuf;
+    }
+
+  buflen = _gpgme_io_read (fd, buffer, size);
   if (buflen < 0)
     return gpg_error_from_syserror ();
   if (buflen == 0)
@@ -584,6 +1115,10 @@ _gpgme_data_inbound_handler (void *opaque, int fd)
       _gpgme_io_close (fd);
       return TRACE_ERR (0);
     }
+  if ((size_t)buflen == size && buffer == dh->pending)
+    grow_io_chunk (dh);
+
+  bufp = buffer;
 
   do
     {
@@ -607,9 +1142,33 @@ _gpgme_data_outbound_handler (void *opaque, int fd)
   TRACE_BEG  (DEBUG_CTX, "_gpgme_data_outbound_handler", dh,
 	      "fd=0x%x", fd);
 
+  nwritten = splice_data (dh, fd, 0);
+  if (nwritten == -2)
+    nwritten = writev_data (dh, fd);
+  if (nwritten == -1 && errno == EAGAIN)
+    return TRACE_ERR (0);
+  if (nwritten == -1 && errno == EPIPE)
+    {
+      /* See below.  */
+      _gpgme_io_close (fd);
+      return TRACE_ERR (0);
+    }
+  if (nwritten != -2)
+    {
+      if (nwritten < 0)
+        return TRACE_ERR (gpg_error_from_syserror ());
+      if (nwritten == 0)
+        _gpgme_io_close (fd);
+      return TRACE_ERR (0);
+    }
+
   if (!dh->pending_len)
     {
-      gpgme_ssize_t amt = gpgme_data_read (dh, dh->pending, BUFFER_SIZE);
+      gpgme_ssize_t amt;
+
+      if (alloc_io_buffer (dh))
+	return TRACE_ERR (gpg_error_from_syserror ());
+      amt = gpgme_data_read (dh, dh->pending, dh->io_chunk);
       if (amt < 0)
 	return TRACE_ERR (gpg_error_from_syserror ());
       if (amt == 0)
@@ -639,6 +1198,8 @@ _gpgme_data_outbound_handler (void *opaque, int fd)
 
   if (nwritten < dh->pending_len)
     memmove (dh->pending, dh->pending + nwritten, dh->pending_len - nwritten);
+  else if ((size_t)nwritten == dh->io_chunk)
+    grow_io_chunk (dh);
   dh->pending_len -= nwritten;
   return TRACE_ERR (0);
 }
@@ -661,3 +1222,11 @@ _gpgme_data_get_size_hint (gpgme_data_t dh)
 {
   return dh ? dh->size_hint : 0;
 }
+
+
+/* Return the I/O buffer size requested for DH or 0 if not set.  */
+size_t
+_gpgme_data_get_io_buffer_size (gpgme_data_t dh)
+{
+  return dh ? dh->io_buffer_size : 0;
+}
@@ -61,6 +61,17 @@ typedef void (*gpgme_data_release_cb) (gpgme_data_t dh);
 /* Get the FD associated with the handle DH, or -1.  */
 typedef int (*gpgme_data_get_fd_cb) (gpgme_data_t dh);
 
+/* Store up to NSEGS contiguous parts of the data in the data object
+   with the handle DH, starting at the current position, in SEGS.
+   Return the number of parts stored, 0 at the end of the data, or -1
+   on error.  If an error occurs, errno is set.  */
+typedef gpgme_ssize_t (*gpgme_data_get_segments_cb)
+     (gpgme_data_t dh, struct gpgme_data_segment *segs, size_t nsegs);
+
+/* Make the data object with the handle DH empty but keep the memory
+   allocated for its content.  */
+typedef gpgme_error_t (*gpgme_data_reset_cb) (gpgme_data_t dh);
+
 struct _gpgme_data_cbs
 {
   gpgme_data_read_cb read;
@@ -68,13 +79,21 @@ struct _gpgme_data_cbs
   gpgme_data_seek_cb seek;
   gpgme_data_release_cb release;
   gpgme_data_get_fd_cb get_fd;
+  gpgme_data_get_segments_cb get_segments;
+  gpgme_data_reset_cb reset;
 };
 
+/* A chunk of a data object created by gpgme_data_new_chunked.  */
+struct _gpgme_data_chunk;
+
+/* The entry of a data object in the property table.  */
+struct _gpgme_data_prop;
+
 struct gpgme_data
 {
   struct _gpgme_data_cbs *cbs;
   gpgme_data_encoding_t encoding;
-  unsigned int propidx;  /* Index into the property table.  */
+  struct _gpgme_data_prop *prop;  /* Entry in the property table.  */
 
 #ifdef PIPE_BUF
 #define BUFFER_SIZE PIPE_BUF
@@ -85,15 +104,40 @@ struct gpgme_data
 #define BUFFER_SIZE 512
 #endif
 #endif
-  char pending[BUFFER_SIZE];
+
+  /* The buffer used by the data handlers.  The first PENDING_LEN
+     bytes have been read from the data object but not yet written by
+     the outbound handler.  PENDING_SIZE is the allocated size.  */
+  char *pending;
+  size_t pending_size;
   int pending_len;
 
+  /* The I/O buffer size requested with the "io-buffer-size" flag or 0
+     for the default.  */
+  size_t io_buffer_size;
+
+  /* The number of bytes the data handlers currently move with one
+     system call.  This starts at BUFFER_SIZE and grows up to the
+     requested I/O buffer size as long as the pipe stays full.  */
+  size_t io_chunk;
+
+  /* Set if the data handlers can't use splice for this object.  */
+  unsigned int no_splice : 1;
+
+  /* Set if the data handlers can't use writev for this object.  */
+  unsigned int no_writev : 1;
+
   /* File name of the data object.  */
   char *file_name;
 
   /* Hint on the to be expected total size of the data.  */
   gpgme_off_t size_hint;
 
+  /* For gpgme_data_new_from_pool: The pool the object is given back
+     to on release and the link in its list of unused objects.  */
+  gpgme_data_pool_t pool;
+  gpgme_data_t pool_next;
+
   union
   {
     /* For gpgme_data_new_from_fd.  */
@@ -121,8 +165,45 @@ struct gpgme_data
       size_t size;
       size_t length;
       gpgme_off_t offset;
+      /* For gpgme_data_new_from_file_mapped: The mapping of the file,
+         which is also used as ORIG_BUFFER, its length, and the
+         offset up to which the pages have been given back to the
+         kernel after reading.  */
+      void *map;
+      size_t map_len;
+      size_t map_dropped;
     } mem;
 
+    /* For gpgme_data_new_chunked.  */
+    struct
+    {
+      /* The list of chunks.  The chunks before the one holding the
+         end of the data are full and those after it are empty; they
+         are kept by gpgme_data_reset.  */
+      struct _gpgme_data_chunk *first;
+      struct _gpgme_data_chunk *last;
+      /* The chunk holding the current position and the offset of its
+         first byte.  */
+      struct _gpgme_data_chunk *cur;
+      size_t cur_start;
+      size_t length;
+      size_t offset;
+    } chunk;
+
+    /* For gpgme_data_new_from_segments.  */
+    struct
+    {
+      /* A copy of the array of segments without empty ones.  */
+      struct gpgme_data_segment *segs;
+      size_t nsegs;
+      /* The segment holding the current position and the offset of
+         its first byte.  */
+      size_t cur;
+      size_t cur_start;
+      size_t length;
+      size_t offset;
+    } segs;
+
     /* For gpgme_data_new_from_read_cb.  */
     struct
     {
@@ -166,5 +247,8 @@ int _gpgme_data_get_fd (gpgme_data_t dh);
 /* Get the size-hint value for DH or 0 if not available.  */
 gpgme_off_t _gpgme_data_get_size_hint (gpgme_data_t dh);
 
+/* Return the I/O buffer size requested for DH or 0 if not set.  */
+size_t _gpgme_data_get_io_buffer_size (gpgme_data_t dh);
+
 
 #endif	/* DATA_H */
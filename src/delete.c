@@ -115,6 +115,7 @@ delete_start (gpgme_ctx_t ctx, int synchronous, const gpgme_key_t key,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   _gpgme_engine_set_status_handler (ctx->engine, delete_status_handler, ctx);
 
@@ -126,6 +126,7 @@ interact_start (gpgme_ctx_t ctx, int synchronous, gpgme_key_t key,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   if (!fnc || !out)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -205,6 +206,7 @@ edit_start (gpgme_ctx_t ctx, int synchronous, int type, gpgme_key_t key,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   if (!fnc || !out)
     return gpg_error (GPG_ERR_INV_VALUE);
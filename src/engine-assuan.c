@@ -838,6 +838,7 @@ struct engine_ops _gpgme_engine_ops_assuan =
     llass_io_event,
     llass_cancel,
     llass_cancel_op,
+    NULL,               /* kill */
     NULL,               /* passwd */
     NULL,               /* set_pinentry_mode */
     NULL                /* opspawn */
@@ -147,6 +147,9 @@ struct engine_ops
   /* Cancel only the current operation, not the whole session.  */
   gpgme_error_t (*cancel_op) (void *engine);
 
+  /* Terminate the backend process of the pending operation.  */
+  gpgme_error_t (*kill) (void *engine);
+
   /* Change the passphrase for KEY. */
   gpgme_error_t (*passwd) (void *engine, gpgme_key_t key, unsigned int flags);
 
@@ -818,6 +818,7 @@ struct engine_ops _gpgme_engine_ops_g13 =
     g13_io_event,
     g13_cancel,
     g13_cancel_op,
+    NULL,               /* kill */
     NULL,               /* passwd */
     NULL,               /* set_pinentry_mode */
     NULL                /* opspawn */
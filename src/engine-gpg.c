@@ -33,6 +33,9 @@
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
 #endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
 
 #include "gpgme.h"
 #include "util.h"
@@ -68,7 +71,7 @@ struct fd_data_map_s
   gpgme_data_t data;
   int inbound;  /* true if this is used for reading from gpg */
   int dup_to;
-  int fd;       /* the fd to use */
+  int fd;       /* the fd to use or -1 if PEER_FD is passed through */
   int peer_fd;  /* the other side of the pipe */
   int arg_loc;  /* The index into the argv for translation purposes.  */
   void *tag;
@@ -141,6 +144,11 @@ struct engine_gpg
   struct gpgme_io_cbs io_cbs;
   gpgme_pinentry_mode_t pinentry_mode;
   char request_origin[10];
+
+  /* The pid of the running gpg process or -1.  */
+  pid_t pid;
+  /* A descriptor for the gpg process or -1 if not supported.  */
+  int pidfd;
   char *auto_key_locate;
   char *trust_model;
 
@@ -329,6 +337,30 @@ add_data (engine_gpg_t gpg, gpgme_data_t data, int dup_to, int inbound)
 }
 
 
+/* Return a duplicate of the file descriptor backing DATA if it can be
+ * handed directly to gpg, or -1 otherwise.  This is the case for
+ * regular files: gpg then reads or writes the file at the current
+ * offset of the descriptor and the data never passes through our
+ * address space.  Other descriptors are still served by the data
+ * handlers because they may be non-blocking.  */
+static int
+get_passthrough_fd (gpgme_data_t data)
+{
+#if defined(HAVE_W32_SYSTEM) || !defined(HAVE_SYS_STAT_H)
+  (void)data;
+  return -1;
+#else
+  struct stat st;
+  int fd;
+
+  fd = _gpgme_data_get_fd (data);
+  if (fd == -1 || fstat (fd, &st) || !S_ISREG (st.st_mode))
+    return -1;
+  return _gpgme_io_dup (fd);
+#endif
+}
+
+
 /* Return true if the engine's version is at least VERSION.  */
 static int
 have_gpg_version (engine_gpg_t gpg, const char *version)
@@ -416,10 +448,38 @@ gpg_cancel (void *engine)
       free_fd_data_map (gpg->fd_data_map);
       gpg->fd_data_map = NULL;
     }
+  if (gpg->pidfd != -1)
+    {
+      _gpgme_io_close (gpg->pidfd);
+      gpg->pidfd = -1;
+    }
+
+  return 0;
+}
+
+/* Terminate gpg.  This is only done until EOF has been read from its
+   status fd.  The pid is not that of our child but of a process
+   reaped by init as soon as it exits, which may happen before we
+   read EOF; thus the pid may have been reused for another process.
+   It is only used if the process can't be signaled through a
+   pidfd.  */
+static gpgme_error_t
+gpg_kill (void *engine)
+{
+  engine_gpg_t gpg = engine;
 
+  if (!gpg)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  if (gpg->pid == (pid_t)(-1) || gpg->status.fd[0] == -1)
+    return 0;
+  if (_gpgme_io_kill (gpg->pid, gpg->pidfd))
+    return gpg_error_from_syserror ();
+  gpg->pid = (pid_t)(-1);
   return 0;
 }
 
+
 static void
 gpg_release (void *engine)
 {
@@ -502,6 +562,8 @@ gpg_new (void **engine, const char *file_name, const char *home_dir,
     }
 
   gpg->argtail = &gpg->arglist;
+  gpg->pid = (pid_t)(-1);
+  gpg->pidfd = -1;
   gpg->status.fd[0] = -1;
   gpg->status.fd[1] = -1;
   gpg->colon.fd[0] = -1;
@@ -864,6 +926,7 @@ build_argv (engine_gpg_t gpg, const char *pgmname)
   char **argv;
   int need_special = 0;
   int use_agent = 0;
+  int fd;
   char *p;
 
   if (_gpgme_in_gpg_one_mode ())
@@ -1100,6 +1163,21 @@ build_argv (engine_gpg_t gpg, const char *pgmname)
 	  /* Create a pipe to pass it down to gpg.  */
 	  fd_data_map[datac].inbound = a->inbound;
 
+	  /* Or pass the file itself if possible.  */
+	  if (!(gpg->cmd.used && gpg->cmd.cb_data == a->data)
+	      && (fd = get_passthrough_fd (a->data)) != -1)
+	    {
+	      if (_gpgme_io_set_close_notify (fd, close_notify_handler, gpg))
+		{
+		  _gpgme_io_close (fd);
+		  free (fd_data_map);
+		  free_argv (argv);
+		  return gpg_error (GPG_ERR_GENERAL);
+		}
+	      fd_data_map[datac].fd      = -1;
+	      fd_data_map[datac].peer_fd = fd;
+	    }
+	  else
 	  /* Create a pipe.  */
 	  {
 	    int fds[2];
@@ -1124,6 +1202,10 @@ build_argv (engine_gpg_t gpg, const char *pgmname)
                    probably better not to do anything.  */
 		return gpg_error (GPG_ERR_GENERAL);
 	      }
+	    /* Enlarge the pipe if a large I/O buffer was requested.  */
+	    if (_gpgme_data_get_io_buffer_size (a->data))
+	      _gpgme_io_set_pipe_size
+                (fds[0], _gpgme_data_get_io_buffer_size (a->data));
 	    /* If the data_type is FD, we have to do a dup2 here.  */
 	    if (fd_data_map[datac].inbound)
 	      {
@@ -1214,35 +1296,54 @@ add_io_cb (engine_gpg_t gpg, int fd, int dir, gpgme_io_cb_t handler, void *data,
 }
 
 
+/* Make sure that the read buffer *BUFFER of size *BUFSIZE, which
+   holds READPOS bytes of an incomplete line, has room for a read.  The
+   buffer is doubled so that very long lines don't need many
+   reallocations.  */
+static gpgme_error_t
+prepare_read_buffer (char **buffer, size_t *bufsize, size_t readpos)
+{
+  char *newbuf;
+
+  if (*bufsize - readpos >= 256)
+    return 0;
+
+  newbuf = realloc (*buffer, 2 * *bufsize);
+  if (!newbuf)
+    return gpg_error_from_syserror ();
+  *buffer = newbuf;
+  *bufsize *= 2;
+  return 0;
+}
+
+
 /* Handle the status output of GnuPG.  This function does read entire
    lines and passes them as C strings to the callback function (we can
    use C Strings because the status output is always UTF-8 encoded).
    Of course we have to buffer the lines to cope with long lines
-   e.g. with a large user ID.  Note: We can optimize this to only cope
+   e.g. with a large user ID.  All complete lines of a read are
+   processed in place; only the trailing incomplete line is moved to
+   the start of the buffer.  Note: We can optimize this to only cope
    with status line code we know about and skip all other stuff
    without buffering (i.e. without extending the buffer).  */
 static gpgme_error_t
 read_status (engine_gpg_t gpg)
 {
-  char *p;
+  char *line, *p, *end;
   int nread;
-  size_t bufsize = gpg->status.bufsize;
-  char *buffer = gpg->status.buffer;
+  char *buffer;
   size_t readpos = gpg->status.readpos;
   gpgme_error_t err;
 
-  assert (buffer);
-  if (bufsize - readpos < 256)
-    {
-      /* Need more room for the read.  */
-      bufsize += 1024;
-      buffer = realloc (buffer, bufsize);
-      if (!buffer)
-	return gpg_error_from_syserror ();
-    }
+  assert (gpg->status.buffer);
+  err = prepare_read_buffer (&gpg->status.buffer, &gpg->status.bufsize,
+                             readpos);
+  if (err)
+    return err;
+  buffer = gpg->status.buffer;
 
   nread = _gpgme_io_read (gpg->status.fd[0],
-			  buffer + readpos, bufsize-readpos);
+			  buffer + readpos, gpg->status.bufsize - readpos);
   if (nread == -1)
     return gpg_error_from_syserror ();
 
@@ -1250,6 +1351,8 @@ read_status (engine_gpg_t gpg)
     {
       err = 0;
       gpg->status.eof = 1;
+      /* Gpg closes the status fd only on exit.  */
+      gpg->pid = (pid_t)(-1);
       if (gpg->status.mon_cb)
         err = gpg->status.mon_cb (gpg->status.mon_cb_value, "", "");
       if (gpg->status.fnc)
@@ -1264,97 +1367,87 @@ read_status (engine_gpg_t gpg)
       return err;
     }
 
-  while (nread > 0)
+  /* (we require that the last line is terminated by a LF).  The data
+     before READPOS has already been checked for a LF.  */
+  end = buffer + readpos + nread;
+  line = buffer;
+  for (p = buffer + readpos;
+       !err && (p = memchr (p, '\n', end - p));
+       line = ++p)
     {
-      for (p = buffer + readpos; nread; nread--, p++)
-	{
-	  if (*p == '\n')
-	    {
-	      /* (we require that the last line is terminated by a LF) */
-	      if (p > buffer && p[-1] == '\r')
-		p[-1] = 0;
-	      *p = 0;
-	      if (!strncmp (buffer, "[GNUPG:] ", 9)
-		  && buffer[9] >= 'A' && buffer[9] <= 'Z')
-		{
-		  char *rest;
-		  gpgme_status_code_t r;
+      if (p > line && p[-1] == '\r')
+        p[-1] = 0;
+      *p = 0;
+      if (!strncmp (line, "[GNUPG:] ", 9)
+          && line[9] >= 'A' && line[9] <= 'Z')
+        {
+          char *rest;
+          gpgme_status_code_t r;
 
-		  rest = strchr (buffer + 9, ' ');
-		  if (!rest)
-		    rest = p; /* Set to an empty string.  */
-		  else
-		    *rest++ = 0;
+          rest = strchr (line + 9, ' ');
+          if (!rest)
+            rest = p; /* Set to an empty string.  */
+          else
+            *rest++ = 0;
 
-		  r = _gpgme_parse_status (buffer + 9);
-                  if (gpg->status.mon_cb && r != GPGME_STATUS_PROGRESS)
+          r = _gpgme_parse_status (line + 9);
+          if (gpg->status.mon_cb && r != GPGME_STATUS_PROGRESS)
+            {
+              /* Note that we call the monitor even if we do
+               * not know the status code (r < 0).  */
+              err = gpg->status.mon_cb (gpg->status.mon_cb_value,
+                                        line + 9, rest);
+              if (err)
+                break;
+            }
+          if (r >= 0)
+            {
+              if (gpg->cmd.used
+                  && (r == GPGME_STATUS_GET_BOOL
+                      || r == GPGME_STATUS_GET_LINE
+                      || r == GPGME_STATUS_GET_HIDDEN))
+                {
+                  gpg->cmd.code = r;
+                  if (gpg->cmd.keyword)
+                    free (gpg->cmd.keyword);
+                  gpg->cmd.keyword = strdup (rest);
+                  if (!gpg->cmd.keyword)
                     {
-                      /* Note that we call the monitor even if we do
-                       * not know the status code (r < 0).  */
-                      err = gpg->status.mon_cb (gpg->status.mon_cb_value,
-                                                buffer + 9, rest);
-                      if (err)
-                        return err;
-                    }
-		  if (r >= 0)
-		    {
-		      if (gpg->cmd.used
-			  && (r == GPGME_STATUS_GET_BOOL
-			      || r == GPGME_STATUS_GET_LINE
-			      || r == GPGME_STATUS_GET_HIDDEN))
-			{
-			  gpg->cmd.code = r;
-			  if (gpg->cmd.keyword)
-			    free (gpg->cmd.keyword);
-			  gpg->cmd.keyword = strdup (rest);
-			  if (!gpg->cmd.keyword)
-			    return gpg_error_from_syserror ();
-			  /* This should be the last thing we have
-			     received and the next thing will be that
-			     the command handler does its action.  */
-			  if (nread > 1)
-			    TRACE (DEBUG_CTX, "gpgme:read_status", 0,
-				    "error: unexpected data");
-
-			  add_io_cb (gpg, gpg->cmd.fd, 0,
-				     command_handler, gpg,
-				     &gpg->fd_data_map[gpg->cmd.idx].tag);
-			  gpg->fd_data_map[gpg->cmd.idx].fd = gpg->cmd.fd;
-			  gpg->cmd.fd = -1;
-                        }
-		      else if (gpg->status.fnc)
-			{
-			  err = gpg->status.fnc (gpg->status.fnc_value,
-						 r, rest);
-                          if (gpg_err_code (err) == GPG_ERR_FALSE)
-                            err = 0; /* Drop special error code.  */
-			  if (err)
-			    return err;
-                        }
+                      err = gpg_error_from_syserror ();
+                      break;
                     }
+                  /* This should be the last thing we have
+                     received and the next thing will be that
+                     the command handler does its action.  */
+                  if (end - p > 1)
+                    TRACE (DEBUG_CTX, "gpgme:read_status", 0,
+                            "error: unexpected data");
+
+                  add_io_cb (gpg, gpg->cmd.fd, 0,
+                             command_handler, gpg,
+                             &gpg->fd_data_map[gpg->cmd.idx].tag);
+                  gpg->fd_data_map[gpg->cmd.idx].fd = gpg->cmd.fd;
+                  gpg->cmd.fd = -1;
+                }
+              else if (gpg->status.fnc)
+                {
+                  err = gpg->status.fnc (gpg->status.fnc_value,
+                                         r, rest);
+                  if (gpg_err_code (err) == GPG_ERR_FALSE)
+                    err = 0; /* Drop special error code.  */
                 }
-	      /* To reuse the buffer for the next line we have to
-		 shift the remaining data to the buffer start and
-		 restart the loop Hmmm: We can optimize this function
-		 by looking forward in the buffer to see whether a
-		 second complete line is available and in this case
-		 avoid the memmove for this line.  */
-	      nread--; p++;
-	      if (nread)
-		memmove (buffer, p, nread);
-	      readpos = 0;
-	      break; /* the for loop */
             }
-	  else
-	    readpos++;
         }
     }
 
-  /* Update the gpg object.  */
-  gpg->status.bufsize = bufsize;
-  gpg->status.buffer = buffer;
-  gpg->status.readpos = readpos;
-  return 0;
+  /* Keep the incomplete line for the next read.  */
+  if (!err)
+    {
+      if (line != buffer && line != end)
+        memmove (buffer, line, end - line);
+      gpg->status.readpos = end - line;
+    }
+  return err;
 }
 
 
@@ -1378,23 +1471,21 @@ status_handler (void *opaque, int fd)
 static gpgme_error_t
 read_colon_line (engine_gpg_t gpg)
 {
-  char *p;
+  char *line, *p, *end;
   int nread;
-  size_t bufsize = gpg->colon.bufsize;
-  char *buffer = gpg->colon.buffer;
+  char *buffer;
   size_t readpos = gpg->colon.readpos;
+  gpgme_error_t err;
 
-  assert (buffer);
-  if (bufsize - readpos < 256)
-    {
-      /* Need more room for the read.  */
-      bufsize += 1024;
-      buffer = realloc (buffer, bufsize);
-      if (!buffer)
-	return gpg_error_from_syserror ();
-    }
+  assert (gpg->colon.buffer);
+  err = prepare_read_buffer (&gpg->colon.buffer, &gpg->colon.bufsize,
+                             readpos);
+  if (err)
+    return err;
+  buffer = gpg->colon.buffer;
 
-  nread = _gpgme_io_read (gpg->colon.fd[0], buffer+readpos, bufsize-readpos);
+  nread = _gpgme_io_read (gpg->colon.fd[0],
+                          buffer + readpos, gpg->colon.bufsize - readpos);
   if (nread == -1)
     return gpg_error_from_syserror ();
 
@@ -1406,74 +1497,53 @@ read_colon_line (engine_gpg_t gpg)
       return 0;
     }
 
-  while (nread > 0)
+  /* (we require that the last line is terminated by a LF) and we
+     skip empty lines.  Note: we use UTF8 encoding and escaping of
+     special characters.  We require at least one colon to cope with
+     some other printed information.  */
+  end = buffer + readpos + nread;
+  line = buffer;
+  for (p = buffer + readpos; (p = memchr (p, '\n', end - p)); line = ++p)
     {
-      for (p = buffer + readpos; nread; nread--, p++)
-	{
-	  if ( *p == '\n' )
-	    {
-	      /* (we require that the last line is terminated by a LF)
-		 and we skip empty lines.  Note: we use UTF8 encoding
-		 and escaping of special characters.  We require at
-		 least one colon to cope with some other printed
-		 information.  */
-	      *p = 0;
-	      if (*buffer && strchr (buffer, ':'))
-		{
-		  char *line = NULL;
+      *p = 0;
+      if (*line && memchr (line, ':', p - line))
+        {
+          char *pline = NULL;
 
-		  if (gpg->colon.preprocess_fnc)
-		    {
-		      gpgme_error_t err;
+          if (gpg->colon.preprocess_fnc)
+            {
+              err = gpg->colon.preprocess_fnc (line, &pline);
+              if (err)
+                return err;
+            }
 
-		      err = gpg->colon.preprocess_fnc (buffer, &line);
-		      if (err)
-			return err;
-		    }
+          assert (gpg->colon.fnc);
+          if (pline)
+            {
+              char *linep = pline;
+              char *endp;
 
-		  assert (gpg->colon.fnc);
-                  if (line)
-                    {
-                      char *linep = line;
-                      char *endp;
-
-                      do
-                        {
-                          endp = strchr (linep, '\n');
-                          if (endp)
-                            *endp++ = 0;
-                          gpg->colon.fnc (gpg->colon.fnc_value, linep);
-                          linep = endp;
-                        }
-                      while (linep && *linep);
-
-                      gpgrt_free (line);
-                    }
-                  else
-                    gpg->colon.fnc (gpg->colon.fnc_value, buffer);
+              do
+                {
+                  endp = strchr (linep, '\n');
+                  if (endp)
+                    *endp++ = 0;
+                  gpg->colon.fnc (gpg->colon.fnc_value, linep);
+                  linep = endp;
                 }
+              while (linep && *linep);
 
-	      /* To reuse the buffer for the next line we have to
-		 shift the remaining data to the buffer start and
-		 restart the loop Hmmm: We can optimize this function
-		 by looking forward in the buffer to see whether a
-		 second complete line is available and in this case
-		 avoid the memmove for this line.  */
-	      nread--; p++;
-	      if (nread)
-		memmove (buffer, p, nread);
-	      readpos = 0;
-	      break; /* The for loop.  */
+              gpgrt_free (pline);
             }
-	  else
-	    readpos++;
+          else
+            gpg->colon.fnc (gpg->colon.fnc_value, line);
         }
     }
 
-  /* Update the gpg object.  */
-  gpg->colon.bufsize = bufsize;
-  gpg->colon.buffer  = buffer;
-  gpg->colon.readpos = readpos;
+  /* Keep the incomplete line for the next read.  */
+  if (line != buffer && line != end)
+    memmove (buffer, line, end - line);
+  gpg->colon.readpos = end - line;
   return 0;
 }
 
@@ -1569,7 +1639,8 @@ start (engine_gpg_t gpg)
   fd_list[n].dup_to = -1;
 
   status = _gpgme_io_spawn (pgmname, gpg->argv,
-                            (IOSPAWN_FLAG_DETACHED |IOSPAWN_FLAG_ALLOW_SET_FG),
+                            (IOSPAWN_FLAG_DETACHED |IOSPAWN_FLAG_ALLOW_SET_FG
+                             | IOSPAWN_FLAG_CHILD_PID),
                             fd_list, NULL, NULL, &pid);
   {
     int saved_err = gpg_error_from_syserror ();
@@ -1577,6 +1648,8 @@ start (engine_gpg_t gpg)
     if (status == -1)
       return saved_err;
   }
+  gpg->pid = pid;
+  gpg->pidfd = _gpgme_io_pidfd_open (pid);
 
   /*_gpgme_register_term_handler ( closure, closure_value, pid );*/
 
@@ -1604,6 +1677,10 @@ start (engine_gpg_t gpg)
 	  gpg->cmd.fd = gpg->fd_data_map[i].fd;
 	  gpg->fd_data_map[i].fd = -1;
 	}
+      else if (gpg->fd_data_map[i].fd == -1)
+	{
+	  /* The file has been passed directly to gpg.  */
+	}
       else
 	{
 	  rc = add_io_cb (gpg, gpg->fd_data_map[i].fd,
@@ -2768,28 +2845,21 @@ gpg_keylist_preprocess (char *line, char **r_line)
   rectype = RT_NONE;
 #define NR_FIELDS 16
   char *field[NR_FIELDS];
-  int fields = 0;
+  int fields;
   size_t n;
 
   *r_line = NULL;
 
-  while (line && fields < NR_FIELDS)
+  fields = _gpgme_split_colon_fields (line, field, NR_FIELDS);
+
+  switch (_gpgme_colon_rectag (field[0]))
     {
-      field[fields++] = line;
-      line = strchr (line, ':');
-      if (line)
-	*(line++) = '\0';
+    case COLON_RECTAG ('i','n','f','o'): rectype = RT_INFO; break;
+    case COLON_RECTAG ('p','u','b',0):   rectype = RT_PUB; break;
+    case COLON_RECTAG ('u','i','d',0):   rectype = RT_UID; break;
+    default: rectype = RT_NONE; break;
     }
 
-  if (!strcmp (field[0], "info"))
-    rectype = RT_INFO;
-  else if (!strcmp (field[0], "pub"))
-    rectype = RT_PUB;
-  else if (!strcmp (field[0], "uid"))
-    rectype = RT_UID;
-  else
-    rectype = RT_NONE;
-
   switch (rectype)
     {
     case RT_INFO:
@@ -3413,6 +3483,7 @@ struct engine_ops _gpgme_engine_ops_gpg =
     gpg_io_event,
     gpg_cancel,
     NULL,		/* cancel_op */
+    gpg_kill,
     gpg_passwd,
     gpg_set_pinentry_mode,
     NULL                /* opspawn */
@@ -349,15 +349,9 @@ gpgconf_config_load_cb (void *hook, char *line)
   gpgme_conf_comp_t comp = *comp_p;
 #define NR_FIELDS 16
   char *field[NR_FIELDS];
-  int fields = 0;
+  int fields;
 
-  while (line && fields < NR_FIELDS)
-    {
-      field[fields++] = line;
-      line = strchr (line, ':');
-      if (line)
-	*(line++) = '\0';
-    }
+  fields = _gpgme_split_colon_fields (line, field, NR_FIELDS);
 
   /* We require at least the first 3 fields.  */
   if (fields < 2)
@@ -476,15 +470,9 @@ gpgconf_config_load_cb2 (void *hook, char *line)
   gpgme_conf_opt_t opt;
 #define NR_FIELDS 16
   char *field[NR_FIELDS];
-  int fields = 0;
+  int fields;
 
-  while (line && fields < NR_FIELDS)
-    {
-      field[fields++] = line;
-      line = strchr (line, ':');
-      if (line)
-	*(line++) = '\0';
-    }
+  fields = _gpgme_split_colon_fields (line, field, NR_FIELDS);
 
   /* We require at least the first 10 fields.  */
   if (fields < 10)
@@ -1047,16 +1035,10 @@ static gpg_error_t
 parse_swdb_line (char *line, gpgme_query_swdb_result_t result)
 {
   char *field[9];
-  int fields = 0;
+  int fields;
   gpg_err_code_t ec;
 
-  while (line && fields < DIM (field))
-    {
-      field[fields++] = line;
-      line = strchr (line, ':');
-      if (line)
-	*line++ = 0;
-    }
+  fields = _gpgme_split_colon_fields (line, field, DIM (field));
   /* We require that all fields exists - gpgme emits all these fields
    * even on error.  They might be empty, though. */
   if (fields < 9)
@@ -1316,6 +1298,7 @@ struct engine_ops _gpgme_engine_ops_gpgconf =
     NULL,		/* io_event */
     NULL,		/* cancel */
     NULL,               /* cancel_op */
+    NULL,               /* kill */
     NULL,               /* passwd */
     NULL,               /* set_pinentry_mode */
     NULL                /* opspawn */
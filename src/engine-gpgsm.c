@@ -749,6 +749,11 @@ gpgsm_set_fd (engine_gpgsm_t gpgsm, fd_type_t fd_type, const char *opt)
       if (_gpgme_io_pipe (fds, dir) < 0)
 	return gpg_error_from_syserror ();
 
+      /* Enlarge the pipe if a large I/O buffer was requested.  */
+      if (_gpgme_data_get_io_buffer_size (iocb_data->data))
+        _gpgme_io_set_pipe_size
+          (fds[0], _gpgme_data_get_io_buffer_size (iocb_data->data));
+
       iocb_data->fd = dir ? fds[0] : fds[1];
       iocb_data->server_fd = dir ? fds[1] : fds[0];
 
@@ -2234,6 +2239,7 @@ struct engine_ops _gpgme_engine_ops_gpgsm =
     gpgsm_io_event,
     gpgsm_cancel,
     NULL,		/* cancel_op */
+    NULL,		/* kill */
     gpgsm_passwd,
     NULL,               /* set_pinentry_mode */
     NULL                /* opspawn */
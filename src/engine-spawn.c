@@ -39,6 +39,7 @@
 #include "wait.h"
 #include "context.h"  /*temp hack until we have GpmeData methods to do I/O */
 #include "priv-io.h"
+#include "data.h"
 #include "sema.h"
 #include "debug.h"
 
@@ -74,6 +75,11 @@ struct engine_spawn
   struct fd_data_map_s *fd_data_map;
 
   struct gpgme_io_cbs io_cbs;
+
+  /* The pid of the spawned process or -1.  */
+  pid_t pid;
+  /* A descriptor for the spawned process or -1 if not supported.  */
+  int pidfd;
 };
 typedef struct engine_spawn *engine_spawn_t;
 
@@ -186,6 +192,10 @@ build_fd_data_map (engine_spawn_t esp)
           /* FIXME: Need error cleanup.  */
           return gpg_error (GPG_ERR_GENERAL);
         }
+      /* Enlarge the pipe if a large I/O buffer was requested.  */
+      if (_gpgme_data_get_io_buffer_size (a->data))
+        _gpgme_io_set_pipe_size (fds[0],
+                                 _gpgme_data_get_io_buffer_size (a->data));
 
       esp->fd_data_map[datac].inbound = a->inbound;
       if (a->inbound)
@@ -237,7 +247,7 @@ engspawn_start (engine_spawn_t esp, const char *file, const char *argv[],
   if (!esp || !file || !argv || !argv[0])
     return gpg_error (GPG_ERR_INV_VALUE);
 
-  spflags = 0;
+  spflags = IOSPAWN_FLAG_CHILD_PID;
   if ((flags & GPGME_SPAWN_DETACHED))
     spflags |= IOSPAWN_FLAG_DETACHED;
   if ((flags & GPGME_SPAWN_ALLOW_SET_FG))
@@ -279,6 +289,8 @@ engspawn_start (engine_spawn_t esp, const char *file, const char *argv[],
   free (fd_list);
   if (status == -1)
     return gpg_error_from_syserror ();
+  esp->pid = pid;
+  esp->pidfd = _gpgme_io_pidfd_open (pid);
 
   for (i = 0; esp->fd_data_map[i].data; i++)
     {
@@ -340,6 +352,8 @@ engspawn_new (void **engine, const char *file_name, const char *home_dir,
     return gpg_error_from_syserror ();
 
   esp->argtail = &esp->arglist;
+  esp->pid = (pid_t)(-1);
+  esp->pidfd = -1;
   *engine = esp;
   return 0;
 }
@@ -389,6 +403,34 @@ engspawn_io_event (void *engine, gpgme_event_io_t type, void *type_data)
 }
 
 
+/* Terminate the spawned process.  This is only done while one of its
+   pipes is open.  The process may nevertheless have exited and been
+   reaped by init, so that its pid may have been reused; the pid is
+   only used if the process can't be signaled through a pidfd.  */
+static gpgme_error_t
+engspawn_kill (void *engine)
+{
+  engine_spawn_t esp = engine;
+  int i;
+
+  if (!esp)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  if (esp->pid == (pid_t)(-1) || !esp->fd_data_map)
+    return 0;
+  for (i = 0; esp->fd_data_map[i].data; i++)
+    if (esp->fd_data_map[i].fd != -1)
+      break;
+  if (!esp->fd_data_map[i].data)
+    return 0;
+
+  if (_gpgme_io_kill (esp->pid, esp->pidfd))
+    return gpg_error_from_syserror ();
+  esp->pid = (pid_t)(-1);
+  return 0;
+}
+
+
 static gpgme_error_t
 engspawn_cancel (void *engine)
 {
@@ -402,6 +444,11 @@ engspawn_cancel (void *engine)
       free_fd_data_map (esp->fd_data_map);
       esp->fd_data_map = NULL;
     }
+  if (esp->pidfd != -1)
+    {
+      _gpgme_io_close (esp->pidfd);
+      esp->pidfd = -1;
+    }
 
   return 0;
 }
@@ -478,6 +525,7 @@ struct engine_ops _gpgme_engine_ops_spawn =
     engspawn_io_event,	/* io_event */
     engspawn_cancel,	/* cancel */
     NULL,               /* cancel_op */
+    engspawn_kill,	/* kill */
     NULL,               /* passwd */
     NULL,               /* set_pinentry_mode */
     engspawn_op_spawn   /* opspawn */
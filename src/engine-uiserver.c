@@ -1449,6 +1449,7 @@ struct engine_ops _gpgme_engine_ops_uiserver =
     uiserver_io_event,
     uiserver_cancel,
     NULL,		/* cancel_op */
+    NULL,		/* kill */
     NULL,               /* passwd */
     NULL,               /* set_pinentry_mode */
     NULL                /* opspawn */
@@ -1069,6 +1069,21 @@ _gpgme_engine_cancel (engine_t engine)
 }
 
 
+/* Terminate the backend process of the pending operation.  This is
+   used to end an operation which ran into its deadline.  */
+gpgme_error_t
+_gpgme_engine_kill (engine_t engine)
+{
+  if (!engine)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  if (!engine->ops->kill)
+    return gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+
+  return (*engine->ops->kill) (engine->engine);
+}
+
+
 /* Cancel the pending operation, but not the complete session.  */
 gpgme_error_t
 _gpgme_engine_cancel_op (engine_t engine)
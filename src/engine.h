@@ -198,6 +198,8 @@ gpgme_error_t _gpgme_engine_cancel (engine_t engine);
 
 gpgme_error_t _gpgme_engine_cancel_op (engine_t engine);
 
+gpgme_error_t _gpgme_engine_kill (engine_t engine);
+
 gpgme_error_t _gpgme_engine_op_passwd (engine_t engine, gpgme_key_t key,
                                        unsigned int flags);
 
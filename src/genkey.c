@@ -248,6 +248,7 @@ genkey_start (gpgme_ctx_t ctx, int synchronous, const char *parms,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   err = _gpgme_op_data_lookup (ctx, OPDATA_GENKEY, &hook,
 			       sizeof (*opd), release_op_data);
@@ -335,6 +336,7 @@ createkey_start (gpgme_ctx_t ctx, int synchronous,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   if (reserved || anchorkey || !userid)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -423,6 +425,7 @@ createsubkey_start (gpgme_ctx_t ctx, int synchronous,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   if (reserved || !key)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -510,6 +513,7 @@ addrevuid_start (gpgme_ctx_t ctx, int synchronous, int extraflags,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   err = _gpgme_op_data_lookup (ctx, OPDATA_GENKEY, &hook,
 			       sizeof (*opd), release_op_data);
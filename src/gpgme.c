@@ -28,6 +28,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
 #endif
@@ -50,9 +51,33 @@ static char *def_lc_messages;
 
 gpgme_error_t _gpgme_selftest = GPG_ERR_NOT_OPERATIONAL;
 
-/* Protects all reference counters in result structures.  All other
-   accesses to a result structure are read only.  */
-DEFINE_STATIC_LOCK (result_ref_lock);
+#ifndef HAVE_ATOMIC_BUILTINS
+/* Protects all reference counters of keys, trust items and result
+   structures if the atomic builtins are not available.  All other
+   accesses to these objects are read only.  */
+DEFINE_STATIC_LOCK (ref_lock);
+
+
+void
+_gpgme_ref_inc (unsigned int *counter)
+{
+  LOCK (ref_lock);
+  ++*counter;
+  UNLOCK (ref_lock);
+}
+
+
+unsigned int
+_gpgme_ref_dec (unsigned int *counter)
+{
+  unsigned int value;
+
+  LOCK (ref_lock);
+  value = --*counter;
+  UNLOCK (ref_lock);
+  return value;
+}
+#endif /*!HAVE_ATOMIC_BUILTINS*/
 
 
 /* Set the global flag NAME to VALUE.  Return 0 on success.  Note that
@@ -81,6 +106,14 @@ gpgme_set_global_flag (const char *name, const char *value)
     return _gpgme_set_default_gpg_name (value);
   else if (!strcmp (name, "w32-inst-dir"))
     return _gpgme_set_override_inst_dir (value);
+  else if (!strcmp (name, "io-backend"))
+    return _gpgme_io_pollset_set_backend (value);
+  else if (!strcmp (name, "key-cache-size"))
+    return _gpgme_keycache_set_size (value);
+#ifndef HAVE_W32_SYSTEM
+  else if (!strcmp (name, "io-spawn"))
+    return _gpgme_io_set_spawn_method (value);
+#endif
   else
     return -1;
 }
@@ -118,6 +151,7 @@ gpgme_new (gpgme_ctx_t *r_ctx)
     }
 
   ctx->keylist_mode = GPGME_KEYLIST_MODE_LOCAL;
+  ctx->keylist_fields = KEYLIST_FIELD_ALL;
   ctx->include_certs = GPGME_INCLUDE_CERTS_DEFAULT;
   ctx->protocol = GPGME_PROTOCOL_OpenPGP;
   ctx->sub_protocol = GPGME_PROTOCOL_DEFAULT;
@@ -226,6 +260,9 @@ gpgme_cancel_async (gpgme_ctx_t ctx)
   ctx->canceled = 1;
   UNLOCK (ctx->lock);
 
+  /* Don't wait for the engine to make the event loop notice this.  */
+  _gpgme_fd_table_wakeup (&ctx->fdt);
+
   return TRACE_ERR (0);
 }
 
@@ -253,6 +290,7 @@ gpgme_release (gpgme_ctx_t ctx)
   free (ctx->request_origin);
   free (ctx->auto_key_locate);
   free (ctx->trust_model);
+  free (ctx->keylist_fields_str);
   _gpgme_engine_info_release (ctx->engine_info);
   ctx->engine_info = NULL;
   DESTROY_LOCK (ctx->lock);
@@ -272,9 +310,7 @@ gpgme_result_ref (void *result)
 
   assert (data->magic == CTX_OP_DATA_MAGIC);
 
-  LOCK (result_ref_lock);
-  data->references++;
-  UNLOCK (result_ref_lock);
+  REF_INC (data->references);
 }
 
 
@@ -290,13 +326,9 @@ gpgme_result_unref (void *result)
 
   assert (data->magic == CTX_OP_DATA_MAGIC);
 
-  LOCK (result_ref_lock);
-  if (--data->references)
-    {
-      UNLOCK (result_ref_lock);
-      return;
-    }
-  UNLOCK (result_ref_lock);
+  assert (data->references > 0);
+  if (REF_DEC (data->references))
+    return;
 
   if (data->cleanup)
     (*data->cleanup) (data->hook);
@@ -491,6 +523,22 @@ gpgme_get_armor (gpgme_ctx_t ctx)
 }
 
 
+/* Parse the decimal number VALUE into R_NUMBER.  */
+static gpgme_error_t
+parse_uint (const char *value, unsigned int *r_number)
+{
+  unsigned long n;
+  char *endp;
+
+  errno = 0;
+  n = strtoul (value, &endp, 10);
+  if (!*value || *endp || *value == '-' || errno || n > UINT_MAX)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  *r_number = n;
+  return 0;
+}
+
+
 /* Set the flag NAME for CTX to VALUE.  Please consult the manual for
  * a description of the flags.
  */
@@ -564,6 +612,51 @@ gpgme_set_ctx_flag (gpgme_ctx_t ctx, const char *name, const char *value)
       if (!ctx->trust_model)
         err = gpg_error_from_syserror ();
     }
+  else if (!strcmp (name, "timeout-ms"))
+    {
+      err = parse_uint (value, &ctx->timeout_ms);
+    }
+  else if (!strcmp (name, "keylist-queue-depth"))
+    {
+      err = parse_uint (value, &ctx->keylist_queue_depth);
+    }
+  else if (!strcmp (name, "key-cache"))
+    {
+      ctx->key_cache = abool;
+    }
+  else if (!strcmp (name, "keylist-shards"))
+    {
+      unsigned int n;
+
+      err = parse_uint (value, &n);
+      if (!err && n > 256)
+        err = gpg_error (GPG_ERR_INV_VALUE);
+      if (!err)
+        ctx->keylist_shards = n;
+    }
+  else if (!strcmp (name, "keylist-shards-ordered"))
+    {
+      ctx->keylist_shards_ordered = abool;
+    }
+  else if (!strcmp (name, "keylist-keybox"))
+    {
+      ctx->keylist_keybox = abool;
+    }
+  else if (!strcmp (name, "keylist-fields"))
+    {
+      unsigned int fields;
+
+      err = _gpgme_keylist_parse_fields (value, &fields);
+      if (!err)
+        {
+          free (ctx->keylist_fields_str);
+          ctx->keylist_fields_str = strdup (value);
+          if (!ctx->keylist_fields_str)
+            err = gpg_error_from_syserror ();
+          else
+            ctx->keylist_fields = fields;
+        }
+    }
   else
     err = gpg_error (GPG_ERR_UNKNOWN_NAME);
 
@@ -621,6 +714,52 @@ gpgme_get_ctx_flag (gpgme_ctx_t ctx, const char *name)
     {
       return ctx->auto_key_locate? ctx->auto_key_locate : "";
     }
+  else if (!strcmp (name, "timeout-ms"))
+    {
+      snprintf (ctx->number_str, sizeof ctx->number_str, "%u",
+                ctx->timeout_ms);
+      return ctx->number_str;
+    }
+  else if (!strcmp (name, "keylist-queue-depth"))
+    {
+      snprintf (ctx->number_str, sizeof ctx->number_str, "%u",
+                ctx->keylist_queue_depth);
+      return ctx->number_str;
+    }
+  else if (!strcmp (name, "key-cache"))
+    {
+      return ctx->key_cache? "1":"";
+    }
+  else if (!strcmp (name, "keylist-shards"))
+    {
+      snprintf (ctx->number_str, sizeof ctx->number_str, "%u",
+                ctx->keylist_shards);
+      return ctx->number_str;
+    }
+  else if (!strcmp (name, "keylist-shards-ordered"))
+    {
+      return ctx->keylist_shards_ordered? "1":"";
+    }
+  else if (!strcmp (name, "keylist-keybox"))
+    {
+      return ctx->keylist_keybox? "1":"";
+    }
+  else if (!strcmp (name, "keylist-fields"))
+    {
+      return ctx->keylist_fields_str? ctx->keylist_fields_str : "";
+    }
+  else if (!strcmp (name, "key-cache-hits"))
+    {
+      snprintf (ctx->number_str, sizeof ctx->number_str, "%lu",
+                ctx->key_cache_hits);
+      return ctx->number_str;
+    }
+  else if (!strcmp (name, "key-cache-misses"))
+    {
+      snprintf (ctx->number_str, sizeof ctx->number_str, "%lu",
+                ctx->key_cache_misses);
+      return ctx->number_str;
+    }
   else
     return NULL;
 }
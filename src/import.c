@@ -269,6 +269,7 @@ _gpgme_op_import_start (gpgme_ctx_t ctx, int synchronous, gpgme_data_t keydata)
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   err = _gpgme_op_data_lookup (ctx, OPDATA_IMPORT, &hook,
 			       sizeof (*opd), release_op_data);
@@ -334,6 +335,7 @@ _gpgme_op_import_keys_start (gpgme_ctx_t ctx, int synchronous,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   err = _gpgme_op_data_lookup (ctx, OPDATA_IMPORT, &hook,
 			       sizeof (*opd), release_op_data);
@@ -35,23 +35,127 @@
 
 
 
-/* Protects all reference counters in keys.  All other accesses to a
-   key are read only.  */
-DEFINE_STATIC_LOCK (key_ref_lock);
+/* The subkeys, user IDs, signatures and most strings of a key are
+   allocated from chunks owned by the key, so that building a key
+   takes only a few calls to malloc and releasing it only a few calls
+   to free.  The size of the first chunk, which is allocated together
+   with the key, fits a key with a few subkeys and user IDs.  Further
+   chunks double in size up to KEY_CHUNK_MAX.  */
+#define KEY_CHUNK_FIRST 1024
+#define KEY_CHUNK_MAX   65536
+
+/* The alignment of the allocations from a chunk.  */
+#define KEY_ALIGN (2 * sizeof (void *))
+#define KEY_ALIGN_UP(n) (((n) + KEY_ALIGN - 1) & ~(KEY_ALIGN - 1))
+
+typedef struct key_chunk_s *key_chunk_t;
+struct key_chunk_s
+{
+  key_chunk_t next;
+  size_t size;
+  size_t used;
+  /* The data follows at offset KEY_ALIGN_UP (sizeof (struct
+     key_chunk_s)).  */
+};
+#define KEY_CHUNK_DATA(c) ((char *) (c) + KEY_ALIGN_UP (sizeof *(c)))
+
+/* A key as allocated by _gpgme_key_new.  */
+struct key_block_s
+{
+  /* This must be the first member.  */
+  struct _gpgme_key key;
+
+  /* The chunk allocations are taken from, followed by the older
+     ones.  */
+  key_chunk_t chunks;
+};
+
+
+/* Return a zeroed block of SIZE bytes owned by KEY.  It is released
+   with the key.  */
+void *
+_gpgme_key_alloc (gpgme_key_t key, size_t size)
+{
+  struct key_block_s *block = (struct key_block_s *) key;
+  key_chunk_t chunk = block->chunks;
+  char *p;
+
+  size = KEY_ALIGN_UP (size);
+  if (chunk->size - chunk->used < size)
+    {
+      size_t chunksize = chunk->size < KEY_CHUNK_MAX / 2
+                         ? 2 * chunk->size : KEY_CHUNK_MAX;
+
+      if (chunksize < size)
+        chunksize = size;
+      chunk = malloc (KEY_ALIGN_UP (sizeof *chunk) + chunksize);
+      if (!chunk)
+        return NULL;
+      chunk->size = chunksize;
+      chunk->used = 0;
+      chunk->next = block->chunks;
+      block->chunks = chunk;
+    }
+
+  p = KEY_CHUNK_DATA (chunk) + chunk->used;
+  chunk->used += size;
+  memset (p, 0, size);
+  return p;
+}
+
+
+/* Return a copy of STRING owned by KEY.  */
+char *
+_gpgme_key_strdup (gpgme_key_t key, const char *string)
+{
+  size_t n = strlen (string) + 1;
+  char *p;
+
+  p = _gpgme_key_alloc (key, n);
+  if (p)
+    memcpy (p, string, n);
+  return p;
+}
+
+
+/* Release P if it has not been allocated with _gpgme_key_alloc.  Some
+   members of a key are allocated with malloc by other modules.  */
+static void
+key_free (gpgme_key_t key, void *p)
+{
+  key_chunk_t chunk;
+
+  if (!p)
+    return;
+  for (chunk = ((struct key_block_s *) key)->chunks; chunk;
+       chunk = chunk->next)
+    if ((char *) p >= KEY_CHUNK_DATA (chunk)
+        && (char *) p < KEY_CHUNK_DATA (chunk) + chunk->size)
+      return;
+  free (p);
+}
 
 
 /* Create a new key.  */
 gpgme_error_t
 _gpgme_key_new (gpgme_key_t *r_key)
 {
-  gpgme_key_t key;
+  struct key_block_s *block;
+  key_chunk_t chunk;
+  size_t blocksize = KEY_ALIGN_UP (sizeof *block);
 
-  key = calloc (1, sizeof *key);
-  if (!key)
+  block = malloc (blocksize + KEY_ALIGN_UP (sizeof *chunk) + KEY_CHUNK_FIRST);
+  if (!block)
     return gpg_error_from_syserror ();
-  key->_refs = 1;
-
-  *r_key = key;
+  memset (block, 0, sizeof *block);
+  chunk = (key_chunk_t) ((char *) block + blocksize);
+  chunk->next = NULL;
+  chunk->size = KEY_CHUNK_FIRST;
+  chunk->used = 0;
+  block->chunks = chunk;
+  block->key._refs = 1;
+
+  *r_key = &block->key;
   return 0;
 }
 
@@ -61,7 +165,7 @@ _gpgme_key_add_subkey (gpgme_key_t key, gpgme_subkey_t *r_subkey)
 {
   gpgme_subkey_t subkey;
 
-  subkey = calloc (1, sizeof *subkey);
+  subkey = _gpgme_key_alloc (key, sizeof *subkey);
   if (!subkey)
     return gpg_error_from_syserror ();
   subkey->keyid = subkey->_keyid;
@@ -215,10 +319,9 @@ _gpgme_key_append_name (gpgme_key_t key, const char *src, int convert)
   /* We can malloc a buffer of the same length, because the converted
      string will never be larger. Actually we allocate it twice the
      size, so that we are able to store the parsed stuff there too.  */
-  uid = malloc (sizeof (*uid) + 2 * src_len + 3);
+  uid = _gpgme_key_alloc (key, sizeof (*uid) + 2 * src_len + 3);
   if (!uid)
     return gpg_error_from_syserror ();
-  memset (uid, 0, sizeof *uid);
 
   uid->uid = ((char *) uid) + sizeof (*uid);
   dst = uid->uid;
@@ -270,10 +373,9 @@ _gpgme_key_add_sig (gpgme_key_t key, char *src)
   /* We can malloc a buffer of the same length, because the converted
      string will never be larger.  Actually we allocate it twice the
      size, so that we are able to store the parsed stuff there too.  */
-  sig = malloc (sizeof (*sig) + 2 * src_len + 3);
+  sig = _gpgme_key_alloc (key, sizeof (*sig) + 2 * src_len + 3);
   if (!sig)
     return NULL;
-  memset (sig, 0, sizeof *sig);
 
   sig->keyid = sig->_keyid;
   sig->_keyid[16] = '\0';
@@ -308,9 +410,7 @@ _gpgme_key_add_sig (gpgme_key_t key, char *src)
 void
 gpgme_key_ref (gpgme_key_t key)
 {
-  LOCK (key_ref_lock);
-  key->_refs++;
-  UNLOCK (key_ref_lock);
+  REF_INC (key->_refs);
 }
 
 
@@ -328,37 +428,28 @@ gpgme_key_unref (gpgme_key_t key)
   if (!key)
     return;
 
-  LOCK (key_ref_lock);
   assert (key->_refs > 0);
-  if (--key->_refs)
-    {
-      UNLOCK (key_ref_lock);
-      return;
-    }
-  UNLOCK (key_ref_lock);
+  if (REF_DEC (key->_refs))
+    return;
 
-  subkey = key->subkeys;
-  while (subkey)
+  /* The subkeys, user IDs and signatures are owned by the key; only
+     the members which may have been allocated elsewhere need to be
+     released one by one.  */
+  for (subkey = key->subkeys; subkey; subkey = subkey->next)
     {
-      gpgme_subkey_t next = subkey->next;
-      free (subkey->fpr);
-      free (subkey->curve);
-      free (subkey->keygrip);
-      free (subkey->card_number);
-      free (subkey);
-      subkey = next;
+      key_free (key, subkey->fpr);
+      key_free (key, subkey->curve);
+      key_free (key, subkey->keygrip);
+      key_free (key, subkey->card_number);
     }
 
-  uid = key->uids;
-  while (uid)
+  for (uid = key->uids; uid; uid = uid->next)
     {
-      gpgme_user_id_t next_uid = uid->next;
-      gpgme_key_sig_t keysig = uid->signatures;
+      gpgme_key_sig_t keysig;
       gpgme_tofu_info_t tofu = uid->tofu;
 
-      while (keysig)
+      for (keysig = uid->signatures; keysig; keysig = keysig->next)
 	{
-	  gpgme_key_sig_t next_keysig = keysig->next;
 	  gpgme_sig_notation_t notation = keysig->notations;
 
 	  while (notation)
@@ -368,9 +459,6 @@ gpgme_key_unref (gpgme_key_t key)
 	      _gpgme_sig_notation_free (notation);
 	      notation = next_notation;
 	    }
-
-          free (keysig);
-	  keysig = next_keysig;
         }
 
       while (tofu)
@@ -379,21 +467,31 @@ gpgme_key_unref (gpgme_key_t key)
            * for it.  */
           gpgme_tofu_info_t tofu_next = tofu->next;
 
-          free (tofu->description);
-          free (tofu);
+          key_free (key, tofu->description);
+          key_free (key, tofu);
           tofu = tofu_next;
         }
 
-      free (uid->address);
-      free (uid);
-      uid = next_uid;
+      key_free (key, uid->address);
     }
 
-  free (key->issuer_serial);
-  free (key->issuer_name);
-  free (key->chain_id);
-  free (key->fpr);
+  key_free (key, key->issuer_serial);
+  key_free (key, key->issuer_name);
+  key_free (key, key->chain_id);
+  key_free (key, key->fpr);
+
+  /* Release the chunks; the oldest one is part of the key block.  */
+  {
+    key_chunk_t chunk = ((struct key_block_s *) key)->chunks;
+
+    while (chunk->next)
+      {
+        key_chunk_t next = chunk->next;
 
+        free (chunk);
+        chunk = next;
+      }
+  }
   free (key);
 }
 
@@ -0,0 +1,1462 @@
+/* keybox.c - Read-only access to the public keybox of gpg.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "gpgme.h"
+#include "util.h"
+#include "context.h"
+#include "ops.h"
+#include "debug.h"
+
+
+/* This module lists the public keys stored in the keybox file
+   "pubring.kbx" of gpg without running gpg.  A key is built from the
+   packets of its keyblock the same way gpg builds the key for its
+   --with-colons listing, except that the trust database is not used:
+   the validity of the user IDs and the owner trust are always
+   unknown and the disabled flag is never set.  The self-signatures
+   are not verified again; gpg does not store invalid self-signatures
+   when it imports a key.  Keys with parts not handled here, for
+   example v3 or v5 keys, unknown algorithms, revocations by a
+   designated revoker or user IDs without a self-signature, are
+   reported with GPG_ERR_NOT_SUPPORTED so that the caller can list
+   them with gpg.  The fingerprint for that is taken from the blob;
+   thus a keybox with OpenPGP blobs in a format not known here, for
+   example the blobs written for v5 keys, is not used at all.  */
+
+/* The kinds of patterns, a subset of those understood by gpg.  */
+typedef enum
+  {
+    KBX_MATCH_SUBSTR,     /* A substring of a user ID.  */
+    KBX_MATCH_EXACT,      /* "=" - A complete user ID.  */
+    KBX_MATCH_MAIL,       /* "<" - A complete mail address.  */
+    KBX_MATCH_MAILSUB,    /* "@" - A substring of a mail address.  */
+    KBX_MATCH_KEYID       /* A key ID or fingerprint.  */
+  } kbx_match_t;
+
+struct kbx_pattern_s
+{
+  kbx_match_t mode;
+
+  /* The trailing bytes of a fingerprint for KBX_MATCH_KEYID.  */
+  unsigned char fpr[20];
+  size_t fprlen;
+
+  /* The string for the other modes.  */
+  char *name;
+  size_t namelen;
+};
+
+struct _gpgme_keybox
+{
+  /* The content of the keybox file.  */
+  unsigned char *image;
+  size_t imagelen;
+
+  /* The offset of the next blob.  */
+  size_t pos;
+
+  /* True if ephemeral keys are listed too.  */
+  int ephemeral;
+
+  /* The time used to decide whether keys have expired.  */
+  unsigned long now;
+
+  /* The patterns; all keys are listed if there are none.  */
+  struct kbx_pattern_s *patterns;
+  unsigned int npatterns;
+  unsigned int patterns_size;
+};
+
+
+/* A blob of the keybox with the parts needed here.  */
+struct kbx_blob_s
+{
+  const unsigned char *image;
+  size_t len;
+  unsigned int flags;
+  const unsigned char *keyblock;
+  size_t keyblocklen;
+  unsigned int nkeys;
+  const unsigned char *keyinfo;
+  size_t keyinfolen;
+  unsigned int nuids;
+  const unsigned char *uidinfo;
+  size_t uidinfolen;
+};
+
+#define KBX_BLOBTYPE_HEADER  1
+#define KBX_BLOBTYPE_PGP     2
+#define KBX_BLOBFLAG_EPHEMERAL 2
+
+
+/* The usage of a key as found in the key flags of a self-signature.
+   USAGE_UNKNOWN marks flags not known here and USAGE_NONE key flags
+   which do not give any usage.  */
+#define USAGE_SIG      1
+#define USAGE_ENC      2
+#define USAGE_CERT     4
+#define USAGE_AUTH     8
+#define USAGE_UNKNOWN  16
+#define USAGE_NONE     32
+
+/* A signature packet with the parts needed here.  */
+struct kbx_sig_s
+{
+  int sigclass;
+  unsigned char keyid[8];
+  int have_keyid;
+  unsigned long created;
+  unsigned long lifetime;     /* Zero or the lifetime in seconds.  */
+  unsigned long key_expire;   /* Zero or the key lifetime in seconds.  */
+  unsigned int usage;         /* USAGE_* bits or 0 w/o key flags.  */
+  int primary_uid;
+};
+
+/* The state of the primary key or a subkey while parsing a
+   keyblock.  */
+struct kbx_pk_s
+{
+  const unsigned char *fpr;
+  unsigned long created;
+  int algo;
+  unsigned int nbits;
+  const char *curve;
+  int de_vs;
+
+  /* The chosen binding signature, or for the primary key the direct
+     key signature.  */
+  int have_sig;
+  unsigned long sigdate;
+  unsigned int sig_usage;
+  unsigned long sig_key_expire;
+
+  int revoked;
+  unsigned int usage;
+  unsigned long expires;
+  int expired;
+};
+
+/* The state of a user ID while parsing a keyblock.  */
+struct kbx_uid_s
+{
+  const unsigned char *name;
+  size_t namelen;
+
+  /* The chosen self-signature.  */
+  int have_sig;
+  unsigned long sigdate;
+  int sig_revocation;
+  int sig_expired;
+  unsigned int sig_usage;
+  unsigned long sig_key_expire;
+  int sig_primary;
+
+  /* The values derived from the self-signature like gpg does.  A
+     zero CREATED marks a revoked or expired user ID.  */
+  int revoked;
+  unsigned long created;
+  int primary;
+};
+
+
+/* The ECC curves with their OID, the name printed by gpg and the key
+   length.  */
+static struct
+{
+  const char *oid;
+  size_t oidlen;
+  const char *name;
+  unsigned int nbits;
+} kbx_curves[] =
+  {
+    { "\x2b\x06\x01\x04\x01\x97\x55\x01\x05\x01", 10, "cv25519", 255 },
+    { "\x2b\x06\x01\x04\x01\xda\x47\x0f\x01", 9, "ed25519", 255 },
+    { "\x2a\x86\x48\xce\x3d\x03\x01\x07", 8, "nistp256", 256 },
+    { "\x2b\x81\x04\x00\x22", 5, "nistp384", 384 },
+    { "\x2b\x81\x04\x00\x23", 5, "nistp521", 521 },
+    { "\x2b\x24\x03\x03\x02\x08\x01\x01\x07", 9, "brainpoolP256r1", 256 },
+    { "\x2b\x24\x03\x03\x02\x08\x01\x01\x0b", 9, "brainpoolP384r1", 384 },
+    { "\x2b\x24\x03\x03\x02\x08\x01\x01\x0d", 9, "brainpoolP512r1", 512 },
+    { "\x2b\x81\x04\x00\x0a", 5, "secp256k1", 256 }
+  };
+
+
+
+static unsigned long
+buf32 (const unsigned char *p)
+{
+  return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+static unsigned int
+buf16 (const unsigned char *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+
+static int
+ascii_tolower (int c)
+{
+  return (c >= 'A' && c <= 'Z')? c + 'a' - 'A' : c;
+}
+
+
+/* Case insensitive ASCII variant of memmem.  */
+static int
+ascii_memcasemem (const unsigned char *buf, size_t buflen,
+                  const char *s, size_t n)
+{
+  size_t i, j;
+
+  if (!n)
+    return 1;
+  for (i = 0; i + n <= buflen; i++)
+    {
+      for (j = 0; j < n; j++)
+        if (ascii_tolower (buf[i + j]) != ascii_tolower ((unsigned char)s[j]))
+          break;
+      if (j == n)
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Return the home directory used by CTX.  */
+static const char *
+get_homedir (gpgme_ctx_t ctx)
+{
+  gpgme_engine_info_t info;
+  const char *homedir;
+
+  for (info = ctx->engine_info; info; info = info->next)
+    if (info->protocol == ctx->protocol)
+      break;
+  homedir = info? info->home_dir : NULL;
+  if (!homedir)
+    homedir = _gpgme_get_default_homedir ();
+  return homedir;
+}
+
+
+/* Return true if the gpg.conf in HOMEDIR has an option which
+   changes the keys gpg lists or the way it lists them.  */
+static int
+conf_has_listing_options (const char *homedir)
+{
+  static const char *options[] =
+    {
+      "keyring", "primary-keyring", "no-default-keyring", "use-keyboxd",
+      "with-keygrip", "with-secret", "with-sig-list", "with-sig-check",
+      "list-options", "faked-system-time", "fast-list-mode",
+      "no-expensive-trust-checks", "with-tofu-info", "ignore-time-conflict"
+    };
+  char *fname;
+  FILE *fp;
+  char line[256];
+  char *p;
+  size_t n;
+  int i, found = 0;
+
+  fname = _gpgme_strconcat (homedir, "/gpg.conf", NULL);
+  if (!fname)
+    return 1;
+  fp = fopen (fname, "r");
+  free (fname);
+  if (!fp)
+    return errno != ENOENT;
+
+  while (!found && fgets (line, sizeof line, fp))
+    {
+      for (p = line; *p == ' ' || *p == '\t'; p++)
+        ;
+      n = strcspn (p, " \t\r\n=");
+      for (i = 0; i < DIM (options); i++)
+        if (n == strlen (options[i]) && !strncmp (p, options[i], n))
+          {
+            found = 1;
+            break;
+          }
+    }
+  fclose (fp);
+  return found;
+}
+
+
+/* Forward declaration.  */
+static int next_blob (struct _gpgme_keybox *kbx, struct kbx_blob_s *blob);
+
+
+/* Read the keybox file of the home directory of CTX for listing
+   keys.  Ephemeral keys are listed only if EPHEMERAL is true.
+   Returns GPG_ERR_NOT_SUPPORTED if gpg uses something else or
+   options which are not implemented here.  */
+gpgme_error_t
+_gpgme_keybox_open (gpgme_ctx_t ctx, int ephemeral,
+                    struct _gpgme_keybox **r_kbx)
+{
+  struct _gpgme_keybox *kbx;
+  struct kbx_blob_s blob;
+  const char *homedir;
+  char *fname;
+  struct stat st;
+  FILE *fp;
+  int rc;
+
+  *r_kbx = NULL;
+
+  homedir = get_homedir (ctx);
+  if (!homedir)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  /* Keys stored by keyboxd are not supported.  */
+  fname = _gpgme_strconcat (homedir, "/public-keys.d", NULL);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  rc = stat (fname, &st);
+  free (fname);
+  if (!rc || conf_has_listing_options (homedir))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  kbx = calloc (1, sizeof *kbx);
+  if (!kbx)
+    return gpg_error_from_syserror ();
+  kbx->ephemeral = ephemeral;
+  kbx->now = (unsigned long)time (NULL);
+
+  fname = _gpgme_strconcat (homedir, "/pubring.kbx", NULL);
+  if (!fname)
+    {
+      free (kbx);
+      return gpg_error_from_syserror ();
+    }
+  fp = fopen (fname, "rb");
+  free (fname);
+  if (!fp || fstat (fileno (fp), &st))
+    {
+      /* Without a keybox gpg uses a keyring or creates the keybox.  */
+      if (fp)
+        fclose (fp);
+      free (kbx);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  kbx->imagelen = st.st_size;
+  kbx->image = malloc (kbx->imagelen + 1);
+  if (!kbx->image)
+    {
+      fclose (fp);
+      free (kbx);
+      return gpg_error_from_syserror ();
+    }
+  /* gpg may append a blob while we read; the blob checks below stop
+     at a truncated last blob.  */
+  kbx->imagelen = fread (kbx->image, 1, kbx->imagelen, fp);
+  fclose (fp);
+
+  /* The file starts with the header blob.  */
+  if (kbx->imagelen < 32
+      || buf32 (kbx->image) < 32 || buf32 (kbx->image) > kbx->imagelen
+      || kbx->image[4] != KBX_BLOBTYPE_HEADER || kbx->image[5] != 1
+      || memcmp (kbx->image + 8, "KBXf", 4))
+    {
+      _gpgme_keybox_release (kbx);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  kbx->pos = buf32 (kbx->image);
+
+  /* Keys in blobs which can't be parsed here could neither be
+     matched against the patterns nor be listed with gpg one by one;
+     use gpg for the entire listing then.  */
+  while ((rc = next_blob (kbx, &blob)) != -1)
+    if (rc == 2)
+      {
+        TRACE (DEBUG_CTX, "_gpgme_keybox_open", ctx,
+               "unknown blob ending at offset %zu", kbx->pos);
+        _gpgme_keybox_release (kbx);
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      }
+  kbx->pos = buf32 (kbx->image);
+
+  *r_kbx = kbx;
+  return 0;
+}
+
+
+void
+_gpgme_keybox_release (struct _gpgme_keybox *kbx)
+{
+  unsigned int i;
+
+  if (!kbx)
+    return;
+  for (i = 0; i < kbx->npatterns; i++)
+    free (kbx->patterns[i].name);
+  free (kbx->patterns);
+  free (kbx->image);
+  free (kbx);
+}
+
+
+/* Add PATTERN to the patterns of KBX.  Returns GPG_ERR_NOT_SUPPORTED
+   for patterns which are not implemented here.  */
+gpgme_error_t
+_gpgme_keybox_add_pattern (struct _gpgme_keybox *kbx, const char *pattern)
+{
+  struct kbx_pattern_s *pat;
+  const char *s = pattern;
+  size_t n;
+  int hexprefix = 0;
+  int i;
+
+  if (kbx->npatterns == kbx->patterns_size)
+    {
+      unsigned int size = kbx->patterns_size? 2 * kbx->patterns_size : 8;
+      struct kbx_pattern_s *p;
+
+      p = realloc (kbx->patterns, size * sizeof *p);
+      if (!p)
+        return gpg_error_from_syserror ();
+      kbx->patterns = p;
+      kbx->patterns_size = size;
+    }
+  pat = kbx->patterns + kbx->npatterns;
+  memset (pat, 0, sizeof *pat);
+
+  /* Classify the pattern like gpg does.  */
+  while (*s == ' ' || *s == '\t')
+    s++;
+  switch (*s)
+    {
+    case 0:
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+    case '=':
+      pat->mode = KBX_MATCH_EXACT;
+      s++;
+      break;
+
+    case '<':
+      pat->mode = KBX_MATCH_MAIL;
+      s++;
+      break;
+
+    case '@':
+      pat->mode = KBX_MATCH_MAILSUB;
+      s++;
+      break;
+
+    case '*':
+      pat->mode = KBX_MATCH_SUBSTR;
+      s++;
+      break;
+
+    case '.': case '+': case '#': case '&': case '^': case '/': case '>':
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+    default:
+      if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+        {
+          hexprefix = 1;
+          s += 2;
+        }
+      n = strspn (s, "0123456789abcdefABCDEF");
+      if (!s[n] && (n == 8 || n == 16 || n == 40))
+        {
+          pat->mode = KBX_MATCH_KEYID;
+          pat->fprlen = n / 2;
+          for (i = 0; i < pat->fprlen; i++)
+            pat->fpr[i] = _gpgme_hextobyte (s + 2 * i);
+        }
+      else if (hexprefix || strspn (s, "0123456789abcdefABCDEF ") == strlen (s)
+               || s[n] == '!')
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      else
+        pat->mode = KBX_MATCH_SUBSTR;
+      break;
+    }
+
+  if (pat->mode != KBX_MATCH_KEYID)
+    {
+      /* gpg ignores the angle brackets around a mail address.  */
+      if (pat->mode == KBX_MATCH_MAILSUB && *s == '<')
+        s++;
+      n = strlen (s);
+      if ((pat->mode == KBX_MATCH_MAIL || pat->mode == KBX_MATCH_MAILSUB)
+          && n && s[n - 1] == '>')
+        n--;
+      pat->name = malloc (n + 1);
+      if (!pat->name)
+        return gpg_error_from_syserror ();
+      memcpy (pat->name, s, n);
+      pat->name[n] = 0;
+      pat->namelen = n;
+    }
+  kbx->npatterns++;
+  return 0;
+}
+
+
+/* Parse the blob at the current position of KBX into BLOB and
+   advance the position.  Returns 0, -1 at the end of the keybox, 1
+   if the blob is not an OpenPGP blob, or 2 if it is an OpenPGP blob
+   which can't be parsed here.  */
+static int
+next_blob (struct _gpgme_keybox *kbx, struct kbx_blob_s *blob)
+{
+  const unsigned char *p;
+  size_t len, off, uoff, ulen;
+  unsigned int i;
+
+  if (kbx->imagelen - kbx->pos < 5)
+    return -1;
+  p = kbx->image + kbx->pos;
+  len = buf32 (p);
+  if (len < 5 || len > kbx->imagelen - kbx->pos)
+    return -1;
+  kbx->pos += len;
+  if (p[4] != KBX_BLOBTYPE_PGP)
+    return 1;
+  /* Version 1 blobs have only keys with a 20 byte fingerprint.  */
+  if (len < 20 || p[5] != 1)
+    return 2;
+
+  memset (blob, 0, sizeof *blob);
+  blob->image = p;
+  blob->len = len;
+  blob->flags = buf16 (p + 6);
+  off = buf32 (p + 8);
+  blob->keyblocklen = buf32 (p + 12);
+  if (off > len || blob->keyblocklen > len - off)
+    return 2;
+  blob->keyblock = p + off;
+
+  blob->nkeys = buf16 (p + 16);
+  blob->keyinfolen = buf16 (p + 18);
+  blob->keyinfo = p + 20;
+  off = 20 + blob->nkeys * blob->keyinfolen;
+  if (!blob->nkeys || blob->keyinfolen < 28 || off + 2 > len)
+    return 2;
+  off += 2 + buf16 (p + off);  /* Skip the serial number.  */
+  if (off + 4 > len)
+    return 2;
+  blob->nuids = buf16 (p + off);
+  blob->uidinfolen = buf16 (p + off + 2);
+  blob->uidinfo = p + off + 4;
+  if (blob->uidinfolen < 12
+      || off + 4 + blob->nuids * blob->uidinfolen > len)
+    return 2;
+  for (i = 0; i < blob->nuids; i++)
+    {
+      uoff = buf32 (blob->uidinfo + i * blob->uidinfolen);
+      ulen = buf32 (blob->uidinfo + i * blob->uidinfolen + 4);
+      if (uoff > len || ulen > len - uoff)
+        return 2;
+    }
+  return 0;
+}
+
+
+/* Return true if one of the user IDs of BLOB matches PAT.  */
+static int
+blob_match_uid (const struct kbx_blob_s *blob,
+                const struct kbx_pattern_s *pat)
+{
+  const unsigned char *name, *mail, *gt;
+  size_t off, len, maillen;
+  unsigned int i;
+
+  for (i = 0; i < blob->nuids; i++)
+    {
+      off = buf32 (blob->uidinfo + i * blob->uidinfolen);
+      len = buf32 (blob->uidinfo + i * blob->uidinfolen + 4);
+      if (off > blob->len || len > blob->len - off)
+        return 0;
+      name = blob->image + off;
+
+      switch (pat->mode)
+        {
+        case KBX_MATCH_SUBSTR:
+          if (ascii_memcasemem (name, len, pat->name, pat->namelen))
+            return 1;
+          break;
+
+        case KBX_MATCH_EXACT:
+          if (len == pat->namelen && !memcmp (name, pat->name, len))
+            return 1;
+          break;
+
+        case KBX_MATCH_MAIL:
+        case KBX_MATCH_MAILSUB:
+          /* Use the part in angle brackets or the entire user ID if
+             it looks like a plain mail address.  */
+          mail = memchr (name, '<', len);
+          if (mail && len - (mail - name) >= 2)
+            {
+              mail++;
+              gt = memchr (mail, '>', len - (mail - name));
+              if (!gt || gt == mail)
+                continue;
+              maillen = gt - mail;
+            }
+          else
+            {
+              mail = name;
+              maillen = len;
+              if (maillen < 3 || !memchr (mail, '@', maillen)
+                  || *mail == '@' || mail[maillen - 1] == '@'
+                  || mail[maillen - 1] == '.'
+                  || memchr (mail, ' ', maillen))
+                continue;
+            }
+          if (pat->mode == KBX_MATCH_MAILSUB)
+            {
+              if (pat->namelen
+                  && ascii_memcasemem (mail, maillen, pat->name, pat->namelen))
+                return 1;
+            }
+          else if (maillen == pat->namelen
+                   && ascii_memcasemem (mail, maillen,
+                                        pat->name, pat->namelen))
+            return 1;
+          break;
+
+        default:
+          break;
+        }
+    }
+  return 0;
+}
+
+
+/* Return true if BLOB matches one of the patterns of KBX.  */
+static int
+blob_match (struct _gpgme_keybox *kbx, const struct kbx_blob_s *blob)
+{
+  const struct kbx_pattern_s *pat;
+  unsigned int i, k;
+
+  if (!kbx->npatterns)
+    return 1;
+
+  for (i = 0; i < kbx->npatterns; i++)
+    {
+      pat = kbx->patterns + i;
+      if (pat->mode == KBX_MATCH_KEYID)
+        {
+          for (k = 0; k < blob->nkeys; k++)
+            if (!memcmp (blob->keyinfo + k * blob->keyinfolen
+                         + 20 - pat->fprlen, pat->fpr, pat->fprlen))
+              return 1;
+        }
+      else if (blob_match_uid (blob, pat))
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Get the next OpenPGP packet from the buffer at *R_P which ends at
+   END.  Returns -1 on error.  */
+static int
+next_packet (const unsigned char **r_p, const unsigned char *end,
+             const unsigned char **r_body, size_t *r_len)
+{
+  const unsigned char *p = *r_p;
+  size_t len;
+  int c, tag, i, n;
+
+  if (p >= end)
+    return -1;
+  c = *p++;
+  if (!(c & 0x80))
+    return -1;
+  if ((c & 0x40))
+    {
+      tag = c & 0x3f;
+      if (p >= end)
+        return -1;
+      c = *p++;
+      if (c < 192)
+        len = c;
+      else if (c < 224)
+        {
+          if (p >= end)
+            return -1;
+          len = ((c - 192) << 8) + *p++ + 192;
+        }
+      else if (c == 255)
+        {
+          if (end - p < 4)
+            return -1;
+          len = buf32 (p);
+          p += 4;
+        }
+      else
+        return -1;  /* Partial body lengths are not used in keyblocks.  */
+    }
+  else
+    {
+      tag = (c >> 2) & 0x0f;
+      n = (c & 3) == 3? 0 : 1 << (c & 3);
+      if (!n || end - p < n)
+        return -1;
+      for (len = 0, i = 0; i < n; i++)
+        len = (len << 8) | *p++;
+    }
+  if (len > (size_t)(end - p))
+    return -1;
+
+  *r_body = p;
+  *r_len = len;
+  *r_p = p + len;
+  return tag;
+}
+
+
+/* Return the number of bits of the MPI at *R_P within N bytes and
+   skip it.  Returns 0 on error.  */
+static unsigned int
+mpi_nbits (const unsigned char **r_p, size_t *r_n)
+{
+  const unsigned char *p = *r_p;
+  size_t nbytes;
+  unsigned int nbits;
+  int c;
+
+  if (*r_n < 2)
+    return 0;
+  nbytes = (buf16 (p) + 7) / 8;
+  p += 2;
+  if (nbytes > *r_n - 2)
+    return 0;
+  *r_p = p + nbytes;
+  *r_n -= nbytes + 2;
+
+  /* Like gpg we count the bits which are actually there.  */
+  for (; nbytes && !*p; nbytes--)
+    p++;
+  if (!nbytes)
+    return 0;
+  nbits = nbytes * 8;
+  for (c = *p; !(c & 0x80); c <<= 1)
+    nbits--;
+  return nbits;
+}
+
+
+/* Parse the public key packet P of length N into PK.  */
+static gpgme_error_t
+parse_key (const unsigned char *p, size_t n, struct kbx_pk_s *pk)
+{
+  unsigned int qbits;
+  int i;
+
+  if (n < 6 || p[0] != 4)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  pk->created = buf32 (p + 1);
+  pk->algo = p[5];
+  p += 6;
+  n -= 6;
+
+  switch (pk->algo)
+    {
+    case 1: case 2: case 3:  /* RSA */
+      pk->nbits = mpi_nbits (&p, &n);
+      pk->de_vs = (pk->nbits == 2048 || pk->nbits == 3072
+                   || pk->nbits == 4096);
+      break;
+
+    case 16:  /* Elgamal */
+      pk->nbits = mpi_nbits (&p, &n);
+      break;
+
+    case 17:  /* DSA */
+      pk->nbits = mpi_nbits (&p, &n);
+      qbits = mpi_nbits (&p, &n);
+      pk->de_vs = (qbits == 256 && (pk->nbits == 2048 || pk->nbits == 3072));
+      break;
+
+    case 18: case 19: case 22:  /* ECDH, ECDSA, EdDSA */
+      if (n < 1 || p[0] + 1 > n)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      for (i = 0; i < DIM (kbx_curves); i++)
+        if (p[0] == kbx_curves[i].oidlen
+            && !memcmp (p + 1, kbx_curves[i].oid, p[0]))
+          break;
+      if (i == DIM (kbx_curves))
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      pk->curve = kbx_curves[i].name;
+      pk->nbits = kbx_curves[i].nbits;
+      pk->de_vs = (pk->algo != 22 && !strncmp (pk->curve, "brainpool", 9));
+      break;
+
+    default:
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  if (!pk->nbits)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  return 0;
+}
+
+
+/* Parse the subpackets of length N at P into SIG.  HASHED tells
+   whether they are from the hashed area.  */
+static int
+parse_subpackets (const unsigned char *p, size_t n, int hashed,
+                  struct kbx_sig_s *sig)
+{
+  size_t len;
+  int type;
+
+  while (n)
+    {
+      if (*p < 192)
+        {
+          len = *p++;
+          n--;
+        }
+      else if (*p < 255)
+        {
+          if (n < 2)
+            return -1;
+          len = ((p[0] - 192) << 8) + p[1] + 192;
+          p += 2;
+          n -= 2;
+        }
+      else
+        {
+          if (n < 5)
+            return -1;
+          len = buf32 (p + 1);
+          p += 5;
+          n -= 5;
+        }
+      if (!len || len > n)
+        return -1;
+      type = *p & 0x7f;
+
+      switch (type)
+        {
+        case 2:  /* Signature creation time.  */
+          if (hashed && len >= 5)
+            sig->created = buf32 (p + 1);
+          break;
+
+        case 3:  /* Signature expiration time.  */
+          if (hashed && len >= 5)
+            sig->lifetime = buf32 (p + 1);
+          break;
+
+        case 9:  /* Key expiration time.  */
+          if (hashed && len >= 5)
+            sig->key_expire = buf32 (p + 1);
+          break;
+
+        case 16:  /* Issuer.  */
+          if (len >= 9)
+            {
+              memcpy (sig->keyid, p + 1, 8);
+              sig->have_keyid = 1;
+            }
+          break;
+
+        case 25:  /* Primary user ID.  */
+          if (hashed && len >= 2)
+            sig->primary_uid = !!p[1];
+          break;
+
+        case 27:  /* Key flags.  */
+          if (hashed)
+            {
+              int flags = len >= 2? p[1] : 0;
+
+              sig->usage = 0;
+              if ((flags & 0x01))
+                sig->usage |= USAGE_CERT;
+              if ((flags & 0x02))
+                sig->usage |= USAGE_SIG;
+              if ((flags & (0x04 | 0x08)))
+                sig->usage |= USAGE_ENC;
+              if ((flags & 0x20))
+                sig->usage |= USAGE_AUTH;
+              if ((flags & ~(0x01 | 0x02 | 0x04 | 0x08 | 0x20)))
+                sig->usage |= USAGE_UNKNOWN;
+              if (!sig->usage)
+                sig->usage = USAGE_NONE;
+            }
+          break;
+
+        case 33:  /* Issuer fingerprint.  */
+          if (len >= 22 && p[1] == 4 && !sig->have_keyid)
+            {
+              memcpy (sig->keyid, p + 14, 8);
+              sig->have_keyid = 1;
+            }
+          break;
+        }
+      p += len;
+      n -= len;
+    }
+  return 0;
+}
+
+
+/* Parse the signature packet P of length N into SIG.  */
+static gpgme_error_t
+parse_sig (const unsigned char *p, size_t n, struct kbx_sig_s *sig)
+{
+  size_t len;
+
+  memset (sig, 0, sizeof *sig);
+  if (n >= 19 && (p[0] == 2 || p[0] == 3) && p[1] == 5)
+    {
+      sig->sigclass = p[2];
+      sig->created = buf32 (p + 3);
+      memcpy (sig->keyid, p + 7, 8);
+      sig->have_keyid = 1;
+      return 0;
+    }
+  if (n < 6 || p[0] != 4)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  sig->sigclass = p[1];
+  len = buf16 (p + 4);
+  p += 6;
+  n -= 6;
+  if (len + 2 > n || parse_subpackets (p, len, 1, sig))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  p += len;
+  n -= len;
+  len = buf16 (p);
+  p += 2;
+  n -= 2;
+  if (len > n || parse_subpackets (p, len, 0, sig))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  return 0;
+}
+
+
+/* Return the usage possible with ALGO.  */
+static unsigned int
+algo_usage (int algo)
+{
+  switch (algo)
+    {
+    case 1:  return USAGE_CERT | USAGE_SIG | USAGE_ENC | USAGE_AUTH;
+    case 2:  return USAGE_ENC;
+    case 3:  return USAGE_CERT | USAGE_SIG;
+    case 16: return USAGE_ENC;
+    case 17: return USAGE_CERT | USAGE_SIG | USAGE_AUTH;
+    case 18: return USAGE_ENC;
+    case 19: return USAGE_CERT | USAGE_SIG | USAGE_AUTH;
+    case 22: return USAGE_CERT | USAGE_SIG | USAGE_AUTH;
+    default: return 0;
+    }
+}
+
+
+/* Return the usage of a key with ALGO given the key flags USAGE of
+   its self-signature.  */
+static unsigned int
+key_usage (int algo, unsigned int usage)
+{
+  if (!usage)
+    return algo_usage (algo);
+  return usage & algo_usage (algo);
+}
+
+
+/* Compare two user IDs like gpg does to decide which one is the
+   primary user ID if their self-signatures have the same date.  */
+static int
+cmp_uids (const struct kbx_uid_s *a, const struct kbx_uid_s *b)
+{
+  if (a->namelen != b->namelen)
+    return a->namelen > b->namelen? 1 : -1;
+  return memcmp (a->name, b->name, a->namelen);
+}
+
+
+/* Parse the packets of the keyblock of BLOB into the states PKS of
+   its NKEYS keys and UIDS of its user IDs, the number of which is
+   stored at R_NUIDS.  */
+static gpgme_error_t
+parse_keyblock (struct _gpgme_keybox *kbx, const struct kbx_blob_s *blob,
+                struct kbx_pk_s *pks, struct kbx_uid_s *uids,
+                unsigned int *r_nuids)
+{
+  const unsigned char *p = blob->keyblock;
+  const unsigned char *end = p + blob->keyblocklen;
+  const unsigned char *body;
+  size_t len;
+  struct kbx_sig_s sig;
+  struct kbx_pk_s *pk = NULL;
+  struct kbx_uid_s *uid = NULL;
+  unsigned int nuids = 0;
+  int in_attribute = 0;
+  int selfsig, expired;
+  int tag;
+  gpgme_error_t err;
+
+  while (p < end)
+    {
+      tag = next_packet (&p, end, &body, &len);
+      switch (tag)
+        {
+        case 6:   /* Public key.  */
+        case 14:  /* Public subkey.  */
+          if ((tag == 6) != !pk)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          pk = pk? pk + 1 : pks;
+          if (pk - pks >= blob->nkeys)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          pk->fpr = blob->keyinfo + (pk - pks) * blob->keyinfolen;
+          err = parse_key (body, len, pk);
+          if (err)
+            return err;
+          uid = NULL;
+          in_attribute = 0;
+          break;
+
+        case 13:  /* User ID.  */
+        case 17:  /* Attribute.  */
+          if (pk != pks)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          uid = NULL;
+          in_attribute = (tag == 17);
+          if (tag == 13)
+            {
+              if (nuids == blob->nuids || memchr (body, 0, len))
+                return gpg_error (GPG_ERR_NOT_SUPPORTED);
+              uid = uids + nuids++;
+              uid->name = body;
+              uid->namelen = len;
+            }
+          break;
+
+        case 12:  /* Trust.  */
+          break;
+
+        case 2:  /* Signature.  */
+          if (!pk)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          err = parse_sig (body, len, &sig);
+          if (err)
+            return err;
+          selfsig = (sig.have_keyid
+                     && !memcmp (sig.keyid, pks->fpr + 12, 8));
+          expired = (sig.lifetime && sig.created + sig.lifetime <= kbx->now);
+
+          if (pk == pks && !uid && !in_attribute)
+            {
+              /* A direct key signature or key revocation.  */
+              if (sig.sigclass == 0x20 && !selfsig)
+                return gpg_error (GPG_ERR_NOT_SUPPORTED);
+              if (!selfsig)
+                ;
+              else if (sig.sigclass == 0x20)
+                pk->revoked = 1;
+              else if (sig.sigclass == 0x1f && sig.created >= pk->sigdate
+                       && !expired)
+                {
+                  pk->have_sig = 1;
+                  pk->sigdate = sig.created;
+                  pk->sig_usage = sig.usage;
+                  pk->sig_key_expire = sig.key_expire;
+                }
+            }
+          else if (uid)
+            {
+              if (selfsig
+                  && ((sig.sigclass >= 0x10 && sig.sigclass <= 0x13)
+                      || sig.sigclass == 0x30)
+                  && sig.created >= uid->sigdate)
+                {
+                  uid->have_sig = 1;
+                  uid->sigdate = sig.created;
+                  uid->sig_revocation = (sig.sigclass == 0x30);
+                  uid->sig_expired = expired;
+                  uid->sig_usage = sig.usage;
+                  uid->sig_key_expire = sig.key_expire;
+                  uid->sig_primary = sig.primary_uid;
+                }
+            }
+          else if (pk != pks && selfsig)
+            {
+              if (sig.sigclass == 0x28)
+                pk->revoked = 1;
+              else if (sig.sigclass == 0x18 && sig.created >= pk->sigdate
+                       && !expired)
+                {
+                  pk->have_sig = 1;
+                  pk->sigdate = sig.created;
+                  pk->sig_usage = sig.usage;
+                  pk->sig_key_expire = sig.key_expire;
+                }
+            }
+          break;
+
+        default:
+          return gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+    }
+
+  if (!pk || pk - pks + 1 != blob->nkeys || !nuids)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  *r_nuids = nuids;
+  return 0;
+}
+
+
+/* Derive the properties of the keys PKS and the user IDs UIDS from
+   their self-signatures like gpg does.  Returns the index of the
+   primary user ID or -1.  */
+static int
+merge_selfsigs (struct _gpgme_keybox *kbx,
+                struct kbx_pk_s *pks, unsigned int nkeys,
+                struct kbx_uid_s *uids, unsigned int nuids)
+{
+  struct kbx_pk_s *pk = pks;
+  struct kbx_uid_s *uid;
+  unsigned int usage = 0;
+  unsigned long key_expire = 0;
+  unsigned long uiddate;
+  int key_expire_seen = 0;
+  int primary = -1;
+  int primary2 = -1;
+  unsigned long uiddate2;
+  unsigned int i;
+
+  for (i = 0; i < nuids; i++)
+    {
+      uid = uids + i;
+      if (uid->sig_revocation)
+        uid->revoked = 1;
+      else if (!uid->sig_expired)
+        {
+          uid->created = uid->sigdate;
+          uid->primary = uid->sig_primary;
+        }
+    }
+
+  if (pk->have_sig)
+    {
+      usage = pk->sig_usage;
+      if (pk->sig_key_expire)
+        {
+          key_expire = pk->created + pk->sig_key_expire;
+          key_expire_seen = 1;
+        }
+    }
+
+  /* Take the usage and the expiration time from the latest user ID
+     which has them.  */
+  if (!usage)
+    for (uiddate = 0, i = 0; i < nuids; i++)
+      {
+        uid = uids + i;
+        if (uid->sig_usage && uid->created > uiddate)
+          {
+            usage = uid->sig_usage;
+            uiddate = uid->created;
+          }
+      }
+  pk->usage = key_usage (pk->algo, usage) | USAGE_CERT;
+
+  if (!key_expire_seen)
+    for (uiddate = 0, i = 0; i < nuids; i++)
+      {
+        uid = uids + i;
+        if (uid->sig_key_expire && uid->created > uiddate)
+          {
+            key_expire = pk->created + uid->sig_key_expire;
+            uiddate = uid->created;
+          }
+      }
+  pk->expires = key_expire;
+  pk->expired = key_expire && key_expire < kbx->now;
+
+  /* The subkeys.  */
+  for (i = 1; i < nkeys; i++)
+    {
+      pk = pks + i;
+      pk->usage = key_usage (pk->algo, pk->sig_usage);
+      pk->expires = pk->sig_key_expire? pk->created + pk->sig_key_expire : 0;
+      pk->expired = pk->expires && pk->expires < kbx->now;
+      if (pks->revoked)
+        pk->revoked = 1;
+      if (pks->expired)
+        {
+          pk->expired = 1;
+          if (!pk->expires || pk->expires > pks->expires)
+            pk->expires = pks->expires;
+        }
+    }
+
+  /* Find the primary user ID: the latest with the primary flag or
+     else the latest.  */
+  uiddate = uiddate2 = 0;
+  for (i = 0; i < nuids; i++)
+    {
+      uid = uids + i;
+      if (uid->primary)
+        {
+          if (uid->created > uiddate)
+            {
+              uiddate = uid->created;
+              primary = i;
+            }
+          else if (uid->created == uiddate && primary != -1
+                   && cmp_uids (uid, uids + primary) > 0)
+            primary = i;
+        }
+      else
+        {
+          if (uid->created > uiddate2)
+            {
+              uiddate2 = uid->created;
+              primary2 = i;
+            }
+          else if (uid->created == uiddate2 && primary2 != -1
+                   && cmp_uids (uid, uids + primary2) > 0)
+            primary2 = i;
+        }
+    }
+  return primary != -1? primary : primary2;
+}
+
+
+/* Set the capabilities of SUBKEY, which has the usage USAGE.  */
+static void
+set_capabilities (gpgme_subkey_t subkey, unsigned int usage, int primary)
+{
+  subkey->can_encrypt = !!(usage & USAGE_ENC);
+  subkey->can_sign = !!(usage & USAGE_SIG);
+  subkey->can_certify = !!(usage & USAGE_CERT)
+                        || (primary && (usage & USAGE_SIG));
+  subkey->can_authenticate = !!(usage & USAGE_AUTH);
+}
+
+
+/* Build the key from the states PKS and UIDS.  FIELDS are the
+   KEYLIST_FIELD_* bits of the parts to build.  */
+static gpgme_error_t
+build_key (struct kbx_pk_s *pks, unsigned int nkeys,
+           struct kbx_uid_s *uids, unsigned int nuids, int primary,
+           unsigned int fields, gpgme_key_t *r_key)
+{
+  gpgme_error_t err;
+  gpgme_key_t key;
+  gpgme_subkey_t subkey;
+  struct kbx_pk_s *pk;
+  unsigned int usable = 0;
+  char *name = NULL;
+  size_t namesize = 0;
+  unsigned int i, k;
+
+  err = _gpgme_key_new (&key);
+  if (err)
+    return err;
+
+  for (i = 0; i < nkeys; i++)
+    {
+      pk = pks + i;
+      if (!pk->revoked && !pk->expired)
+        usable |= pk->usage;
+      if (i && !(fields & KEYLIST_FIELD_SUBKEYS))
+        continue;
+
+      err = _gpgme_key_add_subkey (key, &subkey);
+      if (err)
+        goto leave;
+      subkey->length = pk->nbits;
+      subkey->pubkey_algo = _gpgme_map_pk_algo (pk->algo,
+                                                GPGME_PROTOCOL_OpenPGP);
+      for (k = 0; k < 8; k++)
+        snprintf (subkey->_keyid + 2 * k, 3, "%02X", pk->fpr[12 + k]);
+      subkey->timestamp = pk->created;
+      subkey->expires = pk->expires;
+      if (pk->revoked)
+        subkey->revoked = 1;
+      else if (pk->expired)
+        subkey->expired = 1;
+      set_capabilities (subkey, pk->usage, !i);
+      subkey->is_de_vs = pk->de_vs;
+      if (pk->curve)
+        {
+          subkey->curve = _gpgme_key_strdup (key, pk->curve);
+          if (!subkey->curve)
+            goto syserror;
+        }
+      if ((fields & KEYLIST_FIELD_FPR))
+        {
+          subkey->fpr = _gpgme_key_alloc (key, 41);
+          if (!subkey->fpr)
+            goto syserror;
+          for (k = 0; k < 20; k++)
+            snprintf (subkey->fpr + 2 * k, 3, "%02X", pk->fpr[k]);
+        }
+    }
+
+  /* The summary of the primary key and the usable subkeys.  */
+  subkey = key->subkeys;
+  key->revoked = subkey->revoked;
+  key->expired = subkey->expired;
+  key->can_encrypt = subkey->can_encrypt || !!(usable & USAGE_ENC);
+  key->can_sign = subkey->can_sign || !!(usable & USAGE_SIG);
+  key->can_certify = subkey->can_certify || !!(usable & USAGE_CERT);
+  key->can_authenticate = (subkey->can_authenticate
+                           || !!(usable & USAGE_AUTH));
+  if (subkey->fpr)
+    {
+      key->fpr = _gpgme_key_strdup (key, subkey->fpr);
+      if (!key->fpr)
+        goto syserror;
+    }
+
+  /* The primary user ID is listed first.  */
+  if ((fields & KEYLIST_FIELD_UIDS))
+    for (i = 0; i < nuids; i++)
+      {
+        struct kbx_uid_s *uid;
+
+        if (primary == -1)
+          uid = uids + i;
+        else if (!i)
+          uid = uids + primary;
+        else
+          uid = uids + i - (i <= primary);
+
+        if (uid->namelen + 1 > namesize)
+          {
+            char *p;
+
+            namesize = uid->namelen + 1;
+            p = realloc (name, namesize);
+            if (!p)
+              goto syserror;
+            name = p;
+          }
+        memcpy (name, uid->name, uid->namelen);
+        name[uid->namelen] = 0;
+        err = _gpgme_key_append_name (key, name, 0);
+        if (err)
+          goto leave;
+        if (uid->revoked || key->revoked)
+          key->_last_uid->revoked = 1;
+      }
+
+ leave:
+  free (name);
+  if (err)
+    gpgme_key_unref (key);
+  else
+    *r_key = key;
+  return err;
+
+ syserror:
+  err = gpg_error_from_syserror ();
+  goto leave;
+}
+
+
+/* Get the next key from KBX which matches its patterns and store it
+   at R_KEY.  FIELDS are the KEYLIST_FIELD_* bits of the parts to
+   list.  Returns GPG_ERR_EOF at the end.  If the key can't be built
+   here, GPG_ERR_NOT_SUPPORTED is returned and the fingerprint of the
+   key is stored at R_FPR.  */
+gpgme_error_t
+_gpgme_keybox_next (struct _gpgme_keybox *kbx, unsigned int fields,
+                    gpgme_key_t *r_key, char r_fpr[41])
+{
+  struct kbx_blob_s blob;
+  struct kbx_pk_s *pks;
+  struct kbx_uid_s *uids;
+  unsigned int nuids;
+  gpgme_error_t err;
+  int primary;
+  int rc, i;
+
+  *r_key = NULL;
+  *r_fpr = 0;
+
+  for (;;)
+    {
+      rc = next_blob (kbx, &blob);
+      if (rc == -1)
+        return gpg_error (GPG_ERR_EOF);
+      if (rc == 2)
+        return gpg_error (GPG_ERR_INTERNAL);  /* Checked when opened.  */
+      if (rc)
+        continue;
+      if ((blob.flags & KBX_BLOBFLAG_EPHEMERAL) && !kbx->ephemeral)
+        continue;
+      if (blob_match (kbx, &blob))
+        break;
+    }
+
+  pks = calloc (1, blob.nkeys * sizeof *pks
+                + (blob.nuids + 1) * sizeof *uids);
+  if (!pks)
+    return gpg_error_from_syserror ();
+  uids = (struct kbx_uid_s *) (pks + blob.nkeys);
+
+  err = parse_keyblock (kbx, &blob, pks, uids, &nuids);
+  if (!err)
+    {
+      for (i = 0; i < nuids && !err; i++)
+        if (!uids[i].have_sig)
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      for (i = 1; i < blob.nkeys && !err; i++)
+        if (!pks[i].have_sig)
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  if (!err)
+    {
+      primary = merge_selfsigs (kbx, pks, blob.nkeys, uids, nuids);
+      err = build_key (pks, blob.nkeys, uids, nuids, primary, fields, r_key);
+    }
+  free (pks);
+
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    {
+      for (i = 0; i < 20; i++)
+        snprintf (r_fpr + 2 * i, 3, "%02X", blob.keyinfo[i]);
+      TRACE (DEBUG_CTX, "_gpgme_keybox_next", kbx,
+             "key %s not supported", r_fpr);
+    }
+  return err;
+}
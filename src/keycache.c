@@ -0,0 +1,398 @@
+/* keycache.c - Cache of the keys returned by gpgme_get_key.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "gpgme.h"
+#include "util.h"
+#include "context.h"
+#include "ops.h"
+#include "sema.h"
+#include "debug.h"
+
+
+/* The cache is shared by all contexts of the process.  An item is
+   found by the name given to gpgme_get_key together with the
+   protocol, the keylist mode, the secret flag and the home directory
+   of the context.  An item is valid as long as no operation which
+   may change keys has been started by gpgme (see
+   _gpgme_keycache_invalidate) and the files of the home directory
+   listed below did not change; the latter catches changes by other
+   processes.  */
+
+/* The default maximum number of items.  */
+#define KEYCACHE_DEFAULT_SIZE 1000
+
+/* The files and directories of the home directory whose change
+   invalidates the cache.  */
+static const char *keycache_files[] =
+  {
+    "pubring.kbx", "pubring.gpg", "public-keys.d/pubring.db",
+    "private-keys-v1.d", "trustdb.gpg", "trustlist.txt"
+  };
+
+typedef struct keycache_item_s *keycache_item_t;
+struct keycache_item_s
+{
+  /* The next item in the same hash bucket.  */
+  keycache_item_t next;
+
+  /* The list of all items with the most recently used first.  */
+  keycache_item_t lru_prev;
+  keycache_item_t lru_next;
+
+  unsigned int hash;
+  gpgme_protocol_t protocol;
+  gpgme_keylist_mode_t mode;
+  int secret;
+  struct _gpgme_keycache_stamp stamp;
+  gpgme_key_t key;
+
+  /* The home directory followed by the name.  */
+  size_t homedir_len;
+  char names[1];
+};
+
+DEFINE_STATIC_LOCK (keycache_lock);
+
+/* The maximum number of items; 0 disables the cache.  */
+static unsigned int keycache_size = KEYCACHE_DEFAULT_SIZE;
+
+/* The hash table with NBUCKETS buckets, a power of two, and the
+   number of items.  */
+static keycache_item_t *buckets;
+static unsigned int nbuckets;
+static unsigned int nitems;
+
+/* The most and least recently used items.  */
+static keycache_item_t lru_head;
+static keycache_item_t lru_tail;
+
+/* Incremented by _gpgme_keycache_invalidate.  */
+static unsigned long generation;
+
+
+
+static unsigned int
+hash_string (unsigned int h, const char *s)
+{
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619;
+  return h;
+}
+
+
+/* Return the home directory used by CTX.  */
+static const char *
+get_homedir (gpgme_ctx_t ctx)
+{
+  gpgme_engine_info_t info;
+  const char *homedir;
+
+  for (info = ctx->engine_info; info; info = info->next)
+    if (info->protocol == ctx->protocol)
+      break;
+  homedir = info? info->home_dir : NULL;
+  if (!homedir)
+    homedir = _gpgme_get_default_homedir ();
+  return homedir? homedir : "";
+}
+
+
+/* Return a value which changes if one of the files in HOMEDIR which
+   are relevant for the keys changes.  */
+static unsigned long long
+files_stamp (const char *homedir)
+{
+  unsigned long long stamp = 14695981039346656037ULL;
+  struct stat st;
+  char *fname;
+  size_t n;
+  int i;
+
+  n = strlen (homedir);
+  fname = malloc (n + 32);
+  if (!fname)
+    return 0;
+  memcpy (fname, homedir, n);
+  fname[n++] = '/';
+  for (i = 0; i < DIM (keycache_files); i++)
+    {
+      strcpy (fname + n, keycache_files[i]);
+      if (stat (fname, &st))
+        continue;
+      stamp = (stamp ^ (unsigned long long)st.st_ino) * 1099511628211ULL;
+      stamp = (stamp ^ (unsigned long long)st.st_size) * 1099511628211ULL;
+      stamp = (stamp ^ (unsigned long long)st.st_mtime) * 1099511628211ULL;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+      stamp = (stamp ^ (unsigned long long)st.st_mtim.tv_nsec)
+        * 1099511628211ULL;
+#endif
+      stamp = (stamp ^ i) * 1099511628211ULL;
+    }
+  free (fname);
+  return stamp;
+}
+
+
+/* Remove ITEM from the hash table and the LRU list and release it.
+   Must be called with the lock held.  */
+static void
+remove_item (keycache_item_t item)
+{
+  keycache_item_t *p;
+
+  for (p = &buckets[item->hash & (nbuckets - 1)]; *p; p = &(*p)->next)
+    if (*p == item)
+      {
+        *p = item->next;
+        break;
+      }
+  if (item->lru_prev)
+    item->lru_prev->lru_next = item->lru_next;
+  else
+    lru_head = item->lru_next;
+  if (item->lru_next)
+    item->lru_next->lru_prev = item->lru_prev;
+  else
+    lru_tail = item->lru_prev;
+  nitems--;
+  gpgme_key_unref (item->key);
+  free (item);
+}
+
+
+/* Remove all items.  Must be called with the lock held.  */
+static void
+flush_items (void)
+{
+  while (lru_head)
+    remove_item (lru_head);
+}
+
+
+/* Set the maximum number of cached keys to the decimal number VALUE.
+   Returns 0 on success.  */
+int
+_gpgme_keycache_set_size (const char *value)
+{
+  char *endp;
+  unsigned long n;
+
+  n = strtoul (value, &endp, 10);
+  if (!*value || *endp || n > 1000000)
+    return -1;
+
+  LOCK (keycache_lock);
+  flush_items ();
+  free (buckets);
+  buckets = NULL;
+  nbuckets = 0;
+  keycache_size = n;
+  UNLOCK (keycache_lock);
+  return 0;
+}
+
+
+/* Invalidate all cached keys.  This is called by all operations
+   which may change keys.  */
+void
+_gpgme_keycache_invalidate (void)
+{
+  LOCK (keycache_lock);
+  generation++;
+  flush_items ();
+  UNLOCK (keycache_lock);
+}
+
+
+/* Find the item for the arguments.  Must be called with the lock
+   held.  */
+static keycache_item_t
+find_item (unsigned int hash, gpgme_ctx_t ctx, const char *homedir,
+           const char *name, int secret)
+{
+  keycache_item_t item;
+
+  if (!nbuckets)
+    return NULL;
+  for (item = buckets[hash & (nbuckets - 1)]; item; item = item->next)
+    if (item->hash == hash
+        && item->protocol == ctx->protocol
+        && item->mode == ctx->keylist_mode
+        && item->secret == secret
+        && !strcmp (item->names, homedir)
+        && !strcmp (item->names + item->homedir_len + 1, name))
+      return item;
+  return NULL;
+}
+
+
+static unsigned int
+item_hash (gpgme_ctx_t ctx, const char *homedir, const char *name,
+           int secret)
+{
+  unsigned int h;
+
+  h = 2166136261U ^ (ctx->protocol << 1) ^ (!!secret);
+  h = (h ^ ctx->keylist_mode) * 16777619;
+  h = hash_string (h, homedir);
+  return hash_string (h, name);
+}
+
+
+/* Look up the key NAME for the context CTX and the SECRET flag.  On a
+   hit a new reference to the key is returned.  On a miss NULL is
+   returned and the state of the cache is stored at R_STAMP, to be
+   passed to _gpgme_keycache_put along with the key listed by the
+   caller.  */
+gpgme_key_t
+_gpgme_keycache_get (gpgme_ctx_t ctx, const char *name, int secret,
+                     struct _gpgme_keycache_stamp *r_stamp)
+{
+  const char *homedir;
+  keycache_item_t item;
+  gpgme_key_t key = NULL;
+
+  LOCK (keycache_lock);
+  r_stamp->generation = generation;
+  if (!keycache_size)
+    {
+      UNLOCK (keycache_lock);
+      return NULL;
+    }
+  UNLOCK (keycache_lock);
+
+  homedir = get_homedir (ctx);
+
+  /* No need to hold the lock while looking at the files.  */
+  r_stamp->files = files_stamp (homedir);
+
+  LOCK (keycache_lock);
+  item = find_item (item_hash (ctx, homedir, name, secret),
+                    ctx, homedir, name, secret);
+  if (item && (item->stamp.generation != r_stamp->generation
+               || item->stamp.files != r_stamp->files))
+    {
+      remove_item (item);
+      item = NULL;
+    }
+  if (item)
+    {
+      if (item != lru_head)
+        {
+          item->lru_prev->lru_next = item->lru_next;
+          if (item->lru_next)
+            item->lru_next->lru_prev = item->lru_prev;
+          else
+            lru_tail = item->lru_prev;
+          item->lru_prev = NULL;
+          item->lru_next = lru_head;
+          lru_head->lru_prev = item;
+          lru_head = item;
+        }
+      key = item->key;
+      gpgme_key_ref (key);
+    }
+  UNLOCK (keycache_lock);
+
+  if (key)
+    ctx->key_cache_hits++;
+  else
+    ctx->key_cache_misses++;
+  return key;
+}
+
+
+/* Store KEY, which has been listed for NAME, the context CTX and the
+   SECRET flag after _gpgme_keycache_get returned STAMP.  The key is
+   not stored if the cache has been invalidated in the meantime.  */
+void
+_gpgme_keycache_put (gpgme_ctx_t ctx, const char *name, int secret,
+                     gpgme_key_t key,
+                     const struct _gpgme_keycache_stamp *stamp)
+{
+  const char *homedir;
+  keycache_item_t item;
+  size_t homedir_len, name_len;
+  unsigned int hash, n;
+
+  homedir = get_homedir (ctx);
+  homedir_len = strlen (homedir);
+  name_len = strlen (name);
+  hash = item_hash (ctx, homedir, name, secret);
+
+  item = malloc (sizeof *item + homedir_len + name_len + 1);
+  if (!item)
+    return;  /* Not having the key in the cache is not an error.  */
+  item->hash = hash;
+  item->protocol = ctx->protocol;
+  item->mode = ctx->keylist_mode;
+  item->secret = secret;
+  item->stamp = *stamp;
+  item->homedir_len = homedir_len;
+  memcpy (item->names, homedir, homedir_len + 1);
+  memcpy (item->names + homedir_len + 1, name, name_len + 1);
+
+  LOCK (keycache_lock);
+  if (!keycache_size || stamp->generation != generation)
+    goto leave;
+
+  if (!buckets)
+    {
+      for (n = 16; n < keycache_size && n < 65536; n *= 2)
+        ;
+      buckets = calloc (n, sizeof *buckets);
+      if (!buckets)
+        goto leave;
+      nbuckets = n;
+    }
+
+  /* Another thread may have listed the same key.  */
+  if (find_item (hash, ctx, homedir, name, secret))
+    goto leave;
+  while (nitems >= keycache_size)
+    remove_item (lru_tail);
+
+  gpgme_key_ref (key);
+  item->key = key;
+  item->next = buckets[hash & (nbuckets - 1)];
+  buckets[hash & (nbuckets - 1)] = item;
+  item->lru_prev = NULL;
+  item->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = item;
+  else
+    lru_tail = item;
+  lru_head = item;
+  nitems++;
+  item = NULL;
+
+ leave:
+  UNLOCK (keycache_lock);
+  free (item);
+}
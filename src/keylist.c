@@ -42,6 +42,8 @@
 #include "util.h"
 #include "context.h"
 #include "ops.h"
+#include "wait.h"
+#include "priv-io.h"
 #include "debug.h"
 
 
@@ -51,6 +53,112 @@ struct key_queue_item_s
   gpgme_key_t key;
 };
 
+
+/* A keylist operation distributed over several engine processes as
+   requested by the context flag "keylist-shards".  The patterns are
+   split into jobs of consecutive patterns, which are run by the
+   workers, each with its own context.  The fds of all workers are
+   watched with one readiness set.  For an empty pattern the
+   fingerprints of all keys are listed first and then used as the
+   patterns.  A key may match patterns of several jobs; it is
+   returned only for the first of them.  */
+struct keylist_worker_s
+{
+  /* The context of the worker or NULL if it has not been needed.  */
+  gpgme_ctx_t ctx;
+
+  /* The job run by the worker or -1 if it is idle.  */
+  int job;
+};
+
+/* A fingerprint of a key already returned by a distributed keylist
+   operation.  */
+struct keylist_shard_fpr_s
+{
+  struct keylist_shard_fpr_s *next;
+  char fpr[1];
+};
+
+typedef struct keylist_shards_s *keylist_shards_t;
+struct keylist_shards_s
+{
+  /* The context of the operation.  */
+  gpgme_ctx_t ctx;
+
+  io_pollset_t pollset;
+  int secret_only;
+
+  /* True if the keys are returned in the order of the jobs.  */
+  int ordered;
+
+  /* True while the first worker lists the fingerprints of all keys.  */
+  int list_fprs;
+
+  /* The patterns.  */
+  char **patterns;
+  unsigned int npatterns;
+  unsigned int patterns_size;
+
+  /* The patterns of all jobs, each job terminated by a NULL.  */
+  const char **patv;
+
+  unsigned int job_size;
+  unsigned int njobs;
+
+  /* The next job to start.  */
+  unsigned int next_job;
+
+  /* The job whose keys are returned if ORDERED is set.  */
+  unsigned int out_job;
+
+  /* True if the jobs may list the same keys.  The fingerprints of the
+     primary keys returned so far are then kept in a hash table with
+     FPR_NBUCKETS buckets, a power of two.  */
+  int dedup;
+  struct keylist_shard_fpr_s **fpr_buckets;
+  unsigned int fpr_nbuckets;
+  unsigned int nfprs;
+
+  /* The error which terminated the operation.  */
+  gpgme_error_t err;
+
+  unsigned int nworkers;
+  struct keylist_worker_s workers[1];
+};
+
+/* The maximum number of patterns of a job, which keeps the command
+   line of gpg reasonably short.  */
+#define KEYLIST_SHARD_MAX_PATTERNS 1000
+
+
+static void
+release_shards (keylist_shards_t shards)
+{
+  struct keylist_shard_fpr_s *f, *next;
+  unsigned int i;
+
+  if (!shards)
+    return;
+
+  for (i = 0; i < shards->nworkers; i++)
+    gpgme_release (shards->workers[i].ctx);
+  if (shards->ctx->fdt.pollset == shards->pollset)
+    _gpgme_fd_table_detach (&shards->ctx->fdt);
+  _gpgme_io_pollset_release (shards->pollset);
+  for (i = 0; i < shards->npatterns; i++)
+    free (shards->patterns[i]);
+  free (shards->patterns);
+  free (shards->patv);
+  for (i = 0; i < shards->fpr_nbuckets; i++)
+    for (f = shards->fpr_buckets[i]; f; f = next)
+      {
+        next = f->next;
+        free (f);
+      }
+  free (shards->fpr_buckets);
+  free (shards);
+}
+
 typedef struct
 {
   struct _gpgme_op_keylist_result result;
@@ -66,9 +174,27 @@ typedef struct
   /* This points to the last sig in tmp_uid.  */
   gpgme_key_sig_t tmp_keysig;
 
+  /* The KEYLIST_FIELD_* bits of the parts to parse.  */
+  unsigned int fields;
+
+  /* True while skipping the records of a subkey.  */
+  int skip_subkey;
+
   /* Something new is available.  */
   int key_cond;
   struct key_queue_item_s *key_queue;
+  struct key_queue_item_s *key_queue_tail;
+  unsigned int key_queue_len;
+
+  /* The state of a distributed operation or NULL.  */
+  keylist_shards_t shards;
+
+  /* The keybox read instead of running gpg or NULL.  */
+  struct _gpgme_keybox *keybox;
+
+  /* The context to list the keys the keybox reader does not support
+     or NULL.  */
+  gpgme_ctx_t keybox_listctx;
 } *op_data_t;
 
 
@@ -89,8 +215,13 @@ release_op_data (void *hook)
       struct key_queue_item_s *next = key->next;
 
       gpgme_key_unref (key->key);
+      free (key);
       key = next;
     }
+
+  release_shards (opd->shards);
+  _gpgme_keybox_release (opd->keybox);
+  gpgme_release (opd->keybox_listctx);
 }
 
 
@@ -418,7 +549,7 @@ parse_sec_field15 (gpgme_key_t key, gpgme_subkey_t subkey, char *field)
       /* Fields starts with a hex digit; thus it is a serial number.  */
       key->secret = 1;
       subkey->is_cardkey = 1;
-      subkey->card_number = strdup (field);
+      subkey->card_number = _gpgme_key_strdup (key, field);
       if (!subkey->card_number)
         return gpg_error_from_syserror ();
     }
@@ -557,7 +688,7 @@ keylist_colon_handler (void *priv, char *line)
   rectype = RT_NONE;
 #define NR_FIELDS 20
   char *field[NR_FIELDS];
-  int fields = 0;
+  int fields;
   void *hook;
   op_data_t opd;
   gpgme_error_t err;
@@ -582,43 +713,26 @@ keylist_colon_handler (void *priv, char *line)
       return 0;
     }
 
-  while (line && fields < NR_FIELDS)
+  /* Dispatch on the record type.  All records but those starting a
+     keyblock (and stray signatures) need a key.  */
+  switch (_gpgme_colon_rectag (line))
     {
-      field[fields++] = line;
-      line = strchr (line, ':');
-      if (line)
-	*(line++) = '\0';
+    case COLON_RECTAG ('s','i','g',0): rectype = RT_SIG; break;
+    case COLON_RECTAG ('r','e','v',0): rectype = RT_REV; break;
+    case COLON_RECTAG ('p','u','b',0): rectype = RT_PUB; break;
+    case COLON_RECTAG ('s','e','c',0): rectype = RT_SEC; break;
+    case COLON_RECTAG ('c','r','t',0): rectype = RT_CRT; break;
+    case COLON_RECTAG ('c','r','s',0): rectype = RT_CRS; break;
+    case COLON_RECTAG ('f','p','r',0): rectype = key? RT_FPR : RT_NONE; break;
+    case COLON_RECTAG ('g','r','p',0): rectype = key? RT_GRP : RT_NONE; break;
+    case COLON_RECTAG ('u','i','d',0): rectype = key? RT_UID : RT_NONE; break;
+    case COLON_RECTAG ('t','f','s',0): rectype = key? RT_TFS : RT_NONE; break;
+    case COLON_RECTAG ('s','u','b',0): rectype = key? RT_SUB : RT_NONE; break;
+    case COLON_RECTAG ('s','s','b',0): rectype = key? RT_SSB : RT_NONE; break;
+    case COLON_RECTAG ('s','p','k',0): rectype = key? RT_SPK : RT_NONE; break;
+    default: rectype = RT_NONE; break;
     }
 
-  if (!strcmp (field[0], "sig"))
-    rectype = RT_SIG;
-  else if (!strcmp (field[0], "rev"))
-    rectype = RT_REV;
-  else if (!strcmp (field[0], "pub"))
-    rectype = RT_PUB;
-  else if (!strcmp (field[0], "sec"))
-    rectype = RT_SEC;
-  else if (!strcmp (field[0], "crt"))
-    rectype = RT_CRT;
-  else if (!strcmp (field[0], "crs"))
-    rectype = RT_CRS;
-  else if (!strcmp (field[0], "fpr") && key)
-    rectype = RT_FPR;
-  else if (!strcmp (field[0], "grp") && key)
-    rectype = RT_GRP;
-  else if (!strcmp (field[0], "uid") && key)
-    rectype = RT_UID;
-  else if (!strcmp (field[0], "tfs") && key)
-    rectype = RT_TFS;
-  else if (!strcmp (field[0], "sub") && key)
-    rectype = RT_SUB;
-  else if (!strcmp (field[0], "ssb") && key)
-    rectype = RT_SSB;
-  else if (!strcmp (field[0], "spk") && key)
-    rectype = RT_SPK;
-  else
-    rectype = RT_NONE;
-
   /* Only look at signature and trust info records immediately
      following a user ID.  For this, clear the user ID pointer when
      encountering anything but a signature or trust record.  */
@@ -631,6 +745,54 @@ keylist_colon_handler (void *priv, char *line)
   if (rectype != RT_SPK)
     opd->tmp_keysig = NULL;
 
+  /* Skip the records not asked for before splitting them.  The
+     fingerprint and keygrip records of a skipped subkey are skipped
+     as well, and so are the signature and trust records of a skipped
+     user ID by way of TMP_UID.  */
+  if (rectype == RT_SUB || rectype == RT_SSB)
+    opd->skip_subkey = !(opd->fields & KEYLIST_FIELD_SUBKEYS);
+  else if (rectype != RT_FPR && rectype != RT_GRP)
+    opd->skip_subkey = 0;
+  switch (rectype)
+    {
+    case RT_SUB:
+    case RT_SSB:
+      if (opd->skip_subkey)
+        return 0;
+      break;
+    case RT_FPR:
+      if (opd->skip_subkey || !(opd->fields & KEYLIST_FIELD_FPR))
+        return 0;
+      break;
+    case RT_GRP:
+      if (opd->skip_subkey || !(opd->fields & KEYLIST_FIELD_KEYGRIP))
+        return 0;
+      break;
+    case RT_UID:
+      if (!(opd->fields & KEYLIST_FIELD_UIDS))
+        return 0;
+      break;
+    case RT_SIG:
+    case RT_REV:
+      if (!opd->tmp_uid || !(opd->fields & KEYLIST_FIELD_SIGS))
+        return 0;
+      break;
+    case RT_TFS:
+      if (!opd->tmp_uid || !(opd->fields & KEYLIST_FIELD_TOFU))
+        return 0;
+      break;
+    case RT_SPK:
+      if (!opd->tmp_keysig)
+        return 0;
+      break;
+    case RT_NONE:
+      return 0;
+    default:
+      break;
+    }
+
+  fields = _gpgme_split_colon_fields (line, field, NR_FIELDS);
+
   switch (rectype)
     {
     case RT_PUB:
@@ -693,7 +855,7 @@ keylist_colon_handler (void *priv, char *line)
       /* Field 8 has the X.509 serial number.  */
       if (fields >= 8 && (rectype == RT_CRT || rectype == RT_CRS))
 	{
-	  key->issuer_serial = strdup (field[7]);
+	  key->issuer_serial = _gpgme_key_strdup (key, field[7]);
 	  if (!key->issuer_serial)
 	    return gpg_error_from_syserror ();
 	}
@@ -727,7 +889,7 @@ keylist_colon_handler (void *priv, char *line)
       /* Field 17 has the curve name for ECC.  */
       if (fields >= 17 && *field[16])
         {
-          subkey->curve = strdup (field[16]);
+          subkey->curve = _gpgme_key_strdup (key, field[16]);
           if (!subkey->curve)
             return gpg_error_from_syserror ();
         }
@@ -736,7 +898,7 @@ keylist_colon_handler (void *priv, char *line)
       if (fields >= 17 && *field[17])
         PARSE_COMPLIANCE_FLAGS (field[17], subkey);
 
-      if (fields >= 20)
+      if (fields >= 20 && (opd->fields & KEYLIST_FIELD_ORIGIN))
         {
           key->last_update = _gpgme_parse_timestamp_ul (field[18]);
           key->origin = parse_keyorg (field[19]);
@@ -810,7 +972,7 @@ keylist_colon_handler (void *priv, char *line)
       /* Field 17 has the curve name for ECC.  */
       if (fields >= 17 && *field[16])
         {
-          subkey->curve = strdup (field[16]);
+          subkey->curve = _gpgme_key_strdup (key, field[16]);
           if (!subkey->curve)
             return gpg_error_from_syserror ();
         }
@@ -831,7 +993,7 @@ keylist_colon_handler (void *priv, char *line)
           if (field[1])
             set_userid_flags (key, field[1]);
           opd->tmp_uid = key->_last_uid;
-          if (fields >= 20)
+          if (fields >= 20 && (opd->fields & KEYLIST_FIELD_ORIGIN))
             {
               opd->tmp_uid->last_update = _gpgme_parse_timestamp_ul (field[18]);
               opd->tmp_uid->origin = parse_keyorg (field[19]);
@@ -857,7 +1019,7 @@ keylist_colon_handler (void *priv, char *line)
           subkey = key->_last_subkey;
           if (!subkey->fpr)
             {
-              subkey->fpr = strdup (field[9]);
+              subkey->fpr = _gpgme_key_strdup (key, field[9]);
               if (!subkey->fpr)
                 return gpg_error_from_syserror ();
             }
@@ -872,7 +1034,7 @@ keylist_colon_handler (void *priv, char *line)
                 }
               if (!key->fpr)
                 {
-                  key->fpr = strdup (subkey->fpr);
+                  key->fpr = _gpgme_key_strdup (key, subkey->fpr);
                   if (!key->fpr)
                     return gpg_error_from_syserror ();
                 }
@@ -882,7 +1044,7 @@ keylist_colon_handler (void *priv, char *line)
       /* Field 13 has the gpgsm chain ID (take only the first one).  */
       if (fields >= 13 && !key->chain_id && *field[12])
 	{
-	  key->chain_id = strdup (field[12]);
+	  key->chain_id = _gpgme_key_strdup (key, field[12]);
 	  if (!key->chain_id)
 	    return gpg_error_from_syserror ();
 	}
@@ -897,7 +1059,7 @@ keylist_colon_handler (void *priv, char *line)
           subkey = key->_last_subkey;
           if (!subkey->keygrip)
             {
-              subkey->keygrip = strdup (field[9]);
+              subkey->keygrip = _gpgme_key_strdup (key, field[9]);
               if (!subkey->keygrip)
                 return gpg_error_from_syserror ();
             }
@@ -1036,7 +1198,7 @@ _gpgme_op_keylist_event_cb (void *data, gpgme_event_io_t type, void *type_data)
   gpgme_key_t key = (gpgme_key_t) type_data;
   void *hook;
   op_data_t opd;
-  struct key_queue_item_s *q, *q2;
+  struct key_queue_item_s *q;
 
   assert (type == GPGME_EVENT_NEXT_KEY);
 
@@ -1054,16 +1216,636 @@ _gpgme_op_keylist_event_cb (void *data, gpgme_event_io_t type, void *type_data)
     }
   q->key = key;
   q->next = NULL;
-  /* FIXME: Use a tail pointer?  */
-  if (!(q2 = opd->key_queue))
+  if (opd->key_queue_tail)
+    opd->key_queue_tail->next = q;
+  else
     opd->key_queue = q;
+  opd->key_queue_tail = q;
+  opd->key_queue_len++;
+  opd->key_cond = 1;
+
+  /* Stop reading from gpg while the queue is full, so that gpg is
+     blocked by the pipe until the application catches up.  */
+  if (ctx->keylist_queue_depth
+      && opd->key_queue_len >= ctx->keylist_queue_depth)
+    _gpgme_wait_user_hold (ctx, 1);
+}
+
+
+/* Parse the value of the context flag "keylist-fields", a list of
+   the names below separated by commas or spaces, and store the
+   KEYLIST_FIELD_* bits at R_FIELDS.  An empty value or "all" selects
+   everything.  */
+gpgme_error_t
+_gpgme_keylist_parse_fields (const char *value, unsigned int *r_fields)
+{
+  static struct {
+    const char *name;
+    unsigned int bit;
+  } names[] = {
+    { "fpr",     KEYLIST_FIELD_FPR },
+    { "subkeys", KEYLIST_FIELD_SUBKEYS },
+    { "uids",    KEYLIST_FIELD_UIDS },
+    { "sigs",    KEYLIST_FIELD_SIGS },
+    { "tofu",    KEYLIST_FIELD_TOFU },
+    { "keygrip", KEYLIST_FIELD_KEYGRIP },
+    { "origin",  KEYLIST_FIELD_ORIGIN },
+    { "all",     KEYLIST_FIELD_ALL }
+  };
+  unsigned int fields = 0;
+  const char *s;
+  size_t n;
+  int i;
+
+  for (s = value; *s; s += n)
+    {
+      n = strcspn (s, ", ");
+      if (!n)
+        {
+          n = 1;
+          continue;
+        }
+      for (i = 0; i < DIM (names); i++)
+        if (strlen (names[i].name) == n && !strncmp (s, names[i].name, n))
+          break;
+      if (i == DIM (names))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      fields |= names[i].bit;
+    }
+  *r_fields = fields? fields : KEYLIST_FIELD_ALL;
+  return 0;
+}
+
+
+/* Forward declaration.  */
+static gpgme_error_t new_listctx (gpgme_ctx_t ctx, gpgme_ctx_t *r_listctx);
+
+
+/* Return true if a keylist operation of CTX shall be distributed over
+   several engine processes.  */
+static int
+use_shards (gpgme_ctx_t ctx)
+{
+  return (ctx->keylist_shards > 1
+          && ctx->protocol == GPGME_PROTOCOL_OpenPGP
+          && !ctx->io_cbs.add
+          && !(ctx->keylist_mode & GPGME_KEYLIST_MODE_EXTERN));
+}
+
+
+/* Append a copy of PATTERN to the patterns of SHARDS.  */
+static gpgme_error_t
+shards_add_pattern (keylist_shards_t shards, const char *pattern)
+{
+  if (shards->npatterns == shards->patterns_size)
+    {
+      unsigned int n = shards->patterns_size? 2 * shards->patterns_size : 64;
+      char **p;
+
+      p = realloc (shards->patterns, n * sizeof *p);
+      if (!p)
+        return gpg_error_from_syserror ();
+      shards->patterns = p;
+      shards->patterns_size = n;
+    }
+  shards->patterns[shards->npatterns] = strdup (pattern);
+  if (!shards->patterns[shards->npatterns])
+    return gpg_error_from_syserror ();
+  shards->npatterns++;
+  return 0;
+}
+
+
+/* Start the next job of SHARDS, or the listing of the fingerprints,
+   on the worker W.  */
+static gpgme_error_t
+shards_start_job (keylist_shards_t shards, struct keylist_worker_s *w)
+{
+  gpgme_ctx_t ctx = shards->ctx;
+  gpgme_error_t err;
+
+  if (!w->ctx)
+    {
+      err = new_listctx (ctx, &w->ctx);
+      if (err)
+        return err;
+      w->ctx->offline = ctx->offline;
+    }
+
+  if (shards->list_fprs)
+    {
+      w->job = 0;
+      w->ctx->keylist_fields = KEYLIST_FIELD_FPR;
+      err = gpgme_op_keylist_start (w->ctx, NULL, shards->secret_only);
+    }
   else
     {
-      for (; q2->next; q2 = q2->next)
-	;
-      q2->next = q;
+      w->job = shards->next_job++;
+      w->ctx->keylist_fields = ctx->keylist_fields;
+      err = gpgme_op_keylist_ext_start (w->ctx, shards->patv
+                                        + w->job * (shards->job_size + 1),
+                                        shards->secret_only, 0);
     }
-  opd->key_cond = 1;
+  if (!err)
+    err = _gpgme_fd_table_attach (&w->ctx->fdt, shards->pollset);
+  return err;
+}
+
+
+/* Split the patterns of SHARDS into jobs and start the first ones.  */
+static gpgme_error_t
+shards_start_jobs (keylist_shards_t shards)
+{
+  gpgme_error_t err;
+  unsigned int i, j;
+
+  if (!shards->npatterns)
+    return 0;
+
+  shards->job_size = ((shards->npatterns + shards->nworkers - 1)
+                      / shards->nworkers);
+  if (shards->job_size > KEYLIST_SHARD_MAX_PATTERNS)
+    shards->job_size = KEYLIST_SHARD_MAX_PATTERNS;
+  shards->njobs = ((shards->npatterns + shards->job_size - 1)
+                   / shards->job_size);
+
+  shards->patv = malloc ((shards->npatterns + shards->njobs)
+                         * sizeof *shards->patv);
+  if (!shards->patv)
+    return gpg_error_from_syserror ();
+  for (i = j = 0; i < shards->npatterns; i++)
+    {
+      shards->patv[j++] = shards->patterns[i];
+      if (!((i + 1) % shards->job_size) || i + 1 == shards->npatterns)
+        shards->patv[j++] = NULL;
+    }
+
+  for (i = 0; i < shards->nworkers && shards->next_job < shards->njobs; i++)
+    {
+      err = shards_start_job (shards, &shards->workers[i]);
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+/* Start the keylist operation of CTX with OPD for the NULL terminated
+   array PATTERN, which may be NULL for all keys, distributed over the
+   number of engine processes set with the context flag
+   "keylist-shards".  */
+static gpgme_error_t
+shards_start (gpgme_ctx_t ctx, op_data_t opd, const char *pattern[],
+              int secret_only)
+{
+  keylist_shards_t shards;
+  gpgme_error_t err;
+  unsigned int i;
+
+  shards = calloc (1, sizeof *shards + ((ctx->keylist_shards - 1)
+                                        * sizeof shards->workers[0]));
+  if (!shards)
+    return gpg_error_from_syserror ();
+  shards->ctx = ctx;
+  shards->secret_only = secret_only;
+  shards->ordered = ctx->keylist_shards_ordered;
+  shards->nworkers = ctx->keylist_shards;
+  for (i = 0; i < shards->nworkers; i++)
+    shards->workers[i].job = -1;
+  if (_gpgme_io_pollset_new (&shards->pollset))
+    {
+      err = gpg_error_from_syserror ();
+      free (shards);
+      return err;
+    }
+  opd->shards = shards;
+
+  /* Let gpgme_cancel_async wake up shards_wait.  */
+  err = _gpgme_fd_table_attach (&ctx->fdt, shards->pollset);
+  if (err)
+    return err;
+
+  for (i = 0; pattern && pattern[i]; i++)
+    {
+      err = shards_add_pattern (shards, pattern[i]);
+      if (err)
+        return err;
+    }
+  if (i)
+    {
+      err = shards_start_jobs (shards);
+      shards->dedup = shards->njobs > 1;
+      return err;
+    }
+
+  shards->list_fprs = 1;
+  return shards_start_job (shards, &shards->workers[0]);
+}
+
+
+/* Move the keys queued in SRC to the end of the queue of DST.  */
+static void
+take_key_queue (op_data_t dst, op_data_t src)
+{
+  if (!src->key_queue)
+    return;
+  if (dst->key_queue_tail)
+    dst->key_queue_tail->next = src->key_queue;
+  else
+    dst->key_queue = src->key_queue;
+  dst->key_queue_tail = src->key_queue_tail;
+  dst->key_queue_len += src->key_queue_len;
+  src->key_queue = NULL;
+  src->key_queue_tail = NULL;
+  src->key_queue_len = 0;
+  src->key_cond = 0;
+}
+
+
+static unsigned int
+hash_fpr (const char *fpr)
+{
+  unsigned int h = 2166136261;
+
+  for (; *fpr; fpr++)
+    h = (h ^ (unsigned char)*fpr) * 16777619;
+  return h;
+}
+
+
+/* Add the fingerprint FPR to the fingerprints of the keys returned by
+   SHARDS.  R_SEEN is set if it has been added before.  */
+static gpgme_error_t
+shards_add_fpr (keylist_shards_t shards, const char *fpr, int *r_seen)
+{
+  struct keylist_shard_fpr_s *f, *next, **b;
+  unsigned int h = hash_fpr (fpr);
+  unsigned int i, n;
+
+  *r_seen = 0;
+  if (shards->fpr_nbuckets)
+    for (f = shards->fpr_buckets[h & (shards->fpr_nbuckets - 1)]; f;
+         f = f->next)
+      if (!strcmp (f->fpr, fpr))
+        {
+          *r_seen = 1;
+          return 0;
+        }
+
+  if (shards->nfprs >= shards->fpr_nbuckets)
+    {
+      n = shards->fpr_nbuckets? 2 * shards->fpr_nbuckets : 64;
+      b = calloc (n, sizeof *b);
+      if (!b)
+        return gpg_error_from_syserror ();
+      for (i = 0; i < shards->fpr_nbuckets; i++)
+        for (f = shards->fpr_buckets[i]; f; f = next)
+          {
+            next = f->next;
+            f->next = b[hash_fpr (f->fpr) & (n - 1)];
+            b[hash_fpr (f->fpr) & (n - 1)] = f;
+          }
+      free (shards->fpr_buckets);
+      shards->fpr_buckets = b;
+      shards->fpr_nbuckets = n;
+    }
+
+  f = malloc (sizeof *f + strlen (fpr));
+  if (!f)
+    return gpg_error_from_syserror ();
+  strcpy (f->fpr, fpr);
+  b = &shards->fpr_buckets[h & (shards->fpr_nbuckets - 1)];
+  f->next = *b;
+  *b = f;
+  shards->nfprs++;
+  return 0;
+}
+
+
+/* Move the keys queued in WOPD by a worker of SHARDS to the end of
+   the queue of OPD, leaving out the keys returned before.  */
+static gpgme_error_t
+shards_take_keys (keylist_shards_t shards, op_data_t opd, op_data_t wopd)
+{
+  struct key_queue_item_s *q, *next;
+  gpgme_error_t err = 0;
+  int seen;
+
+  if (!shards->dedup)
+    {
+      take_key_queue (opd, wopd);
+      return 0;
+    }
+
+  for (q = wopd->key_queue; q; q = next)
+    {
+      next = q->next;
+      seen = 0;
+      if (!err && q->key->subkeys && q->key->subkeys->fpr)
+        err = shards_add_fpr (shards, q->key->subkeys->fpr, &seen);
+      if (err || seen)
+        {
+          gpgme_key_unref (q->key);
+          free (q);
+          continue;
+        }
+      q->next = NULL;
+      if (opd->key_queue_tail)
+        opd->key_queue_tail->next = q;
+      else
+        opd->key_queue = q;
+      opd->key_queue_tail = q;
+      opd->key_queue_len++;
+    }
+  wopd->key_queue = NULL;
+  wopd->key_queue_tail = NULL;
+  wopd->key_queue_len = 0;
+  wopd->key_cond = 0;
+  return err;
+}
+
+
+/* The job of the worker W, whose operation data is WOPD, finished.
+   Add its result to OPD.  */
+static void
+shards_finish_job (struct keylist_worker_s *w, op_data_t wopd, op_data_t opd)
+{
+  struct gpgme_io_event_done_data data;
+
+  data.err = 0;
+  data.op_err = 0;
+  _gpgme_engine_io_event (w->ctx->engine, GPGME_EVENT_DONE, &data);
+
+  if (wopd->result.truncated)
+    opd->result.truncated = 1;
+  if (!opd->keydb_search_err)
+    opd->keydb_search_err = wopd->keydb_search_err;
+  w->job = -1;
+}
+
+
+/* Return the operation data of the worker W at R_WOPD.  */
+static gpgme_error_t
+worker_op_data (struct keylist_worker_s *w, op_data_t *r_wopd)
+{
+  gpgme_error_t err;
+  void *hook;
+
+  err = _gpgme_op_data_lookup (w->ctx, OPDATA_KEYLIST, &hook, -1, NULL);
+  if (!err && !hook)
+    err = gpg_error (GPG_ERR_INTERNAL);
+  *r_wopd = hook;
+  return err;
+}
+
+
+/* Collect the fingerprints listed by the first worker of SHARDS.
+   Start the jobs when the listing finished.  */
+static gpgme_error_t
+shards_collect_fprs (keylist_shards_t shards, op_data_t opd)
+{
+  struct keylist_worker_s *w = &shards->workers[0];
+  struct key_queue_item_s *q, *next;
+  gpgme_error_t err;
+  op_data_t wopd;
+
+  err = worker_op_data (w, &wopd);
+  if (err)
+    return err;
+
+  for (q = wopd->key_queue; q; q = next)
+    {
+      next = q->next;
+      if (!err && q->key->subkeys && q->key->subkeys->fpr)
+        err = shards_add_pattern (shards, q->key->subkeys->fpr);
+      gpgme_key_unref (q->key);
+      free (q);
+    }
+  wopd->key_queue = NULL;
+  wopd->key_queue_tail = NULL;
+  wopd->key_queue_len = 0;
+  wopd->key_cond = 0;
+  if (err || w->ctx->fdt.count)
+    return err;
+
+  shards_finish_job (w, wopd, opd);
+  shards->list_fprs = 0;
+  return shards_start_jobs (shards);
+}
+
+
+/* Move the keys listed by the workers of SHARDS to the queue of OPD.
+   Start the next jobs on the workers whose job finished.  */
+static gpgme_error_t
+shards_collect (keylist_shards_t shards, op_data_t opd)
+{
+  struct keylist_worker_s *w;
+  gpgme_error_t err;
+  op_data_t wopd;
+  unsigned int i;
+  int again;
+
+  if (shards->list_fprs)
+    return shards_collect_fprs (shards, opd);
+
+  do
+    {
+      again = 0;
+      for (i = 0; i < shards->nworkers; i++)
+        {
+          w = &shards->workers[i];
+          if (w->job < 0
+              || (shards->ordered && w->job != shards->out_job))
+            continue;
+
+          err = worker_op_data (w, &wopd);
+          if (err)
+            return err;
+          err = shards_take_keys (shards, opd, wopd);
+          if (err)
+            return err;
+          if (w->ctx->fdt.count)
+            continue;
+
+          /* In ordered mode the next job may have finished already.  */
+          shards_finish_job (w, wopd, opd);
+          if (shards->ordered)
+            {
+              shards->out_job++;
+              again = 1;
+            }
+          if (shards->next_job < shards->njobs)
+            {
+              err = shards_start_job (shards, w);
+              if (err)
+                return err;
+            }
+        }
+    }
+  while (again);
+
+  return 0;
+}
+
+
+/* Return true if all jobs of SHARDS finished.  */
+static int
+shards_done (keylist_shards_t shards)
+{
+  unsigned int i;
+
+  if (shards->list_fprs || shards->next_job < shards->njobs)
+    return 0;
+  for (i = 0; i < shards->nworkers; i++)
+    if (shards->workers[i].job >= 0)
+      return 0;
+  return 1;
+}
+
+
+/* Wait until keys are queued in OPD or the distributed keylist
+   operation of CTX finished.  */
+static gpgme_error_t
+shards_wait (gpgme_ctx_t ctx, op_data_t opd)
+{
+  keylist_shards_t shards = opd->shards;
+  struct keylist_worker_s *w;
+  gpgme_error_t err;
+  unsigned int i;
+
+  if (shards->err)
+    return shards->err;
+
+  for (;;)
+    {
+      err = shards_collect (shards, opd);
+      if (err || opd->key_queue || shards_done (shards))
+        break;
+      err = _gpgme_wait_on_pollset (ctx, shards->pollset);
+      if (err)
+        break;
+    }
+
+  if (err || shards_done (shards))
+    {
+      /* The workers are not needed anymore.  */
+      for (i = 0; i < shards->nworkers; i++)
+        {
+          w = &shards->workers[i];
+          if (w->job >= 0 && gpg_err_code (err) == GPG_ERR_TIMEOUT)
+            _gpgme_engine_kill (w->ctx->engine);
+          gpgme_release (w->ctx);
+          w->ctx = NULL;
+          w->job = -1;
+        }
+      shards->err = err;
+    }
+  return err;
+}
+
+
+/* Return the keylist mode to pass to the engine for CTX.  Options
+   which only add records not selected with the context flag
+   "keylist-fields" are removed.  */
+static gpgme_keylist_mode_t
+engine_keylist_mode (gpgme_ctx_t ctx)
+{
+  gpgme_keylist_mode_t mode = ctx->keylist_mode;
+
+  if (!(ctx->keylist_fields & KEYLIST_FIELD_UIDS))
+    mode &= ~(GPGME_KEYLIST_MODE_SIGS | GPGME_KEYLIST_MODE_SIG_NOTATIONS
+              | GPGME_KEYLIST_MODE_WITH_TOFU);
+  if (!(ctx->keylist_fields & KEYLIST_FIELD_SIGS))
+    mode &= ~(GPGME_KEYLIST_MODE_SIGS | GPGME_KEYLIST_MODE_SIG_NOTATIONS);
+  if (!(ctx->keylist_fields & KEYLIST_FIELD_TOFU))
+    mode &= ~GPGME_KEYLIST_MODE_WITH_TOFU;
+  return mode;
+}
+
+
+/* Return true if a keylist operation of CTX shall read the keybox
+   of gpg.  Secret keys, signatures, validity and TOFU information
+   are only listed by gpg.  */
+static int
+use_keybox (gpgme_ctx_t ctx, int secret_only)
+{
+  return (ctx->keylist_keybox
+          && ctx->protocol == GPGME_PROTOCOL_OpenPGP
+          && !secret_only
+          && !ctx->io_cbs.add
+          && !(engine_keylist_mode (ctx)
+               & (GPGME_KEYLIST_MODE_EXTERN | GPGME_KEYLIST_MODE_SIGS
+                  | GPGME_KEYLIST_MODE_SIG_NOTATIONS
+                  | GPGME_KEYLIST_MODE_WITH_SECRET
+                  | GPGME_KEYLIST_MODE_WITH_TOFU
+                  | GPGME_KEYLIST_MODE_VALIDATE)));
+}
+
+
+/* Prepare the listing of the keys matching the NULL terminated array
+   PATTERN from the keybox.  Returns GPG_ERR_NOT_SUPPORTED if gpg has
+   to be used instead.  */
+static gpgme_error_t
+keybox_start (gpgme_ctx_t ctx, op_data_t opd, const char *pattern[])
+{
+  struct _gpgme_keybox *kbx;
+  gpgme_error_t err;
+
+  err = _gpgme_keybox_open (ctx, !!(ctx->keylist_mode
+                                    & GPGME_KEYLIST_MODE_EPHEMERAL), &kbx);
+  for (; !err && pattern && *pattern; pattern++)
+    if (**pattern)
+      err = _gpgme_keybox_add_pattern (kbx, *pattern);
+  if (err)
+    {
+      TRACE (DEBUG_CTX, "keybox_start", ctx, "not using the keybox: %s",
+             gpgme_strerror (err));
+      _gpgme_keybox_release (kbx);
+      return err;
+    }
+
+  opd->keybox = kbx;
+  opd->fields = ctx->keylist_fields;
+  return 0;
+}
+
+
+/* Get the next key of a keylist operation which reads the keybox.
+   Keys not supported by the keybox reader are listed with gpg.  */
+static gpgme_error_t
+keybox_next (gpgme_ctx_t ctx, op_data_t opd, gpgme_key_t *r_key)
+{
+  gpgme_error_t err;
+  gpgme_key_t key;
+  char fpr[41];
+
+  for (;;)
+    {
+      err = _gpgme_keybox_next (opd->keybox, opd->fields, r_key, fpr);
+      if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        break;
+
+      if (!opd->keybox_listctx)
+        {
+          err = new_listctx (ctx, &opd->keybox_listctx);
+          if (err)
+            return err;
+          opd->keybox_listctx->offline = ctx->offline;
+          opd->keybox_listctx->keylist_fields = ctx->keylist_fields;
+        }
+      err = gpgme_op_keylist_start (opd->keybox_listctx, fpr, 0);
+      if (!err)
+        err = gpgme_op_keylist_next (opd->keybox_listctx, r_key);
+      if (gpg_err_code (err) == GPG_ERR_EOF)
+        continue;  /* Not listed by gpg either.  */
+      if (!err)
+        while (!gpgme_op_keylist_next (opd->keybox_listctx, &key))
+          gpgme_key_unref (key);
+      return err;
+    }
+  if (!err)
+    (*r_key)->keylist_mode = ctx->keylist_mode;
+  return err;
 }
 
 
@@ -1101,11 +1883,26 @@ gpgme_op_keylist_start (gpgme_ctx_t ctx, const char *pattern, int secret_only)
   if (err)
     return TRACE_ERR (err);
 
+  if (use_keybox (ctx, secret_only))
+    {
+      const char *patv[2];
+
+      patv[0] = pattern;
+      patv[1] = NULL;
+      err = keybox_start (ctx, opd, patv);
+      if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        return TRACE_ERR (err);
+    }
+
+  if (use_shards (ctx) && (!pattern || !*pattern))
+    return TRACE_ERR (shards_start (ctx, opd, NULL, secret_only));
+
   if (ctx->offline)
     flags |= GPGME_ENGINE_FLAG_OFFLINE;
 
+  opd->fields = ctx->keylist_fields;
   err = _gpgme_engine_op_keylist (ctx->engine, pattern, secret_only,
-				  ctx->keylist_mode, flags);
+				  engine_keylist_mode (ctx), flags);
   return TRACE_ERR (err);
 }
 
@@ -1144,11 +1941,23 @@ gpgme_op_keylist_ext_start (gpgme_ctx_t ctx, const char *pattern[],
   if (err)
     return TRACE_ERR (err);
 
+  if (use_keybox (ctx, secret_only) && !reserved)
+    {
+      err = keybox_start (ctx, opd, pattern);
+      if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        return TRACE_ERR (err);
+    }
+
+  if (use_shards (ctx) && !reserved
+      && (!pattern || !pattern[0] || pattern[1]))
+    return TRACE_ERR (shards_start (ctx, opd, pattern, secret_only));
+
   if (ctx->offline)
     flags |= GPGME_ENGINE_FLAG_OFFLINE;
 
+  opd->fields = ctx->keylist_fields;
   err = _gpgme_engine_op_keylist_ext (ctx->engine, pattern, secret_only,
-				      reserved, ctx->keylist_mode,
+				      reserved, engine_keylist_mode (ctx),
 				      flags);
   return TRACE_ERR (err);
 }
@@ -1185,6 +1994,7 @@ gpgme_op_keylist_from_data_start (gpgme_ctx_t ctx, gpgme_data_t data,
   if (err)
     return TRACE_ERR (err);
 
+  opd->fields = ctx->keylist_fields;
   err = _gpgme_engine_op_keylist_data (ctx->engine, data);
   return TRACE_ERR (err);
 }
@@ -1214,6 +2024,33 @@ gpgme_op_keylist_next (gpgme_ctx_t ctx, gpgme_key_t *r_key)
   if (opd == NULL)
     return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
 
+  if (!opd->key_queue && ctx->keylist_queue_depth && ctx->io_cbs.add)
+    {
+      /* The keys are read by the user event loop.  */
+      if (ctx->fdt.count)
+        return TRACE_ERR (gpg_error (GPG_ERR_EAGAIN));
+      return TRACE_ERR (opd->keydb_search_err? opd->keydb_search_err
+                        /**/                 : gpg_error (GPG_ERR_EOF));
+    }
+  if (opd->keybox)
+    {
+      err = keybox_next (ctx, opd, r_key);
+      if (err)
+        return TRACE_ERR (err);
+      TRACE_SUC ("key=%p (%s)", *r_key,
+                 (*r_key)->subkeys->fpr? (*r_key)->subkeys->fpr : "-");
+      return 0;
+    }
+  if (!opd->key_queue && opd->shards)
+    {
+      err = shards_wait (ctx, opd);
+      if (err)
+        return TRACE_ERR (err);
+
+      if (!opd->key_queue)
+	return TRACE_ERR (opd->keydb_search_err? opd->keydb_search_err
+                          /**/                 : gpg_error (GPG_ERR_EOF));
+    }
   if (!opd->key_queue)
     {
       err = _gpgme_wait_on_condition (ctx, &opd->key_cond, NULL);
@@ -1230,7 +2067,21 @@ gpgme_op_keylist_next (gpgme_ctx_t ctx, gpgme_key_t *r_key)
   queue_item = opd->key_queue;
   opd->key_queue = queue_item->next;
   if (!opd->key_queue)
-    opd->key_cond = 0;
+    {
+      opd->key_queue_tail = NULL;
+      opd->key_cond = 0;
+    }
+  opd->key_queue_len--;
+
+  /* Resume reading when half of the queue has been consumed.  If
+     that fails the operation is canceled, which the application
+     learns from the done event.  */
+  if (ctx->fdt.held && opd->key_queue_len <= ctx->keylist_queue_depth / 2)
+    {
+      err = _gpgme_wait_user_hold (ctx, 0);
+      if (err)
+        _gpgme_cancel_with_err (ctx, err, 0);
+    }
 
   *r_key = queue_item->key;
   free (queue_item);
@@ -1255,6 +2106,37 @@ gpgme_op_keylist_end (gpgme_ctx_t ctx)
 }
 
 
+/* Create a context for listing keys on behalf of CTX and store it at
+   R_LISTCTX.  */
+static gpgme_error_t
+new_listctx (gpgme_ctx_t ctx, gpgme_ctx_t *r_listctx)
+{
+  gpgme_ctx_t listctx;
+  gpgme_protocol_t proto;
+  gpgme_engine_info_t info;
+  gpgme_error_t err;
+
+  /* FIXME: We use our own context because we have to avoid the user's
+     I/O callback handlers.  */
+  err = gpgme_new (&listctx);
+  if (err)
+    return err;
+
+  /* Clone the relevant state.  */
+  proto = gpgme_get_protocol (ctx);
+  gpgme_set_protocol (listctx, proto);
+  gpgme_set_keylist_mode (listctx, gpgme_get_keylist_mode (ctx));
+  info = gpgme_ctx_get_engine_info (ctx);
+  while (info && info->protocol != proto)
+    info = info->next;
+  if (info)
+    gpgme_ctx_set_engine_info (listctx, proto,
+                               info->file_name, info->home_dir);
+  *r_listctx = listctx;
+  return 0;
+}
+
+
 /* Get the key with the fingerprint FPR from the crypto backend.  If
    SECRET is true, get the secret key.  */
 gpgme_error_t
@@ -1264,6 +2146,8 @@ gpgme_get_key (gpgme_ctx_t ctx, const char *fpr, gpgme_key_t *r_key,
   gpgme_ctx_t listctx;
   gpgme_error_t err;
   gpgme_key_t result, key;
+  struct _gpgme_keycache_stamp stamp;
+  int use_cache;
 
   TRACE_BEG  (DEBUG_CTX, "gpgme_get_key", ctx,
 	      "fpr=%s, secret=%i", fpr, secret);
@@ -1277,26 +2161,26 @@ gpgme_get_key (gpgme_ctx_t ctx, const char *fpr, gpgme_key_t *r_key,
   if (strlen (fpr) < 8)	/* We have at least a key ID.  */
     return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
 
-  /* FIXME: We use our own context because we have to avoid the user's
-     I/O callback handlers.  */
-  err = gpgme_new (&listctx);
+  /* Keys looked up on the network are not cached, nor are TOFU
+     statistics, which gpg updates with each verification.  */
+  secret = !!secret;
+  use_cache = (ctx->key_cache
+               && !(ctx->keylist_mode & (GPGME_KEYLIST_MODE_EXTERN
+                                         | GPGME_KEYLIST_MODE_WITH_TOFU)));
+  if (use_cache)
+    {
+      *r_key = _gpgme_keycache_get (ctx, fpr, secret, &stamp);
+      if (*r_key)
+        {
+          TRACE_LOG  ("key=%p (cached)", *r_key);
+          return TRACE_ERR (0);
+        }
+    }
+
+  err = new_listctx (ctx, &listctx);
   if (err)
     return TRACE_ERR (err);
-  {
-    gpgme_protocol_t proto;
-    gpgme_engine_info_t info;
-
-    /* Clone the relevant state.  */
-    proto = gpgme_get_protocol (ctx);
-    gpgme_set_protocol (listctx, proto);
-    gpgme_set_keylist_mode (listctx, gpgme_get_keylist_mode (ctx));
-    info = gpgme_ctx_get_engine_info (ctx);
-    while (info && info->protocol != proto)
-      info = info->next;
-    if (info)
-      gpgme_ctx_set_engine_info (listctx, proto,
-				 info->file_name, info->home_dir);
-  }
+  listctx->keylist_keybox = ctx->keylist_keybox;
 
   err = gpgme_op_keylist_start (listctx, fpr, secret);
   if (!err)
@@ -1335,6 +2219,8 @@ gpgme_get_key (gpgme_ctx_t ctx, const char *fpr, gpgme_key_t *r_key,
   gpgme_release (listctx);
   if (! err)
     {
+      if (use_cache)
+        _gpgme_keycache_put (ctx, fpr, secret, result, &stamp);
       *r_key = result;
       TRACE_LOG  ("key=%p (%s)", *r_key,
 		  ((*r_key)->subkeys && (*r_key)->subkeys->fpr) ?
@@ -1342,3 +2228,200 @@ gpgme_get_key (gpgme_ctx_t ctx, const char *fpr, gpgme_key_t *r_key,
     }
   return TRACE_ERR (err);
 }
+
+
+/* The state of one name in gpgme_get_keys.  */
+struct get_keys_item_s
+{
+  /* The name as an upper case fingerprint or key ID.  */
+  char hex[65];
+  size_t hexlen;
+
+  /* True if the name is looked up with the engine.  */
+  int pending;
+
+  /* True if the name matches more than one key.  */
+  int ambiguous;
+
+  struct _gpgme_keycache_stamp stamp;
+};
+
+
+/* Store NAME, a fingerprint or key ID in hex with an optional "0x"
+   prefix, in upper case at ITEM.  Return false if NAME is something
+   else.  */
+static int
+get_keys_hex_name (const char *name, struct get_keys_item_s *item)
+{
+  size_t n;
+
+  if (name[0] == '0' && (name[1] == 'x' || name[1] == 'X'))
+    name += 2;
+  for (n = 0; name[n] && n < sizeof item->hex - 1; n++)
+    {
+      if (!isxdigit ((unsigned char)name[n]))
+        return 0;
+      item->hex[n] = toupper ((unsigned char)name[n]);
+    }
+  if (name[n] || (n != 8 && n != 16 && n != 32 && n != 40 && n != 64))
+    return 0;
+  item->hex[n] = 0;
+  item->hexlen = n;
+  return 1;
+}
+
+
+/* Return true if the fingerprint or key ID of ITEM is one of the
+   subkeys of KEY.  */
+static int
+get_keys_match (struct get_keys_item_s *item, gpgme_key_t key)
+{
+  gpgme_subkey_t subkey;
+
+  for (subkey = key->subkeys; subkey; subkey = subkey->next)
+    {
+      if (item->hexlen >= 32)
+        {
+          if (subkey->fpr && !strcmp (subkey->fpr, item->hex))
+            return 1;
+        }
+      else if (subkey->keyid && strlen (subkey->keyid) == 16
+               && !strcmp (subkey->keyid + 16 - item->hexlen, item->hex))
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Get the keys for the NULL terminated array of fingerprints or key
+   IDs NAMES from the crypto backend.  If SECRET is true, get the
+   secret keys.  The key for NAMES[i] is stored at R_KEYS[i] and the
+   error for it at R_ERRS[i] if R_ERRS is not NULL; a missing key
+   yields GPG_ERR_EOF and a name which matches several keys
+   GPG_ERR_AMBIGUOUS_NAME, just like gpgme_get_key.  All fingerprints
+   and key IDs are looked up with one engine process; other names are
+   passed to gpgme_get_key.  */
+gpgme_error_t
+gpgme_get_keys (gpgme_ctx_t ctx, const char *names[], int secret,
+                gpgme_key_t r_keys[], gpgme_error_t r_errs[])
+{
+  gpgme_error_t err = 0;
+  gpgme_ctx_t listctx = NULL;
+  struct get_keys_item_s *items = NULL;
+  const char **patterns = NULL;
+  gpgme_key_t key;
+  int use_cache;
+  int i, n, npatterns;
+
+  TRACE_BEG  (DEBUG_CTX, "gpgme_get_keys", ctx, "secret=%i", secret);
+
+  if (!ctx || !names || !r_keys)
+    return TRACE_ERR (gpg_error (GPG_ERR_INV_VALUE));
+
+  for (n = 0; names[n]; n++)
+    {
+      r_keys[n] = NULL;
+      if (r_errs)
+        r_errs[n] = 0;
+    }
+  if (!n)
+    return TRACE_ERR (0);
+
+  items = calloc (n, sizeof *items);
+  patterns = calloc (n + 1, sizeof *patterns);
+  if (!items || !patterns)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  secret = !!secret;
+  use_cache = (ctx->key_cache
+               && !(ctx->keylist_mode & (GPGME_KEYLIST_MODE_EXTERN
+                                         | GPGME_KEYLIST_MODE_WITH_TOFU)));
+  npatterns = 0;
+  for (i = 0; i < n; i++)
+    {
+      if (!get_keys_hex_name (names[i], &items[i]))
+        {
+          err = gpgme_get_key (ctx, names[i], &r_keys[i], secret);
+          if (r_errs)
+            r_errs[i] = err;
+          err = 0;
+          continue;
+        }
+      if (use_cache)
+        {
+          r_keys[i] = _gpgme_keycache_get (ctx, names[i], secret,
+                                           &items[i].stamp);
+          if (r_keys[i])
+            continue;
+        }
+      items[i].pending = 1;
+      patterns[npatterns++] = names[i];
+    }
+  TRACE_LOG  ("%i names, %i looked up with the engine", n, npatterns);
+  if (!npatterns)
+    goto leave;
+
+  err = new_listctx (ctx, &listctx);
+  if (err)
+    goto leave;
+  listctx->keylist_keybox = ctx->keylist_keybox;
+  err = gpgme_op_keylist_ext_start (listctx, patterns, secret, 0);
+  while (!err && !(err = gpgme_op_keylist_next (listctx, &key)))
+    {
+      for (i = 0; i < n; i++)
+        {
+          if (!items[i].pending || !get_keys_match (&items[i], key))
+            continue;
+          if (!r_keys[i])
+            {
+              gpgme_key_ref (key);
+              r_keys[i] = key;
+            }
+          else if (!r_keys[i]->subkeys || !r_keys[i]->subkeys->fpr
+                   || !key->subkeys || !key->subkeys->fpr
+                   || strcmp (r_keys[i]->subkeys->fpr, key->subkeys->fpr))
+            items[i].ambiguous = 1;
+        }
+      gpgme_key_unref (key);
+    }
+  if (gpgme_err_code (err) == GPG_ERR_EOF)
+    err = 0;
+  if (err)
+    goto leave;
+
+  for (i = 0; i < n; i++)
+    {
+      if (!items[i].pending)
+        continue;
+      if (items[i].ambiguous)
+        {
+          gpgme_key_unref (r_keys[i]);
+          r_keys[i] = NULL;
+          if (r_errs)
+            r_errs[i] = gpg_error (GPG_ERR_AMBIGUOUS_NAME);
+        }
+      else if (!r_keys[i])
+        {
+          if (r_errs)
+            r_errs[i] = gpg_error (GPG_ERR_EOF);
+        }
+      else if (use_cache)
+        _gpgme_keycache_put (ctx, names[i], secret, r_keys[i],
+                             &items[i].stamp);
+    }
+
+ leave:
+  if (err)
+    for (i = 0; i < n; i++)
+      {
+        gpgme_key_unref (r_keys[i]);
+        r_keys[i] = NULL;
+      }
+  gpgme_release (listctx);
+  free (patterns);
+  free (items);
+  return TRACE_ERR (err);
+}
@@ -157,6 +157,7 @@ keysign_start (gpgme_ctx_t ctx, int synchronous,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   if (!key)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -97,6 +97,8 @@ _gpgme_op_reset (gpgme_ctx_t ctx, int type)
   ctx->canceled = 0;
   ctx->redraw_suggested = 0;
   UNLOCK (ctx->lock);
+  ctx->deadline = (ctx->timeout_ms
+                   ? _gpgme_get_monotonic_ms () + ctx->timeout_ms : 0);
 
   if (ctx->engine && no_reset)
     reuse_engine = 1;
@@ -40,6 +40,8 @@ gpgme_error_t _gpgme_wait_one (gpgme_ctx_t ctx);
 gpgme_error_t _gpgme_wait_one_ext (gpgme_ctx_t ctx, gpgme_error_t *op_err);
 gpgme_error_t _gpgme_wait_on_condition (gpgme_ctx_t ctx, volatile int *cond,
 					gpgme_error_t *op_err);
+gpgme_error_t _gpgme_wait_on_pollset (gpgme_ctx_t ctx,
+                                      struct io_pollset_s *ps);
 
 
 /* From data.c.  */
@@ -140,6 +142,8 @@ gpgme_error_t _gpgme_progress_status_handler (void *priv,
 
 /* From key.c.  */
 gpgme_error_t _gpgme_key_new (gpgme_key_t *r_key);
+void *_gpgme_key_alloc (gpgme_key_t key, size_t size);
+char *_gpgme_key_strdup (gpgme_key_t key, const char *string);
 gpgme_error_t _gpgme_key_add_subkey (gpgme_key_t key,
 				     gpgme_subkey_t *r_subkey);
 gpgme_error_t _gpgme_key_append_name (gpgme_key_t key,
@@ -151,8 +155,42 @@ gpgme_key_sig_t _gpgme_key_add_sig (gpgme_key_t key, char *src);
 /* From keylist.c.  */
 void _gpgme_op_keylist_event_cb (void *data, gpgme_event_io_t type,
 				 void *type_data);
+gpgme_error_t _gpgme_keylist_parse_fields (const char *value,
+                                           unsigned int *r_fields);
 
 
+/* From keycache.c.  */
+
+/* The state of the cache when a key was looked up.  */
+struct _gpgme_keycache_stamp
+{
+  unsigned long generation;
+  unsigned long long files;
+};
+
+int _gpgme_keycache_set_size (const char *value);
+void _gpgme_keycache_invalidate (void);
+gpgme_key_t _gpgme_keycache_get (gpgme_ctx_t ctx, const char *name,
+                                 int secret,
+                                 struct _gpgme_keycache_stamp *r_stamp);
+void _gpgme_keycache_put (gpgme_ctx_t ctx, const char *name, int secret,
+                          gpgme_key_t key,
+                          const struct _gpgme_keycache_stamp *stamp);
+
+
+/* From keybox.c.  */
+struct _gpgme_keybox;
+
+gpgme_error_t _gpgme_keybox_open (gpgme_ctx_t ctx, int ephemeral,
+                                  struct _gpgme_keybox **r_kbx);
+void _gpgme_keybox_release (struct _gpgme_keybox *kbx);
+gpgme_error_t _gpgme_keybox_add_pattern (struct _gpgme_keybox *kbx,
+                                         const char *pattern);
+gpgme_error_t _gpgme_keybox_next (struct _gpgme_keybox *kbx,
+                                  unsigned int fields, gpgme_key_t *r_key,
+                                  char r_fpr[41]);
+
+
 /* From trust-item.c.  */
 
 /* Create a new trust item.  */
@@ -0,0 +1,1198 @@
+/* pollset.c - Persistent readiness sets for the event loops.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifndef HAVE_W32_SYSTEM
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+# include <sys/eventfd.h>
+#endif
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+# include <sys/epoll.h>
+# define USE_EPOLL 1
+#endif
+#if defined(HAVE_POLL_H) && !defined(HAVE_W32_SYSTEM)
+# include <poll.h>
+# define USE_POLL 1
+#endif
+#if defined(HAVE_LINUX_IO_URING_H) && defined(USE_POLL)
+# include <stdint.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+# if defined(__NR_io_uring_setup) && defined(IORING_FEAT_EXT_ARG)
+#  define USE_IO_URING 1
+# endif
+#endif
+
+#include "util.h"
+#include "priv-io.h"
+#include "sema.h"
+#include "debug.h"
+
+
+/* A readiness set keeps the file descriptors registered with it
+   across calls to _gpgme_io_pollset_wait, so that the event loops
+   only need to tell it about changes.  Each registration carries an
+   opaque value which is returned with the ready fds; the registry
+   mapping fds to these values is a table indexed by the fd, so that
+   dispatching a ready fd does not need to search anything.  The
+   actual waiting is done by a backend:
+
+   "epoll" - Linux only.  The registrations live in the kernel and
+             each change is a single epoll_ctl call.
+
+   "io_uring" - Linux 5.11 or later; only used if requested.  Each
+             registration is a one-shot poll request which is re-armed
+             after it fired.  Arming and waiting are done with a
+             single system call and the results are read from shared
+             memory.
+
+   "poll"  - Portable fallback.  The registrations are kept in a
+             table which is handed to poll(2) or, where that is not
+             available, to _gpgme_io_select.
+
+   The add and del functions of the backends are called with the lock
+   of the readiness set held.
+
+   Each readiness set also watches an internal wakeup fd (an eventfd
+   or a self-pipe), so that another thread can interrupt a wait, for
+   example to cancel an operation.  */
+struct pollset_backend_s
+{
+  const char *name;
+  int (*create) (io_pollset_t ps);
+  void (*release) (io_pollset_t ps);
+  int (*add) (io_pollset_t ps, int fd, int for_write);
+  int (*del) (io_pollset_t ps, int fd);
+  int (*wait) (io_pollset_t ps, struct io_select_fd_s *fds, size_t nfds,
+               int timeout);
+
+  /* True if a running wait does not see fds added meanwhile, so that
+     it must be woken up to pick them up.  */
+  int wake_on_add;
+};
+
+/* An entry of the registry.  */
+struct pollset_slot_s
+{
+  void *opaque;
+  unsigned int used : 1;
+  unsigned int for_write : 1;
+
+  /* The index into the table of the "poll" backend.  */
+  size_t idx;
+
+  /* For the "io_uring" backend: ARMED is set while a poll request is
+     in flight and ARM_PENDING while the fd is queued for arming.  GEN
+     tells the completions of different registrations apart.  */
+  unsigned int armed : 1;
+  unsigned int arm_pending : 1;
+  unsigned int gen;
+};
+
+struct uring_s;
+
+struct io_pollset_s
+{
+  const struct pollset_backend_s *backend;
+
+  /* Protects the registry and the table of the "poll" backend.  The
+     kernel based backends don't need it for the actual waiting.  */
+  DECLARE_LOCK (lock);
+
+  /* The number of registered file descriptors.  */
+  size_t count;
+
+  /* The number of threads in _gpgme_io_pollset_wait.  */
+  int waiters;
+
+  /* The wakeup fd is read from WAKEFD[0] and written to WAKEFD[1],
+     which are the same for an eventfd.  It has a slot in the
+     registry but is not counted.  */
+  int wakefd[2];
+
+  /* The registry, indexed by the fd.  */
+  struct pollset_slot_s *slots;
+  size_t nslots;
+
+  /* The table used by the "poll" backend.  */
+  struct io_select_fd_s *items;
+  size_t nitems;
+  size_t size;
+
+  /* The epoll descriptor used by the "epoll" backend.  */
+  int epfd;
+
+  /* The state of the "io_uring" backend.  */
+  struct uring_s *uring;
+};
+
+
+
+/* The "poll" backend.  */
+
+static int
+poll_create (io_pollset_t ps)
+{
+  ps->items = NULL;
+  ps->nitems = 0;
+  ps->size = 0;
+  return 0;
+}
+
+
+static void
+poll_release (io_pollset_t ps)
+{
+  free (ps->items);
+  ps->items = NULL;
+  ps->nitems = 0;
+  ps->size = 0;
+}
+
+
+static int
+poll_add (io_pollset_t ps, int fd, int for_write)
+{
+  if (ps->nitems == ps->size)
+    {
+      struct io_select_fd_s *newitems;
+      size_t newsize = ps->size + 16;
+
+      newitems = realloc (ps->items, newsize * sizeof *newitems);
+      if (!newitems)
+        return -1;
+      ps->items = newitems;
+      ps->size = newsize;
+    }
+  ps->items[ps->nitems].fd = fd;
+  ps->items[ps->nitems].for_read = !for_write;
+  ps->items[ps->nitems].for_write = !!for_write;
+  ps->items[ps->nitems].signaled = 0;
+  ps->items[ps->nitems].opaque = NULL;
+  ps->slots[fd].idx = ps->nitems;
+  ps->nitems++;
+  return 0;
+}
+
+
+static int
+poll_del (io_pollset_t ps, int fd)
+{
+  size_t i = ps->slots[fd].idx;
+
+  /* The order of the table does not matter; fill the hole with the
+     last entry.  */
+  ps->nitems--;
+  if (i != ps->nitems)
+    {
+      ps->items[i] = ps->items[ps->nitems];
+      ps->slots[ps->items[i].fd].idx = i;
+    }
+  return 0;
+}
+
+
+#ifdef USE_POLL
+static int
+poll_wait (io_pollset_t ps, struct io_select_fd_s *fds, size_t nfds,
+           int timeout)
+{
+  struct pollfd stackbuf[32];
+  struct pollfd *pfds;
+  size_t count, i;
+  int nr, n;
+
+  /* Another thread may change the table while we are waiting, so we
+     wait on a copy.  */
+  LOCK (ps->lock);
+  count = ps->nitems;
+  if (count <= DIM (stackbuf))
+    pfds = stackbuf;
+  else
+    {
+      pfds = malloc (count * sizeof *pfds);
+      if (!pfds)
+        {
+          UNLOCK (ps->lock);
+          return -1;
+        }
+    }
+  for (i = 0; i < count; i++)
+    {
+      pfds[i].fd = ps->items[i].fd;
+      pfds[i].events = ps->items[i].for_write? POLLOUT : POLLIN;
+      pfds[i].revents = 0;
+    }
+  UNLOCK (ps->lock);
+
+  do
+    nr = poll (pfds, count, timeout);
+  while (nr < 0 && errno == EINTR);
+
+  for (n = 0, i = 0; nr > 0 && i < count && n < nfds; i++)
+    if (pfds[i].revents)
+      {
+        /* Like select we report hangups and errors as readiness, so
+           that the handler sees EOF or the error.  */
+        fds[n].fd = pfds[i].fd;
+        fds[n].for_read = !(pfds[i].events & POLLOUT);
+        fds[n].for_write = !!(pfds[i].events & POLLOUT);
+        fds[n].signaled = 1;
+        fds[n].opaque = NULL;
+        n++;
+      }
+  if (nr > 0)
+    nr = n;
+
+  if (pfds != stackbuf)
+    free (pfds);
+  return nr;
+}
+#else /*!USE_POLL*/
+static int
+poll_wait (io_pollset_t ps, struct io_select_fd_s *fds, size_t nfds,
+           int timeout)
+{
+  struct io_select_fd_s stackbuf[32];
+  struct io_select_fd_s *snap;
+  size_t count, i;
+  int nr, n;
+
+  /* Another thread may change the table while we are waiting, so we
+     wait on a copy.  Note that _gpgme_io_select only knows about
+     polling and a fixed timeout.  */
+  LOCK (ps->lock);
+  count = ps->nitems;
+  if (count <= DIM (stackbuf))
+    snap = stackbuf;
+  else
+    {
+      snap = malloc (count * sizeof *snap);
+      if (!snap)
+        {
+          UNLOCK (ps->lock);
+          return -1;
+        }
+    }
+  memcpy (snap, ps->items, count * sizeof *snap);
+  UNLOCK (ps->lock);
+
+  nr = _gpgme_io_select (snap, count, !timeout);
+  for (n = 0, i = 0; nr > 0 && i < count && n < nfds; i++)
+    if (snap[i].signaled)
+      fds[n++] = snap[i];
+  if (nr > 0)
+    nr = n;
+
+  if (snap != stackbuf)
+    free (snap);
+  return nr;
+}
+#endif /*!USE_POLL*/
+
+
+static const struct pollset_backend_s poll_backend =
+  {
+    "poll",
+    poll_create,
+    poll_release,
+    poll_add,
+    poll_del,
+    poll_wait,
+    1
+  };
+
+
+
+/* The "epoll" backend.  */
+#ifdef USE_EPOLL
+
+static int
+epoll_create_backend (io_pollset_t ps)
+{
+  ps->epfd = epoll_create1 (EPOLL_CLOEXEC);
+  return ps->epfd == -1? -1 : 0;
+}
+
+
+static void
+epoll_release (io_pollset_t ps)
+{
+  if (ps->epfd != -1)
+    close (ps->epfd);
+  ps->epfd = -1;
+}
+
+
+static int
+epoll_add (io_pollset_t ps, int fd, int for_write)
+{
+  struct epoll_event ev;
+
+  memset (&ev, 0, sizeof ev);
+  ev.events = for_write? EPOLLOUT : EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl (ps->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+
+static int
+epoll_del (io_pollset_t ps, int fd)
+{
+  struct epoll_event ev;
+
+  /* Kernels before 2.6.9 require a non-NULL event.  */
+  memset (&ev, 0, sizeof ev);
+  return epoll_ctl (ps->epfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+
+static int
+epoll_wait_backend (io_pollset_t ps, struct io_select_fd_s *fds, size_t nfds,
+                    int timeout)
+{
+  struct epoll_event events[32];
+  int nr, i;
+
+  if (nfds > DIM (events))
+    nfds = DIM (events);
+
+  do
+    nr = epoll_wait (ps->epfd, events, nfds, timeout);
+  while (nr < 0 && errno == EINTR);
+
+  /* Like select we report hangups and errors as readiness, so that
+     the handler sees EOF or the error.  The direction is filled in
+     from the registry.  */
+  for (i = 0; i < nr; i++)
+    {
+      fds[i].fd = events[i].data.fd;
+      fds[i].signaled = 1;
+      fds[i].opaque = NULL;
+    }
+  return nr;
+}
+
+
+static const struct pollset_backend_s epoll_backend =
+  {
+    "epoll",
+    epoll_create_backend,
+    epoll_release,
+    epoll_add,
+    epoll_del,
+    epoll_wait_backend,
+    0
+  };
+#endif /*USE_EPOLL*/
+
+
+
+/* The "io_uring" backend.  */
+#ifdef USE_IO_URING
+
+/* The number of submission queue entries.  */
+#define URING_ENTRIES 64
+
+/* The user data of requests whose completion is to be ignored.  */
+#define URING_IGNORE (~(uint64_t)0)
+
+struct uring_s
+{
+  int fd;
+
+  /* The mapped rings.  With IORING_FEAT_SINGLE_MMAP the completion
+     queue is part of the mapping of the submission queue.  */
+  void *ring;
+  size_t ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* The number of entries queued but not yet submitted.  */
+  unsigned int to_submit;
+
+  /* The fds to be armed with the next wait.  */
+  int *arm;
+  size_t narm;
+  size_t arm_size;
+};
+
+
+static int
+uring_enter (struct uring_s *u, unsigned int to_submit,
+             unsigned int min_complete, unsigned int flags,
+             void *arg, size_t argsz)
+{
+  return syscall (__NR_io_uring_enter, u->fd, to_submit, min_complete,
+                  flags, arg, argsz);
+}
+
+
+/* Submit all queued entries without waiting.  */
+static int
+uring_flush (struct uring_s *u)
+{
+  int res;
+
+  if (!u->to_submit)
+    return 0;
+  do
+    res = uring_enter (u, u->to_submit, 0, 0, NULL, 0);
+  while (res < 0 && errno == EINTR);
+  if (res < 0)
+    return -1;
+  u->to_submit -= res;
+  return 0;
+}
+
+
+/* Return a cleared submission queue entry or NULL with ERRNO set on
+   error.  A full queue is submitted first.  */
+static struct io_uring_sqe *
+uring_get_sqe (struct uring_s *u)
+{
+  unsigned int tail = *u->sq_tail;
+  unsigned int idx;
+
+  if (tail - __atomic_load_n (u->sq_head, __ATOMIC_ACQUIRE) == URING_ENTRIES)
+    {
+      if (uring_flush (u))
+        return NULL;
+      if (tail - __atomic_load_n (u->sq_head, __ATOMIC_ACQUIRE)
+          == URING_ENTRIES)
+        {
+          gpg_err_set_errno (EBUSY);
+          return NULL;
+        }
+    }
+
+  idx = tail & *u->sq_mask;
+  u->sq_array[idx] = idx;
+  memset (&u->sqes[idx], 0, sizeof u->sqes[idx]);
+  return &u->sqes[idx];
+}
+
+
+/* Make the entry returned by the last uring_get_sqe visible to the
+   kernel.  */
+static void
+uring_queue_sqe (struct uring_s *u)
+{
+  __atomic_store_n (u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+  u->to_submit++;
+}
+
+
+static uint64_t
+uring_user_data (io_pollset_t ps, int fd)
+{
+  return ((uint64_t)ps->slots[fd].gen << 32) | (unsigned int)fd;
+}
+
+
+static int
+uring_create (io_pollset_t ps)
+{
+  struct io_uring_params p;
+  struct uring_s *u;
+  size_t cq_size;
+  char *ring;
+
+  memset (&p, 0, sizeof p);
+  u = calloc (1, sizeof *u);
+  if (!u)
+    return -1;
+  u->fd = syscall (__NR_io_uring_setup, URING_ENTRIES, &p);
+  if (u->fd == -1)
+    {
+      free (u);
+      return -1;
+    }
+  if (!(p.features & IORING_FEAT_EXT_ARG)
+      || !(p.features & IORING_FEAT_SINGLE_MMAP)
+      || p.sq_entries != URING_ENTRIES)
+    {
+      close (u->fd);
+      free (u);
+      gpg_err_set_errno (ENOSYS);
+      return -1;
+    }
+
+  u->ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (cq_size > u->ring_size)
+    u->ring_size = cq_size;
+  u->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+
+  ring = mmap (NULL, u->ring_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED)
+    {
+      close (u->fd);
+      free (u);
+      return -1;
+    }
+  u->sqes = mmap (NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED)
+    {
+      munmap (ring, u->ring_size);
+      close (u->fd);
+      free (u);
+      return -1;
+    }
+
+  u->ring = ring;
+  u->sq_head = (unsigned int *)(ring + p.sq_off.head);
+  u->sq_tail = (unsigned int *)(ring + p.sq_off.tail);
+  u->sq_mask = (unsigned int *)(ring + p.sq_off.ring_mask);
+  u->sq_array = (unsigned int *)(ring + p.sq_off.array);
+  u->cq_head = (unsigned int *)(ring + p.cq_off.head);
+  u->cq_tail = (unsigned int *)(ring + p.cq_off.tail);
+  u->cq_mask = (unsigned int *)(ring + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+  ps->uring = u;
+  return 0;
+}
+
+
+static void
+uring_release (io_pollset_t ps)
+{
+  struct uring_s *u = ps->uring;
+
+  if (!u)
+    return;
+  munmap (u->sqes, u->sqes_size);
+  munmap (u->ring, u->ring_size);
+  close (u->fd);
+  free (u->arm);
+  free (u);
+  ps->uring = NULL;
+}
+
+
+/* Queue FD for arming with the next wait.  */
+static int
+uring_queue_arm (io_pollset_t ps, int fd)
+{
+  struct uring_s *u = ps->uring;
+
+  if (ps->slots[fd].arm_pending)
+    return 0;
+  if (u->narm == u->arm_size)
+    {
+      int *newarm;
+      size_t newsize = u->arm_size + 16;
+
+      newarm = realloc (u->arm, newsize * sizeof *newarm);
+      if (!newarm)
+        return -1;
+      u->arm = newarm;
+      u->arm_size = newsize;
+    }
+  u->arm[u->narm++] = fd;
+  ps->slots[fd].arm_pending = 1;
+  return 0;
+}
+
+
+static int
+uring_add (io_pollset_t ps, int fd, int for_write)
+{
+  (void)for_write;
+
+  /* Nothing is passed to the kernel until the next wait.  */
+  ps->slots[fd].gen++;
+  ps->slots[fd].armed = 0;
+  return uring_queue_arm (ps, fd);
+}
+
+
+static int
+uring_del (io_pollset_t ps, int fd)
+{
+  struct uring_s *u = ps->uring;
+  struct io_uring_sqe *sqe;
+  size_t i;
+  int res = 0;
+
+  if (ps->slots[fd].arm_pending)
+    {
+      for (i = 0; i < u->narm; i++)
+        if (u->arm[i] == fd)
+          {
+            u->arm[i] = u->arm[--u->narm];
+            break;
+          }
+      ps->slots[fd].arm_pending = 0;
+    }
+
+  /* A request in flight holds a reference to the file and thus needs
+     to be cancelled at once; otherwise closing FD would not close the
+     pipe.  */
+  if (ps->slots[fd].armed)
+    {
+      sqe = uring_get_sqe (u);
+      if (!sqe)
+        res = -1;
+      else
+        {
+          sqe->opcode = IORING_OP_POLL_REMOVE;
+          sqe->fd = -1;
+          sqe->addr = uring_user_data (ps, fd);
+          sqe->user_data = URING_IGNORE;
+          uring_queue_sqe (u);
+          res = uring_flush (u);
+        }
+      ps->slots[fd].armed = 0;
+    }
+  return res;
+}
+
+
+static int
+uring_wait (io_pollset_t ps, struct io_select_fd_s *fds, size_t nfds,
+            int timeout)
+{
+  struct uring_s *u = ps->uring;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  struct io_uring_sqe *sqe;
+  unsigned int submit, head, tail;
+  size_t i;
+  int fd, res, n;
+
+  /* Arm the new registrations and those which fired last time.  The
+     poll requests check the current state, thus this gives the same
+     level triggered semantics as poll.  */
+  LOCK (ps->lock);
+  for (i = 0; i < u->narm; i++)
+    {
+      fd = u->arm[i];
+      sqe = uring_get_sqe (u);
+      if (!sqe)
+        {
+          /* Keep the fds not yet queued for the next call; the others
+             are armed and must not be queued again.  */
+          int saved_errno = errno;
+          memmove (u->arm, u->arm + i, (u->narm - i) * sizeof *u->arm);
+          u->narm -= i;
+          UNLOCK (ps->lock);
+          gpg_err_set_errno (saved_errno);
+          return -1;
+        }
+      ps->slots[fd].arm_pending = 0;
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = fd;
+      /* The 16 bit field works for either byte order.  */
+      sqe->poll_events = ps->slots[fd].for_write? POLLOUT : POLLIN;
+      sqe->user_data = uring_user_data (ps, fd);
+      uring_queue_sqe (u);
+      ps->slots[fd].armed = 1;
+    }
+  u->narm = 0;
+  submit = u->to_submit;
+  u->to_submit = 0;
+  UNLOCK (ps->lock);
+
+  memset (&arg, 0, sizeof arg);
+  if (timeout >= 0)
+    {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (timeout % 1000) * 1000000;
+      arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+  do
+    res = uring_enter (u, submit, timeout? 1 : 0,
+                       IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                       &arg, sizeof arg);
+  while (res < 0 && errno == EINTR);
+  if (res < 0 && errno != ETIME)
+    {
+      int saved_errno = errno;
+      LOCK (ps->lock);
+      u->to_submit += submit;
+      UNLOCK (ps->lock);
+      gpg_err_set_errno (saved_errno);
+      return -1;
+    }
+  if (res >= 0 && (unsigned int)res < submit)
+    {
+      LOCK (ps->lock);
+      u->to_submit += submit - res;
+      UNLOCK (ps->lock);
+    }
+
+  /* Collect the completions.  Fds which do not fit into FDS are
+     simply armed again.  */
+  LOCK (ps->lock);
+  head = *u->cq_head;
+  tail = __atomic_load_n (u->cq_tail, __ATOMIC_ACQUIRE);
+  for (n = 0; head != tail; head++)
+    {
+      uint64_t user_data = u->cqes[head & *u->cq_mask].user_data;
+
+      if (user_data == URING_IGNORE)
+        continue;
+      fd = (int)(user_data & 0xffffffff);
+      if (fd >= ps->nslots || !ps->slots[fd].used
+          || ps->slots[fd].gen != (unsigned int)(user_data >> 32))
+        continue;
+      ps->slots[fd].armed = 0;
+      /* Like select we report errors as readiness, so that the
+         handler sees the error.  */
+      if (n < nfds)
+        {
+          fds[n].fd = fd;
+          fds[n].signaled = 1;
+          fds[n].opaque = NULL;
+          n++;
+        }
+      uring_queue_arm (ps, fd);
+    }
+  __atomic_store_n (u->cq_head, head, __ATOMIC_RELEASE);
+  UNLOCK (ps->lock);
+
+  return n;
+}
+
+
+static const struct pollset_backend_s uring_backend =
+  {
+    "io_uring",
+    uring_create,
+    uring_release,
+    uring_add,
+    uring_del,
+    uring_wait,
+    1
+  };
+#endif /*USE_IO_URING*/
+
+
+
+/* The backends in the order of preference.  The "io_uring" backend
+   must be requested explicitly.  */
+static const struct pollset_backend_s *backends[] =
+  {
+#ifdef USE_EPOLL
+    &epoll_backend,
+#endif
+    &poll_backend,
+#ifdef USE_IO_URING
+    &uring_backend
+#endif
+  };
+
+/* The backend requested with the "io-backend" global flag or NULL
+   for the default.  */
+static const struct pollset_backend_s *requested_backend;
+
+
+/* Select the backend to be used for new readiness sets by NAME.
+   Returns 0 on success or -1 if there is no such backend.  This is
+   used by gpgme_set_global_flag.  */
+int
+_gpgme_io_pollset_set_backend (const char *name)
+{
+  int i;
+
+  for (i = 0; i < DIM (backends); i++)
+    if (!strcmp (backends[i]->name, name))
+      {
+        requested_backend = backends[i];
+        return 0;
+      }
+  return -1;
+}
+
+
+/* Make sure that the registry of PS has a slot for FD.  Returns 0 on
+   success or -1 with ERRNO set.  */
+static int
+grow_slots (io_pollset_t ps, int fd)
+{
+  struct pollset_slot_s *newslots;
+  size_t newsize;
+
+  if (fd < ps->nslots)
+    return 0;
+
+  newsize = ps->nslots? ps->nslots : 64;
+  while (newsize <= fd)
+    newsize *= 2;
+  newslots = realloc (ps->slots, newsize * sizeof *newslots);
+  if (!newslots)
+    return -1;
+  memset (newslots + ps->nslots, 0,
+          (newsize - ps->nslots) * sizeof *newslots);
+  ps->slots = newslots;
+  ps->nslots = newsize;
+  return 0;
+}
+
+
+/* Create the wakeup fd of PS and register it with the backend.
+   Returns 0 on success or -1 with ERRNO set.  There is no wakeup fd
+   on Windows, where the waits are bounded by their timeout.  */
+static int
+wakeup_create (io_pollset_t ps)
+{
+#ifndef HAVE_W32_SYSTEM
+  int fds[2];
+  int i;
+
+# if defined(HAVE_SYS_EVENTFD_H) && defined(EFD_CLOEXEC)
+  fds[0] = fds[1] = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (fds[0] == -1)
+# endif
+    {
+      if (pipe (fds))
+        return -1;
+      for (i = 0; i < 2; i++)
+        if (fcntl (fds[i], F_SETFD, FD_CLOEXEC) == -1
+            || fcntl (fds[i], F_SETFL,
+                      fcntl (fds[i], F_GETFL) | O_NONBLOCK) == -1)
+          {
+            int saved_errno = errno;
+            close (fds[0]);
+            close (fds[1]);
+            errno = saved_errno;
+            return -1;
+          }
+    }
+  ps->wakefd[0] = fds[0];
+  ps->wakefd[1] = fds[1];
+
+  if (grow_slots (ps, fds[0]) || ps->backend->add (ps, fds[0], 0))
+    return -1;
+  ps->slots[fds[0]].used = 1;
+#endif /*!HAVE_W32_SYSTEM*/
+  return 0;
+}
+
+
+/* Close the wakeup fd of PS.  */
+static void
+wakeup_close (io_pollset_t ps)
+{
+  if (ps->wakefd[0] != -1)
+    close (ps->wakefd[0]);
+  if (ps->wakefd[1] != ps->wakefd[0] && ps->wakefd[1] != -1)
+    close (ps->wakefd[1]);
+  ps->wakefd[0] = ps->wakefd[1] = -1;
+}
+
+
+/* Consume all pending wakeups of PS.  */
+static void
+wakeup_drain (io_pollset_t ps)
+{
+#ifndef HAVE_W32_SYSTEM
+  char buf[64];
+
+  while (read (ps->wakefd[0], buf, sizeof buf) > 0)
+    ;
+#else
+  (void)ps;
+#endif
+}
+
+
+/* Create a new empty readiness set and store it at R_PS.  Returns 0
+   on success or -1 with ERRNO set.  */
+int
+_gpgme_io_pollset_new (io_pollset_t *r_ps)
+{
+  io_pollset_t ps;
+  int i;
+  TRACE_BEG (DEBUG_SYSIO, "_gpgme_io_pollset_new", r_ps, "");
+
+  ps = calloc (1, sizeof *ps);
+  if (!ps)
+    return TRACE_SYSRES (-1);
+  INIT_LOCK (ps->lock);
+  ps->epfd = -1;
+  ps->wakefd[0] = ps->wakefd[1] = -1;
+
+  if (requested_backend && !requested_backend->create (ps))
+    ps->backend = requested_backend;
+  else
+    {
+      /* Fall back to the next backend if one is not supported by
+         the running kernel.  The last one always works.  */
+      for (i = 0; i < DIM (backends); i++)
+        if (!backends[i]->create (ps))
+          {
+            ps->backend = backends[i];
+            break;
+          }
+    }
+  if (!ps->backend)
+    {
+      int saved_errno = errno;
+      DESTROY_LOCK (ps->lock);
+      free (ps);
+      errno = saved_errno;
+      return TRACE_SYSRES (-1);
+    }
+  if (wakeup_create (ps))
+    {
+      int saved_errno = errno;
+      ps->backend->release (ps);
+      wakeup_close (ps);
+      free (ps->slots);
+      DESTROY_LOCK (ps->lock);
+      free (ps);
+      errno = saved_errno;
+      return TRACE_SYSRES (-1);
+    }
+
+  *r_ps = ps;
+  TRACE_SUC ("ps=%p backend=%s", ps, ps->backend->name);
+  return 0;
+}
+
+
+/* Release the readiness set PS.  */
+void
+_gpgme_io_pollset_release (io_pollset_t ps)
+{
+  if (!ps)
+    return;
+
+  TRACE (DEBUG_SYSIO, "_gpgme_io_pollset_release", ps, "");
+  ps->backend->release (ps);
+  wakeup_close (ps);
+  free (ps->slots);
+  DESTROY_LOCK (ps->lock);
+  free (ps);
+}
+
+
+/* Register FD with the readiness set PS.  If FOR_WRITE is set FD is
+   watched for writability, otherwise for readability.  OPAQUE is
+   returned with FD by _gpgme_io_pollset_wait.  Returns 0 on success
+   or -1 with ERRNO set.  */
+int
+_gpgme_io_pollset_add (io_pollset_t ps, int fd, int for_write, void *opaque)
+{
+  int res = 0;
+  int wake = 0;
+  TRACE_BEG (DEBUG_SYSIO, "_gpgme_io_pollset_add", ps,
+             "fd=%d, for_write=%d, opaque=%p", fd, for_write, opaque);
+
+  if (fd < 0)
+    {
+      gpg_err_set_errno (EBADF);
+      return TRACE_SYSRES (-1);
+    }
+
+  LOCK (ps->lock);
+  res = grow_slots (ps, fd);
+  if (res)
+    goto leave;
+  if (ps->slots[fd].used)
+    {
+      gpg_err_set_errno (EEXIST);
+      res = -1;
+      goto leave;
+    }
+
+  res = ps->backend->add (ps, fd, for_write);
+  if (!res)
+    {
+      ps->slots[fd].opaque = opaque;
+      ps->slots[fd].used = 1;
+      ps->slots[fd].for_write = !!for_write;
+      ps->count++;
+      wake = ps->waiters && ps->backend->wake_on_add;
+    }
+
+ leave:
+  UNLOCK (ps->lock);
+  if (wake)
+    _gpgme_io_pollset_wakeup (ps);
+  return TRACE_SYSRES (res);
+}
+
+
+/* Remove FD from the readiness set PS.  FD must still be open.
+   Returns 0 on success or -1 with ERRNO set.  */
+int
+_gpgme_io_pollset_del (io_pollset_t ps, int fd)
+{
+  int res;
+  TRACE_BEG (DEBUG_SYSIO, "_gpgme_io_pollset_del", ps, "fd=%d", fd);
+
+  LOCK (ps->lock);
+  if (fd < 0 || fd >= ps->nslots || !ps->slots[fd].used)
+    {
+      gpg_err_set_errno (ENOENT);
+      res = -1;
+    }
+  else
+    {
+      /* Forget about the registration even if the backend fails, so
+         that the fd can be registered again.  */
+      res = ps->backend->del (ps, fd);
+      ps->slots[fd].opaque = NULL;
+      ps->slots[fd].used = 0;
+      ps->count--;
+    }
+  UNLOCK (ps->lock);
+  return TRACE_SYSRES (res);
+}
+
+
+/* Return the opaque value of the registration of FD in PS or NULL if
+   FD is not registered.  The event loops use this to check whether a
+   ready fd returned by _gpgme_io_pollset_wait is still registered
+   after running other handlers.  */
+void *
+_gpgme_io_pollset_get (io_pollset_t ps, int fd)
+{
+  void *opaque = NULL;
+
+  LOCK (ps->lock);
+  if (fd >= 0 && fd < ps->nslots && ps->slots[fd].used)
+    opaque = ps->slots[fd].opaque;
+  UNLOCK (ps->lock);
+  return opaque;
+}
+
+
+/* Wait until at least one file descriptor in PS is ready or TIMEOUT
+   milliseconds have passed; a TIMEOUT of 0 only polls and -1 waits
+   forever.  Up to NFDS ready descriptors are stored at FDS with
+   SIGNALED set and OPAQUE set to the value given at registration.
+   If the wait was interrupted by _gpgme_io_pollset_wakeup, an entry
+   with FD set to -1 and OPAQUE set to NULL is stored.  Returns -1 on
+   error, 0 on timeout or if nothing is registered, or the number of
+   entries stored at FDS.  */
+int
+_gpgme_io_pollset_wait (io_pollset_t ps, struct io_select_fd_s *fds,
+                        size_t nfds, int timeout)
+{
+  size_t count;
+  int nr, i, n;
+  int woken = 0;
+  TRACE_BEG (DEBUG_SYSIO, "_gpgme_io_pollset_wait", ps,
+             "nfds=%zu, timeout=%d", nfds, timeout);
+
+  LOCK (ps->lock);
+  count = ps->count;
+  if (count && nfds)
+    ps->waiters++;
+  UNLOCK (ps->lock);
+  /* Like _gpgme_io_select, return at once if there is nothing to
+     wait for.  */
+  if (!count || !nfds)
+    return TRACE_SYSRES (0);
+
+  nr = ps->backend->wait (ps, fds, nfds, timeout);
+  LOCK (ps->lock);
+  ps->waiters--;
+  UNLOCK (ps->lock);
+  if (nr <= 0)
+    return TRACE_SYSRES (nr);
+
+  /* Look up the registrations.  Fds removed by another thread while
+     we were waiting are dropped.  */
+  LOCK (ps->lock);
+  for (n = i = 0; i < nr; i++)
+    {
+      int fd = fds[i].fd;
+
+      if (fd == ps->wakefd[0])
+        {
+          wakeup_drain (ps);
+          woken = 1;
+          continue;
+        }
+      if (fd < 0 || fd >= ps->nslots || !ps->slots[fd].used)
+        continue;
+      fds[n] = fds[i];
+      fds[n].for_write = ps->slots[fd].for_write;
+      fds[n].for_read = !fds[n].for_write;
+      fds[n].opaque = ps->slots[fd].opaque;
+      n++;
+    }
+  UNLOCK (ps->lock);
+
+  /* Report the wakeup even if FDS is full; the fd it replaces is
+     still ready and thus returned by the next wait.  */
+  if (woken)
+    {
+      if ((size_t)n == nfds)
+        n--;
+      fds[n].fd = -1;
+      fds[n].for_read = 0;
+      fds[n].for_write = 0;
+      fds[n].signaled = 1;
+      fds[n].opaque = NULL;
+      n++;
+    }
+
+  return TRACE_SYSRES (n);
+}
+
+
+/* Interrupt a thread waiting on PS in _gpgme_io_pollset_wait.  If no
+   thread is waiting, the next wait returns at once.  This may be
+   called from any thread.  */
+void
+_gpgme_io_pollset_wakeup (io_pollset_t ps)
+{
+#ifndef HAVE_W32_SYSTEM
+  /* The value is good for an eventfd in either byte order.  A full
+     pipe or counter already means a pending wakeup.  */
+  static const char one[8] = { 1 };
+
+  TRACE (DEBUG_SYSIO, "_gpgme_io_pollset_wakeup", ps, "");
+  if (write (ps->wakefd[1], one, sizeof one) < 0 && errno != EAGAIN)
+    TRACE (DEBUG_SYSIO, "_gpgme_io_pollset_wakeup", ps,
+           "write failed: %s", strerror (errno));
+#else
+  (void)ps;
+#endif
+}
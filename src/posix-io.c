@@ -45,6 +45,9 @@
 #ifdef HAVE_SYS_UIO_H
 # include <sys/uio.h>
 #endif
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
 #include <ctype.h>
 #include <sys/resource.h>
 
@@ -54,6 +57,33 @@
 # include <dirent.h>
 #endif /*USE_LINUX_GETDENTS*/
 
+/* On Linux we can create the child processes with clone(2) sharing
+ * the address space of the caller, which avoids the costs of copying
+ * the page tables.  This requires close_range(2) to get rid of the
+ * unwanted fds without having to figure out which fds are open.  The
+ * stack of the clone children must grow downwards.  */
+#if defined(__linux__) && !defined(__hppa__) && !defined(__ia64__)
+# include <sched.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# if defined(CLONE_VM) && defined(CLONE_VFORK) && defined(SYS_close_range)
+#  define USE_LINUX_CLONE_SPAWN 1
+#  ifndef CLOSE_RANGE_CLOEXEC
+#   define CLOSE_RANGE_CLOEXEC (1U << 2)
+#  endif
+# endif
+#endif
+
+/* On Linux a process can be signaled through a pidfd, which unlike
+ * its pid is not reused for another process after the process
+ * exited.  */
+#ifdef __linux__
+# include <sys/syscall.h>
+# if defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+#  define USE_LINUX_PIDFD 1
+# endif
+#endif
+
 
 #include "util.h"
 #include "priv-io.h"
@@ -123,6 +153,73 @@ _gpgme_io_read (int fd, void *buffer, size_t count)
 }
 
 
+/* Move up to COUNT bytes from FD_IN to FD_OUT without copying them
+   through user space.  One of the fds must be a pipe; operations on
+   the pipe do not block.  Returns the number of bytes moved, 0 on EOF
+   or -1 on error.  ERRNO is ENOSYS or EINVAL if this is not supported
+   for the fds.  */
+int
+_gpgme_io_splice (int fd_in, int fd_out, size_t count)
+{
+  int nread;
+  TRACE_BEG  (DEBUG_SYSIO, "_gpgme_io_splice", fd_in,
+	      "fd_out=0x%x, count=%zu", fd_out, count);
+
+#ifdef HAVE_SPLICE
+  do
+    {
+      nread = splice (fd_in, NULL, fd_out, NULL, count,
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+  while (nread == -1 && errno == EINTR);
+#else
+  gpg_err_set_errno (ENOSYS);
+  nread = -1;
+#endif
+
+  return TRACE_SYSRES (nread);
+}
+
+
+/* Write the data of the NSEGS segments SEGS to FD with one system
+   call.  At most 16 segments are used.  Returns the number of bytes
+   written or -1 on error.  ERRNO is ENOSYS if this is not
+   supported.  */
+int
+_gpgme_io_writev (int fd, const struct gpgme_data_segment *segs, int nsegs)
+{
+#ifdef HAVE_SYS_UIO_H
+  struct iovec iov[16];
+  int i;
+#endif
+  int nwritten;
+  TRACE_BEG  (DEBUG_SYSIO, "_gpgme_io_writev", fd,
+	      "segs=%p, nsegs=%i", segs, nsegs);
+
+#ifdef HAVE_SYS_UIO_H
+  if (nsegs > (int) DIM (iov))
+    nsegs = DIM (iov);
+  for (i = 0; i < nsegs; i++)
+    {
+      iov[i].iov_base = (void *) segs[i].buffer;
+      iov[i].iov_len = segs[i].length;
+    }
+  do
+    {
+      nwritten = writev (fd, iov, nsegs);
+    }
+  while (nwritten == -1 && errno == EINTR);
+#else
+  (void)segs;
+  (void)nsegs;
+  gpg_err_set_errno (ENOSYS);
+  nwritten = -1;
+#endif
+
+  return TRACE_SYSRES (nwritten);
+}
+
+
 int
 _gpgme_io_write (int fd, const void *buffer, size_t count)
 {
@@ -283,6 +380,28 @@ _gpgme_io_set_nonblocking (int fd)
 }
 
 
+/* Ask the system to use a capacity of SIZE bytes for the pipe FD.
+   Returns 0 on success or -1 if this is not possible; the pipe is
+   still usable in this case.  */
+int
+_gpgme_io_set_pipe_size (int fd, size_t size)
+{
+  int res;
+  TRACE_BEG  (DEBUG_SYSIO, "_gpgme_io_set_pipe_size", fd,
+	      "size=%zu", size);
+
+#ifdef F_SETPIPE_SZ
+  res = fcntl (fd, F_SETPIPE_SZ, (int)size);
+  if (res > 0)
+    res = 0;
+#else
+  gpg_err_set_errno (ENOSYS);
+  res = -1;
+#endif
+  return TRACE_SYSRES (res);
+}
+
+
 #ifdef USE_LINUX_GETDENTS
 /* This is not declared in public headers; getdents64(2) says that we must
  * define it ourselves.  */
@@ -462,35 +581,181 @@ _gpgme_io_waitpid (int pid, int hang, int *r_status, int *r_signal)
 }
 
 
-/* Returns 0 on success, -1 on error.  */
+/* The methods to create a child process.  */
+enum spawn_method
+  {
+    SPAWN_METHOD_FORK,
+    SPAWN_METHOD_VFORK
+  };
+
+#ifdef USE_LINUX_CLONE_SPAWN
+static enum spawn_method spawn_method = SPAWN_METHOD_VFORK;
+#else
+static enum spawn_method spawn_method = SPAWN_METHOD_FORK;
+#endif
+
+
+/* Select the method used by _gpgme_io_spawn by its NAME.  Returns 0
+   on success or -1 if the method is not known or not supported.  This
+   is used by gpgme_set_global_flag.  */
 int
-_gpgme_io_spawn (const char *path, char *const argv[], unsigned int flags,
-		 struct spawn_fd_item_s *fd_list,
-		 void (*atfork) (void *opaque, int reserved),
-		 void *atforkvalue, pid_t *r_pid)
+_gpgme_io_set_spawn_method (const char *name)
 {
-  pid_t pid;
+  if (!strcmp (name, "fork"))
+    spawn_method = SPAWN_METHOD_FORK;
+#ifdef USE_LINUX_CLONE_SPAWN
+  else if (!strcmp (name, "vfork"))
+    spawn_method = SPAWN_METHOD_VFORK;
+#endif
+  else
+    return -1;
+  return 0;
+}
+
+
+/* Close all fds in the child which are not listed in FD_LIST.  */
+static void
+close_child_fds (struct spawn_fd_item_s *fd_list)
+{
+  int max_fds = -1;
+  int fd;
   int i;
-  int status;
-  int signo;
 
-  TRACE_BEG  (DEBUG_SYSIO, "_gpgme_io_spawn", path,
-	      "path=%s", path);
-  i = 0;
-  while (argv[i])
+  /* If we have closefrom(2) we first figure out the highest fd we do
+   * not want to close, then call closefrom, and on success use the
+   * regular code to close all fds up to the start point of closefrom.
+   * Note that Solaris', FreeBSD's and glibc's closefrom do not return
+   * errors.  */
+#ifdef HAVE_CLOSEFROM
+  {
+    fd = -1;
+    for (i = 0; fd_list[i].fd != -1; i++)
+      if (fd_list[i].fd > fd)
+        fd = fd_list[i].fd;
+    fd++;
+#if defined(__sun) || defined(__FreeBSD__) || defined(__GLIBC__)
+    closefrom (fd);
+    max_fds = fd;
+#else /*!__sun */
+    while ((i = closefrom (fd)) && errno == EINTR)
+      ;
+    if (!i || errno == EBADF)
+      max_fds = fd;
+#endif /*!__sun*/
+  }
+#endif /*HAVE_CLOSEFROM*/
+  if (max_fds == -1)
+    max_fds = get_max_fds ();
+  for (fd = 0; fd < max_fds; fd++)
     {
-      TRACE_LOG  ("argv[%2i] = %s", i, argv[i]);
-      i++;
+      for (i = 0; fd_list[i].fd != -1; i++)
+        if (fd_list[i].fd == fd)
+          break;
+      if (fd_list[i].fd == -1)
+        close (fd);
     }
+}
+
+
+/* Dup the fds in FD_LIST to their final number in the child and make
+   sure that stdin, stdout and stderr are connected.  Returns 0 on
+   success or -1 on error.  This is called in the child after the
+   unwanted fds have been closed and may only use async-signal-safe
+   functions.  */
+static int
+setup_child_fds (struct spawn_fd_item_s *fd_list)
+{
+  int seen_stdin = 0;
+  int seen_stdout = 0;
+  int seen_stderr = 0;
+  int fd;
+  int i;
+
   for (i = 0; fd_list[i].fd != -1; i++)
-    if (fd_list[i].dup_to == -1)
-      TRACE_LOG  ("fd[%i] = 0x%x", i, fd_list[i].fd);
-    else
-      TRACE_LOG  ("fd[%i] = 0x%x -> 0x%x", i, fd_list[i].fd, fd_list[i].dup_to);
+    {
+      int child_fd;
+
+      if (fd_list[i].dup_to != -1)
+        child_fd = fd_list[i].dup_to;
+      else
+        child_fd = fd_list[i].fd;
+
+      if (child_fd == 0)
+        seen_stdin = 1;
+      else if (child_fd == 1)
+        seen_stdout = 1;
+      else if (child_fd == 2)
+        seen_stderr = 1;
+
+      if (fd_list[i].dup_to == -1)
+        continue;
+
+      /* The debug file descriptor is not dup'ed, so we can't do a
+         trace output on error.  */
+      if (dup2 (fd_list[i].fd, fd_list[i].dup_to) < 0)
+        return -1;
+
+      close (fd_list[i].fd);
+    }
+
+  if (! seen_stdin || ! seen_stdout || !seen_stderr)
+    {
+      fd = open ("/dev/null", O_RDWR);
+      if (fd == -1)
+        return -1;
+      /* Make sure that the process has connected stdin.  */
+      if (! seen_stdin && fd != 0)
+        {
+          if (dup2 (fd, 0) == -1)
+            return -1;
+        }
+      if (! seen_stdout && fd != 1)
+        {
+          if (dup2 (fd, 1) == -1)
+            return -1;
+        }
+      if (! seen_stderr && fd != 2)
+        {
+          if (dup2 (fd, 2) == -1)
+            return -1;
+        }
+      if (fd != 0 && fd != 1 && fd != 2)
+        close (fd);
+    }
+
+  return 0;
+}
+
+
+/* Spawn PATH using fork(2).  An intermediate child is used to prevent
+   zombie processes; its pid is stored at R_PID.  If R_CHILD is not
+   NULL the pid of the new process is stored there.  */
+static int
+spawn_fork (const char *path, char *const argv[],
+            struct spawn_fd_item_s *fd_list,
+            void (*atfork) (void *opaque, int reserved),
+            void *atforkvalue, pid_t *r_pid, pid_t *r_child)
+{
+  pid_t pid;
+  int status;
+  int signo;
+  int pidfds[2] = { -1, -1 };
+
+  /* The intermediate child tells us the pid of the new process
+     through a pipe, which the new process closes.  */
+  if (r_child && pipe (pidfds))
+    return -1;
 
   pid = fork ();
   if (pid == -1)
-    return TRACE_SYSRES (-1);
+    {
+      if (r_child)
+        {
+          close (pidfds[0]);
+          close (pidfds[1]);
+        }
+      return -1;
+    }
 
   if (!pid)
     {
@@ -498,116 +763,12 @@ _gpgme_io_spawn (const char *path, char *const argv[], unsigned int flags,
       if ((pid = fork ()) == 0)
 	{
 	  /* Child.  */
-          int max_fds = -1;
-          int fd;
-	  int seen_stdin = 0;
-	  int seen_stdout = 0;
-	  int seen_stderr = 0;
-
 	  if (atfork)
 	    atfork (atforkvalue, 0);
 
-          /* First close all fds which will not be inherited.  If we
-           * have closefrom(2) we first figure out the highest fd we
-           * do not want to close, then call closefrom, and on success
-           * use the regular code to close all fds up to the start
-           * point of closefrom.  Note that Solaris' and FreeBSD's closefrom do
-           * not return errors.  */
-#ifdef HAVE_CLOSEFROM
-          {
-            fd = -1;
-            for (i = 0; fd_list[i].fd != -1; i++)
-              if (fd_list[i].fd > fd)
-                fd = fd_list[i].fd;
-            fd++;
-#if defined(__sun) || defined(__FreeBSD__)
-            closefrom (fd);
-            max_fds = fd;
-#else /*!__sun */
-            while ((i = closefrom (fd)) && errno == EINTR)
-              ;
-            if (!i || errno == EBADF)
-              max_fds = fd;
-#endif /*!__sun*/
-          }
-#endif /*HAVE_CLOSEFROM*/
-          if (max_fds == -1)
-            max_fds = get_max_fds ();
-          for (fd = 0; fd < max_fds; fd++)
-            {
-              for (i = 0; fd_list[i].fd != -1; i++)
-                if (fd_list[i].fd == fd)
-                  break;
-              if (fd_list[i].fd == -1)
-                close (fd);
-            }
-
-	  /* And now dup and close those to be duplicated.  */
-	  for (i = 0; fd_list[i].fd != -1; i++)
-	    {
-	      int child_fd;
-	      int res;
-
-	      if (fd_list[i].dup_to != -1)
-		child_fd = fd_list[i].dup_to;
-	      else
-		child_fd = fd_list[i].fd;
-
-	      if (child_fd == 0)
-		seen_stdin = 1;
-	      else if (child_fd == 1)
-		seen_stdout = 1;
-	      else if (child_fd == 2)
-		seen_stderr = 1;
-
-	      if (fd_list[i].dup_to == -1)
-		continue;
-
-	      res = dup2 (fd_list[i].fd, fd_list[i].dup_to);
-	      if (res < 0)
-		{
-#if 0
-		  /* FIXME: The debug file descriptor is not
-		     dup'ed anyway, so we can't see this.  */
-		  TRACE_LOG  ("dup2 failed in child: %s\n",
-			      strerror (errno));
-#endif
-		  _exit (8);
-		}
-
-	      close (fd_list[i].fd);
-	    }
-
-	  if (! seen_stdin || ! seen_stdout || !seen_stderr)
-	    {
-	      fd = open ("/dev/null", O_RDWR);
-	      if (fd == -1)
-		{
-		  /* The debug file descriptor is not dup'ed, so we
-		     can't do a trace output.  */
-		  _exit (8);
-		}
-	      /* Make sure that the process has connected stdin.  */
-	      if (! seen_stdin && fd != 0)
-		{
-		  if (dup2 (fd, 0) == -1)
-                    _exit (8);
-		}
-	      if (! seen_stdout && fd != 1)
-                {
-                  if (dup2 (fd, 1) == -1)
-                    _exit (8);
-                }
-	      if (! seen_stderr && fd != 2)
-                {
-                  if (dup2 (fd, 2) == -1)
-                    _exit (8);
-                }
-	      if (fd != 0 && fd != 1 && fd != 2)
-		close (fd);
-	    }
-
-	  execv (path, (char *const *) argv);
+          close_child_fds (fd_list);
+          if (!setup_child_fds (fd_list))
+            execv (path, (char *const *) argv);
 	  /* Hmm: in that case we could write a special status code to the
 	     status-pipe.  */
 	  _exit (8);
@@ -615,14 +776,249 @@ _gpgme_io_spawn (const char *path, char *const argv[], unsigned int flags,
 	}
       if (pid == -1)
 	_exit (1);
-      else
-	_exit (0);
+      if (r_child
+          && write (pidfds[1], &pid, sizeof pid) != sizeof pid)
+        _exit (1);
+      _exit (0);
+    }
+
+  _gpgme_io_waitpid (pid, 1, &status, &signo);
+  if (r_child)
+    {
+      close (pidfds[1]);
+      if (!status && read (pidfds[0], r_child, sizeof *r_child)
+          != sizeof *r_child)
+        status = 1;
+      close (pidfds[0]);
+    }
+  if (status)
+    return -1;
+
+  *r_pid = pid;
+  return 0;
+}
+
+
+#ifdef USE_LINUX_CLONE_SPAWN
+/* The size of the stacks of the clone children.  They only need to
+   set up the fds and call execv.  */
+#define SPAWN_STACK_SIZE (64 * 1024)
+
+/* The arguments shared between the caller and the clone children.  */
+struct spawn_clone_s
+{
+  const char *path;
+  char *const *argv;
+  struct spawn_fd_item_s *fd_list;
+
+  /* The signal mask of the caller to be restored before execv.  */
+  sigset_t oldmask;
+
+  /* Two stacks of SPAWN_STACK_SIZE for the clone children.  */
+  char *stack;
+
+  /* Set to the pid of the new process.  */
+  pid_t child;
+
+  /* Set to the ERRNO of a failed clone or execv.  */
+  int err;
+};
+
+
+/* Return true if close_range(2) supports CLOSE_RANGE_CLOEXEC, which
+   is the case since Linux 5.11.  */
+static int
+have_close_range_cloexec (void)
+{
+  static int result = -1;
+
+  if (result == -1)
+    result = !syscall (SYS_close_range, ~0U, ~0U, CLOSE_RANGE_CLOEXEC);
+  return result;
+}
+
+
+/* Mark all fds in the child which are not listed in FD_LIST as
+   close-on-exec.  This needs one system call for each gap between
+   the listed fds and does not need to know the open fds.  Returns 0
+   on success or -1 on error.  */
+static int
+cloexec_child_fds (struct spawn_fd_item_s *fd_list)
+{
+  unsigned int lo = 0;
+  unsigned int next;
+  int i;
+
+  for (;;)
+    {
+      /* Find the lowest listed fd not below LO.  */
+      next = ~0U;
+      for (i = 0; fd_list[i].fd != -1; i++)
+        if (fd_list[i].fd >= lo && fd_list[i].fd < next)
+          next = fd_list[i].fd;
+      if (next == ~0U)
+        return syscall (SYS_close_range, lo, ~0U, CLOSE_RANGE_CLOEXEC);
+      if (next > lo
+          && syscall (SYS_close_range, lo, next - 1, CLOSE_RANGE_CLOEXEC))
+        return -1;
+      lo = next + 1;
+    }
+}
+
+
+/* The grandchild which becomes the new process.  This runs in the
+   address space of the caller, which is suspended until execv.  */
+static int
+spawn_clone_child (void *opaque)
+{
+  struct spawn_clone_s *args = opaque;
+  struct sigaction sa;
+  int signo;
+
+  /* The signal handlers of the caller must not run here; reset them
+     before unblocking the signals again.  */
+  for (signo = 1; signo < NSIG; signo++)
+    if (!sigaction (signo, NULL, &sa)
+        && sa.sa_handler != SIG_IGN && sa.sa_handler != SIG_DFL)
+      {
+        sa.sa_handler = SIG_DFL;
+        sa.sa_flags = 0;
+        sigemptyset (&sa.sa_mask);
+        sigaction (signo, &sa, NULL);
+      }
+  sigprocmask (SIG_SETMASK, &args->oldmask, NULL);
+
+  if (!cloexec_child_fds (args->fd_list) && !setup_child_fds (args->fd_list))
+    execv (args->path, args->argv);
+  args->err = errno;
+  _exit (8);
+}
+
+
+/* The intermediate child to prevent zombie processes.  Because of
+   CLONE_VFORK it returns only after the grandchild called execv.  */
+static int
+spawn_clone_intermediate (void *opaque)
+{
+  struct spawn_clone_s *args = opaque;
+  pid_t pid;
+
+  pid = clone (spawn_clone_child, args->stack + SPAWN_STACK_SIZE,
+               CLONE_VM | CLONE_VFORK | SIGCHLD, args);
+  if (pid == -1)
+    {
+      args->err = errno;
+      _exit (1);
+    }
+  args->child = pid;
+  _exit (0);
+}
+
+
+/* Spawn PATH like spawn_fork but without copying the address space
+   of the caller.  */
+static int
+spawn_clone (const char *path, char *const argv[],
+             struct spawn_fd_item_s *fd_list, pid_t *r_pid, pid_t *r_child)
+{
+  struct spawn_clone_s args;
+  sigset_t allmask;
+  pid_t pid;
+  int status;
+  int signo;
+  int saved_errno;
+
+  args.path = path;
+  args.argv = argv;
+  args.fd_list = fd_list;
+  args.err = 0;
+  args.child = -1;
+  args.stack = mmap (NULL, 2 * SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (args.stack == MAP_FAILED)
+    return -1;
+
+  /* Block all signals so that no signal handler runs in the clone
+     children while they share our memory.  */
+  sigfillset (&allmask);
+  sigprocmask (SIG_BLOCK, &allmask, &args.oldmask);
+  pid = clone (spawn_clone_intermediate, args.stack + 2 * SPAWN_STACK_SIZE,
+               CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+  saved_errno = errno;
+  sigprocmask (SIG_SETMASK, &args.oldmask, NULL);
+  munmap (args.stack, 2 * SPAWN_STACK_SIZE);
+  if (pid == -1)
+    {
+      errno = saved_errno;
+      return -1;
     }
 
-  TRACE_LOG  ("waiting for child process pid=%i", pid);
   _gpgme_io_waitpid (pid, 1, &status, &signo);
+  if (args.err)
+    {
+      errno = args.err;
+      return -1;
+    }
   if (status)
+    return -1;
+
+  *r_pid = pid;
+  if (r_child)
+    *r_child = args.child;
+  return 0;
+}
+#endif /*USE_LINUX_CLONE_SPAWN*/
+
+
+/* Returns 0 on success, -1 on error.  */
+int
+_gpgme_io_spawn (const char *path, char *const argv[], unsigned int flags,
+		 struct spawn_fd_item_s *fd_list,
+		 void (*atfork) (void *opaque, int reserved),
+		 void *atforkvalue, pid_t *r_pid)
+{
+  pid_t pid;
+  pid_t child;
+  pid_t *r_child;
+  int i;
+  int res;
+
+  TRACE_BEG  (DEBUG_SYSIO, "_gpgme_io_spawn", path,
+	      "path=%s", path);
+  i = 0;
+  while (argv[i])
+    {
+      TRACE_LOG  ("argv[%2i] = %s", i, argv[i]);
+      i++;
+    }
+  for (i = 0; fd_list[i].fd != -1; i++)
+    if (fd_list[i].dup_to == -1)
+      TRACE_LOG  ("fd[%i] = 0x%x", i, fd_list[i].fd);
+    else
+      TRACE_LOG  ("fd[%i] = 0x%x -> 0x%x", i, fd_list[i].fd, fd_list[i].dup_to);
+
+  r_child = (flags & IOSPAWN_FLAG_CHILD_PID)? &child : NULL;
+
+  /* An ATFORK callback may do anything and thus requires a real
+     fork.  */
+#ifdef USE_LINUX_CLONE_SPAWN
+  if (spawn_method == SPAWN_METHOD_VFORK && !atfork
+      && have_close_range_cloexec ())
+    {
+      TRACE_LOG  ("using clone");
+      res = spawn_clone (path, argv, fd_list, &pid, r_child);
+    }
+  else
+#endif
+    res = spawn_fork (path, argv, fd_list, atfork, atforkvalue, &pid,
+                      r_child);
+  if (res)
     return TRACE_SYSRES (-1);
+  if (r_child)
+    {
+      TRACE_LOG  ("child pid=%i", (int)child);
+      pid = child;
+    }
 
   for (i = 0; fd_list[i].fd != -1; i++)
     {
@@ -639,8 +1035,153 @@ _gpgme_io_spawn (const char *path, char *const argv[], unsigned int flags,
 }
 
 
+/* Return a pidfd for the process PID or -1 with ERRNO set.  */
+int
+_gpgme_io_pidfd_open (pid_t pid)
+{
+#ifdef USE_LINUX_PIDFD
+  int fd;
+  TRACE_BEG (DEBUG_SYSIO, "_gpgme_io_pidfd_open", pid, "");
+
+  fd = syscall (SYS_pidfd_open, pid, 0);
+  return TRACE_SYSRES (fd);
+#else
+  (void)pid;
+  gpg_err_set_errno (ENOSYS);
+  return -1;
+#endif
+}
+
+
+/* Send SIGTERM to the process PID, through PIDFD if it is not -1.
+   Returns 0 on success or -1 with ERRNO set.  */
+int
+_gpgme_io_kill (pid_t pid, int pidfd)
+{
+  int res;
+  TRACE_BEG (DEBUG_SYSIO, "_gpgme_io_kill", pid, "pidfd=%d", pidfd);
+
+#ifdef USE_LINUX_PIDFD
+  if (pidfd != -1)
+    {
+      res = syscall (SYS_pidfd_send_signal, pidfd, SIGTERM, NULL, 0);
+      if (res == -1 && errno == ESRCH)
+        res = 0;  /* The process already exited.  */
+      return TRACE_SYSRES (res);
+    }
+#else
+  (void)pidfd;
+#endif
+
+  if (pid <= 0)
+    {
+      gpg_err_set_errno (EINVAL);
+      return TRACE_SYSRES (-1);
+    }
+  res = kill (pid, SIGTERM);
+  return TRACE_SYSRES (res);
+}
+
+
 /* Select on the list of fds.  Returns: -1 = error, 0 = timeout or
    nothing to select, > 0 = number of signaled fds.  */
+#ifdef HAVE_POLL_H
+/* This version uses poll(2) and thus is not limited to FD_SETSIZE.  */
+int
+_gpgme_io_select (struct io_select_fd_s *fds, size_t nfds, int nonblock)
+{
+  struct pollfd stackbuf[32];
+  struct pollfd *pfds;
+  unsigned int i;
+  int npfds;
+  int n;
+  int count;
+  /* Use a 1s timeout.  */
+  int timeout = nonblock? 0 : 1000;
+  void *dbg_help = NULL;
+  TRACE_BEG  (DEBUG_SYSIO, "_gpgme_io_select", fds,
+	      "nfds=%zu, nonblock=%u", nfds, nonblock);
+
+  if (nfds <= DIM (stackbuf))
+    pfds = stackbuf;
+  else
+    {
+      pfds = malloc (nfds * sizeof *pfds);
+      if (!pfds)
+        return TRACE_SYSRES (-1);
+    }
+
+  TRACE_SEQ (dbg_help, "select on [ ");
+
+  npfds = 0;
+  for (i = 0; i < nfds; i++)
+    {
+      if (fds[i].fd == -1)
+	continue;
+      if (fds[i].for_read)
+	{
+	  pfds[npfds].fd = fds[i].fd;
+	  pfds[npfds].events = POLLIN;
+	  pfds[npfds].revents = 0;
+	  npfds++;
+	  TRACE_ADD1 (dbg_help, "r0x%x ", fds[i].fd);
+        }
+      else if (fds[i].for_write)
+	{
+	  pfds[npfds].fd = fds[i].fd;
+	  pfds[npfds].events = POLLOUT;
+	  pfds[npfds].revents = 0;
+	  npfds++;
+	  TRACE_ADD1 (dbg_help, "w0x%x ", fds[i].fd);
+        }
+      fds[i].signaled = 0;
+    }
+  TRACE_END (dbg_help, "]");
+  if (!npfds)
+    {
+      if (pfds != stackbuf)
+        free (pfds);
+      return TRACE_SYSRES (0);
+    }
+
+  do
+    {
+      count = poll (pfds, npfds, timeout);
+    }
+  while (count < 0 && errno == EINTR);
+  if (count < 0)
+    {
+      int saved_errno = errno;
+      if (pfds != stackbuf)
+        free (pfds);
+      errno = saved_errno;
+      return TRACE_SYSRES (-1);
+    }
+
+  /* Like select, we report errors and hangups as readiness so that
+     the handler sees EOF or the error.  POLLIN and POLLOUT are never
+     requested for the same entry, thus the order of PFDS and the
+     used entries of FDS is the same.  */
+  TRACE_SEQ (dbg_help, "select OK [ ");
+  for (n = 0, i = 0; i < nfds && n < npfds; i++)
+    {
+      if (fds[i].fd == -1 || !(fds[i].for_read || fds[i].for_write))
+	continue;
+      if (pfds[n].revents)
+        {
+          fds[i].signaled = 1;
+          TRACE_ADD2 (dbg_help, "%c0x%x ",
+                      fds[i].for_read? 'r':'w', fds[i].fd);
+        }
+      n++;
+    }
+  TRACE_END (dbg_help, "]");
+
+  if (pfds != stackbuf)
+    free (pfds);
+  return TRACE_SYSRES (count);
+}
+#else /*!HAVE_POLL_H*/
 int
 _gpgme_io_select (struct io_select_fd_s *fds, size_t nfds, int nonblock)
 {
@@ -754,6 +1295,9 @@ _gpgme_io_select (struct io_select_fd_s *fds, size_t nfds, int nonblock)
 }
 
 
+#endif /*!HAVE_POLL_H*/
+
+
 int
 _gpgme_io_recvmsg (int fd, struct msghdr *msg, int flags)
 {
@@ -66,12 +66,17 @@ int _gpgme_io_socket (int namespace, int style, int protocol);
 int _gpgme_io_connect (int fd, struct sockaddr *addr, int addrlen);
 int _gpgme_io_read (int fd, void *buffer, size_t count);
 int _gpgme_io_write (int fd, const void *buffer, size_t count);
+int _gpgme_io_splice (int fd_in, int fd_out, size_t count);
+struct gpgme_data_segment;
+int _gpgme_io_writev (int fd, const struct gpgme_data_segment *segs,
+                      int nsegs);
 int _gpgme_io_pipe (int filedes[2], int inherit_idx);
 int _gpgme_io_close (int fd);
 typedef void (*_gpgme_close_notify_handler_t) (int,void*);
 int _gpgme_io_set_close_notify (int fd, _gpgme_close_notify_handler_t handler,
 				void *value);
 int _gpgme_io_set_nonblocking (int fd);
+int _gpgme_io_set_pipe_size (int fd, size_t size);
 
 /* Under Windows do not allocate a console.  */
 #define IOSPAWN_FLAG_DETACHED 1
@@ -82,6 +87,10 @@ int _gpgme_io_set_nonblocking (int fd);
 #define IOSPAWN_FLAG_NOCLOSE 4
 /* Set show window to true for windows */
 #define IOSPAWN_FLAG_SHOW_WINDOW 8
+/* Return the pid of the new process and not that of the intermediate
+   child at R_PID.  The new process is not our child and thus may only
+   be signaled while it is known to run.  */
+#define IOSPAWN_FLAG_CHILD_PID 16
 
 /* Spawn the executable PATH with ARGV as arguments.  After forking
    close all fds except for those in FD_LIST in the child, then
@@ -92,8 +101,35 @@ int _gpgme_io_spawn (const char *path, char *const argv[], unsigned int flags,
 		     void (*atfork) (void *opaque, int reserved),
 		     void *atforkvalue, pid_t *r_pid);
 
+/* Return a descriptor for the process PID, which must have been
+   spawned with IOSPAWN_FLAG_CHILD_PID right before, or -1 if this is
+   not supported.  */
+int _gpgme_io_pidfd_open (pid_t pid);
+
+/* Terminate the process PID spawned with IOSPAWN_FLAG_CHILD_PID.  If
+   PIDFD is not -1 it is the descriptor for the process returned by
+   _gpgme_io_pidfd_open, which stays valid after the process exited.
+   Otherwise PID may only be used while the process is known to
+   run.  */
+int _gpgme_io_kill (pid_t pid, int pidfd);
+
 int _gpgme_io_select (struct io_select_fd_s *fds, size_t nfds, int nonblock);
 
+/* A readiness set which keeps its registered file descriptors across
+   waits; see pollset.c.  */
+typedef struct io_pollset_s *io_pollset_t;
+
+int _gpgme_io_pollset_set_backend (const char *name);
+int _gpgme_io_pollset_new (io_pollset_t *r_ps);
+void _gpgme_io_pollset_release (io_pollset_t ps);
+int _gpgme_io_pollset_add (io_pollset_t ps, int fd, int for_write,
+                           void *opaque);
+int _gpgme_io_pollset_del (io_pollset_t ps, int fd);
+void *_gpgme_io_pollset_get (io_pollset_t ps, int fd);
+int _gpgme_io_pollset_wait (io_pollset_t ps, struct io_select_fd_s *fds,
+                            size_t nfds, int timeout);
+void _gpgme_io_pollset_wakeup (io_pollset_t ps);
+
 /* Write the printable version of FD to the buffer BUF of length
    BUFLEN.  The printable version is the representation on the command
    line that the child process expects.  */
@@ -112,6 +148,7 @@ int _gpgme_io_dup (int fd);
 int _gpgme_io_recvmsg (int fd, struct msghdr *msg, int flags);
 int _gpgme_io_sendmsg (int fd, const struct msghdr *msg, int flags);
 int _gpgme_io_waitpid (int pid, int hang, int *r_status, int *r_signal);
+int _gpgme_io_set_spawn_method (const char *name);
 #endif
 
 #endif /* IO_H */
@@ -41,4 +41,19 @@
 
 #define UNLOCK(name) gpgrt_lock_unlock(&name)
 
+/* Reference counters.  REF_INC increments the unsigned int VAR and
+   REF_DEC decrements it and returns the new value.  The decrement
+   orders the accesses to the object before it, so that the caller
+   who drops the last reference may release the object.  Without the
+   atomic builtins a global lock is used.  */
+#ifdef HAVE_ATOMIC_BUILTINS
+# define REF_INC(var) ((void) __atomic_add_fetch (&(var), 1, __ATOMIC_RELAXED))
+# define REF_DEC(var) __atomic_sub_fetch (&(var), 1, __ATOMIC_ACQ_REL)
+#else
+void _gpgme_ref_inc (unsigned int *counter);
+unsigned int _gpgme_ref_dec (unsigned int *counter);
+# define REF_INC(var) _gpgme_ref_inc (&(var))
+# define REF_DEC(var) _gpgme_ref_dec (&(var))
+#endif
+
 #endif /* SEMA_H */
@@ -133,6 +133,7 @@ tofu_policy_start (gpgme_ctx_t ctx, int synchronous,
   err = _gpgme_op_reset (ctx, synchronous);
   if (err)
     return err;
+  _gpgme_keycache_invalidate ();
 
   err = _gpgme_op_data_lookup (ctx, OPDATA_TOFU_POLICY, &hook,
                                sizeof (*opd), NULL);
@@ -33,11 +33,6 @@
 #include "debug.h"
 
 
-/* Protects all reference counters in trust items.  All other accesses
-   to a trust item are either read only or happen before the trust
-   item is available to the user.  */
-DEFINE_STATIC_LOCK (trust_item_ref_lock);
-
 
 /* Create a new trust item.  */
 gpgme_error_t
@@ -64,9 +59,7 @@ _gpgme_trust_item_new (gpgme_trust_item_t *r_item)
 void
 gpgme_trust_item_ref (gpgme_trust_item_t item)
 {
-  LOCK (trust_item_ref_lock);
-  item->_refs++;
-  UNLOCK (trust_item_ref_lock);
+  REF_INC (item->_refs);
 }
 
 
@@ -78,14 +71,9 @@ gpgme_trust_item_ref (gpgme_trust_item_t item)
 void
 gpgme_trust_item_unref (gpgme_trust_item_t item)
 {
-  LOCK (trust_item_ref_lock);
   assert (item->_refs > 0);
-  if (--item->_refs)
-    {
-      UNLOCK (trust_item_ref_lock);
-      return;
-    }
-  UNLOCK (trust_item_ref_lock);
+  if (REF_DEC (item->_refs))
+    return;
 
   if (item->name)
     free (item->name);
@@ -56,6 +56,10 @@
 int _gpgme_get_conf_int (const char *key, int *value);
 void _gpgme_allow_set_foreground_window (pid_t pid);
 
+/* Return the milliseconds elapsed since an arbitrary point of time
+   from a clock which is not affected by changes of the system time.  */
+unsigned long long _gpgme_get_monotonic_ms (void);
+
 /*-- dirinfo.c --*/
 void _gpgme_dirinfo_disable_gpgconf (void);
 
@@ -143,6 +147,36 @@ gpgme_error_t _gpgme_encode_percent_string (const char *src, char **destp,
  * modifies STRING.  The number of parsed fields is returned.  */
 int _gpgme_split_fields (char *string, char **array, int arraysize);
 
+/* Split a colon delimited record into fields.  A pointer to each field
+ * is stored in ARRAY.  Stop splitting at ARRAYSIZE fields.  The
+ * function modifies LINE.  The number of parsed fields is returned.  */
+int _gpgme_split_colon_fields (char *line, char **array, int arraysize);
+
+/* The record type A B C D as returned by _gpgme_colon_rectag.  Use 0
+ * for D with the usual three letter types.  */
+#define COLON_RECTAG(a,b,c,d)                                   \
+  (((unsigned int)(unsigned char)(a) << 24)                     \
+   | ((unsigned int)(unsigned char)(b) << 16)                   \
+   | ((unsigned int)(unsigned char)(c) << 8)                    \
+   | (unsigned int)(unsigned char)(d))
+
+/* Return the record type in the first field TYPE of a colon record as
+ * an integer to switch on, or 0 if it is not 3 or 4 characters long.
+ * TYPE may be the first field after splitting or the entire line.  */
+static inline unsigned int
+_gpgme_colon_rectag (const char *type)
+{
+#define COLON_END(c) (!(c) || (c) == ':')
+  if (COLON_END (type[0]) || COLON_END (type[1]) || COLON_END (type[2]))
+    return 0;
+  if (COLON_END (type[3]))
+    return COLON_RECTAG (type[0], type[1], type[2], 0);
+  if (COLON_END (type[4]))
+    return COLON_RECTAG (type[0], type[1], type[2], type[3]);
+  return 0;
+#undef COLON_END
+}
+
 /* Convert the field STRING into an unsigned long value.  Check for
  * trailing garbage.  */
 gpgme_error_t _gpgme_strtoul_field (const char *string, unsigned long *result);
@@ -195,7 +229,6 @@ gpgme_error_t _gpgme_getenv (const char *name, char **value);
 
 /*-- status-table.c --*/
 /* Convert a status string to a status code.  */
-void _gpgme_status_init (void);
 gpgme_status_code_t _gpgme_parse_status (const char *name);
 const char *_gpgme_status_to_string (gpgme_status_code_t code);
 
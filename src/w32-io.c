@@ -1306,6 +1306,71 @@ _gpgme_io_set_nonblocking (int fd)
 }
 
 
+int
+_gpgme_io_splice (int fd_in, int fd_out, size_t count)
+{
+  TRACE (DEBUG_SYSIO, "_gpgme_io_splice", fd_in,
+         "fd_out=0x%x, count=%zu", fd_out, count);
+  gpg_err_set_errno (ENOSYS);
+  return -1;
+}
+
+
+int
+_gpgme_io_writev (int fd, const struct gpgme_data_segment *segs, int nsegs)
+{
+  TRACE (DEBUG_SYSIO, "_gpgme_io_writev", fd,
+         "segs=%p, nsegs=%i", segs, nsegs);
+  gpg_err_set_errno (ENOSYS);
+  return -1;
+}
+
+
+int
+_gpgme_io_set_pipe_size (int fd, size_t size)
+{
+  TRACE (DEBUG_SYSIO, "_gpgme_io_set_pipe_size", fd, "size=%zu", size);
+  gpg_err_set_errno (ENOSYS);
+  return -1;
+}
+
+
+int
+_gpgme_io_pidfd_open (pid_t pid)
+{
+  (void)pid;
+  gpg_err_set_errno (ENOSYS);
+  return -1;
+}
+
+
+int
+_gpgme_io_kill (pid_t pid, int pidfd)
+{
+  HANDLE proc;
+  int res = 0;
+  TRACE_BEG (DEBUG_SYSIO, "_gpgme_io_kill", pid, "");
+
+  (void)pidfd;
+
+  proc = OpenProcess (PROCESS_TERMINATE, FALSE, (DWORD)pid);
+  if (!proc)
+    {
+      TRACE_LOG ("OpenProcess failed: ec=%d", (int) GetLastError ());
+      gpg_err_set_errno (EPERM);
+      return TRACE_SYSRES (-1);
+    }
+  if (!TerminateProcess (proc, 1))
+    {
+      TRACE_LOG ("TerminateProcess failed: ec=%d", (int) GetLastError ());
+      gpg_err_set_errno (EPERM);
+      res = -1;
+    }
+  CloseHandle (proc);
+  return TRACE_SYSRES (res);
+}
+
+
 static char *
 build_commandline (char **argv)
 {
@@ -194,6 +194,21 @@ get_basename (const char *name)
 }
 
 
+unsigned long long
+_gpgme_get_monotonic_ms (void)
+{
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+
+  /* GetTickCount64 would require Vista.  */
+  if (!freq.QuadPart)
+    QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&now);
+  return (now.QuadPart / freq.QuadPart * 1000
+          + now.QuadPart % freq.QuadPart * 1000 / freq.QuadPart);
+}
+
+
 void
 _gpgme_allow_set_foreground_window (pid_t pid)
 {
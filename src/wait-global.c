@@ -43,11 +43,14 @@
    GPGME_EVENT_START event.  After that, it is added to the global
    list of active contexts.
 
-   The gpgme_wait function contains a select() loop over all file
-   descriptors in all active contexts.  If an error occurs, it closes
-   all fds in that context and moves the context to the global done
-   list.  Likewise, if a context has removed all I/O callbacks, it is
-   moved to the global done list.
+   The fds of all active contexts are registered with one global
+   readiness set, to which all changes of their fd tables are pushed.
+   The readiness set maps each fd directly to the wait item of its
+   handler.  The gpgme_wait function waits on that set and runs only
+   the handlers of the ready fds.  If an error occurs, it closes all
+   fds in that context and moves the context to the global done list.
+   Likewise, if a context has removed all I/O callbacks, it is moved
+   to the global done list.
 
    All contexts in the global done list are eligible for being
    returned by gpgme_wait if requested by the caller.  */
@@ -90,28 +93,64 @@ static struct ctx_list_item *ctx_active_list;
    successful).  */
 static struct ctx_list_item *ctx_done_list;
 
+/* The readiness set with the fds of all active contexts.  It is
+   created when the first context becomes active and is protected by
+   the ctx_list_lock.  */
+static io_pollset_t global_pollset;
+
+/* The number of active contexts with a deadline.  Protected by the
+   ctx_list_lock.  */
+static int ctx_deadlines;
+
 
 /* Enter the context CTX into the active list.  */
 static gpgme_error_t
 ctx_active (gpgme_ctx_t ctx)
 {
+  gpgme_error_t err = 0;
   struct ctx_list_item *li = malloc (sizeof (struct ctx_list_item));
   if (!li)
     return gpg_error_from_syserror ();
   li->ctx = ctx;
 
   LOCK (ctx_list_lock);
+  if (!global_pollset && _gpgme_io_pollset_new (&global_pollset))
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = _gpgme_fd_table_attach (&ctx->fdt, global_pollset);
+  if (err)
+    {
+      UNLOCK (ctx_list_lock);
+      free (li);
+      return err;
+    }
   /* Add LI to active list.  */
   li->next = ctx_active_list;
   li->prev = NULL;
   if (ctx_active_list)
     ctx_active_list->prev = li;
   ctx_active_list = li;
+  if (ctx->deadline)
+    ctx_deadlines++;
   UNLOCK (ctx_list_lock);
   return 0;
 }
 
 
+/* Return true if CTX is on the active list.  Must be called with the
+   ctx_list_lock held.  */
+static int
+ctx_is_active (gpgme_ctx_t ctx)
+{
+  struct ctx_list_item *li;
+
+  for (li = ctx_active_list; li; li = li->next)
+    if (li->ctx == ctx)
+      return 1;
+  return 0;
+}
+
+
 /* Enter the context CTX into the done list with status STATUS.  */
 static void
 ctx_done (gpgme_ctx_t ctx, gpgme_error_t status, gpgme_error_t op_err)
@@ -131,10 +170,15 @@ ctx_done (gpgme_ctx_t ctx, gpgme_error_t status, gpgme_error_t op_err)
     li->prev->next = li->next;
   else
     ctx_active_list = li->next;
+  if (ctx->deadline)
+    ctx_deadlines--;
 
   li->status = status;
   li->op_err = op_err;
 
+  /* Stop watching the fds which may be left after an error.  */
+  _gpgme_fd_table_detach (&ctx->fdt);
+
   /* Add LI to done list.  */
   li->next = ctx_done_list;
   li->prev = NULL;
@@ -145,6 +189,61 @@ ctx_done (gpgme_ctx_t ctx, gpgme_error_t status, gpgme_error_t op_err)
 }
 
 
+/* Cancel the operations of all active contexts for which
+   gpgme_cancel_async has been called or which ran into their
+   deadline.  Returns the milliseconds until the next deadline or -1
+   if there is none.  */
+static int
+ctx_cancel_pending (void)
+{
+  struct ctx_list_item *li;
+  gpgme_ctx_t ctx;
+  gpgme_error_t err;
+  int timed_out;
+  int left, next;
+
+  do
+    {
+      ctx = NULL;
+      timed_out = 0;
+      next = -1;
+      LOCK (ctx_list_lock);
+      for (li = ctx_active_list; li && !ctx; li = li->next)
+	{
+	  LOCK (li->ctx->lock);
+	  if (li->ctx->canceled)
+	    ctx = li->ctx;
+	  UNLOCK (li->ctx->lock);
+	  if (ctx)
+	    break;
+
+	  left = _gpgme_wait_time_left (li->ctx);
+	  if (!left)
+	    {
+	      ctx = li->ctx;
+	      timed_out = 1;
+	    }
+	  else if (left > 0 && (next == -1 || left < next))
+	    next = left;
+	}
+      UNLOCK (ctx_list_lock);
+
+      /* This moves CTX to the done list.  */
+      if (!ctx)
+	err = 0;
+      else if (timed_out)
+	err = _gpgme_wait_timeout (ctx);
+      else
+	err = _gpgme_cancel_with_err (ctx, gpg_error (GPG_ERR_CANCELED), 0);
+      if (err)
+	break;
+    }
+  while (ctx);
+
+  return next;
+}
+
+
 /* Find finished context CTX (or any context if CTX is NULL) and
    return its status in STATUS after removing it from the done list.
    If a matching context could be found, return it.  Return NULL if no
@@ -257,41 +356,34 @@ gpgme_wait_ext (gpgme_ctx_t ctx, gpgme_error_t *status,
 {
   do
     {
-      unsigned int i = 0;
-      struct ctx_list_item *li;
-      struct fd_table fdt;
+      struct io_select_fd_s ready[32];
+      gpgme_ctx_t touched[DIM (ready)];
+      io_pollset_t ps;
       int nr;
+      int ntouched = 0;
+      int woken;
+      int timeout = 1000;
+      int deadlines;
+      int i, j;
 
-      /* Collect the active file descriptors.  */
       LOCK (ctx_list_lock);
-      for (li = ctx_active_list; li; li = li->next)
-	i += li->ctx->fdt.size;
-      fdt.fds = malloc (i * sizeof (struct io_select_fd_s));
-      if (!fdt.fds)
-	{
-          int saved_err = gpg_error_from_syserror ();
-	  UNLOCK (ctx_list_lock);
-	  if (status)
-	    *status = saved_err;
-	  if (op_err)
-	    *op_err = 0;
-	  return NULL;
-	}
-      fdt.size = i;
-      i = 0;
-      for (li = ctx_active_list; li; li = li->next)
+      ps = global_pollset;
+      deadlines = ctx_deadlines;
+      UNLOCK (ctx_list_lock);
+
+      /* Don't wait beyond the next deadline.  */
+      if (deadlines)
 	{
-	  memcpy (&fdt.fds[i], li->ctx->fdt.fds,
-		  li->ctx->fdt.size * sizeof (struct io_select_fd_s));
-	  i += li->ctx->fdt.size;
+	  int next = ctx_cancel_pending ();
+
+	  if (next >= 0 && next < timeout)
+	    timeout = next;
 	}
-      UNLOCK (ctx_list_lock);
 
-      nr = _gpgme_io_select (fdt.fds, fdt.size, 0);
+      nr = ps? _gpgme_io_pollset_wait (ps, ready, DIM (ready), timeout) : 0;
       if (nr < 0)
 	{
           int saved_err = gpg_error_from_syserror ();
-	  free (fdt.fds);
 	  if (status)
 	    *status = saved_err;
 	  if (op_err)
@@ -299,76 +391,87 @@ gpgme_wait_ext (gpgme_ctx_t ctx, gpgme_error_t *status,
 	  return NULL;
 	}
 
-      for (i = 0; i < fdt.size && nr; i++)
+      /* A wakeup is always reported last.  */
+      woken = nr > 0 && ready[nr - 1].fd == -1;
+
+      /* READY is the list of fds which fired, each with the wait item
+         of its handler.  Thus we only need to touch these handlers
+         and their contexts.  */
+      for (i = 0; i < nr; i++)
 	{
-	  if (fdt.fds[i].fd != -1 && fdt.fds[i].signaled)
+	  gpgme_ctx_t ictx;
+	  gpgme_error_t err = 0;
+	  gpgme_error_t local_op_err = 0;
+	  struct wait_item_s *item;
+
+	  if (ready[i].fd == -1)
+	    continue;
+
+	  /* A handler run before may have removed this fd, in which
+	     case the item may be gone.  */
+	  item = (struct wait_item_s *) ready[i].opaque;
+	  if (_gpgme_io_pollset_get (ps, ready[i].fd) != item)
+	    continue;
+	  assert (item);
+	  ictx = item->ctx;
+	  assert (ictx);
+
+	  for (j = 0; j < ntouched; j++)
+	    if (touched[j] == ictx)
+	      break;
+	  if (j == ntouched)
+	    touched[ntouched++] = ictx;
+
+	  LOCK (ictx->lock);
+	  if (ictx->canceled)
+	    err = gpg_error (GPG_ERR_CANCELED);
+	  UNLOCK (ictx->lock);
+
+	  if (!err)
+	    err = _gpgme_run_io_cb (&ready[i], 0, &local_op_err);
+	  if (err || local_op_err)
 	    {
-	      gpgme_ctx_t ictx;
-	      gpgme_error_t err = 0;
-	      gpgme_error_t local_op_err = 0;
-	      struct wait_item_s *item;
-
-	      assert (nr);
-	      nr--;
-
-	      item = (struct wait_item_s *) fdt.fds[i].opaque;
-	      assert (item);
-	      ictx = item->ctx;
-	      assert (ictx);
-
-	      LOCK (ctx->lock);
-	      if (ctx->canceled)
-		err = gpg_error (GPG_ERR_CANCELED);
-	      UNLOCK (ctx->lock);
-
-	      if (!err)
-		err = _gpgme_run_io_cb (&fdt.fds[i], 0, &local_op_err);
-	      if (err || local_op_err)
-		{
-		  /* An error occurred.  Close all fds in this context,
-		     and signal it.  */
-		  _gpgme_cancel_with_err (ictx, err, local_op_err);
-
-		  /* Break out of the loop, and retry the select()
-		     from scratch, because now all fds should be
-		     gone.  */
-		  break;
-		}
+	      /* An error occurred.  Close all fds in this context,
+		 and signal it.  */
+	      _gpgme_cancel_with_err (ictx, err, local_op_err);
+
+	      /* Break out of the loop, and retry the wait from
+		 scratch, because now all fds should be gone.  */
+	      break;
 	    }
 	}
-      free (fdt.fds);
 
-      /* Now some contexts might have finished successfully.  */
-      LOCK (ctx_list_lock);
-    retry:
-      for (li = ctx_active_list; li; li = li->next)
+      /* We are woken up by gpgme_cancel_async.  */
+      if (woken)
+	ctx_cancel_pending ();
+
+      /* Now some of the contexts we touched might have finished
+         successfully.  A context is active as long as its fd table
+         is attached to the global readiness set.  The contexts were
+         collected without the ctx_list_lock; another thread may have
+         moved them to the done list and released them since, so they
+         may only be looked at if they are still active.  */
+      for (j = 0; j < ntouched; j++)
 	{
-	  gpgme_ctx_t actx = li->ctx;
+	  gpgme_ctx_t actx = touched[j];
+	  int finished;
 
-	  for (i = 0; i < actx->fdt.size; i++)
-	    if (actx->fdt.fds[i].fd != -1)
-	      break;
-	  if (i == actx->fdt.size)
+	  LOCK (ctx_list_lock);
+	  finished = (ctx_is_active (actx)
+		      && actx->fdt.pollset == global_pollset
+		      && !actx->fdt.count);
+	  UNLOCK (ctx_list_lock);
+	  if (finished)
 	    {
 	      struct gpgme_io_event_done_data data;
 	      data.err = 0;
 	      data.op_err = 0;
 
-	      /* FIXME: This does not perform too well.  We have to
-		 release the lock because the I/O event handler
-		 acquires it to remove the context from the active
-		 list.  Two alternative strategies are worth
-		 considering: Either implement the DONE event handler
-		 here in a lock-free manner, or save a list of all
-		 contexts to be released and call the DONE events
-		 afterwards.  */
-	      UNLOCK (ctx_list_lock);
+	      /* The I/O event handler acquires the lock to remove the
+		 context from the active list.  */
 	      _gpgme_engine_io_event (actx->engine, GPGME_EVENT_DONE, &data);
-	      LOCK (ctx_list_lock);
-	      goto retry;
 	    }
 	}
-      UNLOCK (ctx_list_lock);
 
       {
 	gpgme_ctx_t dctx = ctx_wait (ctx, status, op_err);
@@ -82,11 +82,39 @@ _gpgme_wait_on_condition (gpgme_ctx_t ctx, volatile int *cond,
   if (op_err_p)
     *op_err_p = 0;
 
+  /* The fds stay registered with the private readiness set between
+     calls, so that only changes need to be pushed to the kernel.  */
+  if (!ctx->fdt.private_pollset
+      && _gpgme_io_pollset_new (&ctx->fdt.private_pollset))
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = _gpgme_fd_table_attach (&ctx->fdt, ctx->fdt.private_pollset);
+  if (err)
+    {
+      _gpgme_cancel_with_err (ctx, err, 0);
+      return err;
+    }
+
   do
     {
-      int nr = _gpgme_io_select (ctx->fdt.fds, ctx->fdt.size, 0);
+      struct io_select_fd_s ready[16];
+      int nr;
       unsigned int i;
+      int j;
+      int timeout = 1000;
+      int left;
+
+      left = _gpgme_wait_time_left (ctx);
+      if (!left)
+        {
+          err = _gpgme_wait_timeout (ctx);
+          return err? err : gpg_error (GPG_ERR_TIMEOUT);
+        }
+      if (left > 0 && left < timeout)
+        timeout = left;
 
+      nr = _gpgme_io_pollset_wait (ctx->fdt.private_pollset,
+                                   ready, DIM (ready), timeout);
       if (nr < 0)
 	{
 	  /* An error occurred.  Close all fds in this context, and
@@ -97,6 +125,30 @@ _gpgme_wait_on_condition (gpgme_ctx_t ctx, volatile int *cond,
 	  return err;
 	}
 
+      /* gpgme_cancel_async wakes us up to get here.  */
+      LOCK (ctx->lock);
+      if (ctx->canceled)
+	err = gpg_error (GPG_ERR_CANCELED);
+      UNLOCK (ctx->lock);
+      if (err)
+	{
+	  _gpgme_cancel_with_err (ctx, err, 0);
+	  return err;
+	}
+
+      /* Mark the ready fds in the table; the handlers below may
+         change the table, which clears the mark of new entries.  */
+      for (i = 0; i < ctx->fdt.size; i++)
+        ctx->fdt.fds[i].signaled = 0;
+      for (j = 0; j < nr; j++)
+        for (i = 0; ready[j].fd != -1 && i < ctx->fdt.size; i++)
+          if (ctx->fdt.fds[i].fd == ready[j].fd
+              && ctx->fdt.fds[i].for_write == ready[j].for_write)
+            {
+              ctx->fdt.fds[i].signaled = 1;
+              break;
+            }
+
       for (i = 0; i < ctx->fdt.size && nr; i++)
 	{
 	  if (ctx->fdt.fds[i].fd != -1 && ctx->fdt.fds[i].signaled)
@@ -141,10 +193,7 @@ _gpgme_wait_on_condition (gpgme_ctx_t ctx, volatile int *cond,
 	    }
 	}
 
-      for (i = 0; i < ctx->fdt.size; i++)
-	if (ctx->fdt.fds[i].fd != -1)
-	  break;
-      if (i == ctx->fdt.size)
+      if (!ctx->fdt.count)
 	{
 	  struct gpgme_io_event_done_data data;
 	  data.err = 0;
@@ -178,3 +227,61 @@ _gpgme_wait_one_ext (gpgme_ctx_t ctx, gpgme_error_t *op_err)
 {
   return _gpgme_wait_on_condition (ctx, NULL, op_err);
 }
+
+
+/* Wait for the fds of the contexts attached to the readiness set PS
+   and run the handlers of those which are ready, for one round.  This
+   is used to run several operations on behalf of CTX at once; CTX
+   itself should be attached to PS, so that gpgme_cancel_async wakes
+   us up.  The deadline and the cancellation of CTX are honored.  If
+   a handler fails the operation of its context is canceled and the
+   error is returned.  */
+gpgme_error_t
+_gpgme_wait_on_pollset (gpgme_ctx_t ctx, struct io_pollset_s *ps)
+{
+  struct io_select_fd_s ready[16];
+  gpgme_error_t err = 0;
+  int timeout = 1000;
+  int left;
+  int nr, i;
+
+  left = _gpgme_wait_time_left (ctx);
+  if (!left)
+    return gpg_error (GPG_ERR_TIMEOUT);
+  if (left > 0 && left < timeout)
+    timeout = left;
+
+  nr = _gpgme_io_pollset_wait (ps, ready, DIM (ready), timeout);
+  if (nr < 0)
+    return gpg_error_from_syserror ();
+
+  LOCK (ctx->lock);
+  if (ctx->canceled)
+    err = gpg_error (GPG_ERR_CANCELED);
+  UNLOCK (ctx->lock);
+  if (err)
+    return err;
+
+  for (i = 0; i < nr; i++)
+    {
+      struct wait_item_s *item;
+      gpgme_error_t op_err = 0;
+
+      if (ready[i].fd == -1)
+	continue;
+
+      /* A handler run before may have removed this fd.  */
+      item = (struct wait_item_s *) ready[i].opaque;
+      if (_gpgme_io_pollset_get (ps, ready[i].fd) != item)
+	continue;
+
+      err = _gpgme_run_io_cb (&ready[i], 0, &op_err);
+      if (err || op_err)
+	{
+	  _gpgme_cancel_with_err (item->ctx, err, op_err);
+	  return err? err : op_err;
+	}
+    }
+
+  return 0;
+}
@@ -57,26 +57,25 @@ _gpgme_user_io_cb_handler (void *data, int fd)
     err = gpg_error (GPG_ERR_CANCELED);
   UNLOCK (ctx->lock);
 
+  /* We don't control the waiting and can only check the deadline
+     when I/O happens.  */
+  if (!err && !_gpgme_wait_time_left (ctx))
+    {
+      _gpgme_wait_timeout (ctx);
+      return 0;
+    }
+
   if (! err)
     err = _gpgme_run_io_cb (&ctx->fdt.fds[tag->idx], 0, &op_err);
   if (err || op_err)
     _gpgme_cancel_with_err (ctx, err, op_err);
-  else
+  else if (!ctx->fdt.count)
     {
-      unsigned int i;
-
-      for (i = 0; i < ctx->fdt.size; i++)
-	if (ctx->fdt.fds[i].fd != -1)
-	  break;
+      struct gpgme_io_event_done_data done_data;
 
-      if (i == ctx->fdt.size)
-	{
-	  struct gpgme_io_event_done_data done_data;
-
-	  done_data.err = 0;
-	  done_data.op_err = 0;
-	  _gpgme_engine_io_event (ctx->engine, GPGME_EVENT_DONE, &done_data);
-	}
+      done_data.err = 0;
+      done_data.op_err = 0;
+      _gpgme_engine_io_event (ctx->engine, GPGME_EVENT_DONE, &done_data);
     }
   return 0;
 }
@@ -118,16 +117,70 @@ _gpgme_wait_user_remove_io_cb (void *data)
   assert (tag);
   ctx = tag->ctx;
 
-  (*ctx->io_cbs.remove) (tag->user_tag);
+  /* There is no user tag while the fds are held.  */
+  if (tag->user_tag)
+    (*ctx->io_cbs.remove) (tag->user_tag);
   _gpgme_remove_io_cb (data);
 }
 
 
+/* Stop watching the fds of CTX in the user event loop if HOLD is
+   true, or watch them again if HOLD is false.  The fds stay in the fd
+   table, so that the operation is not considered done.  This is used
+   to throttle the backend while its results are not consumed.  Does
+   nothing if CTX does not use a user event loop.  */
+gpgme_error_t
+_gpgme_wait_user_hold (gpgme_ctx_t ctx, int hold)
+{
+  gpgme_error_t err = 0;
+  unsigned int i;
+
+  if (!ctx->io_cbs.add || !hold == !ctx->fdt.held)
+    return 0;
+
+  TRACE (DEBUG_CTX, "_gpgme_wait_user_hold", ctx, "hold=%i", hold);
+  for (i = 0; i < ctx->fdt.size && !err; i++)
+    {
+      struct wait_item_s *item;
+      struct tag *tag;
+
+      if (ctx->fdt.fds[i].fd == -1)
+	continue;
+      item = (struct wait_item_s *) ctx->fdt.fds[i].opaque;
+      tag = item->tag;
+      if (hold && tag->user_tag)
+	{
+	  (*ctx->io_cbs.remove) (tag->user_tag);
+	  tag->user_tag = NULL;
+	}
+      else if (!hold && !tag->user_tag)
+	{
+	  err = (*ctx->io_cbs.add) (ctx->io_cbs.add_priv,
+				    ctx->fdt.fds[i].fd, item->dir,
+				    _gpgme_user_io_cb_handler, tag,
+				    &tag->user_tag);
+	  if (err)
+	    tag->user_tag = NULL;
+	}
+    }
+  ctx->fdt.held = hold;
+  return err;
+}
+
+
 void
 _gpgme_wait_user_event_cb (void *data, gpgme_event_io_t type, void *type_data)
 {
   gpgme_ctx_t ctx = data;
 
+  /* With a queue depth the keys are fetched by the application with
+     gpgme_op_keylist_next.  */
+  if (type == GPGME_EVENT_NEXT_KEY && ctx->keylist_queue_depth)
+    {
+      _gpgme_op_keylist_event_cb (ctx, type, type_data);
+      type_data = NULL;
+    }
+
   if (ctx->io_cbs.event)
     (*ctx->io_cbs.event) (ctx->io_cbs.event_priv, type, type_data);
 }
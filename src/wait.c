@@ -26,6 +26,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #ifdef HAVE_SYS_TYPES_H
 # include <sys/types.h>
 #endif
@@ -45,16 +46,118 @@ _gpgme_fd_table_init (fd_table_t fdt)
 {
   fdt->fds = NULL;
   fdt->size = 0;
+  fdt->count = 0;
+  fdt->pollset = NULL;
+  fdt->private_pollset = NULL;
+  fdt->held = 0;
 }
 
 void
 _gpgme_fd_table_deinit (fd_table_t fdt)
 {
+  _gpgme_fd_table_detach (fdt);
+  _gpgme_io_pollset_release (fdt->private_pollset);
+  fdt->private_pollset = NULL;
   if (fdt->fds)
     free (fdt->fds);
 }
 
 
+/* Register all fds of FDT with the readiness set POLLSET and push
+   all later changes of FDT to it.  A table is attached to at most
+   one readiness set at a time.  */
+gpgme_error_t
+_gpgme_fd_table_attach (fd_table_t fdt, io_pollset_t pollset)
+{
+  gpgme_error_t err;
+  unsigned int i;
+
+  if (fdt->pollset == pollset)
+    return 0;
+  _gpgme_fd_table_detach (fdt);
+
+  for (i = 0; i < fdt->size; i++)
+    {
+      if (fdt->fds[i].fd == -1)
+        continue;
+      if (_gpgme_io_pollset_add (pollset, fdt->fds[i].fd,
+                                 fdt->fds[i].for_write, fdt->fds[i].opaque))
+        {
+          err = gpg_error_from_syserror ();
+          while (i-- > 0)
+            if (fdt->fds[i].fd != -1)
+              _gpgme_io_pollset_del (pollset, fdt->fds[i].fd);
+          return err;
+        }
+    }
+  fdt->pollset = pollset;
+  return 0;
+}
+
+
+/* Remove all fds of FDT from the readiness set it is attached to.  */
+void
+_gpgme_fd_table_detach (fd_table_t fdt)
+{
+  unsigned int i;
+
+  if (!fdt->pollset)
+    return;
+
+  for (i = 0; i < fdt->size; i++)
+    if (fdt->fds[i].fd != -1)
+      _gpgme_io_pollset_del (fdt->pollset, fdt->fds[i].fd);
+  fdt->pollset = NULL;
+}
+
+
+/* Interrupt a thread waiting for the fds of FDT.  This may be called
+   from any thread; the readiness sets live at least as long as the
+   tables attached to them.  */
+void
+_gpgme_fd_table_wakeup (fd_table_t fdt)
+{
+  io_pollset_t pollset = fdt->pollset;
+
+  if (pollset)
+    _gpgme_io_pollset_wakeup (pollset);
+}
+
+
+/* Return the milliseconds left until the deadline of the operation in
+   CTX, 0 if the deadline has passed or -1 if there is no deadline.  */
+int
+_gpgme_wait_time_left (gpgme_ctx_t ctx)
+{
+  unsigned long long now;
+
+  if (!ctx->deadline)
+    return -1;
+  now = _gpgme_get_monotonic_ms ();
+  if (now >= ctx->deadline)
+    return 0;
+  if (ctx->deadline - now > INT_MAX)
+    return INT_MAX;
+  return (int)(ctx->deadline - now);
+}
+
+
+/* Terminate the operation in CTX, which ran into its deadline, with
+   the error GPG_ERR_TIMEOUT.  Returns an error if the operation could
+   not be canceled.  */
+gpgme_error_t
+_gpgme_wait_timeout (gpgme_ctx_t ctx)
+{
+  TRACE (DEBUG_CTX, "_gpgme_wait_timeout", ctx, "timeout_ms=%u",
+         ctx->timeout_ms);
+
+  /* The backend process may hang, for example in a network lookup,
+     and would not notice that we closed the pipes.  */
+  _gpgme_engine_kill (ctx->engine);
+  return _gpgme_cancel_with_err (ctx, gpg_error (GPG_ERR_TIMEOUT), 0);
+}
+
+
 /* XXX We should keep a marker and roll over for speed.  */
 static gpgme_error_t
 fd_table_put (fd_table_t fdt, int fd, int dir, void *opaque, int *idx)
@@ -81,11 +184,16 @@ fd_table_put (fd_table_t fdt, int fd, int dir, void *opaque, int *idx)
 	fdt->fds[i + j].fd = -1;
     }
 
+  if (fdt->pollset
+      && _gpgme_io_pollset_add (fdt->pollset, fd, (dir == 0), opaque))
+    return gpg_error_from_syserror ();
+
   fdt->fds[i].fd = fd;
   fdt->fds[i].for_read = (dir == 1);
   fdt->fds[i].for_write = (dir == 0);
   fdt->fds[i].signaled = 0;
   fdt->fds[i].opaque = opaque;
+  fdt->count++;
   *idx = i;
   return 0;
 }
@@ -127,6 +235,7 @@ _gpgme_add_io_cb (void *data, int fd, int dir, gpgme_io_cb_t fnc,
   item->dir = dir;
   item->handler = fnc;
   item->handler_value = fnc_data;
+  item->tag = tag;
 
   err = fd_table_put (fdt, fd, dir, item, &tag->idx);
   if (err)
@@ -163,10 +272,16 @@ _gpgme_remove_io_cb (void *data)
 	  "setting fd 0x%x (item=%p) done", fdt->fds[idx].fd,
 	  fdt->fds[idx].opaque);
 
+  if (fdt->pollset)
+    _gpgme_io_pollset_del (fdt->pollset, fdt->fds[idx].fd);
+
   free (fdt->fds[idx].opaque);
   free (tag);
 
   /* Free the table entry.  */
+  fdt->count--;
+  if (!fdt->count)
+    fdt->held = 0;
   fdt->fds[idx].fd = -1;
   fdt->fds[idx].for_read = 0;
   fdt->fds[idx].for_write = 0;
@@ -29,6 +29,21 @@ struct fd_table
 {
   struct io_select_fd_s *fds;
   size_t size;
+
+  /* The number of used entries in FDS.  */
+  size_t count;
+
+  /* The readiness set the fds of this table are registered with, or
+     NULL.  While set, all changes to the table are pushed to it.  */
+  struct io_pollset_s *pollset;
+
+  /* The readiness set of the private event loop.  It is created on
+     first use and kept until the table is deinitialized.  */
+  struct io_pollset_s *private_pollset;
+
+  /* True while the fds are not watched by the user event loop; see
+     _gpgme_wait_user_hold.  */
+  int held;
 };
 typedef struct fd_table *fd_table_t;
 
@@ -40,6 +55,9 @@ struct wait_item_s
   gpgme_io_cb_t handler;
   void *handler_value;
   int dir;
+
+  /* The struct tag of the handler.  */
+  void *tag;
 };
 
 /* A registered fd handler is removed later using the tag that
@@ -59,6 +77,13 @@ struct tag
 
 void _gpgme_fd_table_init (fd_table_t fdt);
 void _gpgme_fd_table_deinit (fd_table_t fdt);
+gpgme_error_t _gpgme_fd_table_attach (fd_table_t fdt,
+                                      struct io_pollset_s *pollset);
+void _gpgme_fd_table_detach (fd_table_t fdt);
+void _gpgme_fd_table_wakeup (fd_table_t fdt);
+
+int _gpgme_wait_time_left (gpgme_ctx_t ctx);
+gpgme_error_t _gpgme_wait_timeout (gpgme_ctx_t ctx);
 
 gpgme_error_t _gpgme_add_io_cb (void *data, int fd, int dir,
 			     gpgme_io_cb_t fnc, void *fnc_data, void **r_tag);
@@ -74,6 +99,7 @@ gpgme_error_t _gpgme_wait_user_add_io_cb (void *data, int fd, int dir,
 void _gpgme_wait_user_remove_io_cb (void *tag);
 void _gpgme_wait_user_event_cb (void *data, gpgme_event_io_t type,
 				void *type_data);
+gpgme_error_t _gpgme_wait_user_hold (gpgme_ctx_t ctx, int hold);
 
 gpgme_error_t _gpgme_run_io_cb (struct io_select_fd_s *an_fds, int checked,
 				gpgme_error_t *err);
@@ -54,6 +54,9 @@ flush_data (gpgme_data_t dh)
 }
 
 
+static int eof_seen;
+
+
 gpgme_error_t
 interact_fnc (void *opaque, const char *status, const char *args, int fd)
 {
@@ -65,6 +68,10 @@ interact_fnc (void *opaque, const char *status, const char *args, int fd)
 
   fprintf (stdout, "[-- Code: %s, %s --]\n", status, args);
 
+  /* EOF is reported as an empty string.  */
+  if (!*status)
+    eof_seen = 1;
+
   if (fd >= 0)
     {
       if (!strcmp (args, "keyedit.prompt"))
@@ -143,6 +150,12 @@ main (int argc, char **argv)
 
   err = gpgme_op_interact (ctx, key, 0, interact_fnc, out, out);
   fail_if_err (err);
+  if (!eof_seen)
+    {
+      fprintf (stderr, "%s:%i: EOF not seen by the interact callback\n",
+               __FILE__, __LINE__);
+      exit (1);
+    }
 
   fputs ("[-- Last response --]\n", stdout);
   flush_data (out);
@@ -27,6 +27,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/wait.h>
+#endif
 
 #include <gpgme.h>
 
@@ -68,6 +72,91 @@ write_cb (void *handle, const void *buffer, size_t size)
 }
 
 
+#ifndef HAVE_W32_SYSTEM
+/* Fork a process which writes NBYTES of random data to a pipe and
+   return the read end of it.  */
+static int
+spawn_feeder (size_t nbytes, pid_t *r_pid)
+{
+  struct cb_parms parms;
+  char buffer[4096];
+  int fds[2];
+  size_t n;
+
+  if (pipe (fds) || (*r_pid = fork ()) == -1)
+    {
+      fprintf (stderr, "%s:%i: error creating feeder\n", __FILE__, __LINE__);
+      exit (1);
+    }
+  if (!*r_pid)
+    {
+      close (fds[0]);
+      memset (&parms, 0, sizeof parms);
+      parms.bytes_to_send = nbytes;
+      while ((n = read_cb (&parms, buffer, sizeof buffer)))
+        if (write (fds[1], buffer, n) != n)
+          _exit (1);
+      _exit (0);
+    }
+  close (fds[1]);
+  return fds[0];
+}
+
+
+/* Fork a process which reads from a pipe until EOF and exits with
+   success if it got at least NBYTES.  Return the write end of the
+   pipe.  */
+static int
+spawn_drain (size_t nbytes, pid_t *r_pid)
+{
+  char buffer[4096];
+  int fds[2];
+  size_t total = 0;
+  ssize_t n;
+
+  if (pipe (fds) || (*r_pid = fork ()) == -1)
+    {
+      fprintf (stderr, "%s:%i: error creating drain\n", __FILE__, __LINE__);
+      exit (1);
+    }
+  if (!*r_pid)
+    {
+      close (fds[1]);
+      while ((n = read (fds[0], buffer, sizeof buffer)) > 0)
+        total += n;
+      _exit (!(n == 0 && total >= nbytes));
+    }
+  close (fds[0]);
+  return fds[1];
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+#ifdef __linux__
+/* Return the size in KiB of the file pages of this process which are
+   resident or -1 on error.  */
+static long
+rss_file (void)
+{
+  char line[256];
+  long value = -1;
+  FILE *fp;
+
+  fp = fopen ("/proc/self/status", "r");
+  if (!fp)
+    return -1;
+  while (fgets (line, sizeof line, fp))
+    if (!strncmp (line, "RssFile:", 8))
+      {
+        value = atol (line + 8);
+        break;
+      }
+  fclose (fp);
+  return value;
+}
+#endif /*__linux__*/
+
+
 static void
 progress_cb (void *opaque, const char *what, int type, int current, int total)
 {
@@ -94,6 +183,11 @@ main (int argc, char *argv[])
   gpgme_encrypt_result_t result;
   size_t nbytes;
   struct cb_parms parms;
+  int round;
+  FILE *infp, *outfp;
+  char buffer[4096];
+  size_t n;
+  off_t inpos, outpos;
 
   if (argc > 1)
     nbytes = atoi (argv[1]);
@@ -105,8 +199,6 @@ main (int argc, char *argv[])
   memset (&cbs, 0, sizeof cbs);
   cbs.read = read_cb;
   cbs.write = write_cb;
-  memset (&parms, 0, sizeof parms);
-  parms.bytes_to_send = nbytes;
 
   err = gpgme_new (&ctx);
   fail_if_err (err);
@@ -116,12 +208,6 @@ main (int argc, char *argv[])
      gpgme i/o system. */
   gpgme_set_progress_cb (ctx, progress_cb, NULL);
 
-  err = gpgme_data_new_from_cbs (&in, &cbs, &parms);
-  fail_if_err (err);
-
-  err = gpgme_data_new_from_cbs (&out, &cbs, &parms);
-  fail_if_err (err);
-
   err = gpgme_get_key (ctx, "A0FF4590BB6122EDEF6E3C542D727CC768697734",
 		       &key[0], 0);
   fail_if_err (err);
@@ -129,22 +215,244 @@ main (int argc, char *argv[])
 		       &key[1], 0);
   fail_if_err (err);
 
+  /* The second round uses a large I/O buffer.  */
+  for (round = 0; round < 2; round++)
+    {
+      memset (&parms, 0, sizeof parms);
+      parms.bytes_to_send = nbytes;
+
+      err = gpgme_data_new_from_cbs (&in, &cbs, &parms);
+      fail_if_err (err);
+
+      err = gpgme_data_new_from_cbs (&out, &cbs, &parms);
+      fail_if_err (err);
+
+      if (round)
+        {
+          err = gpgme_data_set_flag (in, "io-buffer-size", "262144");
+          fail_if_err (err);
+          err = gpgme_data_set_flag (out, "io-buffer-size", "262144");
+          fail_if_err (err);
+        }
+
+      err = gpgme_op_encrypt (ctx, key, GPGME_ENCRYPT_ALWAYS_TRUST, in, out);
+      fail_if_err (err);
+      result = gpgme_op_encrypt_result (ctx);
+      if (result->invalid_recipients)
+        {
+          fprintf (stderr, "Invalid recipient encountered: %s\n",
+                   result->invalid_recipients->fpr);
+          exit (1);
+        }
+      if (parms.bytes_to_send || !parms.bytes_received)
+        {
+          fprintf (stderr, "%s:%i: data not completely processed\n",
+                   __FILE__, __LINE__);
+          exit (1);
+        }
+      printf ("plaintext=%u bytes, ciphertext=%u bytes\n",
+              (unsigned int)nbytes, (unsigned int)parms.bytes_received);
+
+      gpgme_data_release (in);
+      gpgme_data_release (out);
+    }
+
+  /* Now the same with regular files, which are handed directly to
+     the engine.  */
+  infp = tmpfile ();
+  outfp = tmpfile ();
+  if (!infp || !outfp)
+    {
+      fprintf (stderr, "%s:%i: error creating temporary files\n",
+               __FILE__, __LINE__);
+      exit (1);
+    }
+  memset (&parms, 0, sizeof parms);
+  parms.bytes_to_send = nbytes;
+  while ((n = read_cb (&parms, buffer, sizeof buffer)))
+    fwrite (buffer, n, 1, infp);
+  fflush (infp);
+  rewind (infp);
+
+  err = gpgme_data_new_from_fd (&in, fileno (infp));
+  fail_if_err (err);
+  err = gpgme_data_new_from_fd (&out, fileno (outfp));
+  fail_if_err (err);
+
   err = gpgme_op_encrypt (ctx, key, GPGME_ENCRYPT_ALWAYS_TRUST, in, out);
   fail_if_err (err);
-  result = gpgme_op_encrypt_result (ctx);
-  if (result->invalid_recipients)
+  inpos = lseek (fileno (infp), 0, SEEK_CUR);
+  outpos = lseek (fileno (outfp), 0, SEEK_CUR);
+  if (inpos != (off_t)nbytes || outpos < (off_t)nbytes)
     {
-      fprintf (stderr, "Invalid recipient encountered: %s\n",
-	       result->invalid_recipients->fpr);
+      fprintf (stderr, "%s:%i: data not completely processed\n",
+               __FILE__, __LINE__);
       exit (1);
     }
   printf ("plaintext=%u bytes, ciphertext=%u bytes\n",
-          (unsigned int)nbytes, (unsigned int)parms.bytes_received);
+          (unsigned int)nbytes, (unsigned int)outpos);
 
-  gpgme_key_unref (key[0]);
-  gpgme_key_unref (key[1]);
   gpgme_data_release (in);
   gpgme_data_release (out);
+  fclose (infp);
+  fclose (outfp);
+
+#ifndef HAVE_W32_SYSTEM
+  /* And with pipes, which are spliced to the engine pipes.  */
+  {
+    pid_t feeder, drain;
+    int infd, outfd;
+    int status;
+
+    infd = spawn_feeder (nbytes, &feeder);
+    outfd = spawn_drain (nbytes, &drain);
+
+    err = gpgme_data_new_from_fd (&in, infd);
+    fail_if_err (err);
+    err = gpgme_data_new_from_fd (&out, outfd);
+    fail_if_err (err);
+
+    err = gpgme_op_encrypt (ctx, key, GPGME_ENCRYPT_ALWAYS_TRUST, in, out);
+    fail_if_err (err);
+
+    gpgme_data_release (in);
+    gpgme_data_release (out);
+    close (infd);
+    close (outfd);
+    if (waitpid (feeder, &status, 0) != feeder || status
+        || waitpid (drain, &status, 0) != drain || status)
+      {
+        fprintf (stderr, "%s:%i: data not completely processed\n",
+                 __FILE__, __LINE__);
+        exit (1);
+      }
+  }
+#endif /*!HAVE_W32_SYSTEM*/
+
+#ifdef __linux__
+  /* And from a large mapped file.  Its data is written to the engine
+     pipe directly from the mapping, but the pages behind the position
+     must still be given back so that the resident set stays small.  */
+  {
+    const char *fname = "t-encrypt-large.tmp";
+    size_t mapsize = 48 * 1024 * 1024;
+    long rss_before, rss_after;
+
+    for (n = 0; n < sizeof buffer; n++)
+      buffer[n] = n;
+    outfp = fopen (fname, "wb");
+    if (!outfp)
+      {
+        fprintf (stderr, "%s:%i: can't create %s\n", __FILE__, __LINE__,
+                 fname);
+        exit (1);
+      }
+    for (n = 0; n < mapsize; n += sizeof buffer)
+      if (fwrite (buffer, sizeof buffer, 1, outfp) != 1)
+        {
+          fprintf (stderr, "%s:%i: error writing %s\n", __FILE__, __LINE__,
+                   fname);
+          exit (1);
+        }
+    if (fclose (outfp))
+      {
+        fprintf (stderr, "%s:%i: error writing %s\n", __FILE__, __LINE__,
+                 fname);
+        exit (1);
+      }
+
+    rss_before = rss_file ();
+    memset (&parms, 0, sizeof parms);
+    err = gpgme_data_new_from_file_mapped (&in, fname);
+    fail_if_err (err);
+    err = gpgme_data_new_from_cbs (&out, &cbs, &parms);
+    fail_if_err (err);
+
+    err = gpgme_op_encrypt (ctx, key, GPGME_ENCRYPT_ALWAYS_TRUST, in, out);
+    fail_if_err (err);
+    rss_after = rss_file ();
+
+    gpgme_data_release (in);
+    gpgme_data_release (out);
+    remove (fname);
+    if (rss_before < 0 || rss_after < 0)
+      {
+        fprintf (stderr, "%s:%i: can't get the resident set size\n",
+                 __FILE__, __LINE__);
+        exit (1);
+      }
+    if (rss_after - rss_before > 24 * 1024)
+      {
+        fprintf (stderr, "%s:%i: resident set grew by %ld KiB\n",
+                 __FILE__, __LINE__, rss_after - rss_before);
+        exit (1);
+      }
+  }
+#endif /*__linux__*/
+
+  /* And from many memory segments, which are written to the engine
+     pipe with writev, into a chunked object.  Check the result by
+     decrypting it.  */
+  {
+    struct gpgme_data_segment segs[100];
+    char *plain, *decrypted;
+    size_t i, off, len;
+    char *agent_info;
+
+    plain = malloc (nbytes);
+    if (!plain)
+      {
+        fprintf (stderr, "%s:%i: out of core\n", __FILE__, __LINE__);
+        exit (1);
+      }
+    for (off = 0; off < nbytes; off++)
+      plain[off] = rand ();
+    for (i = 0, off = 0; i < DIM (segs); i++)
+      {
+        /* Segments of uneven sizes; the last ones may be empty.  */
+        len = nbytes / DIM (segs) + (i % 7) * 13;
+        if (len > nbytes - off || i + 1 == DIM (segs))
+          len = nbytes - off;
+        segs[i].buffer = plain + off;
+        segs[i].length = len;
+        off += len;
+      }
+
+    err = gpgme_data_new_from_segments (&in, segs, DIM (segs));
+    fail_if_err (err);
+    err = gpgme_data_new_chunked (&out);
+    fail_if_err (err);
+
+    err = gpgme_op_encrypt (ctx, key, GPGME_ENCRYPT_ALWAYS_TRUST, in, out);
+    fail_if_err (err);
+    gpgme_data_release (in);
+
+    agent_info = getenv ("GPG_AGENT_INFO");
+    if (!(agent_info && strchr (agent_info, ':')))
+      gpgme_set_passphrase_cb (ctx, passphrase_cb, NULL);
+
+    in = out;
+    err = gpgme_data_rewind (in);
+    fail_if_err (err);
+    err = gpgme_data_new (&out);
+    fail_if_err (err);
+    err = gpgme_op_decrypt (ctx, in, out);
+    fail_if_err (err);
+    gpgme_data_release (in);
+
+    decrypted = gpgme_data_release_and_get_mem (out, &len);
+    if (len != nbytes || memcmp (decrypted, plain, nbytes))
+      {
+        fprintf (stderr, "%s:%i: decrypted data differs\n",
+                 __FILE__, __LINE__);
+        exit (1);
+      }
+    gpgme_free (decrypted);
+    free (plain);
+  }
+
+  gpgme_key_unref (key[0]);
+  gpgme_key_unref (key[1]);
   gpgme_release (ctx);
   return 0;
 }
@@ -0,0 +1,131 @@
+/* t-get-keys.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check that gpgme_get_keys returns the keys in the order of the
+   names and an error for each name without a unique key.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#include "t-support.h"
+
+
+static struct
+{
+  const char *name;
+  const char *fpr;	/* NULL if no key is expected.  */
+  gpg_err_code_t code;
+} names[] =
+  {
+    { "A0FF4590BB6122EDEF6E3C542D727CC768697734",
+      "A0FF4590BB6122EDEF6E3C542D727CC768697734" },
+    /* Key IDs of a subkey.  */
+    { "0x5381EA4EE29BA37F", "D695676BDCEDCC2CDD6152BCFE180B1DA9E3B0B2" },
+    { "E29BA37F", "D695676BDCEDCC2CDD6152BCFE180B1DA9E3B0B2" },
+    { "0000000000000000000000000000000000000000", NULL, GPG_ERR_EOF },
+    { "61ee841a2a27eb983b3b3c26413f4af31afdab6c",
+      "61EE841A2A27EB983B3B3C26413F4AF31AFDAB6C" },
+    /* Names which are not looked up in the batch.  */
+    { "alfa@example.net", "A0FF4590BB6122EDEF6E3C542D727CC768697734" },
+    { "example.net", NULL, GPG_ERR_AMBIGUOUS_NAME },
+    { "A0FF4590BB6122EDEF6E3C542D727CC768697734",
+      "A0FF4590BB6122EDEF6E3C542D727CC768697734" }
+  };
+
+#define NNAMES (sizeof names / sizeof names[0])
+
+
+static void
+check_keys (gpgme_ctx_t ctx)
+{
+  const char *list[NNAMES + 1];
+  gpgme_key_t keys[NNAMES];
+  gpgme_error_t errs[NNAMES];
+  gpgme_error_t err;
+  int i;
+
+  for (i = 0; i < NNAMES; i++)
+    list[i] = names[i].name;
+  list[i] = NULL;
+
+  err = gpgme_get_keys (ctx, list, 0, keys, errs);
+  fail_if_err (err);
+
+  for (i = 0; i < NNAMES; i++)
+    {
+      if (gpgme_err_code (errs[i]) != names[i].code)
+	{
+	  fprintf (stderr, "%s:%i: %s: unexpected error: %s\n",
+		   __FILE__, __LINE__, names[i].name,
+		   gpgme_strerror (errs[i]));
+	  exit (1);
+	}
+      if (!names[i].fpr != !keys[i]
+	  || (keys[i] && (!keys[i]->subkeys || !keys[i]->subkeys->fpr
+			  || strcmp (keys[i]->subkeys->fpr, names[i].fpr))))
+	{
+	  fprintf (stderr, "%s:%i: %s: unexpected key %s\n",
+		   __FILE__, __LINE__, names[i].name,
+		   keys[i] && keys[i]->subkeys && keys[i]->subkeys->fpr
+		   ? keys[i]->subkeys->fpr : "(none)");
+	  exit (1);
+	}
+      gpgme_key_unref (keys[i]);
+    }
+}
+
+
+int
+main (void)
+{
+  gpgme_ctx_t ctx;
+  gpgme_error_t err;
+  const char *s;
+
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+
+  check_keys (ctx);
+
+  /* With the key cache the second call needs no engine for the
+     fingerprints and key IDs found.  */
+  err = gpgme_set_ctx_flag (ctx, "key-cache", "1");
+  fail_if_err (err);
+  check_keys (ctx);
+  check_keys (ctx);
+  s = gpgme_get_ctx_flag (ctx, "key-cache-hits");
+  if (!s || strtoul (s, NULL, 10) < 4)
+    {
+      fprintf (stderr, "%s:%i: %s cache hits\n", __FILE__, __LINE__, s);
+      exit (1);
+    }
+
+  gpgme_release (ctx);
+  return 0;
+}
@@ -0,0 +1,192 @@
+/* t-keycache.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check that gpgme_get_key with the context flag "key-cache" returns
+   cached keys and that the cache is invalidated by an import and by
+   a change of the keyring file.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include <gpgme.h>
+
+#include "t-support.h"
+
+
+#define FPR "A0FF4590BB6122EDEF6E3C542D727CC768697734"
+
+
+/* Get the key FPR with CTX and check that the counters of the cache
+   are HITS and MISSES afterwards.  */
+static gpgme_key_t
+get_key (gpgme_ctx_t ctx, int line, unsigned long hits, unsigned long misses)
+{
+  gpgme_error_t err;
+  gpgme_key_t key;
+  const char *h, *m;
+
+  err = gpgme_get_key (ctx, FPR, &key, 0);
+  fail_if_err (err);
+  if (!key->subkeys || !key->subkeys->fpr || strcmp (key->subkeys->fpr, FPR))
+    {
+      fprintf (stderr, "%s:%i: wrong key returned\n", __FILE__, line);
+      exit (1);
+    }
+  h = gpgme_get_ctx_flag (ctx, "key-cache-hits");
+  if (!h || strtoul (h, NULL, 10) != hits)
+    {
+      fprintf (stderr, "%s:%i: %s hits instead of %lu\n",
+	       __FILE__, line, h? h : "(null)", hits);
+      exit (1);
+    }
+  /* The buffer of H may have been reused.  */
+  m = gpgme_get_ctx_flag (ctx, "key-cache-misses");
+  if (!m || strtoul (m, NULL, 10) != misses)
+    {
+      fprintf (stderr, "%s:%i: %s misses instead of %lu\n",
+	       __FILE__, line, m? m : "(null)", misses);
+      exit (1);
+    }
+  return key;
+}
+
+
+/* Change the modification time of the keyring.  */
+static void
+touch_keyring (void)
+{
+  const char *homedir = getenv ("GNUPGHOME");
+  struct utimbuf ut;
+  struct stat st;
+  char *fname;
+
+  if (!homedir)
+    homedir = ".";
+  fname = malloc (strlen (homedir) + 20);
+  if (!fname)
+    exit (1);
+  sprintf (fname, "%s/pubring.kbx", homedir);
+  if (stat (fname, &st))
+    {
+      sprintf (fname, "%s/pubring.gpg", homedir);
+      if (stat (fname, &st))
+	{
+	  fprintf (stderr, "%s:%i: keyring not found\n", __FILE__, __LINE__);
+	  exit (1);
+	}
+    }
+  ut.actime = st.st_atime;
+  ut.modtime = st.st_mtime + 1;
+  if (utime (fname, &ut))
+    {
+      fprintf (stderr, "%s:%i: utime failed\n", __FILE__, __LINE__);
+      exit (1);
+    }
+  free (fname);
+}
+
+
+int
+main (void)
+{
+  gpgme_ctx_t ctx;
+  gpgme_error_t err;
+  gpgme_key_t key, key2;
+  gpgme_data_t in;
+  char *pubkey = make_filename ("pubkey-1.asc");
+
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  err = gpgme_set_ctx_flag (ctx, "key-cache", "1");
+  fail_if_err (err);
+
+  key = get_key (ctx, __LINE__, 0, 1);
+  key2 = get_key (ctx, __LINE__, 1, 1);
+  if (key != key2)
+    {
+      fprintf (stderr, "%s:%i: cached key not returned\n",
+	       __FILE__, __LINE__);
+      exit (1);
+    }
+  gpgme_key_unref (key2);
+
+  /* Another keylist mode is another key.  */
+  gpgme_set_keylist_mode (ctx, GPGME_KEYLIST_MODE_LOCAL
+			  | GPGME_KEYLIST_MODE_SIGS);
+  key2 = get_key (ctx, __LINE__, 1, 2);
+  gpgme_key_unref (key2);
+  gpgme_set_keylist_mode (ctx, GPGME_KEYLIST_MODE_LOCAL);
+  key2 = get_key (ctx, __LINE__, 2, 2);
+  gpgme_key_unref (key2);
+
+  /* The TOFU statistics change with each verification; keys listed
+     with them are not cached.  */
+  gpgme_set_keylist_mode (ctx, GPGME_KEYLIST_MODE_LOCAL
+			  | GPGME_KEYLIST_MODE_WITH_TOFU);
+  key2 = get_key (ctx, __LINE__, 2, 2);
+  gpgme_key_unref (key2);
+  key2 = get_key (ctx, __LINE__, 2, 2);
+  gpgme_key_unref (key2);
+  gpgme_set_keylist_mode (ctx, GPGME_KEYLIST_MODE_LOCAL);
+
+  /* Importing keys invalidates the cache even if nothing changes.  */
+  err = gpgme_data_new_from_file (&in, pubkey, 1);
+  fail_if_err (err);
+  err = gpgme_op_import (ctx, in);
+  fail_if_err (err);
+  gpgme_data_release (in);
+  key2 = get_key (ctx, __LINE__, 2, 3);
+  gpgme_key_unref (key2);
+  key2 = get_key (ctx, __LINE__, 3, 3);
+  gpgme_key_unref (key2);
+
+  /* So does a change of the keyring.  */
+  touch_keyring ();
+  key2 = get_key (ctx, __LINE__, 3, 4);
+  gpgme_key_unref (key2);
+
+  /* Without the flag the cache is not used.  */
+  err = gpgme_set_ctx_flag (ctx, "key-cache", "0");
+  fail_if_err (err);
+  key2 = get_key (ctx, __LINE__, 3, 4);
+  gpgme_key_unref (key2);
+
+  /* The key returned first is still valid.  */
+  if (strcmp (key->subkeys->fpr, FPR))
+    {
+      fprintf (stderr, "%s:%i: key corrupted\n", __FILE__, __LINE__);
+      exit (1);
+    }
+  gpgme_key_unref (key);
+
+  gpgme_release (ctx);
+  free (pubkey);
+  return 0;
+}
@@ -0,0 +1,140 @@
+/* t-keylist-fields.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check that the context flag "keylist-fields" restricts the parts
+   of the listed keys.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#include "t-support.h"
+
+
+#define FPR "A0FF4590BB6122EDEF6E3C542D727CC768697734"
+
+
+static gpgme_key_t
+list_key (gpgme_ctx_t ctx, const char *fields, int secret)
+{
+  gpgme_error_t err;
+  gpgme_key_t key, next;
+
+  err = gpgme_set_ctx_flag (ctx, "keylist-fields", fields);
+  fail_if_err (err);
+  err = gpgme_op_keylist_start (ctx, FPR, secret);
+  fail_if_err (err);
+  err = gpgme_op_keylist_next (ctx, &key);
+  fail_if_err (err);
+  err = gpgme_op_keylist_next (ctx, &next);
+  if (gpgme_err_code (err) != GPG_ERR_EOF)
+    {
+      fprintf (stderr, "%s:%i: more than one key listed\n",
+	       __FILE__, __LINE__);
+      exit (1);
+    }
+  if (!key->subkeys || strcmp (key->subkeys->keyid, FPR + 24))
+    {
+      fprintf (stderr, "%s:%i: primary key not listed\n",
+	       __FILE__, __LINE__);
+      exit (1);
+    }
+  return key;
+}
+
+
+static void
+check (int line, const char *what, int cond)
+{
+  if (!cond)
+    {
+      fprintf (stderr, "%s:%i: unexpected %s\n", __FILE__, line, what);
+      exit (1);
+    }
+}
+
+
+int
+main (void)
+{
+  gpgme_ctx_t ctx;
+  gpgme_error_t err;
+  gpgme_key_t key;
+  const char *s;
+
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  gpgme_set_keylist_mode (ctx, GPGME_KEYLIST_MODE_LOCAL
+			  | GPGME_KEYLIST_MODE_SIGS);
+
+  if (!gpgme_set_ctx_flag (ctx, "keylist-fields", "fpr,foo"))
+    {
+      fprintf (stderr, "%s:%i: invalid value accepted\n",
+	       __FILE__, __LINE__);
+      exit (1);
+    }
+
+  /* Everything.  */
+  key = list_key (ctx, "", 0);
+  check (__LINE__, "fingerprint", key->fpr && !strcmp (key->fpr, FPR));
+  check (__LINE__, "subkeys", key->subkeys->next != NULL);
+  check (__LINE__, "user IDs", key->uids && key->uids->signatures);
+  gpgme_key_unref (key);
+
+  /* Only the fingerprint.  */
+  key = list_key (ctx, "fpr", 0);
+  s = gpgme_get_ctx_flag (ctx, "keylist-fields");
+  check (__LINE__, "flag value", s && !strcmp (s, "fpr"));
+  check (__LINE__, "fingerprint", key->fpr && !strcmp (key->fpr, FPR));
+  check (__LINE__, "subkeys", !key->subkeys->next);
+  check (__LINE__, "user IDs", !key->uids);
+  gpgme_key_unref (key);
+
+  /* User IDs and subkeys without signatures and fingerprints.  */
+  key = list_key (ctx, "uids subkeys", 0);
+  check (__LINE__, "fingerprint", !key->fpr && !key->subkeys->fpr);
+  check (__LINE__, "subkeys",
+	 key->subkeys->next && !key->subkeys->next->fpr);
+  check (__LINE__, "user IDs", key->uids && !key->uids->signatures);
+  gpgme_key_unref (key);
+
+  /* Keygrips of the secret key.  */
+  key = list_key (ctx, "keygrip", 1);
+  check (__LINE__, "keygrip", key->subkeys->keygrip != NULL);
+  check (__LINE__, "subkeys", !key->subkeys->next);
+  check (__LINE__, "fingerprint", !key->fpr);
+  gpgme_key_unref (key);
+  key = list_key (ctx, "fpr,subkeys", 1);
+  check (__LINE__, "keygrip",
+	 !key->subkeys->keygrip && !key->subkeys->next->keygrip);
+  check (__LINE__, "fingerprint", key->subkeys->next->fpr != NULL);
+  gpgme_key_unref (key);
+
+  gpgme_release (ctx);
+  return 0;
+}
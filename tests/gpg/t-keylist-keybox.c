@@ -0,0 +1,282 @@
+/* t-keylist-keybox.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check that listing the keys by reading the keybox with the context
+   flag "keylist-keybox" gives the same keys as listing them with
+   gpg.  The validity and the owner trust are not compared because
+   they are not computed from the keybox.  The context reading the
+   keybox is given a gpg which does not exist, so that a fall back to
+   gpg makes the test fail.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <gpgme.h>
+
+#include "t-support.h"
+
+
+static int
+strdiff (const char *a, const char *b)
+{
+  if (!a || !b)
+    return a != b;
+  return strcmp (a, b);
+}
+
+
+static void
+check (const char *fpr, const char *what, int cond)
+{
+  if (!cond)
+    {
+      fprintf (stderr, "%s: key %s: %s differs\n", __FILE__,
+	       fpr? fpr : "?", what);
+      exit (1);
+    }
+}
+
+
+/* Compare the key A listed by gpg with the key B read from the
+   keybox.  */
+static void
+compare_keys (gpgme_key_t a, gpgme_key_t b)
+{
+  const char *fpr = a->fpr;
+  gpgme_subkey_t sa, sb;
+  gpgme_user_id_t ua, ub;
+
+  check (fpr, "fingerprint", !strdiff (a->fpr, b->fpr));
+  check (fpr, "revoked", a->revoked == b->revoked);
+  check (fpr, "expired", a->expired == b->expired);
+  check (fpr, "invalid", a->invalid == b->invalid);
+  check (fpr, "can_encrypt", a->can_encrypt == b->can_encrypt);
+  check (fpr, "can_sign", a->can_sign == b->can_sign);
+  check (fpr, "can_certify", a->can_certify == b->can_certify);
+  check (fpr, "can_authenticate",
+	 a->can_authenticate == b->can_authenticate);
+  check (fpr, "protocol", a->protocol == b->protocol);
+  check (fpr, "keylist_mode", a->keylist_mode == b->keylist_mode);
+
+  for (sa = a->subkeys, sb = b->subkeys; sa && sb;
+       sa = sa->next, sb = sb->next)
+    {
+      check (fpr, "subkey fingerprint", !strdiff (sa->fpr, sb->fpr));
+      check (fpr, "subkey keyid", !strdiff (sa->keyid, sb->keyid));
+      check (fpr, "subkey revoked", sa->revoked == sb->revoked);
+      check (fpr, "subkey expired", sa->expired == sb->expired);
+      check (fpr, "subkey invalid", sa->invalid == sb->invalid);
+      check (fpr, "subkey capabilities",
+	     sa->can_encrypt == sb->can_encrypt
+	     && sa->can_sign == sb->can_sign
+	     && sa->can_certify == sb->can_certify
+	     && sa->can_authenticate == sb->can_authenticate);
+      check (fpr, "subkey algorithm", sa->pubkey_algo == sb->pubkey_algo);
+      check (fpr, "subkey length", sa->length == sb->length);
+      check (fpr, "subkey timestamp", sa->timestamp == sb->timestamp);
+      check (fpr, "subkey expires", sa->expires == sb->expires);
+      check (fpr, "subkey curve", !strdiff (sa->curve, sb->curve));
+      check (fpr, "subkey compliance", sa->is_de_vs == sb->is_de_vs);
+    }
+  check (fpr, "number of subkeys", !sa && !sb);
+
+  for (ua = a->uids, ub = b->uids; ua && ub; ua = ua->next, ub = ub->next)
+    {
+      check (fpr, "user ID", !strdiff (ua->uid, ub->uid));
+      check (fpr, "user ID address", !strdiff (ua->address, ub->address));
+      check (fpr, "user ID revoked", ua->revoked == ub->revoked);
+      check (fpr, "user ID invalid", ua->invalid == ub->invalid);
+    }
+  check (fpr, "number of user IDs", !ua && !ub);
+}
+
+
+/* List the keys matching PATTERN with and without the keybox reader
+   and compare them.  Returns the number of keys.  */
+static int
+compare_listings (gpgme_ctx_t gpgctx, gpgme_ctx_t kbxctx,
+		  const char *pattern[])
+{
+  gpgme_error_t err, err2;
+  gpgme_key_t a, b;
+  int n = 0;
+
+  err = gpgme_op_keylist_ext_start (gpgctx, pattern, 0, 0);
+  fail_if_err (err);
+  err = gpgme_op_keylist_ext_start (kbxctx, pattern, 0, 0);
+  fail_if_err (err);
+  for (;;)
+    {
+      err = gpgme_op_keylist_next (gpgctx, &a);
+      err2 = gpgme_op_keylist_next (kbxctx, &b);
+      if (gpgme_err_code (err) == GPG_ERR_EOF
+	  && gpgme_err_code (err2) == GPG_ERR_EOF)
+	break;
+      fail_if_err (err);
+      fail_if_err (err2);
+      compare_keys (a, b);
+      gpgme_key_unref (a);
+      gpgme_key_unref (b);
+      n++;
+    }
+  return n;
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+/* Copy the keybox to a new home directory, change the version of its
+   first OpenPGP blob to one not known to the keybox reader, and check
+   that the keybox is not used for a listing then.  */
+static void
+check_unknown_blob (void)
+{
+  const char *dir = "t-keylist-keybox.d";
+  const char *fname = "t-keylist-keybox.d/pubring.kbx";
+  static unsigned char image[1024 * 1024];
+  gpgme_ctx_t ctx;
+  gpgme_error_t err;
+  gpgme_key_t key;
+  size_t len, off;
+  FILE *fp;
+
+  fp = fopen ("pubring.kbx", "rb");
+  if (!fp)
+    {
+      fprintf (stderr, "%s:%i: can't open pubring.kbx\n", __FILE__, __LINE__);
+      exit (1);
+    }
+  len = fread (image, 1, sizeof image, fp);
+  fclose (fp);
+  for (off = 0; off + 6 <= len && image[off + 4] != 2; )
+    off += (((size_t)image[off] << 24) | (image[off + 1] << 16)
+            | (image[off + 2] << 8) | image[off + 3]);
+  if (len == sizeof image || off + 6 > len)
+    {
+      fprintf (stderr, "%s:%i: no OpenPGP blob found\n", __FILE__, __LINE__);
+      exit (1);
+    }
+  image[off + 5] = 2;
+
+  mkdir (dir, 0700);
+  fp = fopen (fname, "wb");
+  if (!fp || fwrite (image, len, 1, fp) != 1 || fclose (fp))
+    {
+      fprintf (stderr, "%s:%i: can't write %s\n", __FILE__, __LINE__, fname);
+      exit (1);
+    }
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  err = gpgme_ctx_set_engine_info (ctx, GPGME_PROTOCOL_OpenPGP,
+                                   "/nonexistent/gpg", dir);
+  fail_if_err (err);
+  err = gpgme_set_ctx_flag (ctx, "keylist-keybox", "1");
+  fail_if_err (err);
+  err = gpgme_op_keylist_start (ctx, NULL, 0);
+  if (!err)
+    err = gpgme_op_keylist_next (ctx, &key);
+  if (!err || gpgme_err_code (err) == GPG_ERR_EOF)
+    {
+      fprintf (stderr, "%s:%i: keybox with an unknown blob used\n",
+               __FILE__, __LINE__);
+      exit (1);
+    }
+  gpgme_release (ctx);
+
+  remove (fname);
+  rmdir (dir);
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+int
+main (void)
+{
+  static const char *all[] = { NULL };
+  static const char *some[] =
+    {
+      "Alpha", "<bob@example.net>",
+      "=Charlie Test (demo key) <charlie@example.net>", "@example.net>",
+      "0x2D727CC768697734", "A0FF4590BB6122EDEF6E3C542D727CC768697734",
+      "68697734", "nosuchkey", NULL
+    };
+  gpgme_ctx_t gpgctx, kbxctx;
+  gpgme_error_t err;
+  gpgme_key_t key;
+  const char *s;
+  int n;
+
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  err = gpgme_new (&gpgctx);
+  fail_if_err (err);
+  err = gpgme_new (&kbxctx);
+  fail_if_err (err);
+  err = gpgme_ctx_set_engine_info (kbxctx, GPGME_PROTOCOL_OpenPGP,
+                                   "/nonexistent/gpg", NULL);
+  fail_if_err (err);
+  err = gpgme_set_ctx_flag (kbxctx, "keylist-keybox", "1");
+  fail_if_err (err);
+  s = gpgme_get_ctx_flag (kbxctx, "keylist-keybox");
+  if (!s || strcmp (s, "1"))
+    {
+      fprintf (stderr, "%s:%i: unexpected flag value\n", __FILE__, __LINE__);
+      exit (1);
+    }
+
+  n = compare_listings (gpgctx, kbxctx, all);
+  if (n < 20)
+    {
+      fprintf (stderr, "%s:%i: only %d keys listed\n", __FILE__, __LINE__, n);
+      exit (1);
+    }
+  n = compare_listings (gpgctx, kbxctx, some);
+  if (n < 3)
+    {
+      fprintf (stderr, "%s:%i: only %d keys listed\n", __FILE__, __LINE__, n);
+      exit (1);
+    }
+
+  /* gpgme_get_key uses the flag too.  */
+  err = gpgme_get_key (kbxctx, "A0FF4590BB6122EDEF6E3C542D727CC768697734",
+		       &key, 0);
+  fail_if_err (err);
+  if (!key->uids || strcmp (key->uids->email, "alfa@example.net"))
+    {
+      fprintf (stderr, "%s:%i: unexpected key\n", __FILE__, __LINE__);
+      exit (1);
+    }
+  gpgme_key_unref (key);
+
+#ifndef HAVE_W32_SYSTEM
+  check_unknown_blob ();
+#endif
+
+  gpgme_release (gpgctx);
+  gpgme_release (kbxctx);
+  return 0;
+}
@@ -0,0 +1,289 @@
+/* t-keylist-queue.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check that a keylist operation with the context flag
+   "keylist-queue-depth" and a user event loop stops reading from gpg
+   while the queue is full.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+#include <gpgme.h>
+
+#include "t-support.h"
+
+
+/* The queue depth used for the test.  */
+#define DEPTH 1
+
+/* A full queue stops the reading only after the keys of the pending
+   read have been parsed, so the queue may grow a bit beyond DEPTH.  */
+#define SLACK 5
+
+
+struct op_result
+{
+  int done;
+  gpgme_error_t err;
+};
+
+static struct op_result op_result;
+
+struct one_fd
+{
+  int fd;
+  int dir;
+  gpgme_io_cb_t fnc;
+  void *fnc_data;
+};
+
+#define FDLIST_MAX 32
+static struct one_fd fdlist[FDLIST_MAX];
+
+
+static gpgme_error_t
+add_io_cb (void *data, int fd, int dir, gpgme_io_cb_t fnc, void *fnc_data,
+	   void **r_tag)
+{
+  struct one_fd *fds = data;
+  int i;
+
+  for (i = 0; i < FDLIST_MAX; i++)
+    {
+      if (fds[i].fd == -1)
+	{
+	  fds[i].fd = fd;
+	  fds[i].dir = dir;
+	  fds[i].fnc = fnc;
+	  fds[i].fnc_data = fnc_data;
+	  break;
+	}
+    }
+  if (i == FDLIST_MAX)
+    return gpgme_err_make (GPG_ERR_SOURCE_USER_1, GPG_ERR_GENERAL);
+  *r_tag = &fds[i];
+  return 0;
+}
+
+
+static void
+remove_io_cb (void *tag)
+{
+  struct one_fd *fd = tag;
+
+  fd->fd = -1;
+}
+
+
+static void
+io_event (void *data, gpgme_event_io_t type, void *type_data)
+{
+  struct op_result *result = data;
+
+  if (type == GPGME_EVENT_DONE)
+    {
+      result->done = 1;
+      result->err = * (gpgme_error_t *) type_data;
+    }
+  else if (type == GPGME_EVENT_NEXT_KEY && type_data)
+    {
+      fprintf (stderr, "%s:%i: key passed with the event\n",
+	       __FILE__, __LINE__);
+      exit (1);
+    }
+}
+
+
+/* Run the callbacks of the ready fds and return the number of
+   registered fds.  */
+static int
+do_select (void)
+{
+  fd_set rfds;
+  fd_set wfds;
+  int i, n;
+  int count = 0;
+  struct timeval tv;
+
+  FD_ZERO (&rfds);
+  FD_ZERO (&wfds);
+  for (i = 0; i < FDLIST_MAX; i++)
+    if (fdlist[i].fd != -1)
+      {
+	FD_SET (fdlist[i].fd, fdlist[i].dir ? &rfds : &wfds);
+	count++;
+      }
+  if (!count)
+    return 0;
+
+  tv.tv_sec = 0;
+  tv.tv_usec = 1000;
+
+  do
+    {
+      n = select (FD_SETSIZE, &rfds, &wfds, NULL, &tv);
+    }
+  while (n < 0 && errno == EINTR);
+  if (n < 0)
+    {
+      fprintf (stderr, "%s:%i: select failed: %s\n",
+	       __FILE__, __LINE__, strerror (errno));
+      exit (1);
+    }
+
+  for (i = 0; i < FDLIST_MAX && n; i++)
+    if (fdlist[i].fd != -1
+	&& FD_ISSET (fdlist[i].fd, fdlist[i].dir ? &rfds : &wfds))
+      {
+	n--;
+	(*fdlist[i].fnc) (fdlist[i].fnc_data, fdlist[i].fd);
+      }
+
+  for (i = count = 0; i < FDLIST_MAX; i++)
+    if (fdlist[i].fd != -1)
+      count++;
+  return count;
+}
+
+
+static struct gpgme_io_cbs io_cbs =
+  {
+    add_io_cb,
+    fdlist,
+    remove_io_cb,
+    io_event,
+    &op_result
+  };
+
+
+/* Return the number of keys listed in the usual way.  */
+static int
+count_keys (void)
+{
+  gpgme_ctx_t ctx;
+  gpgme_error_t err;
+  gpgme_key_t key;
+  int n = 0;
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  err = gpgme_op_keylist_start (ctx, NULL, 0);
+  fail_if_err (err);
+  while (!(err = gpgme_op_keylist_next (ctx, &key)))
+    {
+      gpgme_key_unref (key);
+      n++;
+    }
+  if (gpgme_err_code (err) != GPG_ERR_EOF)
+    fail_if_err (err);
+  gpgme_release (ctx);
+  return n;
+}
+
+
+int
+main (void)
+{
+  gpgme_ctx_t ctx;
+  gpgme_error_t err;
+  gpgme_key_t key;
+  const char *s;
+  int expected, total, queued, max_queued, pauses;
+  int i;
+
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  for (i = 0; i < FDLIST_MAX; i++)
+    fdlist[i].fd = -1;
+
+  expected = count_keys ();
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  gpgme_set_io_cbs (ctx, &io_cbs);
+  err = gpgme_set_ctx_flag (ctx, "keylist-queue-depth", "1");
+  fail_if_err (err);
+  s = gpgme_get_ctx_flag (ctx, "keylist-queue-depth");
+  if (!s || strcmp (s, "1"))
+    {
+      fprintf (stderr, "%s:%i: unexpected flag value '%s'\n",
+	       __FILE__, __LINE__, s? s : "(null)");
+      exit (1);
+    }
+
+  err = gpgme_op_keylist_start (ctx, NULL, 0);
+  fail_if_err (err);
+
+  /* Only fetch the keys if gpgme does not wait for any fd, that is if
+     the queue is full or the operation is done.  */
+  total = max_queued = pauses = 0;
+  err = 0;
+  while (gpgme_err_code (err) != GPG_ERR_EOF)
+    {
+      if (do_select ())
+	continue;
+      if (!op_result.done)
+	pauses++;
+
+      queued = 0;
+      while (!(err = gpgme_op_keylist_next (ctx, &key)))
+	{
+	  gpgme_key_unref (key);
+	  queued++;
+	}
+      if (gpgme_err_code (err) != GPG_ERR_EAGAIN
+	  && gpgme_err_code (err) != GPG_ERR_EOF)
+	fail_if_err (err);
+      if (gpgme_err_code (err) == GPG_ERR_EAGAIN && op_result.done)
+	{
+	  fprintf (stderr, "%s:%i: no EOF after the done event\n",
+		   __FILE__, __LINE__);
+	  exit (1);
+	}
+      total += queued;
+      if (queued > max_queued)
+	max_queued = queued;
+    }
+  fail_if_err (op_result.err);
+
+  if (total != expected)
+    {
+      fprintf (stderr, "%s:%i: got %i keys instead of %i\n",
+	       __FILE__, __LINE__, total, expected);
+      exit (1);
+    }
+  if (max_queued > DEPTH + SLACK || (expected > DEPTH + SLACK && !pauses))
+    {
+      fprintf (stderr, "%s:%i: %i keys queued (%i pauses)\n",
+	       __FILE__, __LINE__, max_queued, pauses);
+      exit (1);
+    }
+
+  gpgme_release (ctx);
+  return 0;
+}
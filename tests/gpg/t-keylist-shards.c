@@ -0,0 +1,188 @@
+/* t-keylist-shards.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check that a keylist operation distributed over several engine
+   processes with the context flag "keylist-shards" lists the same
+   keys as a single process.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#include "t-support.h"
+
+
+#define MAXKEYS 100
+
+static char *fprs[MAXKEYS + 1];
+static int nfprs;
+
+
+/* List the keys for PATTERN with CTX and return their number.  The
+   fingerprints are stored at R_FPRS.  */
+static int
+list_keys (gpgme_ctx_t ctx, const char *pattern[], char **r_fprs)
+{
+  gpgme_error_t err;
+  gpgme_key_t key;
+  gpgme_keylist_result_t result;
+  int n = 0;
+
+  err = gpgme_op_keylist_ext_start (ctx, pattern, 0, 0);
+  fail_if_err (err);
+  while (!(err = gpgme_op_keylist_next (ctx, &key)))
+    {
+      if (n == MAXKEYS || !key->subkeys || !key->subkeys->fpr || !key->uids)
+	{
+	  fprintf (stderr, "%s:%i: unexpected key\n", __FILE__, __LINE__);
+	  exit (1);
+	}
+      r_fprs[n++] = strdup (key->subkeys->fpr);
+      gpgme_key_unref (key);
+    }
+  if (gpgme_err_code (err) != GPG_ERR_EOF)
+    fail_if_err (err);
+  result = gpgme_op_keylist_result (ctx);
+  if (!result || result->truncated)
+    {
+      fprintf (stderr, "%s:%i: unexpected result\n", __FILE__, __LINE__);
+      exit (1);
+    }
+  return n;
+}
+
+
+/* Check the keys listed for PATTERN with CTX against the keys in
+   FPRS, in the same order if ORDERED is set.  */
+static void
+check_keys (gpgme_ctx_t ctx, const char *pattern[], int ordered, int line)
+{
+  char *got[MAXKEYS];
+  int n, i, j;
+
+  n = list_keys (ctx, pattern, got);
+  if (n != nfprs)
+    {
+      fprintf (stderr, "%s:%i: %d keys instead of %d\n",
+	       __FILE__, line, n, nfprs);
+      exit (1);
+    }
+  for (i = 0; i < n; i++)
+    {
+      if (ordered)
+	j = strcmp (got[i], fprs[i])? n : i;
+      else
+	for (j = 0; j < n && strcmp (got[i], fprs[j]); j++)
+	  ;
+      if (j == n)
+	{
+	  fprintf (stderr, "%s:%i: unexpected key %s at %d\n",
+		   __FILE__, line, got[i], i);
+	  exit (1);
+	}
+      free (got[i]);
+    }
+}
+
+
+int
+main (void)
+{
+  static const char *overlap[] = { "alfa@example.net", "example.net", NULL };
+  gpgme_ctx_t ctx;
+  gpgme_error_t err;
+  const char *s;
+  int i;
+
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+
+  nfprs = list_keys (ctx, NULL, fprs);
+  if (nfprs < 3)
+    {
+      fprintf (stderr, "%s:%i: only %d keys\n", __FILE__, __LINE__, nfprs);
+      exit (1);
+    }
+
+  if (!gpgme_set_ctx_flag (ctx, "keylist-shards", "1000"))
+    {
+      fprintf (stderr, "%s:%i: invalid value accepted\n",
+	       __FILE__, __LINE__);
+      exit (1);
+    }
+  err = gpgme_set_ctx_flag (ctx, "keylist-shards", "3");
+  fail_if_err (err);
+  s = gpgme_get_ctx_flag (ctx, "keylist-shards");
+  if (!s || strcmp (s, "3"))
+    {
+      fprintf (stderr, "%s:%i: wrong flag value\n", __FILE__, __LINE__);
+      exit (1);
+    }
+
+  /* All keys, which are first listed by their fingerprints.  */
+  check_keys (ctx, NULL, 0, __LINE__);
+  err = gpgme_set_ctx_flag (ctx, "keylist-shards-ordered", "1");
+  fail_if_err (err);
+  check_keys (ctx, NULL, 1, __LINE__);
+
+  /* The keys given by their fingerprints in the order of the
+     keyring.  */
+  check_keys (ctx, (const char **)fprs, 1, __LINE__);
+  err = gpgme_set_ctx_flag (ctx, "keylist-shards-ordered", "0");
+  fail_if_err (err);
+  check_keys (ctx, (const char **)fprs, 0, __LINE__);
+
+  /* More shards than keys.  */
+  err = gpgme_set_ctx_flag (ctx, "keylist-shards", "64");
+  fail_if_err (err);
+  check_keys (ctx, (const char **)fprs, 0, __LINE__);
+
+  /* A key matching patterns of two groups is listed once, like by a
+     single process.  */
+  for (i = 0; i < nfprs; i++)
+    free (fprs[i]);
+  err = gpgme_set_ctx_flag (ctx, "keylist-shards", "1");
+  fail_if_err (err);
+  nfprs = list_keys (ctx, overlap, fprs);
+  if (nfprs < 2)
+    {
+      fprintf (stderr, "%s:%i: only %d keys\n", __FILE__, __LINE__, nfprs);
+      exit (1);
+    }
+  err = gpgme_set_ctx_flag (ctx, "keylist-shards", "2");
+  fail_if_err (err);
+  check_keys (ctx, overlap, 0, __LINE__);
+  err = gpgme_set_ctx_flag (ctx, "keylist-shards-ordered", "1");
+  fail_if_err (err);
+  check_keys (ctx, overlap, 1, __LINE__);
+
+  for (i = 0; i < nfprs; i++)
+    free (fprs[i]);
+  gpgme_release (ctx);
+  return 0;
+}
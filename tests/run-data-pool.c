@@ -0,0 +1,250 @@
+/* run-data-pool.c  - Count the heap allocations for data objects
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* This is not a unit test but a tool to show the effect of
+ * gpgme_data_new_from_pool.  It handles a number of requests, each
+ * with an input and an output data object which are filled, read
+ * and released, once with gpgme_data_new and once with a pool, and
+ * prints the number of heap allocations per request done by this
+ * process after the first requests.  The allocations are counted by
+ * replacing malloc and friends.  GNU libc only.  Example:
+ *
+ *   ./run-data-pool --loops 10000 --size 65536
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#define PGM "run-data-pool"
+
+#include "run-support.h"
+
+#ifdef __GLIBC__
+# include <sys/time.h>
+
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static unsigned long nallocs;
+
+
+void *
+malloc (size_t size)
+{
+  nallocs++;
+  return __libc_malloc (size);
+}
+
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  nallocs++;
+  return __libc_calloc (nmemb, size);
+}
+
+
+void *
+realloc (void *ptr, size_t size)
+{
+  nallocs++;
+  return __libc_realloc (ptr, size);
+}
+
+
+static int verbose;
+static int loops = 1000;
+static size_t size = 16384;
+static char *payload;
+
+
+static int
+show_usage (int ex)
+{
+  fputs ("usage: " PGM " [options]\n\n"
+         "Options:\n"
+         "  --verbose        run in verbose mode\n"
+         "  --loops N        handle N requests (default 1000)\n"
+         "  --size N         move N bytes per request (default 16384)\n"
+         , stderr);
+  exit (ex);
+}
+
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* Handle one request: copy the payload from an input object to an
+   output object like an operation would do.  */
+static void
+handle_request (gpgme_data_pool_t pool)
+{
+  gpgme_error_t err;
+  gpgme_data_t in, out;
+  char buffer[4096];
+  gpgme_ssize_t n;
+
+  if (pool)
+    {
+      err = gpgme_data_new_from_pool (&in, pool);
+      fail_if_err (err);
+      err = gpgme_data_new_from_pool (&out, pool);
+      fail_if_err (err);
+    }
+  else
+    {
+      err = gpgme_data_new (&in);
+      fail_if_err (err);
+      err = gpgme_data_new (&out);
+      fail_if_err (err);
+    }
+
+  if (gpgme_data_write (in, payload, size) != size)
+    fail_if_err (gpg_error_from_syserror ());
+  err = gpgme_data_rewind (in);
+  fail_if_err (err);
+  while ((n = gpgme_data_read (in, buffer, sizeof buffer)) > 0)
+    if (gpgme_data_write (out, buffer, n) != n)
+      fail_if_err (gpg_error_from_syserror ());
+  if (n < 0)
+    fail_if_err (gpg_error_from_syserror ());
+
+  gpgme_data_release (in);
+  gpgme_data_release (out);
+}
+
+
+static void
+run (const char *name, gpgme_data_pool_t pool)
+{
+  unsigned long count;
+  double start, elapsed;
+  int i;
+
+  /* Warm up the pool.  */
+  handle_request (pool);
+
+  count = nallocs;
+  start = now ();
+  for (i = 0; i < loops; i++)
+    handle_request (pool);
+  elapsed = now () - start;
+  count = nallocs - count;
+
+  printf ("%-10s %8d %12.1f %12.2f\n", name, loops,
+          elapsed > 0? loops / elapsed : 0.0, (double)count / loops);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  gpgme_error_t err;
+  gpgme_data_pool_t pool;
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        show_usage (0);
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--loops"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          loops = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--size"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          size = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        show_usage (1);
+    }
+
+  if (argc || loops < 1 || !size)
+    show_usage (1);
+
+  init_gpgme_basic ();
+  if (verbose)
+    printf ("%s: %d requests of %zu bytes\n", PGM, loops, size);
+
+  payload = calloc (1, size);
+  if (!payload)
+    fail_if_err (gpg_error_from_syserror ());
+
+  err = gpgme_data_pool_new (&pool, 4);
+  fail_if_err (err);
+
+  printf ("%-10s %8s %12s %12s\n", "mode", "requests", "requests/s",
+          "allocs/req");
+  run ("new", NULL);
+  run ("pool", pool);
+
+  gpgme_data_pool_release (pool);
+  free (payload);
+  return 0;
+}
+
+#else /*!__GLIBC__*/
+
+int
+main (void)
+{
+  fputs (PGM ": this tool is only available with the GNU libc\n", stderr);
+  return 0;
+}
+
+#endif /*!__GLIBC__*/
@@ -62,6 +62,7 @@ show_usage (int ex)
          "  --from-wkd       list key from a web key directory\n"
          "  --require-gnupg  required at least the given GnuPG version\n"
          "  --trust-model    use the specified trust-model\n"
+         "  --shards N       list all keys with N gpg processes\n"
          , stderr);
   exit (ex);
 }
@@ -107,6 +108,7 @@ main (int argc, char **argv)
   int from_wkd = 0;
   gpgme_data_t data = NULL;
   char *trust_model = NULL;
+  const char *shards = NULL;
 
 
   if (argc)
@@ -219,6 +221,14 @@ main (int argc, char **argv)
           trust_model = strdup (*argv);
           argc--; argv++;
         }
+      else if (!strcmp (*argv, "--shards"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          shards = *argv;
+          argc--; argv++;
+        }
       else if (!strncmp (*argv, "--", 2))
         show_usage (1);
     }
@@ -244,6 +254,12 @@ main (int argc, char **argv)
       fail_if_err (err);
     }
 
+  if (shards)
+    {
+      err = gpgme_set_ctx_flag (ctx, "keylist-shards", shards);
+      fail_if_err (err);
+    }
+
   if (from_wkd)
     {
       err = gpgme_set_ctx_flag (ctx, "auto-key-locate",
@@ -0,0 +1,231 @@
+/* run-parse-status.c  - Measure the status keyword lookup
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* This is not a unit test but a tool to compare the lookup of status
+ * keywords in src/status-table.c with a binary search over a sorted
+ * table, which is how gpgme used to do it.  The internal table is
+ * compiled into this program.  By default a corpus recorded from gpg
+ * 2.2 is used; a file with captured status output can be given
+ * instead:
+ *
+ *   gpg --status-fd 1 --verify foo.sig > status.txt
+ *   ./run-parse-status --file status.txt
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../src/status-table.c"
+
+#define PGM "run-parse-status"
+
+
+/* The keywords of sign, verify, import of tests/gpg/pubdemo.asc,
+   encrypt and decrypt in that order.  */
+static const char *corpus[] =
+  {
+    "KEY_CONSIDERED", "KEY_CONSIDERED", "BEGIN_SIGNING", "SIG_CREATED",
+
+    "NEWSIG", "KEY_CONSIDERED", "SIG_ID", "KEY_CONSIDERED", "GOODSIG",
+    "VALIDSIG", "KEY_CONSIDERED", "TRUST_UNDEFINED",
+
+    "IMPORT_OK", "KEY_CONSIDERED", "IMPORT_OK", "KEY_CONSIDERED",
+    "IMPORT_OK", "KEY_CONSIDERED", "IMPORT_OK", "KEY_CONSIDERED",
+    "IMPORT_OK", "KEY_CONSIDERED", "IMPORT_OK", "KEY_CONSIDERED",
+    "KEYEXPIRED", "IMPORT_RES",
+
+    "KEY_CONSIDERED", "KEY_CONSIDERED", "BEGIN_ENCRYPTION",
+    "END_ENCRYPTION",
+
+    "ENC_TO", "KEY_CONSIDERED", "PINENTRY_LAUNCHED", "KEY_CONSIDERED",
+    "DECRYPTION_KEY", "KEY_CONSIDERED", "BEGIN_DECRYPTION",
+    "DECRYPTION_INFO", "PLAINTEXT", "PLAINTEXT_LENGTH", "DECRYPTION_OKAY",
+    "GOODMDC", "END_DECRYPTION"
+  };
+
+
+static int
+show_usage (int ex)
+{
+  fputs ("usage: " PGM " [options]\n\n"
+         "Options:\n"
+         "  --loops N        run over the corpus N times (default 200000)\n"
+         "  --file FILE      use the keywords of the status lines in FILE\n"
+         , stderr);
+  exit (ex);
+}
+
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* Read the keywords of the status lines in FNAME into R_WORDS.  */
+static int
+read_corpus (const char *fname, char ***r_words)
+{
+  char line[4096];
+  char **words = NULL;
+  int n = 0;
+  FILE *fp;
+  char *p;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    {
+      perror (fname);
+      exit (1);
+    }
+  while (fgets (line, sizeof line, fp))
+    {
+      if (strncmp (line, "[GNUPG:] ", 9))
+        continue;
+      p = line + 9 + strcspn (line + 9, " \r\n");
+      *p = 0;
+      words = realloc (words, (n + 1) * sizeof *words);
+      if (!words || !(words[n] = strdup (line + 9)))
+        exit (1);
+      n++;
+    }
+  fclose (fp);
+  *r_words = words;
+  return n;
+}
+
+
+static int
+sorted_cmp (const void *ap, const void *bp)
+{
+  const struct status_table_s *a = ap;
+  const struct status_table_s *b = bp;
+
+  return strcmp (a->name, b->name);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  long loops = 200000;
+  const char **words = corpus;
+  int nwords = DIM (corpus);
+  struct status_table_s *sorted, key, *r;
+  int nsorted = 0;
+  const struct status_table_s *t;
+  double start, t_bucket, t_bsearch;
+  unsigned long sum_bucket = 0, sum_bsearch = 0;
+  long l;
+  int i;
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        show_usage (0);
+      else if (!strcmp (*argv, "--loops"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          loops = atol (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--file"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          nwords = read_corpus (*argv, (char ***)&words);
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        show_usage (1);
+    }
+  if (argc || loops < 1 || !nwords)
+    show_usage (1);
+
+  /* The reference: one sorted table searched with strcmp.  */
+  sorted = calloc (200, sizeof *sorted);
+  if (!sorted)
+    exit (1);
+  for (i = 0; i < DIM (status_buckets); i++)
+    for (t = status_buckets[i]; t && t->name && nsorted < 200; t++)
+      sorted[nsorted++] = *t;
+  qsort (sorted, nsorted, sizeof *sorted, sorted_cmp);
+
+  for (i = 0; i < nwords; i++)
+    {
+      key.name = words[i];
+      r = bsearch (&key, sorted, nsorted, sizeof key, sorted_cmp);
+      if ((r? (int)r->code : -1) != (int)_gpgme_parse_status (words[i]))
+        {
+          fprintf (stderr, PGM ": lookup of '%s' differs\n", words[i]);
+          exit (1);
+        }
+    }
+
+  start = now ();
+  for (l = 0; l < loops; l++)
+    for (i = 0; i < nwords; i++)
+      sum_bucket += _gpgme_parse_status (words[i]);
+  t_bucket = now () - start;
+
+  start = now ();
+  for (l = 0; l < loops; l++)
+    for (i = 0; i < nwords; i++)
+      {
+        key.name = words[i];
+        r = bsearch (&key, sorted, nsorted, sizeof key, sorted_cmp);
+        sum_bsearch += r? r->code : -1;
+      }
+  t_bsearch = now () - start;
+
+  if (sum_bucket != sum_bsearch)
+    exit (1);
+
+  printf ("%d keywords, %ld loops\n", nwords, loops);
+  printf ("%-10s %8.1f Mlookups/s\n", "buckets",
+          t_bucket > 0? loops * nwords / t_bucket / 1e6 : 0.0);
+  printf ("%-10s %8.1f Mlookups/s\n", "bsearch",
+          t_bsearch > 0? loops * nwords / t_bsearch / 1e6 : 0.0);
+  free (sorted);
+  return 0;
+}
@@ -0,0 +1,233 @@
+/* run-refcount.c  - Stress the reference counters from many threads
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* This is not a unit test but a tool to measure how well the
+ * reference counters of keys and results scale with the number of
+ * threads.  All threads take and drop references to the same key and
+ * to the same keylist result, which is what an application does that
+ * shares cached keys between its worker threads.  At the end the
+ * counters must be back at their initial values.  Example:
+ *
+ *   GNUPGHOME=tests/gpg ./run-refcount --threads 8
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#define PGM "run-refcount"
+
+#include "run-support.h"
+
+#ifndef HAVE_W32_SYSTEM
+# include <pthread.h>
+# include <sys/time.h>
+
+
+static long loops = 1000000;
+static gpgme_key_t key;
+static gpgme_keylist_result_t result;
+
+/* Set to start all threads at once.  */
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int
+show_usage (int ex)
+{
+  fputs ("usage: " PGM " [options] [PATTERN]\n\n"
+         "Options:\n"
+         "  --loops N        take N references per thread (default 1000000)\n"
+         "  --threads N      use up to N threads (default 8)\n"
+         , stderr);
+  exit (ex);
+}
+
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void *
+worker (void *arg)
+{
+  long i;
+
+  (void)arg;
+
+  pthread_mutex_lock (&start_lock);
+  pthread_mutex_unlock (&start_lock);
+
+  for (i = 0; i < loops; i++)
+    {
+      gpgme_key_ref (key);
+      gpgme_result_ref (result);
+      gpgme_key_unref (key);
+      gpgme_result_unref (result);
+    }
+  return NULL;
+}
+
+
+/* Run NTHREADS threads and return the elapsed time.  */
+static double
+run_threads (int nthreads)
+{
+  pthread_t *threads;
+  double start;
+  int i;
+
+  threads = calloc (nthreads, sizeof *threads);
+  if (!threads)
+    exit (1);
+
+  pthread_mutex_lock (&start_lock);
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create (&threads[i], NULL, worker, NULL))
+      {
+        fputs (PGM ": pthread_create failed\n", stderr);
+        exit (1);
+      }
+  start = now ();
+  pthread_mutex_unlock (&start_lock);
+  for (i = 0; i < nthreads; i++)
+    pthread_join (threads[i], NULL);
+  start = now () - start;
+  free (threads);
+  return start;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+  gpgme_key_t next;
+  const char *pattern = NULL;
+  int maxthreads = 8;
+  unsigned int refs;
+  double elapsed;
+  int n;
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        show_usage (0);
+      else if (!strcmp (*argv, "--loops"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          loops = atol (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--threads"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          maxthreads = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        show_usage (1);
+    }
+  if (argc > 1 || loops < 1 || maxthreads < 1)
+    show_usage (1);
+  if (argc)
+    pattern = *argv;
+
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  err = gpgme_op_keylist_start (ctx, pattern, 0);
+  fail_if_err (err);
+  err = gpgme_op_keylist_next (ctx, &key);
+  if (gpgme_err_code (err) == GPG_ERR_EOF)
+    {
+      fputs (PGM ": no key found\n", stderr);
+      exit (1);
+    }
+  fail_if_err (err);
+  while (!(err = gpgme_op_keylist_next (ctx, &next)))
+    gpgme_key_unref (next);
+  if (gpgme_err_code (err) != GPG_ERR_EOF)
+    fail_if_err (err);
+  result = gpgme_op_keylist_result (ctx);
+  gpgme_result_ref (result);
+  gpgme_release (ctx);
+
+  refs = key->_refs;
+  printf ("%7s %12s %10s\n", "threads", "refs/s", "ns/ref");
+  for (n = 1; n <= maxthreads; n = n < maxthreads && 2 * n > maxthreads
+                                      ? maxthreads : 2 * n)
+    {
+      elapsed = run_threads (n);
+      /* Each loop takes two references.  */
+      printf ("%7d %12.0f %10.1f\n", n,
+              elapsed > 0? 2.0 * n * loops / elapsed : 0.0,
+              elapsed * 1e9 / (2.0 * n * loops));
+      if (key->_refs != refs)
+        {
+          fprintf (stderr, PGM ": key has %u references instead of %u\n",
+                   key->_refs, refs);
+          exit (1);
+        }
+    }
+
+  gpgme_result_unref (result);
+  gpgme_key_unref (key);
+  return 0;
+}
+
+#else /*HAVE_W32_SYSTEM*/
+
+int
+main (void)
+{
+  fputs (PGM ": this tool is not available on Windows\n", stderr);
+  return 0;
+}
+
+#endif /*HAVE_W32_SYSTEM*/
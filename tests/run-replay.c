@@ -0,0 +1,347 @@
+/* run-replay.c  - Replay captured gpg output through the gpg engine
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* This is not a unit test but a tool to measure how fast the gpg
+ * engine splits and dispatches the status and colon lines.  The
+ * program registers itself as the gpg binary and, when run by gpgme,
+ * writes the given files to the status fd and to stdout instead of
+ * running gpg.  Without files a synthetic stream is used.  Capture a
+ * real stream for example with
+ *
+ *   gpg --status-fd 2 --with-colons -k 2>status.txt >colons.txt
+ *   ./run-replay --status status.txt --colons colons.txt
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#define PGM "run-replay"
+
+#include "run-support.h"
+
+#ifndef HAVE_W32_SYSTEM
+# include <unistd.h>
+# include <sys/time.h>
+
+
+/* The environment variable used to pass the files to the fake gpg.  */
+#define REPLAY_ENV "RUN_REPLAY_FILES"
+
+static int verbose;
+static int nsigs;
+
+
+static int
+show_usage (int ex)
+{
+  fputs ("usage: " PGM " [options]\n\n"
+         "Options:\n"
+         "  --verbose        run in verbose mode\n"
+         "  --loops N        run N keylist operations (default 10)\n"
+         "  --keys N         use N synthetic keys (default 20000)\n"
+         "  --sigs N         add N signatures to each synthetic key\n"
+         "  --fields LIST    set the context flag keylist-fields to LIST\n"
+         "  --status FILE    replay FILE as the status output\n"
+         "  --colons FILE    replay FILE as the colon output\n"
+         , stderr);
+  exit (ex);
+}
+
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* Copy the file NAME to the file descriptor FD.  */
+static void
+copy_file (const char *name, int fd)
+{
+  char buffer[65536];
+  FILE *fp;
+  size_t n;
+
+  fp = fopen (name, "rb");
+  if (!fp)
+    _exit (1);
+  while ((n = fread (buffer, 1, sizeof buffer, fp)))
+    if (write (fd, buffer, n) != (ssize_t)n)
+      _exit (1);
+  fclose (fp);
+}
+
+
+/* Act as gpg for gpgme.  FILES is "STATUSFILE:COLONFILE".  */
+static int
+fake_gpg (int argc, char **argv, char *files)
+{
+  char *colons;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    if (!strcmp (argv[i], "--version"))
+      {
+        fputs ("gpg (GnuPG) 2.2.99\n", stdout);
+        return 0;
+      }
+
+  colons = strchr (files, ':');
+  if (!colons)
+    return 1;
+  *colons++ = 0;
+  for (i = 1; i + 1 < argc; i++)
+    if (!strcmp (argv[i], "--status-fd"))
+      {
+        copy_file (files, atoi (argv[i + 1]));
+        break;
+      }
+  copy_file (colons, 1);
+  return 0;
+}
+
+
+/* Write NKEYS synthetic keys to temporary files and store their names
+   in STATUSFILE and COLONFILE.  */
+static void
+make_stream (int nkeys, char *statusfile, char *colonfile)
+{
+  FILE *sfp, *cfp;
+  int sfd, cfd;
+  int i, j;
+
+  sfd = mkstemp (statusfile);
+  cfd = mkstemp (colonfile);
+  if (sfd == -1 || cfd == -1)
+    {
+      perror (PGM ": mkstemp");
+      exit (1);
+    }
+  sfp = fdopen (sfd, "w");
+  cfp = fdopen (cfd, "w");
+  if (!sfp || !cfp)
+    exit (1);
+
+  for (i = 0; i < nkeys; i++)
+    {
+      fprintf (sfp, "[GNUPG:] KEY_CONSIDERED %040X 0\n", i);
+      fprintf (cfp,
+               "pub:u:2048:1:%016X:1500000000:::u:::scESC::::::23::0:\n"
+               "fpr:::::::::%040X:\n"
+               "uid:u::::1500000000::%040X::Test key %d"
+               " <key%d@example.org>::::::::::0:\n",
+               i, i, i, i, i);
+      for (j = 0; j < nsigs; j++)
+        fprintf (cfp,
+                 "sig:!::1:%016X:1500000000::::Signer %d"
+                 " <signer%d@example.org>:13x:::::8:\n",
+                 j, j, j);
+      fprintf (cfp,
+               "sub:u:2048:1:%016X:1500000000::::::e::::::23:\n"
+               "fpr:::::::::%040X:\n",
+               i + 0x10000000, i + 0x10000000);
+    }
+  if (fclose (sfp) || fclose (cfp))
+    exit (1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+  gpgme_key_t key;
+  const char *statusname = NULL;
+  const char *colonname = NULL;
+  const char *fields = NULL;
+  char statusfile[] = "/tmp/" PGM "-status-XXXXXX";
+  char colonfile[] = "/tmp/" PGM "-colons-XXXXXX";
+  char *files;
+  char self[1024];
+  int loops = 10;
+  int nkeys = 20000;
+  long total = 0;
+  double start, elapsed;
+  int i;
+
+  files = getenv (REPLAY_ENV);
+  if (files)
+    return fake_gpg (argc, argv, files);
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        show_usage (0);
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--loops"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          loops = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--keys"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          nkeys = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--sigs"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          nsigs = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--fields"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          fields = *argv;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--status"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          statusname = *argv;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--colons"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          colonname = *argv;
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        show_usage (1);
+    }
+
+  if (argc || loops < 1 || nkeys < 1 || nsigs < 0
+      || !statusname != !colonname)
+    show_usage (1);
+
+  /* Our own binary is run as gpg.  */
+  i = readlink ("/proc/self/exe", self, sizeof self - 1);
+  if (i <= 0)
+    {
+      fputs (PGM ": this tool needs /proc/self/exe\n", stderr);
+      return 1;
+    }
+  self[i] = 0;
+
+  if (!statusname)
+    {
+      make_stream (nkeys, statusfile, colonfile);
+      statusname = statusfile;
+      colonname = colonfile;
+    }
+  files = malloc (strlen (REPLAY_ENV) + strlen (statusname)
+                  + strlen (colonname) + 3);
+  if (!files)
+    exit (1);
+  sprintf (files, "%s=%s:%s", REPLAY_ENV, statusname, colonname);
+  putenv (files);
+
+  gpgme_check_version (NULL);
+  err = gpgme_set_engine_info (GPGME_PROTOCOL_OpenPGP, self, NULL);
+  fail_if_err (err);
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  if (fields)
+    {
+      err = gpgme_set_ctx_flag (ctx, "keylist-fields", fields);
+      fail_if_err (err);
+    }
+
+  start = now ();
+  for (i = 0; i < loops; i++)
+    {
+      err = gpgme_op_keylist_start (ctx, NULL, 0);
+      fail_if_err (err);
+      while (!(err = gpgme_op_keylist_next (ctx, &key)))
+        {
+          gpgme_key_unref (key);
+          total++;
+        }
+      if (gpgme_err_code (err) != GPG_ERR_EOF)
+        fail_if_err (err);
+    }
+  elapsed = now () - start;
+  gpgme_release (ctx);
+
+  if (statusname == statusfile)
+    {
+      remove (statusfile);
+      remove (colonfile);
+    }
+
+  printf ("%d ops, %ld keys, %.3f s, %.0f keys/s\n",
+          loops, total, elapsed, elapsed > 0? total / elapsed : 0.0);
+  if (verbose)
+    printf ("%.1f ms/op\n", elapsed * 1000 / loops);
+  return 0;
+}
+
+#else /*HAVE_W32_SYSTEM*/
+
+int
+main (void)
+{
+  fputs (PGM ": this tool is not available on Windows\n", stderr);
+  return 0;
+}
+
+#endif /*HAVE_W32_SYSTEM*/
@@ -0,0 +1,190 @@
+/* run-spawn.c  - Benchmark for the creation of backend processes
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* This is not a unit test but a tool to compare the spawn methods.
+ * It runs a cheap key listing in a loop, optionally after allocating
+ * a ballast of memory to emulate a large process, and prints the
+ * number of operations per second.  Example:
+ *
+ *   ./run-spawn --loops 200 --ballast 4096 --spawn fork
+ *   ./run-spawn --loops 200 --ballast 4096 --spawn vfork
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <gpgme.h>
+
+#define PGM "run-spawn"
+
+#include "run-support.h"
+
+
+static int verbose;
+
+
+static int
+show_usage (int ex)
+{
+  fputs ("usage: " PGM " [options] [PATTERN]\n\n"
+         "Options:\n"
+         "  --verbose        run in verbose mode\n"
+         "  --loops N        run N operations (default 100)\n"
+         "  --ballast N      allocate and touch N MiB before starting\n"
+         "  --spawn METHOD   use METHOD (fork or vfork) to spawn gpg\n"
+         , stderr);
+  exit (ex);
+}
+
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+  gpgme_key_t key;
+  const char *pattern = NULL;
+  const char *method = NULL;
+  int loops = 100;
+  size_t ballast = 0;
+  char *ballast_buf = NULL;
+  int nkeys;
+  int i;
+  double start, elapsed;
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        show_usage (0);
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--loops"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          loops = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--ballast"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          ballast = strtoul (*argv, NULL, 10) * 1024 * 1024;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--spawn"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          method = *argv;
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        show_usage (1);
+    }
+
+  if (argc > 1 || loops < 1)
+    show_usage (1);
+  if (argc)
+    pattern = *argv;
+
+  if (method && gpgme_set_global_flag ("io-spawn", method))
+    {
+      fprintf (stderr, PGM ": spawn method '%s' not supported\n", method);
+      exit (1);
+    }
+
+  if (ballast)
+    {
+      ballast_buf = malloc (ballast);
+      if (!ballast_buf)
+        {
+          fprintf (stderr, PGM ": error allocating the ballast\n");
+          exit (1);
+        }
+      /* Touch every page so that it is actually mapped.  */
+      memset (ballast_buf, 0x55, ballast);
+    }
+
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+
+  start = now ();
+  for (i = 0; i < loops; i++)
+    {
+      nkeys = 0;
+      err = gpgme_op_keylist_start (ctx, pattern, 0);
+      fail_if_err (err);
+      while (!(err = gpgme_op_keylist_next (ctx, &key)))
+        {
+          nkeys++;
+          gpgme_key_unref (key);
+        }
+      if (gpgme_err_code (err) != GPG_ERR_EOF)
+        fail_if_err (err);
+      if (verbose)
+        printf ("%d: %d keys\n", i, nkeys);
+    }
+  elapsed = now () - start;
+
+  printf ("spawn method ...: %s\n", method? method : "default");
+  printf ("ballast ........: %lu MiB\n", (unsigned long)(ballast >> 20));
+  printf ("operations .....: %d\n", loops);
+  printf ("elapsed ........: %.3f s\n", elapsed);
+  printf ("ops/s ..........: %.1f\n", loops / elapsed);
+
+  gpgme_release (ctx);
+  free (ballast_buf);
+  return 0;
+}
@@ -0,0 +1,374 @@
+/* run-syscalls.c  - Count the system calls per operation
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* This is not a unit test but a tool to compare the backends of the
+ * event loops (see the global flag "io-backend").  For each backend
+ * the operations are run by several threads, once to measure the
+ * time and once under ptrace to count the system calls done by this
+ * process; the system calls of gpg are not counted.  Linux only.
+ * Example:
+ *
+ *   ./run-syscalls --threads 8 --loops 20
+ *   ./run-syscalls --encrypt --backend io_uring
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#define PGM "run-syscalls"
+
+#include "run-support.h"
+
+#ifdef __linux__
+# include <unistd.h>
+# include <signal.h>
+# include <pthread.h>
+# include <sys/ptrace.h>
+# include <sys/time.h>
+# include <sys/wait.h>
+
+
+static int verbose;
+static int loops = 50;
+static int nthreads = 4;
+static int do_encrypt;
+static gpgme_key_t keys[2];
+
+
+static int
+show_usage (int ex)
+{
+  fputs ("usage: " PGM " [options]\n\n"
+         "Options:\n"
+         "  --verbose        run in verbose mode\n"
+         "  --loops N        run N operations per thread (default 50)\n"
+         "  --threads N      use N threads (default 4)\n"
+         "  --encrypt        encrypt 4 KiB instead of listing keys\n"
+         "  --backend NAME   only test backend NAME\n"
+         , stderr);
+  exit (ex);
+}
+
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void *
+worker (void *arg)
+{
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+  gpgme_key_t key;
+  gpgme_data_t in, out;
+  static char plaintext[4096];
+  int i;
+
+  (void)arg;
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  for (i = 0; i < loops; i++)
+    {
+      if (do_encrypt)
+        {
+          err = gpgme_data_new_from_mem (&in, plaintext, sizeof plaintext, 0);
+          fail_if_err (err);
+          err = gpgme_data_new (&out);
+          fail_if_err (err);
+          err = gpgme_op_encrypt (ctx, keys, GPGME_ENCRYPT_ALWAYS_TRUST,
+                                  in, out);
+          fail_if_err (err);
+          gpgme_data_release (in);
+          gpgme_data_release (out);
+        }
+      else
+        {
+          err = gpgme_op_keylist_start (ctx, NULL, 0);
+          fail_if_err (err);
+          while (!(err = gpgme_op_keylist_next (ctx, &key)))
+            gpgme_key_unref (key);
+          if (gpgme_err_code (err) != GPG_ERR_EOF)
+            fail_if_err (err);
+        }
+    }
+  gpgme_release (ctx);
+  return NULL;
+}
+
+
+/* Run the operations with BACKEND and write the elapsed time to FD.
+   The signals SIGUSR1 and SIGUSR2 tell a tracer where the operations
+   start and end.  */
+static void
+run_child (const char *backend, int fd)
+{
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+  pthread_t *threads;
+  double start, elapsed;
+  int i;
+
+  if (gpgme_set_global_flag ("io-backend", backend))
+    _exit (2);
+  init_gpgme (GPGME_PROTOCOL_OpenPGP);
+
+  if (do_encrypt)
+    {
+      err = gpgme_new (&ctx);
+      fail_if_err (err);
+      err = gpgme_op_keylist_start (ctx, NULL, 0);
+      fail_if_err (err);
+      err = gpgme_op_keylist_next (ctx, &keys[0]);
+      fail_if_err (err);
+      gpgme_release (ctx);
+    }
+
+  threads = calloc (nthreads, sizeof *threads);
+  if (!threads)
+    _exit (1);
+
+  raise (SIGUSR1);
+  start = now ();
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create (&threads[i], NULL, worker, NULL))
+      _exit (1);
+  for (i = 0; i < nthreads; i++)
+    pthread_join (threads[i], NULL);
+  elapsed = now () - start;
+  raise (SIGUSR2);
+
+  if (write (fd, &elapsed, sizeof elapsed) != sizeof elapsed)
+    _exit (1);
+  _exit (0);
+}
+
+
+/* Trace the process PID and all its threads and return the number of
+   system calls between SIGUSR1 and SIGUSR2 or -1 on error.  */
+static long
+count_syscalls (pid_t pid)
+{
+  long stops = 0;
+  long result = -1;
+  int counting = 0;
+  int status;
+  pid_t tid;
+  int sig;
+
+  if (waitpid (pid, &status, 0) != pid || !WIFSTOPPED (status))
+    return -1;
+  if (ptrace (PTRACE_SETOPTIONS, pid, 0,
+              PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE
+              | PTRACE_O_EXITKILL))
+    return -1;
+  ptrace (PTRACE_SYSCALL, pid, 0, 0);
+
+  while ((tid = waitpid (-1, &status, __WALL)) != -1)
+    {
+      if (!WIFSTOPPED (status))
+        continue;
+
+      sig = WSTOPSIG (status);
+      if (sig == (SIGTRAP | 0x80))
+        {
+          /* Entry and exit of a system call.  */
+          if (counting)
+            stops++;
+          sig = 0;
+        }
+      else if (status >> 16)
+        sig = 0;  /* Clone event.  */
+      else if (sig == SIGSTOP)
+        sig = 0;  /* New thread.  */
+      else if (sig == SIGUSR1)
+        {
+          counting = 1;
+          sig = 0;
+        }
+      else if (sig == SIGUSR2)
+        {
+          counting = 0;
+          result = stops / 2;
+          sig = 0;
+        }
+      ptrace (PTRACE_SYSCALL, tid, 0, sig);
+    }
+  return result;
+}
+
+
+static void
+run_backend (const char *backend)
+{
+  double elapsed = 0;
+  long nsyscalls;
+  int ops = loops * nthreads;
+  int fds[2];
+  pid_t pid;
+  int status;
+
+  /* First run for the time.  */
+  if (pipe (fds))
+    exit (1);
+  fflush (stdout);
+  pid = fork ();
+  if (pid == -1)
+    exit (1);
+  if (!pid)
+    {
+      close (fds[0]);
+      signal (SIGUSR1, SIG_IGN);
+      signal (SIGUSR2, SIG_IGN);
+      run_child (backend, fds[1]);
+    }
+  close (fds[1]);
+  if (read (fds[0], &elapsed, sizeof elapsed) != sizeof elapsed)
+    elapsed = 0;
+  close (fds[0]);
+  waitpid (pid, &status, 0);
+  if (!WIFEXITED (status) || WEXITSTATUS (status))
+    {
+      printf ("%-10s %s\n", backend,
+              WIFEXITED (status) && WEXITSTATUS (status) == 2
+              ? "not supported" : "failed");
+      return;
+    }
+
+  /* Then count the system calls.  */
+  if (pipe (fds))
+    exit (1);
+  fflush (stdout);
+  pid = fork ();
+  if (pid == -1)
+    exit (1);
+  if (!pid)
+    {
+      close (fds[0]);
+      if (ptrace (PTRACE_TRACEME, 0, 0, 0))
+        _exit (1);
+      raise (SIGSTOP);
+      run_child (backend, fds[1]);
+    }
+  close (fds[1]);
+  nsyscalls = count_syscalls (pid);
+  close (fds[0]);
+
+  printf ("%-10s %6d %10.1f %12.1f\n", backend, ops,
+          elapsed > 0? ops / elapsed : 0.0,
+          nsyscalls < 0? -1.0 : (double)nsyscalls / ops);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  const char *backend = NULL;
+  static const char *backends[] = { "epoll", "poll", "io_uring" };
+  int i;
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        show_usage (0);
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--encrypt"))
+        {
+          do_encrypt = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--loops"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          loops = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--threads"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          nthreads = atoi (*argv);
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--backend"))
+        {
+          argc--; argv++;
+          if (!argc)
+            show_usage (1);
+          backend = *argv;
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        show_usage (1);
+    }
+
+  if (argc || loops < 1 || nthreads < 1)
+    show_usage (1);
+
+  printf ("%-10s %6s %10s %12s\n", "backend", "ops", "ops/s", "syscalls/op");
+  if (backend)
+    run_backend (backend);
+  else
+    for (i = 0; i < DIM (backends); i++)
+      run_backend (backends[i]);
+
+  return 0;
+}
+
+#else /*!__linux__*/
+
+int
+main (void)
+{
+  fputs (PGM ": this tool is only available on Linux\n", stderr);
+  return 0;
+}
+
+#endif /*!__linux__*/
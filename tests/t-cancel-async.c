@@ -0,0 +1,171 @@
+/* t-cancel-async.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check that gpgme_cancel_async interrupts a thread waiting in the
+   private or the global event loop although the backend process does
+   not produce any output.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#ifndef HAVE_W32_SYSTEM
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+
+/* The backend process sleeps much longer than this.  */
+#define MAX_SECONDS 5
+
+static const char *sleep_argv[] = { "sh", "-c", "exec sleep 30", NULL };
+
+
+#define fail_if_err(err)					\
+  do								\
+    {								\
+      if (err)							\
+        {							\
+          fprintf (stderr, "%s:%d: %s: %s\n",			\
+                   __FILE__, __LINE__, gpgme_strsource (err),	\
+		   gpgme_strerror (err));			\
+          exit (1);						\
+        }							\
+    }								\
+  while (0)
+
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void *
+thread_cancel (void *data)
+{
+  gpgme_ctx_t ctx = data;
+  gpgme_error_t err;
+
+  usleep (200000);
+  err = gpgme_cancel_async (ctx);
+  fail_if_err (err);
+
+  return NULL;
+}
+
+
+static void
+check_canceled (const char *what, gpgme_error_t err, double start)
+{
+  double elapsed = now () - start;
+
+  if (gpgme_err_code (err) != GPG_ERR_CANCELED)
+    {
+      fprintf (stderr, "%s: unexpected result: %s\n",
+               what, gpgme_strerror (err));
+      exit (1);
+    }
+  if (elapsed > MAX_SECONDS)
+    {
+      fprintf (stderr, "%s: cancellation took %.1f s\n", what, elapsed);
+      exit (1);
+    }
+}
+
+
+static gpgme_ctx_t
+new_spawn_ctx (void)
+{
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  err = gpgme_set_protocol (ctx, GPGME_PROTOCOL_SPAWN);
+  fail_if_err (err);
+  return ctx;
+}
+
+
+int
+main (void)
+{
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+  gpgme_data_t out;
+  pthread_t tcancel;
+  double start;
+
+  gpgme_check_version (NULL);
+
+  /* The private event loop.  */
+  ctx = new_spawn_ctx ();
+  err = gpgme_data_new (&out);
+  fail_if_err (err);
+  start = now ();
+  pthread_create (&tcancel, NULL, thread_cancel, ctx);
+  err = gpgme_op_spawn (ctx, "/bin/sh", sleep_argv, NULL, out, NULL, 0);
+  pthread_join (tcancel, NULL);
+  check_canceled ("private", err, start);
+  gpgme_data_release (out);
+  gpgme_release (ctx);
+
+  /* The global event loop.  */
+  ctx = new_spawn_ctx ();
+  err = gpgme_data_new (&out);
+  fail_if_err (err);
+  start = now ();
+  err = gpgme_op_spawn_start (ctx, "/bin/sh", sleep_argv, NULL, out, NULL, 0);
+  fail_if_err (err);
+  pthread_create (&tcancel, NULL, thread_cancel, ctx);
+  if (gpgme_wait (ctx, &err, 1) != ctx)
+    {
+      fprintf (stderr, "global: gpgme_wait failed: %s\n",
+               gpgme_strerror (err));
+      exit (1);
+    }
+  pthread_join (tcancel, NULL);
+  check_canceled ("global", err, start);
+  gpgme_data_release (out);
+  gpgme_release (ctx);
+
+  return 0;
+}
+
+#else /*HAVE_W32_SYSTEM*/
+
+int
+main (void)
+{
+  return 0;
+}
+
+#endif /*HAVE_W32_SYSTEM*/
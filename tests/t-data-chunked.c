@@ -0,0 +1,215 @@
+/* t-data-chunked.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check the data objects created by gpgme_data_new_chunked with
+   enough data to span many chunks, the data objects created by
+   gpgme_data_new_from_segments, and gpgme_data_get_segments.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <gpgme.h>
+
+
+/* More than fits into the first few chunks.  */
+#define DATA_SIZE (3 * 1024 * 1024 + 12345)
+
+#define fail(what)						\
+  do								\
+    {								\
+      fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__, what);	\
+      exit (1);							\
+    }								\
+  while (0)
+
+
+/* Compare the data in DH from the current position to the end with
+   the LEN bytes at EXPECT using gpgme_data_get_segments.  */
+static void
+check_segments (gpgme_data_t dh, const char *expect, size_t len)
+{
+  struct gpgme_data_segment segs[4];
+  size_t off = 0;
+  gpgme_off_t start;
+  gpgme_ssize_t n, i;
+  int nsegs = 0;
+
+  start = gpgme_data_seek (dh, 0, SEEK_CUR);
+  while ((n = gpgme_data_get_segments (dh, segs, 4)) > 0)
+    {
+      for (i = 0; i < n; i++)
+        {
+          if (segs[i].length > len - off
+              || memcmp (segs[i].buffer, expect + off, segs[i].length))
+            fail ("wrong segment data");
+          off += segs[i].length;
+          nsegs++;
+        }
+      /* The position is not changed by gpgme_data_get_segments.  */
+      if (gpgme_data_seek (dh, start + off, SEEK_SET) != start + off)
+        fail ("seek failed");
+    }
+  if (n < 0)
+    fail ("gpgme_data_get_segments failed");
+  if (off != len)
+    fail ("segments too short");
+  if (len > 1024 * 1024 && nsegs < 2)
+    fail ("data not split into chunks");
+}
+
+
+int
+main (void)
+{
+  gpgme_data_t dh;
+  gpgme_error_t err;
+  struct gpgme_data_segment seg;
+  char *expect, *buffer, *mem;
+  size_t off, amt, len;
+  gpgme_ssize_t n;
+
+  gpgme_check_version (NULL);
+
+  expect = malloc (DATA_SIZE);
+  buffer = malloc (DATA_SIZE);
+  if (!expect || !buffer)
+    fail ("out of core");
+  for (off = 0; off < DATA_SIZE; off++)
+    expect[off] = (off * 7) % 251;
+
+  err = gpgme_data_new_chunked (&dh);
+  if (err)
+    fail (gpgme_strerror (err));
+
+  /* Write the data in pieces of odd sizes.  */
+  for (off = 0, amt = 1; off < DATA_SIZE; off += amt, amt = amt * 3 + 1)
+    {
+      if (amt > DATA_SIZE - off)
+        amt = DATA_SIZE - off;
+      if (gpgme_data_write (dh, expect + off, amt) != amt)
+        fail ("gpgme_data_write failed");
+    }
+  if (gpgme_data_seek (dh, 0, SEEK_END) != DATA_SIZE)
+    fail ("wrong size");
+
+  /* Overwrite a range spanning several chunks.  */
+  if (gpgme_data_seek (dh, 4000, SEEK_SET) != 4000)
+    fail ("seek failed");
+  memset (expect + 4000, 'x', 100000);
+  if (gpgme_data_write (dh, expect + 4000, 100000) != 100000)
+    fail ("gpgme_data_write failed");
+
+  /* Read it back in pieces.  */
+  if (gpgme_data_seek (dh, 0, SEEK_SET))
+    fail ("seek failed");
+  for (off = 0; (n = gpgme_data_read (dh, buffer + off, 65537)) > 0; off += n)
+    ;
+  if (n < 0 || off != DATA_SIZE || memcmp (buffer, expect, DATA_SIZE))
+    fail ("gpgme_data_read returned wrong data");
+
+  /* Check the segments from the start and from the middle.  */
+  if (gpgme_data_seek (dh, 0, SEEK_SET))
+    fail ("seek failed");
+  check_segments (dh, expect, DATA_SIZE);
+  if (gpgme_data_seek (dh, -1000000, SEEK_END) != DATA_SIZE - 1000000)
+    fail ("seek failed");
+  check_segments (dh, expect + DATA_SIZE - 1000000, 1000000);
+  if (gpgme_data_seek (dh, 1, SEEK_END) != -1)
+    fail ("seek past the end succeeded");
+
+  /* Get the data as one buffer.  */
+  mem = gpgme_data_release_and_get_mem (dh, &len);
+  if (!mem || len != DATA_SIZE || memcmp (mem, expect, DATA_SIZE))
+    fail ("gpgme_data_release_and_get_mem returned wrong data");
+  gpgme_free (mem);
+
+  /* An empty chunked object.  */
+  err = gpgme_data_new_chunked (&dh);
+  if (err)
+    fail (gpgme_strerror (err));
+  if (gpgme_data_get_segments (dh, &seg, 1) != 0
+      || gpgme_data_read (dh, buffer, 1) != 0)
+    fail ("empty object not empty");
+  mem = gpgme_data_release_and_get_mem (dh, &len);
+  if (mem || len)
+    fail ("gpgme_data_release_and_get_mem returned data");
+
+  /* A memory object has one segment.  */
+  err = gpgme_data_new_from_mem (&dh, expect, 1000, 0);
+  if (err)
+    fail (gpgme_strerror (err));
+  check_segments (dh, expect, 1000);
+  gpgme_data_release (dh);
+
+  /* An object made of segments returns them and reads across them.  */
+  {
+    struct gpgme_data_segment in[4];
+
+    in[0].buffer = expect;
+    in[0].length = 3000;
+    in[1].buffer = expect + 3000;
+    in[1].length = 0;
+    in[2].buffer = expect + 3000;
+    in[2].length = 1;
+    in[3].buffer = expect + 3001;
+    in[3].length = 70000;
+    err = gpgme_data_new_from_segments (&dh, in, 4);
+    if (err)
+      fail (gpgme_strerror (err));
+    check_segments (dh, expect, 73001);
+    if (gpgme_data_seek (dh, 2999, SEEK_SET) != 2999)
+      fail ("seek failed");
+    check_segments (dh, expect + 2999, 70002);
+    if (gpgme_data_seek (dh, 10, SEEK_SET) != 10)
+      fail ("seek failed");
+    for (off = 10; (n = gpgme_data_read (dh, buffer + off, 2999)) > 0;
+         off += n)
+      ;
+    if (n < 0 || off != 73001 || memcmp (buffer + 10, expect + 10, 72991))
+      fail ("gpgme_data_read returned wrong data");
+    if (gpgme_data_write (dh, "x", 1) != -1)
+      fail ("gpgme_data_write succeeded");
+    gpgme_data_release (dh);
+
+    in[1].buffer = NULL;
+    in[1].length = 1;
+    if (gpgme_err_code (gpgme_data_new_from_segments (&dh, in, 4))
+        != GPG_ERR_INV_VALUE)
+      fail ("invalid segment accepted");
+  }
+
+  /* Other objects have none.  */
+  err = gpgme_data_new_from_fd (&dh, 0);
+  if (err)
+    fail (gpgme_strerror (err));
+  if (gpgme_data_get_segments (dh, &seg, 1) != -1 || errno != ENOSYS)
+    fail ("gpgme_data_get_segments succeeded for an fd object");
+  gpgme_data_release (dh);
+
+  free (expect);
+  free (buffer);
+  return 0;
+}
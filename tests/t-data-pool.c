@@ -0,0 +1,198 @@
+/* t-data-pool.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check gpgme_data_reset and the data objects taken from a pool.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+
+#define DATA_SIZE (100 * 1024)
+
+#define fail(what)						\
+  do								\
+    {								\
+      fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__, what);	\
+      exit (1);							\
+    }								\
+  while (0)
+
+
+/* Write LEN bytes of EXPECT to DH, check that it reads them back, and
+   return the address of the first segment.  */
+static const void *
+fill_and_check (gpgme_data_t dh, const char *expect, size_t len)
+{
+  static char buffer[DATA_SIZE];
+  struct gpgme_data_segment seg;
+  size_t off;
+  gpgme_ssize_t n;
+
+  if (gpgme_data_write (dh, expect, len) != len)
+    fail ("gpgme_data_write failed");
+  if (gpgme_data_rewind (dh))
+    fail ("gpgme_data_rewind failed");
+  if (gpgme_data_get_segments (dh, &seg, 1) != 1)
+    fail ("gpgme_data_get_segments failed");
+  for (off = 0; (n = gpgme_data_read (dh, buffer + off, 4000)) > 0; off += n)
+    ;
+  if (n < 0 || off != len || memcmp (buffer, expect, len))
+    fail ("gpgme_data_read returned wrong data");
+  return seg.buffer;
+}
+
+
+/* Check that DH is empty.  */
+static void
+check_empty (gpgme_data_t dh)
+{
+  struct gpgme_data_segment seg;
+  char c;
+
+  if (gpgme_data_seek (dh, 0, SEEK_END) != 0
+      || gpgme_data_read (dh, &c, 1) != 0
+      || gpgme_data_get_segments (dh, &seg, 1) != 0)
+    fail ("data object not empty");
+  if (gpgme_data_get_encoding (dh) != GPGME_DATA_ENCODING_NONE
+      || gpgme_data_get_file_name (dh))
+    fail ("meta data not reset");
+}
+
+
+int
+main (void)
+{
+  gpgme_data_t dh, dh2, dh3;
+  gpgme_data_pool_t pool;
+  gpgme_error_t err;
+  char *expect;
+  const void *p;
+  size_t off;
+
+  gpgme_check_version (NULL);
+
+  expect = malloc (DATA_SIZE);
+  if (!expect)
+    fail ("out of core");
+  for (off = 0; off < DATA_SIZE; off++)
+    expect[off] = (off * 13) % 253;
+
+  /* A reset memory object keeps its buffer.  */
+  err = gpgme_data_new (&dh);
+  if (err)
+    fail (gpgme_strerror (err));
+  p = fill_and_check (dh, expect, DATA_SIZE);
+  gpgme_data_set_encoding (dh, GPGME_DATA_ENCODING_ARMOR);
+  gpgme_data_set_file_name (dh, "foo");
+  err = gpgme_data_reset (dh);
+  if (err)
+    fail (gpgme_strerror (err));
+  check_empty (dh);
+  if (fill_and_check (dh, expect + 1, DATA_SIZE - 1) != p)
+    fail ("buffer not reused");
+  gpgme_data_release (dh);
+
+  /* A chunked object keeps its chunks.  */
+  err = gpgme_data_new_chunked (&dh);
+  if (err)
+    fail (gpgme_strerror (err));
+  p = fill_and_check (dh, expect, DATA_SIZE);
+  err = gpgme_data_reset (dh);
+  if (err)
+    fail (gpgme_strerror (err));
+  check_empty (dh);
+  if (fill_and_check (dh, expect + 7, 5000) != p)
+    fail ("chunk not reused");
+  if (gpgme_data_seek (dh, 0, SEEK_END) != 5000)
+    fail ("wrong size");
+  /* Overwrite it and fill the other kept chunks.  */
+  if (gpgme_data_rewind (dh))
+    fail ("gpgme_data_rewind failed");
+  if (fill_and_check (dh, expect, DATA_SIZE) != p)
+    fail ("chunk not reused");
+  gpgme_data_release (dh);
+
+  /* An object using the buffer of the caller becomes empty.  */
+  err = gpgme_data_new_from_mem (&dh, expect, DATA_SIZE, 0);
+  if (err)
+    fail (gpgme_strerror (err));
+  err = gpgme_data_reset (dh);
+  if (err)
+    fail (gpgme_strerror (err));
+  check_empty (dh);
+  fill_and_check (dh, expect, 1000);
+  gpgme_data_release (dh);
+
+  /* Other objects can't be reset.  */
+  err = gpgme_data_new_from_fd (&dh, 0);
+  if (err)
+    fail (gpgme_strerror (err));
+  if (gpgme_err_code (gpgme_data_reset (dh)) != GPG_ERR_NOT_SUPPORTED)
+    fail ("gpgme_data_reset succeeded for an fd object");
+  gpgme_data_release (dh);
+
+  /* A released object is given back to the pool.  */
+  err = gpgme_data_pool_new (&pool, 1);
+  if (err)
+    fail (gpgme_strerror (err));
+  err = gpgme_data_new_from_pool (&dh, pool);
+  if (err)
+    fail (gpgme_strerror (err));
+  p = fill_and_check (dh, expect, DATA_SIZE);
+  gpgme_data_set_file_name (dh, "foo");
+  gpgme_data_release (dh);
+  err = gpgme_data_new_from_pool (&dh2, pool);
+  if (err)
+    fail (gpgme_strerror (err));
+  if (dh2 != dh)
+    fail ("data object not reused");
+  check_empty (dh2);
+  if (fill_and_check (dh2, expect, DATA_SIZE) != p)
+    fail ("buffer not reused");
+
+  /* The pool keeps only one object; the other is destroyed.  */
+  err = gpgme_data_new_from_pool (&dh3, pool);
+  if (err)
+    fail (gpgme_strerror (err));
+  if (dh3 == dh2)
+    fail ("data object handed out twice");
+  gpgme_data_release (dh2);
+  gpgme_data_release (dh3);
+  err = gpgme_data_new_from_pool (&dh, pool);
+  if (err)
+    fail (gpgme_strerror (err));
+  if (dh != dh2)
+    fail ("data object not reused");
+
+  /* Objects may outlive their pool.  */
+  gpgme_data_pool_release (pool);
+  fill_and_check (dh, expect, 1000);
+  gpgme_free (gpgme_data_release_and_get_mem (dh, NULL));
+
+  free (expect);
+  return 0;
+}
@@ -0,0 +1,115 @@
+/* t-data-threads.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Create and release many data objects in several threads at once.
+   Each thread keeps a few thousand objects alive, which is more than
+   fits into the first parts of the property table, and releases them
+   in a different order than it created them.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <gpgme.h>
+
+
+#define NTHREADS 8
+#define NOBJECTS 3000
+#define NROUNDS  5
+
+#define fail(what)						\
+  do								\
+    {								\
+      fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__, what);	\
+      exit (1);							\
+    }								\
+  while (0)
+
+
+static void *
+worker (void *arg)
+{
+  unsigned int id = (unsigned int)(size_t)arg;
+  static gpgme_data_t objects[NTHREADS][NOBJECTS];
+  gpgme_data_t *dh = objects[id];
+  gpgme_error_t err;
+  unsigned int value, i, round;
+
+  for (round = 0; round < NROUNDS; round++)
+    {
+      for (i = 0; i < NOBJECTS; i++)
+        {
+          err = gpgme_data_new (&dh[i]);
+          if (err)
+            fail (gpgme_strerror (err));
+          value = id * NOBJECTS + i;
+          if (gpgme_data_write (dh[i], &value, sizeof value) != sizeof value)
+            fail ("gpgme_data_write failed");
+        }
+
+      /* Release every other object and create them again.  */
+      for (i = round % 2; i < NOBJECTS; i += 2)
+        {
+          gpgme_data_release (dh[i]);
+          value = id * NOBJECTS + i;
+          err = gpgme_data_new_from_mem (&dh[i], (void *)&value,
+                                         sizeof value, 1);
+          if (err)
+            fail (gpgme_strerror (err));
+          if (gpgme_data_seek (dh[i], 0, SEEK_END) != sizeof value)
+            fail ("wrong size");
+        }
+
+      for (i = NOBJECTS; i-- > 0; )
+        {
+          if (gpgme_data_rewind (dh[i]))
+            fail ("gpgme_data_rewind failed");
+          if (gpgme_data_read (dh[i], &value, sizeof value) != sizeof value)
+            fail ("gpgme_data_read failed");
+          if (value != id * NOBJECTS + i)
+            fail ("wrong data");
+          gpgme_data_release (dh[i]);
+        }
+    }
+  return NULL;
+}
+
+
+int
+main (void)
+{
+  pthread_t threads[NTHREADS];
+  size_t i;
+
+  gpgme_check_version (NULL);
+
+  for (i = 0; i < NTHREADS; i++)
+    if (pthread_create (&threads[i], NULL, worker, (void *)i))
+      fail ("pthread_create failed");
+  for (i = 0; i < NTHREADS; i++)
+    pthread_join (threads[i], NULL);
+
+  return 0;
+}
@@ -54,6 +54,9 @@ typedef enum
     TEST_INOUT_MEM_FROM_FILE_PART_BY_NAME,
     TEST_INOUT_MEM_FROM_INEXISTANT_FILE_PART,
     TEST_INOUT_MEM_FROM_FILE_PART_BY_FP,
+    TEST_INOUT_MEM_FROM_FILE_MAPPED,
+    TEST_INOUT_MEM_FROM_INEXISTANT_FILE_MAPPED,
+    TEST_INOUT_CHUNKED,
     TEST_END
   } round_t;
 
@@ -254,6 +257,26 @@ main (void)
 						strlen (text), strlen (text));
 	  }
 	  break;
+	case TEST_INOUT_MEM_FROM_FILE_MAPPED:
+	  err = gpgme_data_new_from_file_mapped (&data, text_filename);
+	  break;
+	case TEST_INOUT_MEM_FROM_INEXISTANT_FILE_MAPPED:
+	  err = gpgme_data_new_from_file_mapped (&data, missing_filename);
+	  if (!err)
+	    {
+	      fprintf (stderr, "%s:%d: gpgme_data_new_from_file_mapped on "
+		       "inexistant file succeeded unexpectedly\n",
+		       __FILE__, __LINE__);
+	      exit (1);
+	    }
+	  continue;
+	case TEST_INOUT_CHUNKED:
+	  err = gpgme_data_new_chunked (&data);
+	  if (!err
+	      && (gpgme_data_write (data, text, strlen (text)) != strlen (text)
+		  || gpgme_data_seek (data, 0, SEEK_SET)))
+	    err = gpgme_error_from_errno (errno);
+	  break;
 	case TEST_END:
 	  goto out;
 	case TEST_INITIALIZER:
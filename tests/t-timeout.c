@@ -0,0 +1,212 @@
+/* t-timeout.c - Regression test.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GPGME.
+ *
+ * GPGME is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * GPGME is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <https://gnu.org/licenses/>.
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/* Check that the context flag "timeout-ms" ends an operation whose
+   backend process hangs without producing any output, and that the
+   process is terminated.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gpgme.h>
+
+#ifndef HAVE_W32_SYSTEM
+#include <unistd.h>
+#include <sys/time.h>
+
+
+/* The backend process sleeps much longer than this.  */
+#define MAX_SECONDS 5
+
+/* The process prints its pid, so that we can check that it is gone.  */
+static const char *sleep_argv[] =
+  { "sh", "-c", "echo $$; exec sleep 30", NULL };
+
+
+#define fail_if_err(err)					\
+  do								\
+    {								\
+      if (err)							\
+        {							\
+          fprintf (stderr, "%s:%d: %s: %s\n",			\
+                   __FILE__, __LINE__, gpgme_strsource (err),	\
+		   gpgme_strerror (err));			\
+          exit (1);						\
+        }							\
+    }								\
+  while (0)
+
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* Return true if the process PID printed to OUT still runs.  We
+   can't use kill(2) because the process is not our child and may
+   linger as a zombie.  */
+static int
+still_running (gpgme_data_t out)
+{
+  char buf[64];
+  char *pid;
+  size_t len;
+  FILE *fp;
+  char state = 0;
+  int i;
+
+  pid = gpgme_data_release_and_get_mem (out, &len);
+  if (!pid || !len || len >= sizeof buf)
+    {
+      fprintf (stderr, "no pid received\n");
+      exit (1);
+    }
+  snprintf (buf, sizeof buf, "/proc/%.*s/stat", (int)len - 1, pid);
+  gpgme_free (pid);
+
+  /* Give the process a moment to die.  */
+  for (i = 0; i < 50; i++)
+    {
+      fp = fopen (buf, "r");
+      if (!fp)
+        return 0;  /* Gone or no /proc.  */
+      if (fscanf (fp, "%*d %*s %c", &state) != 1)
+        state = 0;
+      fclose (fp);
+      if (state == 'Z' || state == 'X')
+        return 0;
+      usleep (20000);
+    }
+  return 1;
+}
+
+
+static void
+check_timeout (const char *what, gpgme_error_t err, double start,
+               gpgme_data_t out)
+{
+  double elapsed = now () - start;
+
+  if (gpgme_err_code (err) != GPG_ERR_TIMEOUT)
+    {
+      fprintf (stderr, "%s: unexpected result: %s\n",
+               what, gpgme_strerror (err));
+      exit (1);
+    }
+  if (elapsed > MAX_SECONDS)
+    {
+      fprintf (stderr, "%s: timeout took %.1f s\n", what, elapsed);
+      exit (1);
+    }
+  if (still_running (out))
+    {
+      fprintf (stderr, "%s: process not terminated\n", what);
+      exit (1);
+    }
+}
+
+
+static gpgme_ctx_t
+new_spawn_ctx (void)
+{
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+
+  err = gpgme_new (&ctx);
+  fail_if_err (err);
+  err = gpgme_set_protocol (ctx, GPGME_PROTOCOL_SPAWN);
+  fail_if_err (err);
+  err = gpgme_set_ctx_flag (ctx, "timeout-ms", "200");
+  fail_if_err (err);
+  return ctx;
+}
+
+
+int
+main (void)
+{
+  gpgme_error_t err;
+  gpgme_ctx_t ctx;
+  gpgme_data_t out;
+  const char *s;
+  double start;
+
+  gpgme_check_version (NULL);
+
+  ctx = new_spawn_ctx ();
+  s = gpgme_get_ctx_flag (ctx, "timeout-ms");
+  if (!s || strcmp (s, "200"))
+    {
+      fprintf (stderr, "unexpected flag value '%s'\n", s? s : "(null)");
+      exit (1);
+    }
+  if (!gpgme_set_ctx_flag (ctx, "timeout-ms", "-1")
+      || !gpgme_set_ctx_flag (ctx, "timeout-ms", "12x"))
+    {
+      fprintf (stderr, "invalid flag value accepted\n");
+      exit (1);
+    }
+
+  /* The private event loop.  */
+  err = gpgme_data_new (&out);
+  fail_if_err (err);
+  start = now ();
+  err = gpgme_op_spawn (ctx, "/bin/sh", sleep_argv, NULL, out, NULL, 0);
+  check_timeout ("private", err, start, out);
+  gpgme_release (ctx);
+
+  /* The global event loop.  */
+  ctx = new_spawn_ctx ();
+  err = gpgme_data_new (&out);
+  fail_if_err (err);
+  start = now ();
+  err = gpgme_op_spawn_start (ctx, "/bin/sh", sleep_argv, NULL, out, NULL, 0);
+  fail_if_err (err);
+  if (gpgme_wait (ctx, &err, 1) != ctx)
+    {
+      fprintf (stderr, "global: gpgme_wait failed: %s\n",
+               gpgme_strerror (err));
+      exit (1);
+    }
+  check_timeout ("global", err, start, out);
+  gpgme_release (ctx);
+
+  return 0;
+}
+
+#else /*HAVE_W32_SYSTEM*/
+
+int
+main (void)
+{
+  return 0;
+}
+
+#endif /*HAVE_W32_SYSTEM*/